@@ -1,3 +1,47 @@
 from .libAtomDistanceIO import initialize
 from .libAtomDistanceIO import save_atoms
 from .libAtomDistanceIO import load_aligned_contact_map
+from .libAtomDistanceIO import load_aligned_contact_maps
+from .libAtomDistanceIO import fill_aligned_contact_map
+from .libAtomDistanceIO import load_packed_contact_map
+from .libAtomDistanceIO import load_aligned_packed_contact_map
+from .libAtomDistanceIO import load_aligned_packed_contact_maps
+from .libAtomDistanceIO import load_packed_contact_map_file
+from .libAtomDistanceIO import load_aligned_packed_contact_maps_to_device
+from .libAtomDistanceIO import load_aligned_sparse_contact_map
+from .libAtomDistanceIO import load_aligned_sparse_contact_maps
+from .libAtomDistanceIO import load_cigar_aligned_contact_maps
+from .libAtomDistanceIO import prefetch_aligned_contact_maps
+from .libAtomDistanceIO import prefetch_cigar_aligned_contact_maps
+from .libAtomDistanceIO import build_aligned_contact_map_store
+from .libAtomDistanceIO import build_cigar_aligned_contact_map_store
+from .libAtomDistanceIO import build_stored_aligned_contact_map_store
+from .libAtomDistanceIO import align_and_load_contact_map
+from .libAtomDistanceIO import align_sequences
+from .libAtomDistanceIO import align_best_hits
+from .libAtomDistanceIO import align_best_hits_to_alignment_shard
+from .libAtomDistanceIO import save_alignment_shard
+from .libAtomDistanceIO import ingest_structure_files
+from .libAtomDistanceIO import compact_atoms_database
+from .libAtomDistanceIO import set_contact_map_cache_size
+from .libAtomDistanceIO import clear_contact_map_cache
+from .libAtomDistanceIO import get_contact_map_cache_stats
+from .libAtomDistanceIO import get_engine_stats
+from .libAtomDistanceIO import reset_engine_stats
+from .libAtomDistanceIO import set_engine_tracing
+from .libAtomDistanceIO import take_engine_trace
+from .libAtomDistanceIO import set_contact_bounds_policy
+from .libAtomDistanceIO import get_contact_bounds_policy
+from .libAtomDistanceIO import set_contact_definition
+from .libAtomDistanceIO import get_contact_definition
+from .libAtomDistanceIO import set_contact_backend
+from .libAtomDistanceIO import get_contact_backend
+from .libAtomDistanceIO import cuda_contacts_available
+from .libAtomDistanceIO import AtomsDatabase
+from .libAtomDistanceIO import AtomsDatabaseWriter
+from .libAtomDistanceIO import AtomsDatabaseUpdater
+from .libAtomDistanceIO import AlignedContactMapStore
+from .libAtomDistanceIO import ContactMapPrefetcher
+from .libAtomDistanceIO import DeviceContactMaps
+from .libAtomDistanceIO import AlignmentStore
+from .libAtomDistanceIO import AlignmentRecord
@@ -0,0 +1,269 @@
+#ifndef ALIGNMENT_KERNEL
+#define ALIGNMENT_KERNEL
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "distance_kernel.h"
+
+// Traceback of one cell, bits 0 and 1 say where the best score comes from,
+// bits 2 and 3 say if the gap in query or in target was extended rather than opened.
+static const uint8_t TRACE_DIAGONAL = 0;
+static const uint8_t TRACE_QUERY_GAP = 1;
+static const uint8_t TRACE_TARGET_GAP = 2;
+static const uint8_t TRACE_SOURCE_MASK = 3;
+static const uint8_t TRACE_QUERY_GAP_EXTENDED = 4;
+static const uint8_t TRACE_TARGET_GAP_EXTENDED = 8;
+
+// scoring of AlignmentScoring in thousandths, see AlignmentScoreUnits
+struct AlignmentPenalties {
+  int32_t match;
+  int32_t mismatch;
+  int32_t gap_open;
+  int32_t gap_continuation;
+};
+
+// One anti-diagonal of the Gotoh DP of AlignSequences, every array is indexed by the query position i of the cell.
+// previous arrays hold the two preceding anti-diagonals, current arrays and trace are written,
+// target[i] is the target residue of the cell at position i.
+struct AntiDiagonalCells {
+  const int32_t* h_previous2;
+  const int32_t* h_previous;
+  const int32_t* e_previous;
+  const int32_t* f_previous;
+  int32_t* h_current;
+  int32_t* e_current;
+  int32_t* f_current;
+  uint8_t* trace;
+  const char* query;
+  const char* target;
+};
+
+// Fills cells begin ... end of the anti-diagonal, none of them is on the border of the DP matrix.
+// Cells of an anti-diagonal do not depend on each other, so the kernels below evaluate 4, 8 or 16 of them at once.
+// All kernels compute the same integers and the same tie rules, their results are identical.
+typedef void (*AlignAntiDiagonalKernel)(const AntiDiagonalCells& cells, const AlignmentPenalties& penalties, int begin, int end);
+
+
+static void AlignAntiDiagonalScalar(const AntiDiagonalCells& cells, const AlignmentPenalties& penalties, const int begin, const int end) {
+  const int32_t* __restrict h_previous2 = cells.h_previous2;
+  const int32_t* __restrict h_previous = cells.h_previous;
+  const int32_t* __restrict e_previous = cells.e_previous;
+  const int32_t* __restrict f_previous = cells.f_previous;
+  int32_t* __restrict h_current = cells.h_current;
+  int32_t* __restrict e_current = cells.e_current;
+  int32_t* __restrict f_current = cells.f_current;
+  uint8_t* __restrict trace = cells.trace;
+  const char* __restrict query = cells.query;
+  const char* __restrict target = cells.target;
+  const int32_t match = penalties.match;
+  const int32_t mismatch = penalties.mismatch;
+  const int32_t gap_open = penalties.gap_open;
+  const int32_t gap_continuation = penalties.gap_continuation;
+  for (int i = begin; i <= end; ++i) {
+    const int32_t e_open = h_previous[i] + gap_open;
+    const int32_t e_extend = e_previous[i] + gap_continuation;
+    const int32_t e = std::max(e_open, e_extend);
+    const int32_t f_open = h_previous[i - 1] + gap_open;
+    const int32_t f_extend = f_previous[i - 1] + gap_continuation;
+    const int32_t f = std::max(f_open, f_extend);
+    const int32_t diagonal = h_previous2[i - 1] + (query[i - 1] == target[i] ? match : mismatch);
+
+    // ties prefer aligned pairs, then gaps in target, then gaps in query, and opening a gap over extending one
+    const int32_t best_gap = std::max(e, f);
+    // branch free form of diagonal >= best_gap ? TRACE_DIAGONAL : (f >= e ? TRACE_TARGET_GAP : TRACE_QUERY_GAP)
+    const int source = (diagonal < best_gap) << (f >= e);
+    trace[i] = (uint8_t) (source | (e_extend > e_open) << 2 | (f_extend > f_open) << 3);
+    h_current[i] = std::max(diagonal, best_gap);
+    e_current[i] = e;
+    f_current[i] = f;
+  }
+}
+
+
+#ifdef DISTANCE_KERNEL_X86
+__attribute__((target("avx2")))
+static void AlignAntiDiagonalAVX2(const AntiDiagonalCells& cells, const AlignmentPenalties& penalties, const int begin, const int end) {
+  const __m256i match = _mm256_set1_epi32(penalties.match);
+  const __m256i mismatch = _mm256_set1_epi32(penalties.mismatch);
+  const __m256i gap_open = _mm256_set1_epi32(penalties.gap_open);
+  const __m256i gap_continuation = _mm256_set1_epi32(penalties.gap_continuation);
+  const __m256i query_gap = _mm256_set1_epi32(TRACE_QUERY_GAP);
+  const __m256i target_gap = _mm256_set1_epi32(TRACE_TARGET_GAP);
+  const __m256i query_gap_extended = _mm256_set1_epi32(TRACE_QUERY_GAP_EXTENDED);
+  const __m256i target_gap_extended = _mm256_set1_epi32(TRACE_TARGET_GAP_EXTENDED);
+  // lowest byte of every 32 bit lane, packed to the low 4 bytes of each 128 bit half
+  const __m256i trace_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                               0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+  int i = begin;
+  for (; i + 8 <= end + 1; i += 8) {
+    const __m256i e_open = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (cells.h_previous + i)), gap_open);
+    const __m256i e_extend = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (cells.e_previous + i)), gap_continuation);
+    const __m256i e = _mm256_max_epi32(e_open, e_extend);
+    const __m256i f_open = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (cells.h_previous + i - 1)), gap_open);
+    const __m256i f_extend = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (cells.f_previous + i - 1)), gap_continuation);
+    const __m256i f = _mm256_max_epi32(f_open, f_extend);
+    const __m256i identical = _mm256_cmpeq_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (cells.query + i - 1))),
+                                                 _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (cells.target + i))));
+    const __m256i diagonal = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) (cells.h_previous2 + i - 1)),
+                                              _mm256_blendv_epi8(mismatch, match, identical));
+
+    const __m256i best_gap = _mm256_max_epi32(e, f);
+    const __m256i gap_wins = _mm256_cmpgt_epi32(best_gap, diagonal);
+    const __m256i source = _mm256_and_si256(gap_wins, _mm256_blendv_epi8(target_gap, query_gap, _mm256_cmpgt_epi32(e, f)));
+    const __m256i extended = _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi32(e_extend, e_open), query_gap_extended),
+                                             _mm256_and_si256(_mm256_cmpgt_epi32(f_extend, f_open), target_gap_extended));
+    const __m256i packed = _mm256_shuffle_epi8(_mm256_or_si256(source, extended), trace_bytes);
+    _mm_storel_epi64((__m128i*) (cells.trace + i), _mm_unpacklo_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1)));
+    _mm256_storeu_si256((__m256i*) (cells.h_current + i), _mm256_max_epi32(diagonal, best_gap));
+    _mm256_storeu_si256((__m256i*) (cells.e_current + i), e);
+    _mm256_storeu_si256((__m256i*) (cells.f_current + i), f);
+  }
+  AlignAntiDiagonalScalar(cells, penalties, i, end);
+}
+
+
+__attribute__((target("avx512f")))
+static void AlignAntiDiagonalAVX512(const AntiDiagonalCells& cells, const AlignmentPenalties& penalties, const int begin, const int end) {
+  const __m512i match = _mm512_set1_epi32(penalties.match);
+  const __m512i mismatch = _mm512_set1_epi32(penalties.mismatch);
+  const __m512i gap_open = _mm512_set1_epi32(penalties.gap_open);
+  const __m512i gap_continuation = _mm512_set1_epi32(penalties.gap_continuation);
+  const __m512i query_gap = _mm512_set1_epi32(TRACE_QUERY_GAP);
+  const __m512i target_gap = _mm512_set1_epi32(TRACE_TARGET_GAP);
+  const __m512i query_gap_extended = _mm512_set1_epi32(TRACE_QUERY_GAP_EXTENDED);
+  const __m512i target_gap_extended = _mm512_set1_epi32(TRACE_TARGET_GAP_EXTENDED);
+
+  // byte loads cannot be masked without AVX-512BW, the tail goes to the scalar kernel
+  int i = begin;
+  for (; i + 16 <= end + 1; i += 16) {
+    const __m512i e_open = _mm512_add_epi32(_mm512_loadu_si512(cells.h_previous + i), gap_open);
+    const __m512i e_extend = _mm512_add_epi32(_mm512_loadu_si512(cells.e_previous + i), gap_continuation);
+    const __m512i e = _mm512_max_epi32(e_open, e_extend);
+    const __m512i f_open = _mm512_add_epi32(_mm512_loadu_si512(cells.h_previous + i - 1), gap_open);
+    const __m512i f_extend = _mm512_add_epi32(_mm512_loadu_si512(cells.f_previous + i - 1), gap_continuation);
+    const __m512i f = _mm512_max_epi32(f_open, f_extend);
+    const __mmask16 identical = _mm512_cmpeq_epi32_mask(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (cells.query + i - 1))),
+                                                        _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (cells.target + i))));
+    const __m512i diagonal = _mm512_add_epi32(_mm512_loadu_si512(cells.h_previous2 + i - 1), _mm512_mask_blend_epi32(identical, mismatch, match));
+
+    const __m512i best_gap = _mm512_max_epi32(e, f);
+    const __mmask16 gap_wins = _mm512_cmpgt_epi32_mask(best_gap, diagonal);
+    const __m512i source = _mm512_maskz_mov_epi32(gap_wins, _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(e, f), target_gap, query_gap));
+    const __m512i extended = _mm512_or_si512(_mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(e_extend, e_open), query_gap_extended),
+                                             _mm512_maskz_mov_epi32(_mm512_cmpgt_epi32_mask(f_extend, f_open), target_gap_extended));
+    _mm_storeu_si128((__m128i*) (cells.trace + i), _mm512_cvtepi32_epi8(_mm512_or_si512(source, extended)));
+    _mm512_storeu_si512(cells.h_current + i, _mm512_max_epi32(diagonal, best_gap));
+    _mm512_storeu_si512(cells.e_current + i, e);
+    _mm512_storeu_si512(cells.f_current + i, f);
+  }
+  AlignAntiDiagonalScalar(cells, penalties, i, end);
+}
+#endif
+
+
+#ifdef DISTANCE_KERNEL_NEON
+// four residues widened to 32 bit lanes
+static uint32x4_t LoadResidues(const char* residues) {
+  uint32_t bytes;
+  std::memcpy(&bytes, residues, sizeof(bytes));
+  return vmovl_u16(vget_low_u16(vmovl_u8(vcreate_u8(bytes))));
+}
+
+
+static void AlignAntiDiagonalNEON(const AntiDiagonalCells& cells, const AlignmentPenalties& penalties, const int begin, const int end) {
+  const int32x4_t match = vdupq_n_s32(penalties.match);
+  const int32x4_t mismatch = vdupq_n_s32(penalties.mismatch);
+  const int32x4_t gap_open = vdupq_n_s32(penalties.gap_open);
+  const int32x4_t gap_continuation = vdupq_n_s32(penalties.gap_continuation);
+  const uint32x4_t query_gap = vdupq_n_u32(TRACE_QUERY_GAP);
+  const uint32x4_t target_gap = vdupq_n_u32(TRACE_TARGET_GAP);
+  const uint32x4_t query_gap_extended = vdupq_n_u32(TRACE_QUERY_GAP_EXTENDED);
+  const uint32x4_t target_gap_extended = vdupq_n_u32(TRACE_TARGET_GAP_EXTENDED);
+
+  int i = begin;
+  for (; i + 4 <= end + 1; i += 4) {
+    const int32x4_t e_open = vaddq_s32(vld1q_s32(cells.h_previous + i), gap_open);
+    const int32x4_t e_extend = vaddq_s32(vld1q_s32(cells.e_previous + i), gap_continuation);
+    const int32x4_t e = vmaxq_s32(e_open, e_extend);
+    const int32x4_t f_open = vaddq_s32(vld1q_s32(cells.h_previous + i - 1), gap_open);
+    const int32x4_t f_extend = vaddq_s32(vld1q_s32(cells.f_previous + i - 1), gap_continuation);
+    const int32x4_t f = vmaxq_s32(f_open, f_extend);
+    const uint32x4_t identical = vceqq_u32(LoadResidues(cells.query + i - 1), LoadResidues(cells.target + i));
+    const int32x4_t diagonal = vaddq_s32(vld1q_s32(cells.h_previous2 + i - 1), vbslq_s32(identical, match, mismatch));
+
+    const int32x4_t best_gap = vmaxq_s32(e, f);
+    const uint32x4_t gap_wins = vcgtq_s32(best_gap, diagonal);
+    const uint32x4_t source = vandq_u32(gap_wins, vbslq_u32(vcgtq_s32(e, f), query_gap, target_gap));
+    const uint32x4_t extended = vorrq_u32(vandq_u32(vcgtq_s32(e_extend, e_open), query_gap_extended),
+                                          vandq_u32(vcgtq_s32(f_extend, f_open), target_gap_extended));
+    const uint16x4_t narrow = vmovn_u32(vorrq_u32(source, extended));
+    const uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(narrow, narrow))), 0);
+    std::memcpy(cells.trace + i, &packed, sizeof(packed));
+    vst1q_s32(cells.h_current + i, vmaxq_s32(diagonal, best_gap));
+    vst1q_s32(cells.e_current + i, e);
+    vst1q_s32(cells.f_current + i, f);
+  }
+  AlignAntiDiagonalScalar(cells, penalties, i, end);
+}
+#endif
+
+
+// chosen once per process by CPU features
+static AlignAntiDiagonalKernel SelectAlignAntiDiagonalKernel() {
+#if defined(DISTANCE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return AlignAntiDiagonalAVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return AlignAntiDiagonalAVX2;
+  return AlignAntiDiagonalScalar;
+#elif defined(DISTANCE_KERNEL_NEON)
+  return AlignAntiDiagonalNEON;
+#else
+  return AlignAntiDiagonalScalar;
+#endif
+}
+
+
+static AlignAntiDiagonalKernel AlignAntiDiagonal() {
+  static const AlignAntiDiagonalKernel kernel = SelectAlignAntiDiagonalKernel();
+  return kernel;
+}
+
+
+// every kernel this CPU can run, for benchmarks and tests
+static std::vector<std::pair<const char*, AlignAntiDiagonalKernel>> AvailableAlignAntiDiagonalKernels() {
+  std::vector<std::pair<const char*, AlignAntiDiagonalKernel>> kernels{{"scalar", AlignAntiDiagonalScalar}};
+#if defined(DISTANCE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    kernels.emplace_back("avx2", AlignAntiDiagonalAVX2);
+  if (__builtin_cpu_supports("avx512f"))
+    kernels.emplace_back("avx512", AlignAntiDiagonalAVX512);
+#elif defined(DISTANCE_KERNEL_NEON)
+  kernels.emplace_back("neon", AlignAntiDiagonalNEON);
+#endif
+  return kernels;
+}
+
+
+static const char* AlignAntiDiagonalKernelName() {
+  const AlignAntiDiagonalKernel kernel = AlignAntiDiagonal();
+#if defined(DISTANCE_KERNEL_X86)
+  if (kernel == AlignAntiDiagonalAVX512)
+    return "avx512";
+  if (kernel == AlignAntiDiagonalAVX2)
+    return "avx2";
+#elif defined(DISTANCE_KERNEL_NEON)
+  if (kernel == AlignAntiDiagonalNEON)
+    return "neon";
+#endif
+  return "scalar";
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef ALIGNMENT_STORE
+#define ALIGNMENT_STORE
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "contact_maps.h"
+#include "mapped_file.h"
+#include "sequence_alignment.h"
+
+// Best alignment of every query of a job, in place of alignments.json. Every search task writes its own shard,
+// a store is a shard file or a directory of *.alns shards that are memory mapped and read together.
+// Shard layout, native byte order:
+//   header   magic, version, reserved, record count, names size, run count
+//   records  AlignmentStoreRecord[record count], sorted by query id
+//   names    query id and target id of every record
+//   runs     uint32 length << 2 | operation of every run, operation 0 is 'M', 1 'I' and 2 'D'
+static const char ALIGNMENT_STORE_MAGIC[8] = {'D', 'F', 'R', 'I', 'A', 'L', 'N', 'S'};
+static const uint32_t ALIGNMENT_STORE_VERSION = 1;
+static const char ALIGNMENT_SHARD_SUFFIX[] = ".alns";
+
+struct AlignmentStoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t record_count;
+  uint64_t names_size;
+  uint64_t run_count;
+};
+
+struct AlignmentStoreRecord {
+  // query id followed by target id
+  uint64_t names_offset;
+  uint32_t query_id_length;
+  uint32_t target_id_length;
+  uint64_t runs_offset;
+  uint32_t run_count;
+  int32_t query_length;
+  double score;
+  double sequence_identity;
+};
+
+static_assert(sizeof(AlignmentStoreHeader) == 40, "AlignmentStoreHeader layout must not change");
+static_assert(sizeof(AlignmentStoreRecord) == 48, "AlignmentStoreRecord layout must not change");
+
+
+// alignment of a query, as written to and read from a store
+struct StoredAlignment {
+  std::string query_id;
+  std::string target_id;
+  double score;
+  double sequence_identity;
+  AlignmentRuns runs;
+
+  int QueryLength() const {
+    int64_t length = 0;
+    for (const AlignmentRun& run : runs) {
+      if (run.operation != 'D')
+        length += run.length;
+    }
+    if (length > std::numeric_limits<int32_t>::max())
+      throw std::invalid_argument("Alignment of " + query_id + " is too long");
+    return (int) length;
+  }
+};
+
+
+static uint32_t EncodeAlignmentRun(const AlignmentRun& run) {
+  const uint32_t operation = run.operation == 'M' ? 0 : (run.operation == 'I' ? 1 : (run.operation == 'D' ? 2 : 3));
+  if (operation == 3 || run.length <= 0 || run.length >= (1 << 30))
+    throw std::invalid_argument("Alignment run " + std::to_string(run.length) + run.operation + " can not be stored");
+  return (uint32_t) run.length << 2 | operation;
+}
+
+
+// Records are sorted by query id, duplicated query ids are an error. Written to save_path.tmp and renamed.
+static void WriteAlignmentShard(const std::string& save_path, std::vector<StoredAlignment> alignments) {
+  std::sort(alignments.begin(), alignments.end(), [](const StoredAlignment& a, const StoredAlignment& b) { return a.query_id < b.query_id; });
+  std::vector<AlignmentStoreRecord> records(alignments.size());
+  std::string names;
+  std::vector<uint32_t> runs;
+  for (size_t i = 0; i < alignments.size(); ++i) {
+    const StoredAlignment& alignment = alignments[i];
+    if (i > 0 && alignment.query_id == alignments[i - 1].query_id)
+      throw std::invalid_argument("Query " + alignment.query_id + " has more than one alignment");
+    AlignmentStoreRecord& record = records[i];
+    record.names_offset = names.size();
+    record.query_id_length = (uint32_t) alignment.query_id.size();
+    record.target_id_length = (uint32_t) alignment.target_id.size();
+    record.runs_offset = runs.size();
+    record.run_count = (uint32_t) alignment.runs.size();
+    record.query_length = alignment.QueryLength();
+    record.score = alignment.score;
+    record.sequence_identity = alignment.sequence_identity;
+    names += alignment.query_id;
+    names += alignment.target_id;
+    for (const AlignmentRun& run : alignment.runs)
+      runs.push_back(EncodeAlignmentRun(run));
+  }
+
+  const std::string temporary_path = save_path + ".tmp";
+  {
+    std::ofstream writer(temporary_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!writer)
+      throw std::runtime_error("Unable to create " + temporary_path);
+    AlignmentStoreHeader header{};
+    std::memcpy(header.magic, ALIGNMENT_STORE_MAGIC, sizeof(header.magic));
+    header.version = ALIGNMENT_STORE_VERSION;
+    header.record_count = records.size();
+    header.names_size = names.size();
+    header.run_count = runs.size();
+    writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writer.write(reinterpret_cast<const char*>(records.data()), (std::streamsize) (records.size() * sizeof(AlignmentStoreRecord)));
+    writer.write(names.data(), (std::streamsize) names.size());
+    writer.write(reinterpret_cast<const char*>(runs.data()), (std::streamsize) (runs.size() * sizeof(uint32_t)));
+    writer.close();
+    if (!writer) {
+      std::remove(temporary_path.c_str());
+      throw std::runtime_error("Unable to write alignments to " + temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), save_path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Unable to move alignments to " + save_path);
+  }
+}
+
+
+// Memory mapped shard, record bounds are checked when the shard is opened and runs when they are read.
+class AlignmentShard {
+ public:
+  explicit AlignmentShard(const std::string& file_path) : file_path_(file_path), file_(file_path) {
+    AlignmentStoreHeader header{};
+    if (file_.Size() < sizeof(header))
+      throw std::runtime_error(file_path + " is not an alignment store, file is too short");
+    std::memcpy(&header, file_.Data(), sizeof(header));
+    if (std::memcmp(header.magic, ALIGNMENT_STORE_MAGIC, sizeof(header.magic)) != 0)
+      throw std::runtime_error(file_path + " is not an alignment store");
+    if (header.version != ALIGNMENT_STORE_VERSION)
+      throw std::runtime_error(file_path + " has unsupported alignment store version " + std::to_string(header.version));
+    const size_t available = file_.Size() - sizeof(header);
+    if (header.record_count > available / sizeof(AlignmentStoreRecord) ||
+        header.names_size > available - header.record_count * sizeof(AlignmentStoreRecord) ||
+        header.run_count != (available - header.record_count * sizeof(AlignmentStoreRecord) - header.names_size) / sizeof(uint32_t))
+      throw std::runtime_error(file_path + " is corrupted, sections do not match file size");
+
+    record_count_ = (size_t) header.record_count;
+    names_size_ = (size_t) header.names_size;
+    run_count_ = (size_t) header.run_count;
+    records_ = file_.Data() + sizeof(header);
+    names_ = records_ + record_count_ * sizeof(AlignmentStoreRecord);
+    runs_ = names_ + names_size_;
+    for (size_t i = 0; i < record_count_; ++i) {
+      const AlignmentStoreRecord record = Record(i);
+      if (record.names_offset > names_size_ || (uint64_t) record.query_id_length + record.target_id_length > names_size_ - record.names_offset ||
+          record.runs_offset > run_count_ || record.run_count > run_count_ - record.runs_offset || record.query_length < 0)
+        throw std::runtime_error(file_path + " is corrupted, record " + std::to_string(i) + " is out of file bounds");
+      if (i > 0 && !(QueryId(i - 1) < QueryId(i)))
+        throw std::runtime_error(file_path + " is corrupted, records are not sorted by query id");
+    }
+  }
+
+  size_t Size() const {
+    return record_count_;
+  }
+
+  // records are not aligned inside the file, they are copied out
+  AlignmentStoreRecord Record(const size_t index) const {
+    AlignmentStoreRecord record;
+    std::memcpy(&record, records_ + index * sizeof(AlignmentStoreRecord), sizeof(record));
+    return record;
+  }
+
+  std::string_view QueryId(const size_t index) const {
+    const AlignmentStoreRecord record = Record(index);
+    return std::string_view(names_ + record.names_offset, record.query_id_length);
+  }
+
+  std::string_view TargetId(const size_t index) const {
+    const AlignmentStoreRecord record = Record(index);
+    return std::string_view(names_ + record.names_offset + record.query_id_length, record.target_id_length);
+  }
+
+  AlignmentRuns Runs(const size_t index) const {
+    const AlignmentStoreRecord record = Record(index);
+    AlignmentRuns runs(record.run_count);
+    int64_t query_length = 0;
+    for (uint32_t i = 0; i < record.run_count; ++i) {
+      uint32_t encoded;
+      std::memcpy(&encoded, runs_ + (record.runs_offset + i) * sizeof(uint32_t), sizeof(encoded));
+      const uint32_t operation = encoded & 3;
+      if (operation == 3 || (encoded >> 2) == 0)
+        throw std::runtime_error(file_path_ + " is corrupted, record " + std::to_string(index) + " has an invalid alignment run");
+      runs[i] = AlignmentRun{"MID"[operation], (int) (encoded >> 2)};
+      if (operation != 2)
+        query_length += runs[i].length;
+    }
+    if (query_length != record.query_length)
+      throw std::runtime_error(file_path_ + " is corrupted, runs of record " + std::to_string(index) + " do not match its query length");
+    return runs;
+  }
+
+  StoredAlignment Alignment(const size_t index) const {
+    const AlignmentStoreRecord record = Record(index);
+    return StoredAlignment{std::string(QueryId(index)), std::string(TargetId(index)), record.score, record.sequence_identity, Runs(index)};
+  }
+
+  // index of query_id, Size() if the shard does not have it
+  size_t Find(const std::string_view query_id) const {
+    size_t low = 0;
+    size_t high = record_count_;
+    while (low < high) {
+      const size_t middle = (low + high) / 2;
+      if (QueryId(middle) < query_id)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+    return low < record_count_ && QueryId(low) == query_id ? low : record_count_;
+  }
+
+ private:
+  std::string file_path_;
+  MappedFile file_;
+  size_t record_count_ = 0;
+  size_t names_size_ = 0;
+  size_t run_count_ = 0;
+  const char* records_ = nullptr;
+  const char* names_ = nullptr;
+  const char* runs_ = nullptr;
+};
+
+
+// Shards of a store path in name order, the path itself if it is a file.
+static std::vector<std::string> AlignmentShardPaths(const std::string& store_path) {
+  struct stat path_stat{};
+  if (stat(store_path.c_str(), &path_stat) != 0)
+    throw std::runtime_error("Alignment store " + store_path + " does not exist");
+  if (!S_ISDIR(path_stat.st_mode))
+    return {store_path};
+  DIR* directory = opendir(store_path.c_str());
+  if (directory == nullptr)
+    throw std::runtime_error("Unable to open alignment store " + store_path);
+  std::vector<std::string> shard_paths;
+  const std::string suffix = ALIGNMENT_SHARD_SUFFIX;
+  while (const dirent* entry = readdir(directory)) {
+    const std::string name = entry->d_name;
+    if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0)
+      shard_paths.push_back(store_path + '/' + name);
+  }
+  closedir(directory);
+  std::sort(shard_paths.begin(), shard_paths.end());
+  return shard_paths;
+}
+
+
+// All records of all shards, record i of the store is record i - (records of earlier shards) of its shard.
+// Query ids are expected to be unique across shards, Find gives the first shard having a query.
+class AlignmentStore {
+ public:
+  explicit AlignmentStore(const std::string& store_path) {
+    record_offsets_.push_back(0);
+    for (const std::string& shard_path : AlignmentShardPaths(store_path)) {
+      shards_.emplace_back(std::make_unique<AlignmentShard>(shard_path));
+      record_offsets_.push_back(record_offsets_.back() + shards_.back()->Size());
+    }
+  }
+
+  size_t Size() const {
+    return record_offsets_.back();
+  }
+
+  size_t ShardCount() const {
+    return shards_.size();
+  }
+
+  StoredAlignment Alignment(const size_t index) const {
+    const std::pair<const AlignmentShard*, size_t> location = Locate(index);
+    return location.first->Alignment(location.second);
+  }
+
+  std::string_view QueryId(const size_t index) const {
+    const std::pair<const AlignmentShard*, size_t> location = Locate(index);
+    return location.first->QueryId(location.second);
+  }
+
+  std::string_view TargetId(const size_t index) const {
+    const std::pair<const AlignmentShard*, size_t> location = Locate(index);
+    return location.first->TargetId(location.second);
+  }
+
+  // index of query_id in the store, Size() if no shard has it
+  size_t Find(const std::string_view query_id) const {
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+      const size_t index = shards_[shard]->Find(query_id);
+      if (index < shards_[shard]->Size())
+        return record_offsets_[shard] + index;
+    }
+    return Size();
+  }
+
+  // runs of every record in store order, for batch loaders
+  AlignmentInputs Inputs() const {
+    AlignmentInputs alignments;
+    alignments.use_runs = true;
+    alignments.runs.reserve(Size());
+    for (const std::unique_ptr<AlignmentShard>& shard : shards_) {
+      for (size_t i = 0; i < shard->Size(); ++i)
+        alignments.runs.push_back(shard->Runs(i));
+    }
+    return alignments;
+  }
+
+  std::vector<std::string> TargetIds() const {
+    std::vector<std::string> target_ids;
+    target_ids.reserve(Size());
+    for (const std::unique_ptr<AlignmentShard>& shard : shards_) {
+      for (size_t i = 0; i < shard->Size(); ++i)
+        target_ids.emplace_back(shard->TargetId(i));
+    }
+    return target_ids;
+  }
+
+ private:
+  std::pair<const AlignmentShard*, size_t> Locate(const size_t index) const {
+    if (index >= Size())
+      throw std::out_of_range("Alignment index " + std::to_string(index) + " is out of range of store of size " + std::to_string(Size()));
+    const size_t shard = (size_t) (std::upper_bound(record_offsets_.begin(), record_offsets_.end(), index) - record_offsets_.begin()) - 1;
+    return {shards_[shard].get(), index - record_offsets_[shard]};
+  }
+
+  std::vector<std::unique_ptr<AlignmentShard>> shards_;
+  std::vector<size_t> record_offsets_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef ALIGNMENT_STORE_PYTHON
+#define ALIGNMENT_STORE_PYTHON
+
+#include <boost/python.hpp>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "alignment_store.h"
+#include "load_contact_maps.h"
+#include "python_utils.h"
+#include "sequence_alignment_python.h"
+
+// python layer of alignment_store.h
+
+static int StoredAlignmentQueryLength(const StoredAlignment& alignment) {
+  return alignment.QueryLength();
+}
+
+
+static std::string StoredAlignmentCigar(const StoredAlignment& alignment) {
+  return FormatCigar(alignment.runs);
+}
+
+
+static bool AlignmentStoreContains(const AlignmentStore& store, const std::string& query_id) {
+  return store.Find(query_id) < store.Size();
+}
+
+
+static StoredAlignment AlignmentStoreItem(const AlignmentStore& store, const std::string& query_id) {
+  const size_t index = store.Find(query_id);
+  if (index == store.Size()) {
+    PyErr_SetString(PyExc_KeyError, query_id.c_str());
+    py::throw_error_already_set();
+  }
+  return store.Alignment(index);
+}
+
+
+// ids in store order, the order of build_stored_aligned_contact_map_store maps
+static py::list AlignmentStoreQueryIds(const AlignmentStore& store) {
+  py::list ids;
+  for (size_t i = 0; i < store.Size(); ++i)
+    ids.append(std::string(store.QueryId(i)));
+  return ids;
+}
+
+
+static py::list AlignmentStoreTargetIds(const AlignmentStore& store) {
+  py::list ids;
+  for (size_t i = 0; i < store.Size(); ++i)
+    ids.append(std::string(store.TargetId(i)));
+  return ids;
+}
+
+
+// shard of alignments given as CIGAR strings, e.g. to convert alignments.json of an older job
+static void SaveAlignmentShard(const std::string& save_path, const py::list& query_id_list, const py::list& target_id_list, const py::list& score_list,
+                               const py::list& sequence_identity_list, const py::list& cigar_list) {
+  const std::vector<std::string> query_ids = ExtractStrings(query_id_list);
+  const std::vector<std::string> target_ids = ExtractStrings(target_id_list);
+  const std::vector<std::string> cigars = ExtractStrings(cigar_list);
+  const size_t size = query_ids.size();
+  if (target_ids.size() != size || (size_t) py::len(score_list) != size || (size_t) py::len(sequence_identity_list) != size || cigars.size() != size)
+    throw std::invalid_argument("query ids, target ids, scores, sequence identities and cigars must have the same length");
+  std::vector<StoredAlignment> alignments(size);
+  for (size_t i = 0; i < size; ++i) {
+    alignments[i] = StoredAlignment{query_ids[i], target_ids[i], py::extract<double>(score_list[i]), py::extract<double>(sequence_identity_list[i]),
+                                    ParseCigar(cigars[i])};
+  }
+  ReleaseGIL release_gil;
+  WriteAlignmentShard(save_path, std::move(alignments));
+}
+
+
+// align_best_hits writing the best alignment of every query straight into a shard, aligned strings are never built.
+// Returns number of stored alignments.
+static size_t AlignBestHitsToShardPython(const py::list& query_id_list, const py::list& target_id_list, const py::list& query_sequence_list,
+                                         const py::list& target_sequence_list, const double match, const double mismatch, const double gap_open,
+                                         const double gap_continuation, const double min_sequence_identity, const int thread_count,
+                                         const std::string& save_path) {
+  const std::vector<std::string> query_ids = ExtractStrings(query_id_list);
+  const std::vector<std::string> target_ids = ExtractStrings(target_id_list);
+  const std::vector<std::string> query_sequences = ExtractStrings(query_sequence_list);
+  const std::vector<std::string> target_sequences = ExtractStrings(target_sequence_list);
+  if (target_ids.size() != query_ids.size())
+    throw std::invalid_argument("query ids and target ids must have the same length");
+
+  ReleaseGIL release_gil;
+  std::vector<BestAlignment> best_alignments = AlignBestHits(query_ids, query_sequences, target_sequences,
+                                                             AlignmentScoring{match, mismatch, gap_open, gap_continuation}, min_sequence_identity,
+                                                             thread_count, false);
+  std::vector<StoredAlignment> alignments;
+  alignments.reserve(best_alignments.size());
+  for (BestAlignment& best : best_alignments) {
+    alignments.push_back(StoredAlignment{query_ids[best.hit], target_ids[best.hit], best.alignment.score, best.alignment.identity,
+                                         std::move(best.alignment.runs)});
+  }
+  const size_t count = alignments.size();
+  WriteAlignmentShard(save_path, std::move(alignments));
+  return count;
+}
+
+
+// LoadAlignedContactMap taking an alignment record of a store
+static np::ndarray LoadStoredAlignedContactMap(const std::string& file_path, float angstrom_contact_threshold, const StoredAlignment& alignment,
+                                               const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  std::pair<SparseContacts, int> query_contacts = AlignSparseContacts(sparse_target_contacts, alignment.runs, generated_contacts);
+  bool* contact_map;
+  int query_length;
+  std::tie(contact_map, query_length) = DenseFromAlignedContacts(query_contacts.first, query_contacts.second);
+  return CreateNumpyArray(contact_map, query_length);
+}
+
+
+// target of the record is the protein id
+static np::ndarray LoadStoredAlignedContactMapFromDatabase(const AtomsDatabase& database, float angstrom_contact_threshold, const StoredAlignment& alignment,
+                                                           const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, alignment.target_id, angstrom_contact_threshold);
+  std::pair<SparseContacts, int> query_contacts = AlignSparseContacts(sparse_target_contacts, alignment.runs, generated_contacts);
+  bool* contact_map;
+  int query_length;
+  std::tie(contact_map, query_length) = DenseFromAlignedContacts(query_contacts.first, query_contacts.second);
+  return CreateNumpyArray(contact_map, query_length);
+}
+
+
+// Contact map store of every record of alignment_store, file_paths[i] is the atoms file of record i.
+static std::shared_ptr<AlignedContactMapStore> BuildStoredAlignedContactMapStore(const py::list& file_paths, float angstrom_contact_threshold,
+                                                                                 const AlignmentStore& alignment_store, const int generated_contacts,
+                                                                                 const int thread_count, const std::string& spill_path) {
+  const std::vector<std::string> target_names = ExtractStrings(file_paths);
+  ReleaseGIL release_gil;
+  return BuildContactMapStore([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, target_names, alignment_store.Inputs(), generated_contacts, thread_count, spill_path);
+}
+
+
+static std::shared_ptr<AlignedContactMapStore> BuildStoredAlignedContactMapStoreFromDatabase(const AtomsDatabase& database, float angstrom_contact_threshold,
+                                                                                             const AlignmentStore& alignment_store,
+                                                                                             const int generated_contacts, const int thread_count,
+                                                                                             const std::string& spill_path) {
+  ReleaseGIL release_gil;
+  return BuildContactMapStore([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, alignment_store.TargetIds(), alignment_store.Inputs(), generated_contacts, thread_count, spill_path);
+}
+
+#endif
@@ -0,0 +1,851 @@
+#ifndef ATOMS_DATABASE
+#define ATOMS_DATABASE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "atoms_file_io.h"
+#include "contact_lists.h"
+#include "engine_stats.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+// Packed atoms database stores many protein structures in a single file:
+//
+//   AtomsDatabaseHeader
+//   for each protein:  int32 group_indexes[chain_length + 1], float32 atoms_positions[atom_count * 3],
+//                      int32 representative_atoms[chain_length * 2] if the entry has ATOMS_DATABASE_ENTRY_REPRESENTATIVE_ATOMS
+//   AtomsDatabaseEntry index[entry_count] sorted by protein id
+//   protein ids string table referenced by the index
+//
+// group_indexes and atoms_positions have the same meaning as inside a single .bin file (see atoms_file_io.h).
+// Entries with ATOMS_DATABASE_ENTRY_FIXED_POSITIONS store int32 fixed_origin[3] and int16 fixed_positions[atom_count * 3]
+// padded to 4 bytes instead of atoms_positions (see fixed_positions.h), which halves the size of most entries.
+// Proteins are appended while writing and the index is written at the end, so the writer keeps only index in memory.
+//
+// Version 2 entries record a hash of the atoms (content_hash) and of the structure file they were made from (source_hash),
+// and removed proteins stay in the index as tombstones. AtomsDatabaseUpdater appends new data and a new index
+// after the end of the file and then rewrites the header, so unchanged proteins keep their offsets and
+// readers that already mapped the file keep a consistent view. Space of replaced and removed proteins is reclaimed
+// by CompactAtomsDatabase. Version 1 databases are still readable.
+//
+// Optionally target contacts for a set of thresholds follow the ids table (see contact_lists.h),
+// so loading contact maps at those thresholds does not run the contact engine.
+
+static const char ATOMS_DATABASE_MAGIC[8] = {'D', 'F', 'R', 'I', 'A', 'T', 'D', 'B'};
+static const uint32_t ATOMS_DATABASE_VERSION = 2;
+static const uint32_t ATOMS_DATABASE_ENTRY_REMOVED = 1;
+static const uint32_t ATOMS_DATABASE_ENTRY_REPRESENTATIVE_ATOMS = 2;
+static const uint32_t ATOMS_DATABASE_ENTRY_FIXED_POSITIONS = 4;
+// header flag
+static const uint32_t ATOMS_DATABASE_HAS_CONTACT_LISTS = 1;
+
+struct AtomsDatabaseHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t entry_count;
+  uint64_t index_offset;
+  uint64_t ids_offset;
+  uint64_t ids_size;
+  // zero in version 1
+  uint64_t live_count;
+  uint64_t dead_bytes;
+};
+
+struct AtomsDatabaseEntry {
+  uint64_t data_offset;
+  uint64_t id_offset;
+  uint32_t id_length;
+  uint32_t chain_length;
+  uint32_t atom_count;
+  uint32_t flags;
+  uint64_t source_hash;
+  uint64_t content_hash;
+
+  uint64_t DataSize() const {
+    const uint64_t representative_size = HasRepresentativeAtoms() ? sizeof(int) * 2 * (uint64_t) chain_length : 0;
+    return sizeof(int) * ((uint64_t) chain_length + 1) + PositionsSize() + representative_size;
+  }
+
+  uint64_t PositionsSize() const {
+    if (HasFixedPositions())
+      return sizeof(int) * 3 + (sizeof(int16_t) * 3 * (uint64_t) atom_count + 3) / 4 * 4;
+    return sizeof(float) * 3 * (uint64_t) atom_count;
+  }
+
+  bool HasRepresentativeAtoms() const {
+    return (flags & ATOMS_DATABASE_ENTRY_REPRESENTATIVE_ATOMS) != 0;
+  }
+
+  bool HasFixedPositions() const {
+    return (flags & ATOMS_DATABASE_ENTRY_FIXED_POSITIONS) != 0;
+  }
+
+  bool Removed() const {
+    return (flags & ATOMS_DATABASE_ENTRY_REMOVED) != 0;
+  }
+};
+
+struct AtomsDatabaseEntryV1 {
+  uint64_t data_offset;
+  uint64_t id_offset;
+  uint32_t id_length;
+  uint32_t chain_length;
+  uint32_t atom_count;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(AtomsDatabaseHeader) == 64, "AtomsDatabaseHeader layout must not change");
+static_assert(sizeof(AtomsDatabaseEntry) == 48, "AtomsDatabaseEntry layout must not change");
+static_assert(sizeof(AtomsDatabaseEntryV1) == 32, "AtomsDatabaseEntryV1 layout must not change");
+
+
+// MurmurHash64A, hashes are stored in the database so the function must never change
+static uint64_t HashBytes(const void* data, const size_t size, const uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (size * m);
+
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  const size_t blocks = size / 8;
+  for (size_t i = 0; i < blocks; ++i) {
+    uint64_t k;
+    std::memcpy(&k, bytes + i * 8, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  const unsigned char* tail = bytes + blocks * 8;
+  switch (size & 7) {
+    case 7: h ^= uint64_t(tail[6]) << 48; [[fallthrough]];
+    case 6: h ^= uint64_t(tail[5]) << 40; [[fallthrough]];
+    case 5: h ^= uint64_t(tail[4]) << 32; [[fallthrough]];
+    case 4: h ^= uint64_t(tail[3]) << 24; [[fallthrough]];
+    case 3: h ^= uint64_t(tail[2]) << 16; [[fallthrough]];
+    case 2: h ^= uint64_t(tail[1]) << 8; [[fallthrough]];
+    case 1: h ^= uint64_t(tail[0]);
+      h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+
+// hash of group indexes, positions and representative atoms, the bytes stored for a protein
+static uint64_t AtomsContentHash(const int* group_indexes, const int chain_length, const void* positions, const size_t positions_size,
+                                 const int* representative_atoms) {
+  uint64_t hash = HashBytes(group_indexes, sizeof(int) * ((size_t) chain_length + 1), 0);
+  hash = HashBytes(positions, positions_size, hash);
+  if (representative_atoms != nullptr)
+    hash = HashBytes(representative_atoms, sizeof(int) * 2 * (size_t) chain_length, hash);
+  return hash;
+}
+
+
+// Writes protein data at the current end of the stream, shared by the writer and the updater.
+// With fixed_positions positions are quantised unless they do not fit int16, views with fixed point positions always keep them.
+static AtomsDatabaseEntry WriteAtomsDatabaseData(std::ostream& writer, uint64_t& offset, const std::string& protein_id, const AtomsView& atoms,
+                                                 const uint64_t source_hash, const bool fixed_positions = false) {
+  if (atoms.chain_length < 0)
+    throw std::invalid_argument("Invalid chain length of " + protein_id);
+  const int atom_count = atoms.group_indexes[atoms.chain_length];
+  AtomsDatabaseEntry entry{};
+  entry.data_offset = offset;
+  entry.id_length = (uint32_t) protein_id.size();
+  entry.chain_length = (uint32_t) atoms.chain_length;
+  entry.atom_count = (uint32_t) atom_count;
+  entry.source_hash = source_hash;
+  if (atoms.representative_atoms != nullptr)
+    entry.flags |= ATOMS_DATABASE_ENTRY_REPRESENTATIVE_ATOMS;
+
+  // database keeps interleaved positions whatever the layout of the source file
+  std::vector<float> interleaved;
+  std::vector<char> positions;
+  if (atoms.fixed_positions == nullptr) {
+    const float* float_positions = InterleavedPositions(atoms, interleaved);
+    int origin[3];
+    std::vector<int16_t> quantized;
+    if (fixed_positions && QuantizePositions(float_positions, atom_count, origin, quantized)) {
+      entry.flags |= ATOMS_DATABASE_ENTRY_FIXED_POSITIONS;
+      positions.assign(entry.PositionsSize(), 0);
+      std::memcpy(positions.data(), origin, sizeof(origin));
+      std::memcpy(positions.data() + sizeof(origin), quantized.data(), sizeof(int16_t) * quantized.size());
+    } else {
+      positions.assign(reinterpret_cast<const char*>(float_positions), reinterpret_cast<const char*>(float_positions + (size_t) atom_count * 3));
+    }
+  } else {
+    entry.flags |= ATOMS_DATABASE_ENTRY_FIXED_POSITIONS;
+    positions.assign(entry.PositionsSize(), 0);
+    std::memcpy(positions.data(), atoms.fixed_origin, sizeof(int) * 3);
+    std::memcpy(positions.data() + sizeof(int) * 3, atoms.fixed_positions, sizeof(int16_t) * 3 * (size_t) atom_count);
+  }
+  entry.content_hash = AtomsContentHash(atoms.group_indexes, atoms.chain_length, positions.data(), positions.size(), atoms.representative_atoms);
+
+  writer.write(reinterpret_cast<const char*>(atoms.group_indexes), sizeof(int) * (atoms.chain_length + 1));
+  writer.write(positions.data(), (std::streamsize) positions.size());
+  if (atoms.representative_atoms != nullptr)
+    writer.write(reinterpret_cast<const char*>(atoms.representative_atoms), sizeof(int) * 2 * atoms.chain_length);
+  offset += entry.DataSize();
+  return entry;
+}
+
+
+// view of entry data starting at data, bounds are checked by the reader
+static AtomsView AtomsDatabaseEntryView(const AtomsDatabaseEntry& entry, const char* data) {
+  AtomsView atoms{};
+  atoms.chain_length = (int) entry.chain_length;
+  atoms.group_indexes = reinterpret_cast<const int*>(data);
+  const char* positions = data + sizeof(int) * ((size_t) entry.chain_length + 1);
+  if (entry.HasFixedPositions()) {
+    atoms.fixed_origin = reinterpret_cast<const int*>(positions);
+    atoms.fixed_positions = reinterpret_cast<const int16_t*>(positions + sizeof(int) * 3);
+  } else {
+    atoms.atoms_positions = reinterpret_cast<const float*>(positions);
+  }
+  if (entry.HasRepresentativeAtoms())
+    atoms.representative_atoms = reinterpret_cast<const int*>(positions + entry.PositionsSize());
+  return atoms;
+}
+
+
+// positions of ids sorted the way the index is
+static std::vector<size_t> AtomsDatabaseIndexOrder(const std::vector<std::string>& ids) {
+  std::vector<size_t> order(ids.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&ids](size_t a, size_t b) { return ids[a] < ids[b]; });
+  for (size_t i = 1; i < order.size(); ++i) {
+    if (ids[order[i - 1]] == ids[order[i]])
+      throw std::invalid_argument("Duplicated protein id " + ids[order[i]]);
+  }
+  return order;
+}
+
+
+static void WritePadding(std::ostream& writer, uint64_t& offset, const uint64_t alignment) {
+  const uint64_t padding = (alignment - offset % alignment) % alignment;
+  const char zeros[8] = {};
+  writer.write(zeros, (std::streamsize) padding);
+  offset += padding;
+}
+
+
+// Writes index in the given order and ids table, entries get their id_offset. Returns header without magic and version.
+static AtomsDatabaseHeader WriteAtomsDatabaseIndex(std::ostream& writer, uint64_t& offset, const std::vector<AtomsDatabaseEntry>& entries,
+                                                   const std::vector<std::string>& ids, const std::vector<size_t>& order) {
+  // index is 8 bytes aligned
+  WritePadding(writer, offset, 8);
+
+  AtomsDatabaseHeader header{};
+  std::string ids_table;
+  std::vector<AtomsDatabaseEntry> index;
+  index.reserve(entries.size());
+  for (size_t i : order) {
+    AtomsDatabaseEntry entry = entries[i];
+    entry.id_offset = ids_table.size();
+    ids_table += ids[i];
+    index.push_back(entry);
+    if (!entry.Removed())
+      ++header.live_count;
+  }
+
+  header.entry_count = index.size();
+  header.index_offset = offset;
+  header.ids_offset = offset + sizeof(AtomsDatabaseEntry) * index.size();
+  header.ids_size = ids_table.size();
+  writer.write(reinterpret_cast<const char*>(index.data()), (std::streamsize) (sizeof(AtomsDatabaseEntry) * index.size()));
+  writer.write(ids_table.data(), (std::streamsize) ids_table.size());
+  offset = header.ids_offset + header.ids_size;
+  return header;
+}
+
+
+// Writes contact lists section right after the ids table. Lists of entries with reusable lists for a threshold are copied,
+// other live entries run the contact engine on the data already written to data_path, a window of entries at a time.
+static void WriteAtomsDatabaseContactLists(std::ostream& writer, uint64_t& offset, const std::string& data_path,
+                                           const std::vector<AtomsDatabaseEntry>& entries, const std::vector<EncodedContactLists>& reusable_lists,
+                                           const std::vector<size_t>& order, const std::vector<float>& thresholds, const int thread_count) {
+  writer.flush();
+  const MappedFile data_file(data_path);
+
+  WritePadding(writer, offset, 8);
+  const uint64_t section_offset = offset;
+  ContactListsHeader section{};
+  std::memcpy(section.magic, CONTACT_LISTS_MAGIC, sizeof(section.magic));
+  section.threshold_count = (uint32_t) thresholds.size();
+  section.entry_count = order.size();
+  writer.write(reinterpret_cast<const char*>(&section), sizeof(section));
+  writer.write(reinterpret_cast<const char*>(thresholds.data()), (std::streamsize) (sizeof(float) * thresholds.size()));
+  offset += sizeof(section) + sizeof(float) * thresholds.size();
+  WritePadding(writer, offset, 8);
+
+  // lists are written entry after entry, list k = i * threshold_count + t spans list_offsets[k] to list_offsets[k + 1]
+  const size_t threshold_count = thresholds.size();
+  const size_t entry_count = order.size();
+  std::vector<uint64_t> list_offsets;
+  list_offsets.reserve(entry_count * threshold_count + 1);
+  uint64_t data_size = 0;
+
+  WorkStealingPool pool(thread_count);
+  const size_t window = (size_t) pool.ThreadCount() * 64;
+  std::vector<std::string> encoded(window * threshold_count);
+  for (size_t begin = 0; begin < entry_count; begin += window) {
+    const size_t end = std::min(begin + window, entry_count);
+    for (size_t i = begin; i < end; ++i) {
+      pool.Submit([&, i]() {
+        const AtomsDatabaseEntry& entry = entries[order[i]];
+        const EncodedContactLists& reusable = reusable_lists[order[i]];
+        for (size_t t = 0; t < threshold_count; ++t) {
+          std::string& output = encoded[(i - begin) * threshold_count + t];
+          output.clear();
+          if (entry.Removed())
+            continue;
+          auto reused = std::find_if(reusable.begin(), reusable.end(), [&](const EncodedContactList& list) { return list.threshold == thresholds[t]; });
+          if (reused != reusable.end()) {
+            output.assign(reused->data.data(), reused->data.size());
+            continue;
+          }
+          const AtomsView atoms = AtomsDatabaseEntryView(entry, data_file.Data() + entry.data_offset);
+          EncodeContactList(ComputeSparseContacts(atoms, thresholds[t]), output);
+        }
+      });
+    }
+    pool.Wait();
+
+    for (size_t k = 0; k < (end - begin) * threshold_count; ++k) {
+      list_offsets.push_back(data_size);
+      writer.write(encoded[k].data(), (std::streamsize) encoded[k].size());
+      data_size += encoded[k].size();
+    }
+  }
+  list_offsets.push_back(data_size);
+
+  offset += data_size;
+  WritePadding(writer, offset, 8);
+  writer.write(reinterpret_cast<const char*>(list_offsets.data()), (std::streamsize) (sizeof(uint64_t) * list_offsets.size()));
+  offset += sizeof(uint64_t) * list_offsets.size();
+
+  section.data_size = data_size;
+  writer.seekp((std::streamoff) section_offset);
+  writer.write(reinterpret_cast<const char*>(&section), sizeof(section));
+  writer.seekp(0, std::ios::end);
+}
+
+
+static void WriteAtomsDatabaseHeader(std::ostream& writer, AtomsDatabaseHeader header) {
+  std::memcpy(header.magic, ATOMS_DATABASE_MAGIC, sizeof(header.magic));
+  header.version = ATOMS_DATABASE_VERSION;
+  writer.seekp(0);
+  writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+
+// Writes into path + ".tmp" and renames it to path on Close,
+// so processes that keep the previous database mapped are not affected.
+class AtomsDatabaseWriter {
+ public:
+  explicit AtomsDatabaseWriter(const std::string& database_path)
+      : database_path_(database_path), temporary_path_(database_path + ".tmp") {
+    writer_.open(temporary_path_, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!writer_)
+      throw std::runtime_error("Unable to create " + temporary_path_);
+    AtomsDatabaseHeader header{};
+    writer_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    offset_ = sizeof(header);
+  }
+
+  ~AtomsDatabaseWriter() {
+    if (!closed_) {
+      writer_.close();
+      std::remove(temporary_path_.c_str());
+    }
+  }
+
+  AtomsDatabaseWriter(const AtomsDatabaseWriter&) = delete;
+  AtomsDatabaseWriter& operator=(const AtomsDatabaseWriter&) = delete;
+
+  // reusable_lists are copied instead of running the contact engine, they must stay valid until Close
+  void Add(const std::string& protein_id, const AtomsView& atoms, const uint64_t source_hash = 0, EncodedContactLists reusable_lists = {}) {
+    if (closed_)
+      throw std::runtime_error("AtomsDatabaseWriter is already closed");
+    entries_.push_back(WriteAtomsDatabaseData(writer_, offset_, protein_id, atoms, source_hash, fixed_positions_));
+    ids_.push_back(protein_id);
+    reusable_lists_.push_back(std::move(reusable_lists));
+  }
+
+  // proteins added later store int16 fixed point positions, proteins that already have them keep them anyway
+  void SetFixedPositions(const bool fixed_positions) {
+    fixed_positions_ = fixed_positions;
+  }
+
+  // contact lists for these thresholds are computed on Close, empty thresholds store none
+  void SetContactThresholds(const std::vector<float>& thresholds, const int thread_count) {
+    contact_thresholds_ = thresholds;
+    thread_count_ = thread_count;
+  }
+
+  void Close() {
+    if (closed_)
+      return;
+
+    const std::vector<size_t> order = AtomsDatabaseIndexOrder(ids_);
+    AtomsDatabaseHeader header = WriteAtomsDatabaseIndex(writer_, offset_, entries_, ids_, order);
+    if (!contact_thresholds_.empty()) {
+      WriteAtomsDatabaseContactLists(writer_, offset_, temporary_path_, entries_, reusable_lists_, order, contact_thresholds_, thread_count_);
+      header.flags |= ATOMS_DATABASE_HAS_CONTACT_LISTS;
+    }
+    WriteAtomsDatabaseHeader(writer_, header);
+    writer_.close();
+    if (!writer_)
+      throw std::runtime_error("Unable to write " + temporary_path_);
+
+    if (std::rename(temporary_path_.c_str(), database_path_.c_str()) != 0)
+      throw std::runtime_error("Unable to rename " + temporary_path_ + " to " + database_path_);
+    closed_ = true;
+  }
+
+  size_t Size() const {
+    return entries_.size();
+  }
+
+ private:
+  std::string database_path_;
+  std::string temporary_path_;
+  std::ofstream writer_;
+  uint64_t offset_ = 0;
+  std::vector<AtomsDatabaseEntry> entries_;
+  std::vector<std::string> ids_;
+  std::vector<EncodedContactLists> reusable_lists_;
+  std::vector<float> contact_thresholds_;
+  int thread_count_ = 0;
+  bool fixed_positions_ = false;
+  bool closed_ = false;
+};
+
+
+// Memory mapped reader of the packed atoms database.
+// Views returned by Find and Get point directly into the mapping and stay valid as long as the reader exists.
+// Header and index location are read once, so updates appended to the file later are not seen by this reader.
+class AtomsDatabase {
+ public:
+  explicit AtomsDatabase(const std::string& database_path) : database_path_(database_path), file_(database_path) {
+    if (file_.Size() < sizeof(AtomsDatabaseHeader))
+      throw std::runtime_error(database_path + " is not an atoms database, file is too short");
+    std::memcpy(&header_, file_.Data(), sizeof(header_));
+    if (std::memcmp(header_.magic, ATOMS_DATABASE_MAGIC, sizeof(header_.magic)) != 0)
+      throw std::runtime_error(database_path + " is not an atoms database");
+    if (header_.version != 1 && header_.version != ATOMS_DATABASE_VERSION)
+      throw std::runtime_error(database_path + " has unsupported atoms database version " + std::to_string(header_.version));
+
+    const size_t entry_size = header_.version == 1 ? sizeof(AtomsDatabaseEntryV1) : sizeof(AtomsDatabaseEntry);
+    if (header_.index_offset > file_.Size() ||
+        header_.entry_count > (file_.Size() - header_.index_offset) / entry_size ||
+        header_.ids_offset > file_.Size() || header_.ids_size > file_.Size() - header_.ids_offset)
+      throw std::runtime_error(database_path + " is corrupted, index is out of file bounds");
+    ids_ = file_.Data() + header_.ids_offset;
+
+    if (header_.version == 1) {
+      // version 1 entries have no hashes and no tombstones
+      const auto* entries = reinterpret_cast<const AtomsDatabaseEntryV1*>(file_.Data() + header_.index_offset);
+      converted_index_.resize(header_.entry_count);
+      for (uint64_t i = 0; i < header_.entry_count; ++i) {
+        AtomsDatabaseEntry& entry = converted_index_[i];
+        entry = AtomsDatabaseEntry{};
+        entry.data_offset = entries[i].data_offset;
+        entry.id_offset = entries[i].id_offset;
+        entry.id_length = entries[i].id_length;
+        entry.chain_length = entries[i].chain_length;
+        entry.atom_count = entries[i].atom_count;
+      }
+      index_ = converted_index_.data();
+      header_.live_count = header_.entry_count;
+      header_.dead_bytes = 0;
+    } else {
+      index_ = reinterpret_cast<const AtomsDatabaseEntry*>(file_.Data() + header_.index_offset);
+    }
+
+    // validating all entries once is cheap compared to reading garbage later
+    for (uint64_t i = 0; i < header_.entry_count; ++i) {
+      const AtomsDatabaseEntry& entry = index_[i];
+      if (entry.id_offset + entry.id_length > header_.ids_size || entry.data_offset > header_.index_offset ||
+          entry.DataSize() > header_.index_offset - entry.data_offset || entry.data_offset % sizeof(int) != 0)
+        throw std::runtime_error(database_path + " is corrupted, entry " + std::to_string(i) + " is out of file bounds");
+    }
+
+    if (header_.version != 1 && (header_.flags & ATOMS_DATABASE_HAS_CONTACT_LISTS) != 0)
+      ReadContactListsSection();
+  }
+
+  AtomsDatabase(const AtomsDatabase&) = delete;
+  AtomsDatabase& operator=(const AtomsDatabase&) = delete;
+
+  const std::string& Path() const {
+    return database_path_;
+  }
+
+  const AtomsDatabaseHeader& Header() const {
+    return header_;
+  }
+
+  // number of proteins, tombstones are not counted
+  size_t Size() const {
+    return header_.live_count;
+  }
+
+  // number of index entries including tombstones, Id and Entry take index below it
+  size_t EntryCount() const {
+    return header_.entry_count;
+  }
+
+  std::string Id(size_t index) const {
+    if (index >= EntryCount())
+      throw std::out_of_range("Atoms database index out of range");
+    return std::string(ids_ + index_[index].id_offset, index_[index].id_length);
+  }
+
+  const AtomsDatabaseEntry& Entry(size_t index) const {
+    if (index >= EntryCount())
+      throw std::out_of_range("Atoms database index out of range");
+    return index_[index];
+  }
+
+  bool Contains(const std::string& protein_id) const {
+    return FindLiveEntry(protein_id) != nullptr;
+  }
+
+  // entry of a protein that is not removed, nullptr otherwise
+  const AtomsDatabaseEntry* FindLiveEntry(const std::string& protein_id) const {
+    const AtomsDatabaseEntry* entry = FindEntry(protein_id);
+    return entry == nullptr || entry->Removed() ? nullptr : entry;
+  }
+
+  AtomsView View(const AtomsDatabaseEntry& entry, const std::string& protein_id) const {
+    EngineStageTimer timer(EngineCounter::LOAD_NS);
+    CountEngineEvent(EngineCounter::BYTES_READ, entry.DataSize());
+    const AtomsView atoms = AtomsDatabaseEntryView(entry, file_.Data() + entry.data_offset);
+    ValidateGroupIndexes(atoms, entry.atom_count, database_path_ + "/" + protein_id);
+    ValidateRepresentativeAtoms(atoms, database_path_ + "/" + protein_id);
+    return atoms;
+  }
+
+  bool Find(const std::string& protein_id, AtomsView& atoms) const {
+    const AtomsDatabaseEntry* entry = FindLiveEntry(protein_id);
+    if (entry == nullptr)
+      return false;
+    atoms = View(*entry, protein_id);
+    return true;
+  }
+
+  AtomsView Get(const std::string& protein_id) const {
+    AtomsView atoms{};
+    if (!Find(protein_id, atoms))
+      throw std::out_of_range(protein_id + " not found in atoms database " + database_path_);
+    return atoms;
+  }
+
+  // thresholds with precomputed contact lists, empty if the database has none
+  const std::vector<float>& ContactThresholds() const {
+    return contact_thresholds_;
+  }
+
+  // precomputed lists of an entry returned by Entry or FindLiveEntry, they point into the mapping
+  EncodedContactLists ContactLists(const AtomsDatabaseEntry& entry) const {
+    EncodedContactLists lists;
+    if (entry.Removed())
+      return lists;
+    const size_t entry_index = (size_t) (&entry - index_);
+    for (size_t t = 0; t < contact_thresholds_.size(); ++t) {
+      const size_t k = entry_index * contact_thresholds_.size() + t;
+      lists.push_back(EncodedContactList{contact_thresholds_[t],
+                                         std::string_view(contact_lists_ + list_offsets_[k], list_offsets_[k + 1] - list_offsets_[k])});
+    }
+    return lists;
+  }
+
+  // false if there is no precomputed list for the threshold
+  bool LoadContactList(const AtomsDatabaseEntry& entry, const float angstrom_contact_threshold, SparseContacts& sparse_contacts) const {
+    for (const EncodedContactList& list : ContactLists(entry)) {
+      if (list.threshold == angstrom_contact_threshold) {
+        EngineStageTimer timer(EngineCounter::LOAD_NS);
+        CountEngineEvent(EngineCounter::BYTES_READ, list.data.size());
+        sparse_contacts = DecodeContactList(list.data, (int) entry.chain_length);
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  void ReadContactListsSection() {
+    const uint64_t section_offset = (header_.ids_offset + header_.ids_size + 7) / 8 * 8;
+    const std::string corrupted = database_path_ + " is corrupted, contact lists are out of file bounds";
+    if (section_offset > file_.Size() || file_.Size() - section_offset < sizeof(ContactListsHeader))
+      throw std::runtime_error(corrupted);
+    ContactListsHeader section;
+    std::memcpy(&section, file_.Data() + section_offset, sizeof(section));
+    if (std::memcmp(section.magic, CONTACT_LISTS_MAGIC, sizeof(section.magic)) != 0 || section.entry_count != header_.entry_count)
+      throw std::runtime_error(database_path_ + " is corrupted, contact lists do not match the index");
+
+    const uint64_t thresholds_offset = section_offset + sizeof(section);
+    const uint64_t lists_offset = (thresholds_offset + sizeof(float) * (uint64_t) section.threshold_count + 7) / 8 * 8;
+    const uint64_t offsets_offset = (lists_offset + section.data_size + 7) / 8 * 8;
+    const uint64_t offset_count = section.entry_count * section.threshold_count + 1;
+    if (lists_offset > file_.Size() || section.data_size > file_.Size() - lists_offset || offsets_offset > file_.Size() ||
+        offset_count > (file_.Size() - offsets_offset) / sizeof(uint64_t))
+      throw std::runtime_error(corrupted);
+
+    contact_thresholds_.resize(section.threshold_count);
+    std::memcpy(contact_thresholds_.data(), file_.Data() + thresholds_offset, sizeof(float) * section.threshold_count);
+    contact_lists_ = file_.Data() + lists_offset;
+    list_offsets_ = reinterpret_cast<const uint64_t*>(file_.Data() + offsets_offset);
+    for (uint64_t k = 0; k + 1 < offset_count; ++k) {
+      if (list_offsets_[k] > list_offsets_[k + 1] || list_offsets_[k + 1] > section.data_size)
+        throw std::runtime_error(corrupted);
+    }
+  }
+
+  int CompareId(const AtomsDatabaseEntry& entry, const std::string& protein_id) const {
+    const size_t common_length = std::min((size_t) entry.id_length, protein_id.size());
+    int comparison = std::memcmp(ids_ + entry.id_offset, protein_id.data(), common_length);
+    if (comparison != 0)
+      return comparison;
+    if (entry.id_length == protein_id.size())
+      return 0;
+    return entry.id_length < protein_id.size() ? -1 : 1;
+  }
+
+  const AtomsDatabaseEntry* FindEntry(const std::string& protein_id) const {
+    size_t begin = 0;
+    size_t end = header_.entry_count;
+    while (begin < end) {
+      const size_t middle = begin + (end - begin) / 2;
+      const int comparison = CompareId(index_[middle], protein_id);
+      if (comparison == 0)
+        return index_ + middle;
+      if (comparison < 0)
+        begin = middle + 1;
+      else
+        end = middle;
+    }
+    return nullptr;
+  }
+
+  std::string database_path_;
+  MappedFile file_;
+  AtomsDatabaseHeader header_{};
+  const AtomsDatabaseEntry* index_ = nullptr;
+  std::vector<AtomsDatabaseEntry> converted_index_;
+  const char* ids_ = nullptr;
+  std::vector<float> contact_thresholds_;
+  const char* contact_lists_ = nullptr;
+  const uint64_t* list_offsets_ = nullptr;
+};
+
+
+// Updates the database in place. New and changed proteins are appended after the current end of file,
+// removed ones become tombstones and Close appends a new index and rewrites the header.
+// Until Close the file is valid and shows the previous state, a failed update leaves it unchanged.
+// Only one updater or compaction may work on a database at a time.
+class AtomsDatabaseUpdater {
+ public:
+  explicit AtomsDatabaseUpdater(const std::string& database_path) : database_path_(database_path) {
+    {
+      std::ifstream existing(database_path, std::ios::in | std::ios::binary);
+      if (!existing)
+        AtomsDatabaseWriter(database_path).Close();
+    }
+    // previous state stays mapped, contact lists of unchanged proteins are copied from it on Close
+    previous_ = std::make_unique<AtomsDatabase>(database_path);
+    entries_.reserve(previous_->EntryCount());
+    ids_.reserve(previous_->EntryCount());
+    for (size_t i = 0; i < previous_->EntryCount(); ++i) {
+      entries_.push_back(previous_->Entry(i));
+      ids_.push_back(previous_->Id(i));
+      reusable_lists_.push_back(previous_->ContactLists(previous_->Entry(i)));
+      positions_.emplace(ids_.back(), i);
+    }
+    version_ = previous_->Header().version;
+    contact_thresholds_ = previous_->ContactThresholds();
+
+    file_.open(database_path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file_)
+      throw std::runtime_error("Unable to open " + database_path + " for update");
+    file_.seekp(0, std::ios::end);
+    original_size_ = (uint64_t) file_.tellp();
+    offset_ = original_size_;
+    // protein data is 4 bytes aligned
+    const uint64_t padding = (4 - offset_ % 4) % 4;
+    const char zeros[4] = {};
+    file_.write(zeros, (std::streamsize) padding);
+    offset_ += padding;
+  }
+
+  ~AtomsDatabaseUpdater() {
+    if (!closed_) {
+      // drop appended data, the previous header still describes the file
+      file_.close();
+      std::error_code error;
+      std::filesystem::resize_file(database_path_, original_size_, error);
+    }
+  }
+
+  AtomsDatabaseUpdater(const AtomsDatabaseUpdater&) = delete;
+  AtomsDatabaseUpdater& operator=(const AtomsDatabaseUpdater&) = delete;
+
+  bool Contains(const std::string& protein_id) const {
+    auto position = positions_.find(protein_id);
+    return position != positions_.end() && !entries_[position->second].Removed();
+  }
+
+  // source hash of a protein that is not removed, 0 if unknown
+  uint64_t SourceHash(const std::string& protein_id) const {
+    auto position = positions_.find(protein_id);
+    if (position == positions_.end() || entries_[position->second].Removed())
+      return 0;
+    return entries_[position->second].source_hash;
+  }
+
+  // adds a new protein or replaces the existing one
+  void Add(const std::string& protein_id, const AtomsView& atoms, const uint64_t source_hash = 0) {
+    if (closed_)
+      throw std::runtime_error("AtomsDatabaseUpdater is already closed");
+    AtomsDatabaseEntry entry = WriteAtomsDatabaseData(file_, offset_, protein_id, atoms, source_hash, fixed_positions_);
+    auto inserted = positions_.emplace(protein_id, entries_.size());
+    if (inserted.second) {
+      entries_.push_back(entry);
+      ids_.push_back(protein_id);
+      reusable_lists_.emplace_back();
+    } else {
+      entries_[inserted.first->second] = entry;
+      reusable_lists_[inserted.first->second].clear();
+    }
+    ++changed_;
+  }
+
+  // only new and changed proteins are affected, existing entries keep their positions
+  void SetFixedPositions(const bool fixed_positions) {
+    fixed_positions_ = fixed_positions;
+  }
+
+  // thresholds of the previous database are kept unless set, lists are computed on Close only for changed proteins
+  void SetContactThresholds(const std::vector<float>& thresholds, const int thread_count) {
+    if (thresholds != contact_thresholds_)
+      ++changed_;
+    contact_thresholds_ = thresholds;
+    thread_count_ = thread_count;
+  }
+
+  // marks a protein removed, returns false if it is not in the database
+  bool Remove(const std::string& protein_id) {
+    if (closed_)
+      throw std::runtime_error("AtomsDatabaseUpdater is already closed");
+    auto position = positions_.find(protein_id);
+    if (position == positions_.end() || entries_[position->second].Removed())
+      return false;
+    entries_[position->second].flags |= ATOMS_DATABASE_ENTRY_REMOVED;
+    ++changed_;
+    return true;
+  }
+
+  void Close() {
+    if (closed_)
+      return;
+    // version 1 files are rewritten to get the version 2 index
+    if (changed_ == 0 && version_ == ATOMS_DATABASE_VERSION) {
+      file_.close();
+      std::filesystem::resize_file(database_path_, original_size_);
+      closed_ = true;
+      return;
+    }
+
+    const std::vector<size_t> order = AtomsDatabaseIndexOrder(ids_);
+    AtomsDatabaseHeader header = WriteAtomsDatabaseIndex(file_, offset_, entries_, ids_, order);
+    if (!contact_thresholds_.empty()) {
+      WriteAtomsDatabaseContactLists(file_, offset_, database_path_, entries_, reusable_lists_, order, contact_thresholds_, thread_count_);
+      header.flags |= ATOMS_DATABASE_HAS_CONTACT_LISTS;
+    }
+    uint64_t live_bytes = 0;
+    for (const AtomsDatabaseEntry& entry : entries_) {
+      if (!entry.Removed())
+        live_bytes += entry.DataSize();
+    }
+    header.dead_bytes = header.index_offset - sizeof(AtomsDatabaseHeader) - live_bytes;
+    // header goes last, so the file stays valid whenever the update stops
+    file_.flush();
+    WriteAtomsDatabaseHeader(file_, header);
+    file_.close();
+    if (!file_)
+      throw std::runtime_error("Unable to write " + database_path_);
+    closed_ = true;
+  }
+
+  size_t Size() const {
+    size_t live_count = 0;
+    for (const AtomsDatabaseEntry& entry : entries_)
+      live_count += !entry.Removed();
+    return live_count;
+  }
+
+  std::vector<std::string> Ids() const {
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      if (!entries_[i].Removed())
+        ids.push_back(ids_[i]);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+ private:
+  std::string database_path_;
+  std::fstream file_;
+  uint64_t original_size_ = 0;
+  uint64_t offset_ = 0;
+  uint32_t version_ = 0;
+  size_t changed_ = 0;
+  std::unique_ptr<AtomsDatabase> previous_;
+  std::vector<AtomsDatabaseEntry> entries_;
+  std::vector<std::string> ids_;
+  std::vector<EncodedContactLists> reusable_lists_;
+  std::unordered_map<std::string, size_t> positions_;
+  std::vector<float> contact_thresholds_;
+  int thread_count_ = 0;
+  bool fixed_positions_ = false;
+  bool closed_ = false;
+};
+
+
+// Rewrites the database without tombstones and data of replaced proteins. Offsets change, hashes and contact lists are kept.
+// The compacted file replaces the database by rename, readers that mapped the old file are not affected.
+static void CompactAtomsDatabase(const std::string& database_path) {
+  const AtomsDatabase database(database_path);
+  AtomsDatabaseWriter writer(database_path);
+  writer.SetContactThresholds(database.ContactThresholds(), 1);
+  for (size_t i = 0; i < database.EntryCount(); ++i) {
+    const AtomsDatabaseEntry& entry = database.Entry(i);
+    if (entry.Removed())
+      continue;
+    const std::string protein_id = database.Id(i);
+    writer.Add(protein_id, database.View(entry, protein_id), entry.source_hash, database.ContactLists(entry));
+  }
+  writer.Close();
+}
+
+#endif
@@ -0,0 +1,228 @@
+// Round trip check of in place atoms database updates and compaction, run by ctest:
+//   AtomsDatabaseCheck [directory]
+// Writes a small database with contact lists, updates it in place, interrupts an update and compacts the result,
+// checking after every step what readers see. Failed checks are printed and the check exits with status 1.
+
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "atoms_database.h"
+#include "contact_definition.h"
+
+struct CheckStructure {
+  std::vector<int> group_indexes;
+  std::vector<float> positions;
+
+  AtomsView View() const {
+    return AtomsView{(int) group_indexes.size() - 1, group_indexes.data(), positions.data(), nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+                     nullptr};
+  }
+};
+
+// contents of an entry that have to survive updates of other entries and compaction
+struct EntrySnapshot {
+  uint64_t data_offset;
+  uint64_t source_hash;
+  uint64_t content_hash;
+  std::vector<SparseContacts> contact_lists;
+};
+
+static int failed_checks = 0;
+
+
+static void Check(const bool condition, const std::string& description) {
+  if (condition)
+    return;
+  std::cerr << "FAILED: " << description << std::endl;
+  ++failed_checks;
+}
+
+
+// random walk of 3.8 Å steps with up to 5 atoms within 2 Å of every step
+static CheckStructure GenerateStructure(const int chain_length, const unsigned seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> unit(-1, 1);
+  std::uniform_int_distribution<int> atom_count(1, 5);
+  CheckStructure structure;
+  structure.group_indexes.push_back(0);
+  float position[3] = {0, 0, 0};
+  for (int residue = 0; residue < chain_length; ++residue) {
+    float step[3] = {unit(generator), unit(generator), unit(generator)};
+    const float length = std::sqrt(step[0] * step[0] + step[1] * step[1] + step[2] * step[2]) + 1e-6f;
+    for (int axis = 0; axis < 3; ++axis)
+      position[axis] += 3.8f * step[axis] / length;
+    const int atoms = atom_count(generator);
+    for (int atom = 0; atom < atoms; ++atom) {
+      for (int axis = 0; axis < 3; ++axis)
+        structure.positions.push_back(position[axis] + 2 * unit(generator));
+    }
+    structure.group_indexes.push_back(structure.group_indexes.back() + atoms);
+  }
+  return structure;
+}
+
+
+static std::string ReadFileBytes(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+
+static bool SameAtoms(const AtomsView& atoms, const CheckStructure& structure) {
+  const AtomsView expected = structure.View();
+  if (atoms.chain_length != expected.chain_length || atoms.atoms_positions == nullptr)
+    return false;
+  const size_t atom_count = (size_t) expected.group_indexes[expected.chain_length];
+  return std::memcmp(atoms.group_indexes, expected.group_indexes, sizeof(int) * ((size_t) expected.chain_length + 1)) == 0 &&
+         std::memcmp(atoms.atoms_positions, expected.atoms_positions, sizeof(float) * 3 * atom_count) == 0;
+}
+
+
+static std::map<std::string, EntrySnapshot> Snapshot(const AtomsDatabase& database) {
+  std::map<std::string, EntrySnapshot> snapshot;
+  for (size_t i = 0; i < database.EntryCount(); ++i) {
+    const AtomsDatabaseEntry& entry = database.Entry(i);
+    if (entry.Removed())
+      continue;
+    EntrySnapshot& entry_snapshot = snapshot[database.Id(i)];
+    entry_snapshot = EntrySnapshot{entry.data_offset, entry.source_hash, entry.content_hash, {}};
+    for (const float threshold : database.ContactThresholds()) {
+      SparseContacts contacts;
+      database.LoadContactList(entry, threshold, contacts);
+      entry_snapshot.contact_lists.push_back(std::move(contacts));
+    }
+  }
+  return snapshot;
+}
+
+
+// every live protein has the expected atoms and precomputed lists equal to the contact engine
+static void CheckDatabase(const std::string& step, const std::string& database_path, const std::map<std::string, const CheckStructure*>& expected) {
+  const AtomsDatabase database(database_path);
+  Check(database.Size() == expected.size(), step + ": number of proteins");
+  Check(database.ContactThresholds() == std::vector<float>({6, 8}), step + ": contact thresholds");
+  for (const auto& protein : expected) {
+    const AtomsDatabaseEntry* entry = database.FindLiveEntry(protein.first);
+    Check(entry != nullptr, step + ": " + protein.first + " is present");
+    if (entry == nullptr)
+      continue;
+    const AtomsView atoms = database.View(*entry, protein.first);
+    Check(SameAtoms(atoms, *protein.second), step + ": atoms of " + protein.first);
+    for (const float threshold : database.ContactThresholds()) {
+      SparseContacts contacts;
+      Check(database.LoadContactList(*entry, threshold, contacts) && contacts == ComputeSparseContacts(atoms, threshold),
+            step + ": contact list of " + protein.first + " at " + std::to_string(threshold));
+    }
+  }
+}
+
+
+static void RunChecks(const std::string& database_path) {
+  const CheckStructure a = GenerateStructure(40, 1), b = GenerateStructure(65, 2), c = GenerateStructure(30, 3), d = GenerateStructure(90, 4);
+  const CheckStructure b_replaced = GenerateStructure(55, 5), e = GenerateStructure(70, 6), f = GenerateStructure(20, 7);
+
+  {
+    AtomsDatabaseWriter writer(database_path);
+    writer.SetContactThresholds({6, 8}, 2);
+    writer.Add("A", a.View(), 11);
+    writer.Add("B", b.View(), 12);
+    writer.Add("C", c.View(), 13);
+    writer.Add("D", d.View(), 14);
+    writer.Close();
+  }
+  CheckDatabase("write", database_path, {{"A", &a}, {"B", &b}, {"C", &c}, {"D", &d}});
+  std::map<std::string, EntrySnapshot> written;
+  {
+    const AtomsDatabase database(database_path);
+    written = Snapshot(database);
+  }
+
+  // add, replace, remove and close
+  {
+    AtomsDatabaseUpdater updater(database_path);
+    Check(updater.Contains("B") && updater.SourceHash("B") == 12, "update: source hash of B before replacing");
+    updater.Add("E", e.View(), 15);
+    updater.Add("B", b_replaced.View(), 22);
+    Check(updater.Remove("C"), "update: C is removed");
+    Check(!updater.Remove("C") && !updater.Remove("missing"), "update: removing twice or a missing protein fails");
+    Check(updater.Ids() == std::vector<std::string>({"A", "B", "D", "E"}), "update: ids before close");
+    updater.Close();
+  }
+  CheckDatabase("update", database_path, {{"A", &a}, {"B", &b_replaced}, {"D", &d}, {"E", &e}});
+  std::map<std::string, EntrySnapshot> updated;
+  {
+    const AtomsDatabase database(database_path);
+    Check(!database.Contains("C"), "update: C is a tombstone");
+    Check(database.Header().dead_bytes > 0, "update: data of C and of the first B is counted as dead");
+    updated = Snapshot(database);
+  }
+  for (const char* unchanged : {"A", "D"}) {
+    const EntrySnapshot& before = written[unchanged];
+    const EntrySnapshot& after = updated[unchanged];
+    Check(after.data_offset == before.data_offset && after.content_hash == before.content_hash && after.contact_lists == before.contact_lists,
+          std::string("update: ") + unchanged + " keeps its offset, hash and contact lists");
+  }
+  Check(updated["B"].source_hash == 22 && updated["B"].content_hash != written["B"].content_hash, "update: B has the new hashes");
+
+  // an update that fails before Close and one without changes leave the file byte identical
+  const std::string updated_bytes = ReadFileBytes(database_path);
+  try {
+    AtomsDatabaseUpdater updater(database_path);
+    updater.Add("F", f.View(), 16);
+    updater.Add("A", b.View(), 31);
+    updater.Remove("D");
+    throw std::runtime_error("interrupted update");
+  } catch (const std::runtime_error&) {
+  }
+  Check(ReadFileBytes(database_path) == updated_bytes, "failed update: file is unchanged");
+  {
+    AtomsDatabaseUpdater updater(database_path);
+    updater.Close();
+  }
+  Check(ReadFileBytes(database_path) == updated_bytes, "empty update: file is unchanged");
+
+  // compaction drops tombstones and replaced data, keeps hashes and contact lists
+  CompactAtomsDatabase(database_path);
+  CheckDatabase("compaction", database_path, {{"A", &a}, {"B", &b_replaced}, {"D", &d}, {"E", &e}});
+  {
+    const AtomsDatabase database(database_path);
+    Check(database.EntryCount() == 4 && database.Header().dead_bytes == 0, "compaction: no tombstones and no dead data");
+    const std::map<std::string, EntrySnapshot> compacted = Snapshot(database);
+    for (const auto& protein : updated) {
+      const auto after = compacted.find(protein.first);
+      Check(after != compacted.end() && after->second.source_hash == protein.second.source_hash &&
+                after->second.content_hash == protein.second.content_hash && after->second.contact_lists == protein.second.contact_lists,
+            "compaction: " + protein.first + " keeps its hashes and contact lists");
+    }
+  }
+  Check(ReadFileBytes(database_path).size() < updated_bytes.size(), "compaction: file is smaller");
+  Check(!std::filesystem::exists(database_path + ".tmp"), "compaction: temporary file is renamed");
+}
+
+
+int main(int argc, char** argv) {
+  const std::filesystem::path directory =
+      argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::temp_directory_path() / "deepfri_atoms_database_check";
+  std::filesystem::create_directories(directory);
+  const std::string database_path = (directory / "check.db").string();
+  std::filesystem::remove(database_path);
+  try {
+    RunChecks(database_path);
+  } catch (const std::exception& error) {
+    Check(false, std::string("unexpected exception: ") + error.what());
+  }
+  std::filesystem::remove(database_path);
+  if (failed_checks == 0)
+    std::cerr << "All atoms database checks passed" << std::endl;
+  return failed_checks == 0 ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+#ifndef ATOMS_DATABASE_PYTHON
+#define ATOMS_DATABASE_PYTHON
+
+#include <boost/python.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "atoms_database.h"
+#include "atoms_file_io_python.h"
+#include "python_utils.h"
+
+// python layer of atoms_database.h
+
+// functions below are shared by AtomsDatabaseWriter and AtomsDatabaseUpdater
+template <typename DatabaseWriter>
+static void AddAtomsToDatabase(DatabaseWriter& writer, const std::string& protein_id, const np::ndarray& position_array, const np::ndarray& groups_array,
+                               const py::object& representative_atoms) {
+  // same arrays as SaveAtomsFile
+  writer.Add(protein_id, AtomsViewFromArrays(position_array, groups_array, representative_atoms));
+}
+
+
+template <typename DatabaseWriter>
+static void AddAtomsFileToDatabase(DatabaseWriter& writer, const std::string& protein_id, const std::string& file_path) {
+  const AtomsFile atoms_file = LoadAtomsFile(file_path);
+  writer.Add(protein_id, atoms_file.atoms);
+}
+
+
+// copies a protein of an existing database, used to carry proteins over when the database is rebuilt
+template <typename DatabaseWriter>
+static void AddDatabaseAtomsToDatabase(DatabaseWriter& writer, const AtomsDatabase& database, const std::string& protein_id) {
+  const AtomsDatabaseEntry* entry = database.FindLiveEntry(protein_id);
+  if (entry == nullptr)
+    throw std::out_of_range(protein_id + " not found in atoms database " + database.Path());
+  writer.Add(protein_id, database.View(*entry, protein_id), entry->source_hash);
+}
+
+
+static py::list AtomsDatabaseIds(const AtomsDatabase& database) {
+  py::list ids;
+  for (size_t i = 0; i < database.EntryCount(); ++i) {
+    if (!database.Entry(i).Removed())
+      ids.append(database.Id(i));
+  }
+  return ids;
+}
+
+
+template <typename DatabaseWriter>
+static void SetContactThresholdsPython(DatabaseWriter& writer, const py::list& threshold_list, const int thread_count) {
+  std::vector<float> thresholds(py::len(threshold_list));
+  for (size_t i = 0; i < thresholds.size(); ++i)
+    thresholds[i] = py::extract<float>(threshold_list[i]);
+  std::sort(thresholds.begin(), thresholds.end());
+  thresholds.erase(std::unique(thresholds.begin(), thresholds.end()), thresholds.end());
+  writer.SetContactThresholds(thresholds, thread_count);
+}
+
+
+// contact lists are computed on close, other python threads keep running meanwhile
+template <typename DatabaseWriter>
+static void CloseDatabasePython(DatabaseWriter& writer) {
+  ReleaseGIL release_gil;
+  writer.Close();
+}
+
+
+static py::list AtomsDatabaseContactThresholds(const AtomsDatabase& database) {
+  py::list thresholds;
+  for (const float threshold : database.ContactThresholds())
+    thresholds.append(threshold);
+  return thresholds;
+}
+
+
+static py::list AtomsDatabaseUpdaterIds(const AtomsDatabaseUpdater& updater) {
+  py::list ids;
+  for (const std::string& protein_id : updater.Ids())
+    ids.append(protein_id);
+  return ids;
+}
+
+
+static py::dict AtomsDatabaseStats(const AtomsDatabase& database) {
+  const AtomsDatabaseHeader& header = database.Header();
+  size_t fixed_count = 0;
+  for (size_t i = 0; i < database.EntryCount(); ++i)
+    fixed_count += !database.Entry(i).Removed() && database.Entry(i).HasFixedPositions();
+  py::dict output;
+  output["version"] = header.version;
+  output["entries"] = header.entry_count;
+  output["live"] = header.live_count;
+  output["removed"] = header.entry_count - header.live_count;
+  output["dead_bytes"] = header.dead_bytes;
+  output["fixed_positions"] = fixed_count;
+  output["live_bytes"] = header.index_offset - sizeof(AtomsDatabaseHeader) - header.dead_bytes;
+  return output;
+}
+
+
+static void CompactAtomsDatabasePython(const std::string& database_path) {
+  // GIL is released, so python can compact in a background thread
+  ReleaseGIL release_gil;
+  CompactAtomsDatabase(database_path);
+}
+
+#endif
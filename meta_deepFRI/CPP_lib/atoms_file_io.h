@@ -5,45 +5,343 @@
 #ifndef ATOMS_FILE_IO
 #define ATOMS_FILE_IO
 
-#include <boost/python.hpp>
-#include <boost/python/numpy.hpp>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-namespace py = boost::python;
-namespace np = py::numpy;
+#include "engine_stats.h"
+#include "fixed_positions.h"
+#include "mapped_file.h"
 
+// Non owning view of a single protein structure.
+// Atoms of residue i are group_indexes[i] ... group_indexes[i + 1] - 1,
+// position of atom j is atoms_positions[j * 3] ... atoms_positions[j * 3 + 2].
+// Files with separate coordinate blocks leave atoms_positions null and set xs, ys, zs instead,
+// atoms of residue i are then stored at coordinate_indexes[i] ... coordinate_indexes[i] + group size - 1.
+// Fixed point positions (see fixed_positions.h) leave both null and set fixed_origin[3] and fixed_positions, interleaved.
+// representative_atoms holds alpha and beta carbon atom index of every residue, -1 if the residue does not have it,
+// it is null for files written without atom names.
+struct AtomsView {
+  int chain_length;
+  const int* group_indexes;
+  const float* atoms_positions;
+  const int* coordinate_indexes;
+  const float* xs;
+  const float* ys;
+  const float* zs;
+  const int* representative_atoms;
+  const int* fixed_origin;
+  const int16_t* fixed_positions;
+};
+
+// Atoms file layout:
+//   AtomsFileHeader
+//   int32 group_indexes[chain_length + 1]    last value is the number of atoms
+//   float32 atoms_positions[atom_count * 3]
+//
+// With ATOMS_FILE_REPRESENTATIVE_ATOMS flag int32 representative_atoms[chain_length * 2] follow group indexes
+// (and coordinate indexes), as pairs of alpha and beta carbon atom index of every residue.
+//
+// With ATOMS_FILE_FIXED_POSITIONS flag int32 fixed_origin[3] and int16 fixed_positions[atom_count * 3]
+// replace float32 atoms_positions, this flag can not be combined with separate coordinates.
+//
+// With ATOMS_FILE_SEPARATE_COORDINATES flag positions are stored as blocks of x, y and z instead:
+//   AtomsFileHeader
+//   int32 group_indexes[chain_length + 1]
+//   int32 coordinate_indexes[chain_length + 1]    only with ATOMS_FILE_PADDED_RESIDUES flag
+//   zeros up to a multiple of 64 bytes
+//   float32 x[coordinate_count], float32 y[coordinate_count], float32 z[coordinate_count]
+// coordinate_count is a multiple of 16, so every block starts 64 bytes aligned. With padded residues every residue
+// starts at a multiple of residue_padding, otherwise coordinate_indexes are the group_indexes. Unused slots are NaN.
+//
+// Version 1 files have only the first 16 bytes of the header and interleaved positions.
+// Files written before the header was introduced start directly with int32 (chain_length + 1),
+// the magic word can never be mistaken for such a chain length, so all layouts are readable.
+static const char ATOMS_FILE_MAGIC[4] = {'D', 'F', 'A', 'T'};
+static const uint32_t ATOMS_FILE_VERSION = 2;
+static const uint32_t ATOMS_FILE_SEPARATE_COORDINATES = 1;
+static const uint32_t ATOMS_FILE_PADDED_RESIDUES = 2;
+static const uint32_t ATOMS_FILE_REPRESENTATIVE_ATOMS = 4;
+static const uint32_t ATOMS_FILE_FIXED_POSITIONS = 8;
+static const size_t ATOMS_FILE_BLOCK_ALIGNMENT = 64;
+static const int ATOMS_FILE_MAX_RESIDUE_PADDING = 1024;
+
+struct AtomsFileHeader {
+  char magic[4];
+  uint32_t version;
+  int32_t chain_length;
+  int32_t atom_count;
+  uint32_t flags;
+  int32_t coordinate_count;
+  int32_t residue_padding;
+  uint32_t reserved;
+};
+
+static const size_t ATOMS_FILE_V1_HEADER_SIZE = 16;
+static_assert(sizeof(AtomsFileHeader) == 32, "AtomsFileHeader layout must not change");
+
+// Atoms file memory mapped for as long as the object exists, atoms view points into the mapping.
+struct AtomsFile {
+  MappedFile file;
+  AtomsView atoms;
+};
+
+
+// group indexes have to start at 0 or later, never decrease and end exactly at atom_count
+static void ValidateGroupIndexes(const AtomsView& atoms, const int64_t atom_count, const std::string& source) {
+  if (atoms.chain_length < 0)
+    throw std::runtime_error(source + " is corrupted, negative chain length");
+  if (atoms.group_indexes[0] < 0)
+    throw std::runtime_error(source + " is corrupted, negative group index");
+  for (int i = 0; i < atoms.chain_length; ++i) {
+    if (atoms.group_indexes[i + 1] < atoms.group_indexes[i])
+      throw std::runtime_error(source + " is corrupted, group indexes are not sorted");
+  }
+  if (atoms.group_indexes[atoms.chain_length] != atom_count)
+    throw std::runtime_error(source + " is corrupted, group indexes do not match number of atoms");
+}
 
-static void SaveAtomsFile(const np::ndarray &position_array, const np::ndarray &groups_array, const std::string &save_path) {
-  int chain_length = (int) groups_array.shape(0);
-  int* group_indexes = reinterpret_cast<int*>(groups_array.get_data());
-  int atom_count = group_indexes[chain_length - 1];
-  float* atom_positions = reinterpret_cast<float*>(position_array.get_data());
+
+// every representative atom is -1 or an atom of its own residue
+static void ValidateRepresentativeAtoms(const AtomsView& atoms, const std::string& source) {
+  if (atoms.representative_atoms == nullptr)
+    return;
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    for (int k = 0; k < 2; ++k) {
+      const int atom = atoms.representative_atoms[group * 2 + k];
+      if (atom != -1 && (atom < atoms.group_indexes[group] || atom >= atoms.group_indexes[group + 1]))
+        throw std::runtime_error(source + " is corrupted, representative atom is outside of its residue");
+    }
+  }
+}
+
+
+// Positions of a view as interleaved xyz, copied only for views with separate coordinate blocks or fixed point positions.
+static const float* InterleavedPositions(const AtomsView& atoms, std::vector<float>& buffer) {
+  if (atoms.atoms_positions != nullptr)
+    return atoms.atoms_positions;
+  const int atom_count = atoms.group_indexes[atoms.chain_length];
+  if (atoms.fixed_positions != nullptr) {
+    buffer.resize((size_t) atom_count * 3);
+    for (size_t i = 0; i < buffer.size(); ++i)
+      buffer[i] = FixedPositionToAngstrom(atoms.fixed_origin[i % 3], atoms.fixed_positions[i]);
+    return buffer.data();
+  }
+  buffer.assign((size_t) atom_count * 3, 0);
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    for (int atom = atoms.group_indexes[group]; atom < atoms.group_indexes[group + 1]; ++atom) {
+      const int coordinate = atoms.coordinate_indexes[group] + atom - atoms.group_indexes[group];
+      buffer[atom * 3] = atoms.xs[coordinate];
+      buffer[atom * 3 + 1] = atoms.ys[coordinate];
+      buffer[atom * 3 + 2] = atoms.zs[coordinate];
+    }
+  }
+  return buffer.data();
+}
+
+
+// Positions that can not be quantised are written as float32 even if fixed_positions is set,
+// views that already have fixed point positions keep them.
+static void WriteAtomsFile(const AtomsView& atoms, const std::string& save_path, const bool separate_coordinates, const int residue_padding,
+                           const bool fixed_positions = false) {
+  if (residue_padding < 0 || residue_padding > ATOMS_FILE_MAX_RESIDUE_PADDING)
+    throw std::invalid_argument("residue padding must be between 0 and " + std::to_string(ATOMS_FILE_MAX_RESIDUE_PADDING));
+  if (residue_padding > 0 && !separate_coordinates)
+    throw std::invalid_argument("residue padding requires separate coordinates layout");
+  if (fixed_positions && separate_coordinates)
+    throw std::invalid_argument("fixed point positions require interleaved layout");
+  const int chain_length = atoms.chain_length;
+  const int atom_count = atoms.group_indexes[chain_length];
+  std::vector<float> interleaved;
+  const float* positions = atoms.fixed_positions != nullptr && !separate_coordinates ? nullptr : InterleavedPositions(atoms, interleaved);
+  int origin[3];
+  std::vector<int16_t> quantized;
+  const bool fixed = !separate_coordinates &&
+                     (atoms.fixed_positions != nullptr || (fixed_positions && QuantizePositions(positions, atom_count, origin, quantized)));
+  const int* fixed_origin = atoms.fixed_positions != nullptr ? atoms.fixed_origin : origin;
+  const int16_t* fixed_data = atoms.fixed_positions != nullptr ? atoms.fixed_positions : quantized.data();
+
+  AtomsFileHeader header{};
+  std::memcpy(header.magic, ATOMS_FILE_MAGIC, sizeof(header.magic));
+  header.version = ATOMS_FILE_VERSION;
+  header.chain_length = chain_length;
+  header.atom_count = atom_count;
+  const uint32_t representative_flag = atoms.representative_atoms != nullptr ? ATOMS_FILE_REPRESENTATIVE_ATOMS : 0;
+  const std::streamsize representative_size = atoms.representative_atoms != nullptr ? 4 * 2 * (std::streamsize) chain_length : 0;
 
   std::ofstream writer(save_path, std::ios::out | std::ios::binary);
-  writer.write(reinterpret_cast<const char*>(&chain_length), 4);
-  writer.write(reinterpret_cast<const char*>(group_indexes), 4 * chain_length);
-  writer.write(reinterpret_cast<const char*>(atom_positions), 4 * atom_count * 3);
+  if (!separate_coordinates) {
+    header.flags = representative_flag | (fixed ? ATOMS_FILE_FIXED_POSITIONS : 0);
+    writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writer.write(reinterpret_cast<const char*>(atoms.group_indexes), 4 * (chain_length + 1));
+    writer.write(reinterpret_cast<const char*>(atoms.representative_atoms), representative_size);
+    if (fixed) {
+      writer.write(reinterpret_cast<const char*>(fixed_origin), 4 * 3);
+      writer.write(reinterpret_cast<const char*>(fixed_data), 2 * (std::streamsize) atom_count * 3);
+    } else {
+      writer.write(reinterpret_cast<const char*>(positions), 4 * (std::streamsize) atom_count * 3);
+    }
+  } else {
+    std::vector<int> coordinate_indexes(atoms.group_indexes, atoms.group_indexes + chain_length + 1);
+    if (residue_padding > 0) {
+      coordinate_indexes[0] = 0;
+      for (int group = 0; group < chain_length; ++group) {
+        const int group_size = atoms.group_indexes[group + 1] - atoms.group_indexes[group];
+        coordinate_indexes[group + 1] = coordinate_indexes[group] + (group_size + residue_padding - 1) / residue_padding * residue_padding;
+      }
+    }
+    const int coordinate_count = (coordinate_indexes[chain_length] + 15) / 16 * 16;
+    header.flags = ATOMS_FILE_SEPARATE_COORDINATES | (residue_padding > 0 ? ATOMS_FILE_PADDED_RESIDUES : 0) | representative_flag;
+    header.coordinate_count = coordinate_count;
+    header.residue_padding = residue_padding;
+
+    std::vector<float> blocks((size_t) coordinate_count * 3, std::numeric_limits<float>::quiet_NaN());
+    for (int group = 0; group < chain_length; ++group) {
+      for (int atom = atoms.group_indexes[group]; atom < atoms.group_indexes[group + 1]; ++atom) {
+        const int coordinate = coordinate_indexes[group] + atom - atoms.group_indexes[group];
+        for (int k = 0; k < 3; ++k)
+          blocks[(size_t) k * coordinate_count + coordinate] = positions[atom * 3 + k];
+      }
+    }
+
+    size_t offset = sizeof(header) + 4 * (chain_length + 1);
+    writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writer.write(reinterpret_cast<const char*>(atoms.group_indexes), 4 * (chain_length + 1));
+    if (residue_padding > 0) {
+      writer.write(reinterpret_cast<const char*>(coordinate_indexes.data()), 4 * (chain_length + 1));
+      offset += 4 * (chain_length + 1);
+    }
+    writer.write(reinterpret_cast<const char*>(atoms.representative_atoms), representative_size);
+    offset += representative_size;
+    const std::vector<char> zeros((ATOMS_FILE_BLOCK_ALIGNMENT - offset % ATOMS_FILE_BLOCK_ALIGNMENT) % ATOMS_FILE_BLOCK_ALIGNMENT, 0);
+    writer.write(zeros.data(), (std::streamsize) zeros.size());
+    writer.write(reinterpret_cast<const char*>(blocks.data()), (std::streamsize) (sizeof(float) * blocks.size()));
+  }
   writer.close();
+  if (!writer)
+    throw std::runtime_error("Unable to write " + save_path);
 }
 
 
-static std::tuple<int, int*, float*> LoadAtomsFile(const std::string& file_path){
-  std::ifstream reader(file_path, std::ios::in | std::ios::binary);
+// Maps the file instead of copying it. Size of every section is checked against the file size,
+// so truncated or corrupted files raise an error instead of producing garbage contacts.
+static AtomsFile LoadAtomsFile(const std::string& file_path){
+  EngineStageTimer timer(EngineCounter::LOAD_NS);
+  AtomsFile atoms_file{MappedFile(file_path), AtomsView{}};
+  CountEngineEvent(EngineCounter::BYTES_READ, atoms_file.file.Size());
+  AtomsView& atoms = atoms_file.atoms;
+  const char* data = atoms_file.file.Data();
+  const size_t file_size = atoms_file.file.Size();
 
-  int chain_length;
-  reader.read(reinterpret_cast<char*>(&chain_length), 4);
+  AtomsFileHeader header{};
+  size_t groups_offset;
+  int64_t atom_count;
+  if (file_size >= ATOMS_FILE_V1_HEADER_SIZE && std::memcmp(data, ATOMS_FILE_MAGIC, sizeof(ATOMS_FILE_MAGIC)) == 0) {
+    std::memcpy(&header, data, ATOMS_FILE_V1_HEADER_SIZE);
+    if (header.version == 1) {
+      groups_offset = ATOMS_FILE_V1_HEADER_SIZE;
+    } else if (header.version == ATOMS_FILE_VERSION) {
+      if (file_size < sizeof(AtomsFileHeader))
+        throw std::runtime_error(file_path + " is truncated, header is missing");
+      std::memcpy(&header, data, sizeof(AtomsFileHeader));
+      groups_offset = sizeof(AtomsFileHeader);
+    } else {
+      throw std::runtime_error(file_path + " has unsupported atoms file version " + std::to_string(header.version));
+    }
+    if (header.chain_length < 0 || header.atom_count < 0)
+      throw std::runtime_error(file_path + " is corrupted, negative chain length or atom count");
+    const uint32_t known_flags = ATOMS_FILE_SEPARATE_COORDINATES | ATOMS_FILE_PADDED_RESIDUES | ATOMS_FILE_REPRESENTATIVE_ATOMS | ATOMS_FILE_FIXED_POSITIONS;
+    if ((header.flags & ~known_flags) != 0 ||
+        ((header.flags & ATOMS_FILE_PADDED_RESIDUES) && !(header.flags & ATOMS_FILE_SEPARATE_COORDINATES)) ||
+        ((header.flags & ATOMS_FILE_FIXED_POSITIONS) && (header.flags & ATOMS_FILE_SEPARATE_COORDINATES)))
+      throw std::runtime_error(file_path + " has unsupported atoms file flags " + std::to_string(header.flags));
+    atoms.chain_length = header.chain_length;
+    atom_count = header.atom_count;
+  } else {
+    // legacy layout without header
+    if (file_size < sizeof(int32_t))
+      throw std::runtime_error(file_path + " is too short to be an atoms file");
+    int32_t stored_chain_length;
+    std::memcpy(&stored_chain_length, data, sizeof(int32_t));
+    if (stored_chain_length < 1)
+      throw std::runtime_error(file_path + " is corrupted, invalid chain length");
+    atoms.chain_length = stored_chain_length - 1;
+    groups_offset = sizeof(int32_t);
+    atom_count = -1;
+  }
+
+  const size_t groups_size = sizeof(int32_t) * ((size_t) atoms.chain_length + 1);
+  if (file_size - groups_offset < groups_size)
+    throw std::runtime_error(file_path + " is truncated, group indexes are missing");
+  atoms.group_indexes = reinterpret_cast<const int*>(data + groups_offset);
+  if (atom_count < 0)
+    atom_count = atoms.group_indexes[atoms.chain_length];
+  ValidateGroupIndexes(atoms, atom_count, file_path);
 
-  int* group_indexes = new int[chain_length];
-  reader.read(reinterpret_cast<char*>(group_indexes), 4 * chain_length);
+  size_t positions_offset = groups_offset + groups_size;
+  // representative atoms follow coordinate indexes, if there are any
+  auto read_representative_atoms = [&]() {
+    if (!(header.flags & ATOMS_FILE_REPRESENTATIVE_ATOMS))
+      return;
+    const size_t representative_size = sizeof(int32_t) * 2 * (size_t) atoms.chain_length;
+    if (file_size - positions_offset < representative_size)
+      throw std::runtime_error(file_path + " is truncated, representative atoms are missing");
+    atoms.representative_atoms = reinterpret_cast<const int*>(data + positions_offset);
+    positions_offset += representative_size;
+    ValidateRepresentativeAtoms(atoms, file_path);
+  };
+  if (!(header.flags & ATOMS_FILE_SEPARATE_COORDINATES)) {
+    read_representative_atoms();
+    if (header.flags & ATOMS_FILE_FIXED_POSITIONS) {
+      if (file_size - positions_offset < sizeof(int32_t) * 3 ||
+          (file_size - positions_offset - sizeof(int32_t) * 3) / (sizeof(int16_t) * 3) < (size_t) atom_count)
+        throw std::runtime_error(file_path + " is truncated, atom positions are missing");
+      atoms.fixed_origin = reinterpret_cast<const int*>(data + positions_offset);
+      atoms.fixed_positions = reinterpret_cast<const int16_t*>(data + positions_offset + sizeof(int32_t) * 3);
+      return atoms_file;
+    }
+    if ((file_size - positions_offset) / (sizeof(float) * 3) < (size_t) atom_count)
+      throw std::runtime_error(file_path + " is truncated, atom positions are missing");
+    atoms.atoms_positions = reinterpret_cast<const float*>(data + positions_offset);
+    return atoms_file;
+  }
 
-  chain_length--;
-  int atom_count = group_indexes[chain_length];
+  atoms.coordinate_indexes = atoms.group_indexes;
+  if (header.flags & ATOMS_FILE_PADDED_RESIDUES) {
+    if (file_size - positions_offset < groups_size)
+      throw std::runtime_error(file_path + " is truncated, coordinate indexes are missing");
+    atoms.coordinate_indexes = reinterpret_cast<const int*>(data + positions_offset);
+    positions_offset += groups_size;
+  }
+  read_representative_atoms();
+  if (atoms.coordinate_indexes[0] < 0 || atoms.coordinate_indexes[atoms.chain_length] > header.coordinate_count)
+    throw std::runtime_error(file_path + " is corrupted, coordinate indexes do not match coordinate count");
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    if (atoms.coordinate_indexes[group + 1] - atoms.coordinate_indexes[group] < atoms.group_indexes[group + 1] - atoms.group_indexes[group])
+      throw std::runtime_error(file_path + " is corrupted, residue does not fit into its coordinate slots");
+  }
 
-  float* atoms_positions = new float[atom_count * 3];
-  reader.read(reinterpret_cast<char*>(atoms_positions), 4 * atom_count * 3);
-  reader.close();
+  positions_offset = (positions_offset + ATOMS_FILE_BLOCK_ALIGNMENT - 1) / ATOMS_FILE_BLOCK_ALIGNMENT * ATOMS_FILE_BLOCK_ALIGNMENT;
+  if (positions_offset > file_size || (file_size - positions_offset) / (sizeof(float) * 3) < (size_t) header.coordinate_count)
+    throw std::runtime_error(file_path + " is truncated, atom coordinates are missing");
+  atoms.xs = reinterpret_cast<const float*>(data + positions_offset);
+  atoms.ys = atoms.xs + header.coordinate_count;
+  atoms.zs = atoms.ys + header.coordinate_count;
 
-  return std::make_tuple(chain_length, group_indexes, atoms_positions);
+  // contact search streams whole slot ranges of residues, it relies on unused slots never matching
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    const int used_end = atoms.coordinate_indexes[group] + atoms.group_indexes[group + 1] - atoms.group_indexes[group];
+    for (int slot = used_end; slot < atoms.coordinate_indexes[group + 1]; ++slot) {
+      if (!std::isnan(atoms.xs[slot]))
+        throw std::runtime_error(file_path + " is corrupted, residue padding is not NaN");
+    }
+  }
+  return atoms_file;
 }
 
 #endif
@@ -0,0 +1,60 @@
+#ifndef ATOMS_FILE_IO_PYTHON
+#define ATOMS_FILE_IO_PYTHON
+
+#include <boost/python.hpp>
+#include <boost/python/numpy.hpp>
+#include <stdexcept>
+#include <string>
+
+#include "atoms_file_io.h"
+#include "python_utils.h"
+
+// numpy arrays of python as atoms views, see atoms_file_io.h
+
+// positions array of shape (atom_count, 3) and groups array of residue start indexes ending with atom_count,
+// optional representative atoms array of shape (chain_length, 2)
+static AtomsView AtomsViewFromArrays(const np::ndarray &position_array, const np::ndarray &groups_array,
+                                     const py::object& representative_atoms_array = py::object()) {
+  if (groups_array.get_dtype() != np::dtype::get_builtin<int>() || position_array.get_dtype() != np::dtype::get_builtin<float>())
+    throw std::invalid_argument("groups array must be int32 and positions array must be float32");
+  if (groups_array.get_nd() != 1 || groups_array.shape(0) < 1)
+    throw std::invalid_argument("groups array must end with the number of atoms");
+  if (!(groups_array.get_flags() & np::ndarray::C_CONTIGUOUS) || !(position_array.get_flags() & np::ndarray::C_CONTIGUOUS))
+    throw std::invalid_argument("groups and positions arrays must be C contiguous");
+
+  AtomsView atoms{};
+  atoms.chain_length = (int) groups_array.shape(0) - 1;
+  atoms.group_indexes = reinterpret_cast<const int*>(groups_array.get_data());
+  atoms.atoms_positions = reinterpret_cast<const float*>(position_array.get_data());
+  if (position_array.get_nd() != 2 || position_array.shape(1) != 3 || position_array.shape(0) < atoms.group_indexes[atoms.chain_length])
+    throw std::invalid_argument("positions array must have shape (number of atoms, 3)");
+  ValidateGroupIndexes(atoms, atoms.group_indexes[atoms.chain_length], "groups array");
+
+  if (!representative_atoms_array.is_none()) {
+    const np::ndarray representative_atoms = py::extract<np::ndarray>(representative_atoms_array);
+    if (representative_atoms.get_dtype() != np::dtype::get_builtin<int>() || representative_atoms.get_nd() != 2 ||
+        representative_atoms.shape(0) != atoms.chain_length || representative_atoms.shape(1) != 2 ||
+        !(representative_atoms.get_flags() & np::ndarray::C_CONTIGUOUS))
+      throw std::invalid_argument("representative atoms array must be C contiguous int32 of shape (chain length, 2)");
+    atoms.representative_atoms = reinterpret_cast<const int*>(representative_atoms.get_data());
+    try {
+      ValidateRepresentativeAtoms(atoms, "representative atoms array");
+    } catch (const std::runtime_error& error) {
+      throw std::invalid_argument(error.what());
+    }
+  }
+  return atoms;
+}
+
+
+// separate_coordinates writes x, y, z blocks, residue_padding > 0 additionally starts every residue at a multiple of it
+// representative_atoms are alpha and beta carbon atom indexes of every residue, None if atom names are unknown
+// fixed_positions stores int16 positions at 0.01 Å resolution instead of float32
+static void SaveAtomsFile(const np::ndarray &position_array, const np::ndarray &groups_array, const std::string &save_path,
+                          const bool separate_coordinates, const int residue_padding, const py::object& representative_atoms,
+                          const bool fixed_positions) {
+  WriteAtomsFile(AtomsViewFromArrays(position_array, groups_array, representative_atoms), save_path, separate_coordinates, residue_padding,
+                 fixed_positions);
+}
+
+#endif
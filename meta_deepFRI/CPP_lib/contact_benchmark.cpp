@@ -0,0 +1,387 @@
+// Contact engine benchmarks, built with cmake -DDEEPFRI_BUILD_BENCHMARKS=ON:
+//   ContactBenchmark [google benchmark flags] [--threshold=6] [atoms files (.bin) ...]
+// Synthetic structures over a range of chain lengths and atom densities are written as atoms files,
+// real atoms files given on the command line are benchmarked next to them. Loading, contacts and projection are timed separately.
+// Every engine variant is checked against the brute force engine first, a variant that differs reports an error instead of timings
+// and the benchmark exits with status 1. Sequence alignment kernels are checked against the scalar kernel the same way.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "atoms_file_io.h"
+#include "contact_engine.h"
+#include "contact_maps.h"
+#include "contact_projection.h"
+#include "sequence_alignment.h"
+#include "thread_pool.h"
+
+struct BenchmarkStructure {
+  std::string name;
+  std::vector<int> group_indexes;
+  std::vector<float> positions;
+  std::vector<float> xs, ys, zs;
+  SparseContacts reference;
+  std::string interleaved_path;
+  std::string separate_path;
+
+  int ChainLength() const {
+    return (int) group_indexes.size() - 1;
+  }
+
+  AtomsView View() const {
+    return AtomsView{ChainLength(), group_indexes.data(), positions.data(), nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+  }
+
+  AtomsCoordinates Coordinates() const {
+    return AtomsCoordinates{ChainLength(), group_indexes.data(), group_indexes.data(), xs.data(), ys.data(), zs.data()};
+  }
+};
+
+
+// Random walk of 3.8 Å steps, the alpha carbon distance, kept inside a sphere of the size of a globular protein of that length.
+// Other atoms of a residue are scattered within 2 Å of its alpha carbon.
+static void GenerateStructure(BenchmarkStructure& structure, const int chain_length, const int atoms_per_residue, const unsigned seed) {
+  std::mt19937 random(seed);
+  std::normal_distribution<float> normal(0, 1);
+  std::uniform_real_distribution<float> uniform(-1, 1);
+  const float radius = 2.2f * std::pow((float) chain_length, 0.38f) * 1.3f + 4;
+
+  float position[3] = {0, 0, 0};
+  structure.group_indexes.assign(1, 0);
+  for (int residue = 0; residue < chain_length; ++residue) {
+    for (int attempt = 0; attempt < 100; ++attempt) {
+      float step[3] = {normal(random), normal(random), normal(random)};
+      const float length = std::sqrt(step[0] * step[0] + step[1] * step[1] + step[2] * step[2]) + 1e-6f;
+      float next[3];
+      for (int axis = 0; axis < 3; ++axis)
+        next[axis] = position[axis] + step[axis] / length * 3.8f;
+      if (next[0] * next[0] + next[1] * next[1] + next[2] * next[2] <= radius * radius || attempt == 99) {
+        std::copy(next, next + 3, position);
+        break;
+      }
+    }
+    structure.positions.insert(structure.positions.end(), position, position + 3);
+    for (int atom = 1; atom < atoms_per_residue; ++atom) {
+      float offset[3];
+      do {
+        for (float& value : offset)
+          value = uniform(random) * 2;
+      } while (offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2] > 4);
+      for (int axis = 0; axis < 3; ++axis)
+        structure.positions.push_back(position[axis] + offset[axis]);
+    }
+    structure.group_indexes.push_back(structure.group_indexes.back() + atoms_per_residue);
+  }
+}
+
+
+static void PrepareStructure(BenchmarkStructure& structure, const std::filesystem::path& directory, const float angstrom_contact_threshold) {
+  const int atom_count = structure.group_indexes.back();
+  structure.xs.resize(atom_count);
+  structure.ys.resize(atom_count);
+  structure.zs.resize(atom_count);
+  for (int atom = 0; atom < atom_count; ++atom) {
+    structure.xs[atom] = structure.positions[atom * 3];
+    structure.ys[atom] = structure.positions[atom * 3 + 1];
+    structure.zs[atom] = structure.positions[atom * 3 + 2];
+  }
+  structure.reference = BruteForceSparseContacts(structure.ChainLength(), structure.group_indexes.data(), structure.positions.data(),
+                                                 angstrom_contact_threshold);
+  structure.interleaved_path = (directory / (structure.name + ".bin")).string();
+  structure.separate_path = (directory / (structure.name + "_separate.bin")).string();
+  WriteAtomsFile(structure.View(), structure.interleaved_path, false, 0);
+  WriteAtomsFile(structure.View(), structure.separate_path, true, 8);
+}
+
+
+static void LoadRealStructure(BenchmarkStructure& structure, const std::string& file_path) {
+  const AtomsFile atoms_file = LoadAtomsFile(file_path);
+  const AtomsView& atoms = atoms_file.atoms;
+  std::vector<float> buffer;
+  const float* positions = InterleavedPositions(atoms, buffer);
+  const int atom_count = atoms.group_indexes[atoms.chain_length];
+  structure.name = std::filesystem::path(file_path).stem().string();
+  structure.group_indexes.assign(atoms.group_indexes, atoms.group_indexes + atoms.chain_length + 1);
+  structure.positions.assign(positions, positions + (size_t) atom_count * 3);
+}
+
+
+// set by a variant that differs from its reference, the benchmark then exits with an error
+static std::atomic<bool> verification_failed(false);
+
+
+static bool CheckContacts(benchmark::State& state, const SparseContacts& contacts, const SparseContacts& reference) {
+  if (contacts == reference)
+    return true;
+  verification_failed = true;
+  state.SkipWithError("contacts differ from the brute force engine");
+  return false;
+}
+
+
+static void SetStructureCounters(benchmark::State& state, const BenchmarkStructure& structure) {
+  state.counters["residues"] = structure.ChainLength();
+  state.counters["atoms"] = structure.group_indexes.back();
+  state.counters["contacts"] = (double) structure.reference.size();
+  state.SetItemsProcessed((int64_t) state.iterations() * structure.ChainLength());
+}
+
+
+// Query of the same length as the target with every tenth target residue deleted and every tenth query residue inserted.
+static ResidueMapping BenchmarkMapping(const int target_length) {
+  std::string query_alignment, target_alignment;
+  for (int residue = 0; residue < target_length; ++residue) {
+    query_alignment.push_back(residue % 10 == 3 ? '-' : 'A');
+    target_alignment.push_back('A');
+    if (residue % 10 == 7) {
+      query_alignment.push_back('A');
+      target_alignment.push_back('-');
+    }
+  }
+  return MappingFromAlignment(query_alignment, target_alignment);
+}
+
+
+// straightforward projection of target contacts, the reference of the projection benchmark
+static std::vector<bool> ReferenceProjection(const ResidueMapping& mapping, const SparseContacts& target_contacts, const int generated_contacts) {
+  const int size = mapping.query_length;
+  std::vector<bool> dense((size_t) size * size, false);
+  const auto set = [&](const int a, const int b) {
+    dense[(size_t) a * size + b] = true;
+    dense[(size_t) b * size + a] = true;
+  };
+  for (int i = 0; i < size; ++i)
+    set(i, i);
+  for (const int residue : mapping.gapped_query_residues) {
+    for (int j = std::max(residue - generated_contacts, 0); j <= std::min(residue + generated_contacts, size - 1); ++j)
+      set(residue, j);
+  }
+  for (std::pair<int, int> contact : target_contacts) {
+    const int a = mapping.target_to_query[contact.first];
+    const int b = mapping.target_to_query[contact.second];
+    if (a >= 0 && b >= 0)
+      set(a, b);
+  }
+  return dense;
+}
+
+
+static void RegisterStructureBenchmarks(const std::shared_ptr<BenchmarkStructure>& structure, const float angstrom_contact_threshold) {
+  const std::string prefix = structure->name + "/";
+  const bool has_files = !structure->interleaved_path.empty();
+
+  if (has_files) {
+    for (const bool separate : {false, true}) {
+      benchmark::RegisterBenchmark((prefix + (separate ? "load/separate" : "load/interleaved")).c_str(), [structure, separate](benchmark::State& state) {
+        const std::string& path = separate ? structure->separate_path : structure->interleaved_path;
+        for (auto _ : state) {
+          AtomsFile atoms_file = LoadAtomsFile(path);
+          benchmark::DoNotOptimize(atoms_file.atoms.group_indexes);
+        }
+        SetStructureCounters(state, *structure);
+      });
+    }
+  }
+
+  benchmark::RegisterBenchmark((prefix + "contacts/brute_force").c_str(), [structure, angstrom_contact_threshold](benchmark::State& state) {
+    for (auto _ : state) {
+      SparseContacts contacts = BruteForceSparseContacts(structure->ChainLength(), structure->group_indexes.data(), structure->positions.data(),
+                                                         angstrom_contact_threshold);
+      benchmark::DoNotOptimize(contacts.data());
+    }
+    SetStructureCounters(state, *structure);
+  });
+
+  for (const std::pair<const char*, FindContactKernel>& kernel : AvailableFindContactKernels()) {
+    benchmark::RegisterBenchmark((prefix + "contacts/grid_" + kernel.first).c_str(), [structure, angstrom_contact_threshold, kernel](benchmark::State& state) {
+      if (!CheckContacts(state, ComputeSparseContacts(structure->Coordinates(), angstrom_contact_threshold, kernel.second), structure->reference))
+        return;
+      for (auto _ : state) {
+        SparseContacts contacts = ComputeSparseContacts(structure->Coordinates(), angstrom_contact_threshold, kernel.second);
+        benchmark::DoNotOptimize(contacts.data());
+      }
+      SetStructureCounters(state, *structure);
+    });
+  }
+
+  // pipeline entry point, interleaved positions are copied into separate arrays on every call
+  benchmark::RegisterBenchmark((prefix + "contacts/interleaved").c_str(), [structure, angstrom_contact_threshold](benchmark::State& state) {
+    const int chain_length = structure->ChainLength();
+    const int* group_indexes = structure->group_indexes.data();
+    const float* positions = structure->positions.data();
+    if (!CheckContacts(state, ComputeSparseContacts(chain_length, group_indexes, positions, angstrom_contact_threshold), structure->reference))
+      return;
+    for (auto _ : state) {
+      SparseContacts contacts = ComputeSparseContacts(chain_length, group_indexes, positions, angstrom_contact_threshold);
+      benchmark::DoNotOptimize(contacts.data());
+    }
+    SetStructureCounters(state, *structure);
+  });
+
+  benchmark::RegisterBenchmark((prefix + "projection/dense").c_str(), [structure](benchmark::State& state) {
+    const int generated_contacts = 2;
+    const ResidueMapping mapping = BenchmarkMapping(structure->ChainLength());
+    const std::vector<bool> reference = ReferenceProjection(mapping, structure->reference, generated_contacts);
+    SparseContacts projected;
+    const int query_length = ProjectContacts(mapping, structure->reference, generated_contacts, ContactBoundsPolicy::SKIP, projected);
+    std::pair<bool*, int> contact_map = DenseFromAlignedContacts(projected, query_length);
+    const bool same = std::equal(reference.begin(), reference.end(), contact_map.first);
+    delete[] contact_map.first;
+    if (!same) {
+      verification_failed = true;
+      state.SkipWithError("projected contact map differs from the reference projection");
+      return;
+    }
+    for (auto _ : state) {
+      ProjectContacts(mapping, structure->reference, generated_contacts, ContactBoundsPolicy::SKIP, projected);
+      contact_map = DenseFromAlignedContacts(projected, query_length);
+      benchmark::DoNotOptimize(contact_map.first);
+      delete[] contact_map.first;
+    }
+    SetStructureCounters(state, *structure);
+  });
+}
+
+
+// homologous pair of random protein sequences, a few percent of residues substituted, deleted or inserted
+static std::pair<std::string, std::string> GenerateSequencePair(const int length, const unsigned seed) {
+  static const char amino_acids[] = "ACDEFGHIKLMNPQRSTVWY";
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<int> residue(0, 19);
+  std::uniform_int_distribution<int> edit(0, 99);
+  std::string query, target;
+  for (int i = 0; i < length; ++i) {
+    const char amino_acid = amino_acids[residue(generator)];
+    query.push_back(amino_acid);
+    const int kind = edit(generator);
+    if (kind < 20)
+      target.push_back(amino_acids[residue(generator)]);
+    else if (kind < 23)
+      continue;
+    else
+      target.push_back(amino_acid);
+    if (kind >= 97)
+      target.push_back(amino_acids[residue(generator)]);
+  }
+  return {query, target};
+}
+
+
+static bool SameAlignment(const SequenceAlignment& alignment, const SequenceAlignment& reference) {
+  return alignment.score == reference.score && alignment.identity == reference.identity && FormatCigar(alignment.runs) == FormatCigar(reference.runs);
+}
+
+
+static void RegisterAlignmentBenchmarks() {
+  const AlignmentScoring scoring{2, -1, -0.5, -0.1};
+  unsigned seed = 1;
+  for (const int length : {100, 300, 1000, 2500}) {
+    const auto sequences = std::make_shared<std::pair<std::string, std::string>>(GenerateSequencePair(length, seed++));
+    const auto reference = std::make_shared<SequenceAlignment>(AlignSequences(sequences->first, sequences->second, scoring, false,
+                                                                              AlignAntiDiagonalScalar));
+    for (const std::pair<const char*, AlignAntiDiagonalKernel>& kernel : AvailableAlignAntiDiagonalKernels()) {
+      const std::string name = "alignment_" + std::to_string(length) + "/" + kernel.first;
+      benchmark::RegisterBenchmark(name.c_str(), [sequences, reference, scoring, kernel](benchmark::State& state) {
+        if (!SameAlignment(AlignSequences(sequences->first, sequences->second, scoring, false, kernel.second), *reference)) {
+          verification_failed = true;
+          state.SkipWithError("alignment differs from the scalar kernel");
+          return;
+        }
+        for (auto _ : state) {
+          SequenceAlignment alignment = AlignSequences(sequences->first, sequences->second, scoring, false, kernel.second);
+          benchmark::DoNotOptimize(alignment.score);
+        }
+        state.counters["cells"] = (double) (sequences->first.size() + 1) * (sequences->second.size() + 1);
+        state.SetItemsProcessed((int64_t) state.iterations() * (int64_t) (sequences->first.size() + 1) * (int64_t) (sequences->second.size() + 1));
+      });
+    }
+  }
+}
+
+
+// contacts of all structures at once, one structure per task of the thread pool
+static void RegisterThreadedBenchmark(const std::vector<std::shared_ptr<BenchmarkStructure>>& structures, const float angstrom_contact_threshold) {
+  benchmark::RegisterBenchmark("all/contacts/threaded", [structures, angstrom_contact_threshold](benchmark::State& state) {
+    WorkStealingPool pool((int) state.range(0));
+    std::vector<SparseContacts> contacts(structures.size());
+    const auto compute = [&]() {
+      for (size_t i = 0; i < structures.size(); ++i) {
+        pool.Submit([&, i]() {
+          const BenchmarkStructure& structure = *structures[i];
+          contacts[i] = ComputeSparseContacts(structure.ChainLength(), structure.group_indexes.data(), structure.positions.data(),
+                                              angstrom_contact_threshold);
+        });
+      }
+      pool.Wait();
+    };
+    compute();
+    for (size_t i = 0; i < structures.size(); ++i) {
+      if (!CheckContacts(state, contacts[i], structures[i]->reference))
+        return;
+    }
+    int64_t residues = 0;
+    for (const auto& structure : structures)
+      residues += structure->ChainLength();
+    for (auto _ : state)
+      compute();
+    state.SetItemsProcessed((int64_t) state.iterations() * residues);
+  })->RangeMultiplier(2)->Range(1, (int) std::max(std::thread::hardware_concurrency(), 1u))->UseRealTime();
+}
+
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  float angstrom_contact_threshold = 6;
+  std::vector<std::string> atoms_files;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--threshold=", 12) == 0)
+      angstrom_contact_threshold = std::stof(argv[i] + 12);
+    else
+      atoms_files.emplace_back(argv[i]);
+  }
+
+  const std::filesystem::path directory = std::filesystem::temp_directory_path() / "deepfri_contact_benchmark";
+  std::filesystem::create_directories(directory);
+
+  std::vector<std::shared_ptr<BenchmarkStructure>> structures;
+  unsigned seed = 1;
+  for (const int chain_length : {100, 300, 1000, 2500}) {
+    for (const int atoms_per_residue : {4, 8, 14}) {
+      auto structure = std::make_shared<BenchmarkStructure>();
+      structure->name = "synthetic_" + std::to_string(chain_length) + "x" + std::to_string(atoms_per_residue);
+      GenerateStructure(*structure, chain_length, atoms_per_residue, seed++);
+      structures.push_back(structure);
+    }
+  }
+  for (const std::string& file_path : atoms_files) {
+    auto structure = std::make_shared<BenchmarkStructure>();
+    LoadRealStructure(*structure, file_path);
+    structures.push_back(structure);
+  }
+
+  std::cerr << "Computing brute force contacts of " << structures.size() << " structures, distance kernel " << FindContactKernelName() << std::endl;
+  for (const auto& structure : structures)
+    PrepareStructure(*structure, directory, angstrom_contact_threshold);
+  for (const auto& structure : structures)
+    RegisterStructureBenchmarks(structure, angstrom_contact_threshold);
+  RegisterThreadedBenchmark(structures, angstrom_contact_threshold);
+  std::cerr << "Alignment kernel " << AlignAntiDiagonalKernelName() << std::endl;
+  RegisterAlignmentBenchmarks();
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  std::filesystem::remove_all(directory);
+  return verification_failed ? 1 : 0;
+}
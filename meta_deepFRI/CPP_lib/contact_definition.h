@@ -0,0 +1,133 @@
+#ifndef CONTACT_DEFINITION
+#define CONTACT_DEFINITION
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "atoms_file_io.h"
+#include "contact_engine.h"
+#include "contact_map_cache.h"
+#include "engine_stats.h"
+
+// Residues are in contact if
+//   ALL_ATOMS  any pair of their atoms is within the threshold
+//   CA         their alpha carbons are within the threshold, like contact maps DeepFRI was trained on
+//   CB         their beta carbons are within the threshold, glycine has no beta carbon and uses its alpha carbon
+// Single atom definitions need representative atoms of every residue (AtomsView::representative_atoms),
+// residues without the atom never get contacts.
+enum class ContactDefinition { ALL_ATOMS = 0, CA = 1, CB = 2 };
+
+inline std::atomic<ContactDefinition>& GlobalContactDefinition() {
+  static std::atomic<ContactDefinition> definition(ContactDefinition::ALL_ATOMS);
+  return definition;
+}
+
+
+// slot of an atom name inside representative_atoms pairs, -1 for other atoms
+static int RepresentativeAtomSlot(const std::string_view atom_name) {
+  if (atom_name == "CA")
+    return 0;
+  if (atom_name == "CB")
+    return 1;
+  return -1;
+}
+
+
+// Fills representative_atoms pairs of residues [0, chain_length) from per atom slots, first matching atom of a residue wins.
+static std::vector<int> RepresentativeAtoms(const int chain_length, const int* group_indexes, const std::vector<signed char>& atom_slots) {
+  std::vector<int> representative_atoms((size_t) chain_length * 2, -1);
+  for (int group = 0; group < chain_length; ++group) {
+    for (int atom = group_indexes[group + 1] - 1; atom >= group_indexes[group]; --atom) {
+      if (atom_slots[atom] >= 0)
+        representative_atoms[group * 2 + atom_slots[atom]] = atom;
+    }
+  }
+  return representative_atoms;
+}
+
+
+// atom representing the residue in single atom definitions, -1 if it has none
+static int RepresentativeAtom(const AtomsView& atoms, const int group, const ContactDefinition definition) {
+  const int ca = atoms.representative_atoms[group * 2];
+  const int cb = atoms.representative_atoms[group * 2 + 1];
+  return definition == ContactDefinition::CB && cb >= 0 ? cb : ca;
+}
+
+
+// ALL_ATOMS definition, picks the contact engine entry point matching the layout of the atoms file
+static SparseContacts ComputeSparseContacts(const AtomsView& atoms, const float angstrom_contact_threshold) {
+  if (atoms.fixed_positions != nullptr)
+    return ComputeSparseContacts(atoms.chain_length, atoms.group_indexes, atoms.fixed_positions, angstrom_contact_threshold);
+  if (atoms.atoms_positions != nullptr)
+    return ComputeSparseContacts(atoms.chain_length, atoms.group_indexes, atoms.atoms_positions, angstrom_contact_threshold);
+  const AtomsCoordinates coordinates{atoms.chain_length, atoms.group_indexes, atoms.coordinate_indexes, atoms.xs, atoms.ys, atoms.zs};
+  return ComputeSparseContacts(coordinates, angstrom_contact_threshold);
+}
+
+
+// Single atom definitions run the same grid engine over one atom per residue, residues without the atom are left empty.
+static SparseContacts ComputeSparseContacts(const AtomsView& atoms, const float angstrom_contact_threshold, const ContactDefinition definition) {
+  EngineStageTimer timer(EngineCounter::CONTACT_NS);
+  if (definition == ContactDefinition::ALL_ATOMS)
+    return ComputeSparseContacts(atoms, angstrom_contact_threshold);
+  if (atoms.representative_atoms == nullptr)
+    throw std::runtime_error("Structure has no representative atoms for CA or CB contacts, process its structure file again");
+
+  std::vector<int> group_indexes(1, 0);
+  std::vector<float> xs, ys, zs;
+  std::vector<int16_t> fixed_positions;
+  group_indexes.reserve(atoms.chain_length + 1);
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    const int atom = RepresentativeAtom(atoms, group, definition);
+    if (atom >= 0) {
+      if (atoms.fixed_positions != nullptr) {
+        fixed_positions.insert(fixed_positions.end(), atoms.fixed_positions + atom * 3, atoms.fixed_positions + atom * 3 + 3);
+      } else if (atoms.atoms_positions != nullptr) {
+        xs.push_back(atoms.atoms_positions[atom * 3]);
+        ys.push_back(atoms.atoms_positions[atom * 3 + 1]);
+        zs.push_back(atoms.atoms_positions[atom * 3 + 2]);
+      } else {
+        const int coordinate = atoms.coordinate_indexes[group] + atom - atoms.group_indexes[group];
+        xs.push_back(atoms.xs[coordinate]);
+        ys.push_back(atoms.ys[coordinate]);
+        zs.push_back(atoms.zs[coordinate]);
+      }
+    }
+    group_indexes.push_back(atoms.fixed_positions != nullptr ? (int) fixed_positions.size() / 3 : (int) xs.size());
+  }
+  if (atoms.fixed_positions != nullptr)
+    return ComputeSparseContacts(atoms.chain_length, group_indexes.data(), fixed_positions.data(), angstrom_contact_threshold);
+  const AtomsCoordinates coordinates{atoms.chain_length, group_indexes.data(), group_indexes.data(), xs.data(), ys.data(), zs.data()};
+  return ComputeSparseContacts(coordinates, angstrom_contact_threshold);
+}
+
+
+// python interface
+
+static void SetContactDefinition(const std::string& definition) {
+  if (definition == "ALL_ATOMS")
+    GlobalContactDefinition().store(ContactDefinition::ALL_ATOMS);
+  else if (definition == "CA")
+    GlobalContactDefinition().store(ContactDefinition::CA);
+  else if (definition == "CB")
+    GlobalContactDefinition().store(ContactDefinition::CB);
+  else
+    throw std::invalid_argument("Unknown contact definition " + definition + ", use ALL_ATOMS, CA or CB");
+}
+
+
+static std::string GetContactDefinition() {
+  switch (GlobalContactDefinition().load()) {
+    case ContactDefinition::CA:
+      return "CA";
+    case ContactDefinition::CB:
+      return "CB";
+    default:
+      return "ALL_ATOMS";
+  }
+}
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef CONTACT_ENGINE
+#define CONTACT_ENGINE
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "distance_kernel.h"
+#include "engine_stats.h"
+#include "fixed_positions.h"
+
+// squares are plain multiplications, powf(x, 2) calls of unoptimized builds round exact ties differently
+static float Distance(const float* array, int i, int j) {
+  const float dx = array[i * 3] - array[j * 3];
+  const float dy = array[i * 3 + 1] - array[j * 3 + 1];
+  const float dz = array[i * 3 + 2] - array[j * 3 + 2];
+  return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+
+// Reference implementation comparing every atom of every residue pair.
+// Kept to validate faster engines against, it is not used on the pipeline path.
+static std::vector<std::pair<int, int>> BruteForceSparseContacts(const int chain_length, const int* group_indexes, const float* atoms_positions,
+                                                                 const float angstrom_contact_threshold) {
+  std::vector<std::pair<int, int>> sparse_contacts;
+  sparse_contacts.reserve(chain_length * 10);
+
+  for (int group_a = 0; group_a < chain_length; ++group_a) {
+    for (int group_b = group_a + 1; group_b < chain_length; ++group_b) {
+      bool group_connected = false;
+
+      for (int atom_a = group_indexes[group_a]; atom_a < group_indexes[group_a + 1]; ++atom_a) {
+        for (int atom_b = group_indexes[group_b]; atom_b < group_indexes[group_b + 1]; ++atom_b) {
+          if (Distance(atoms_positions, atom_a, atom_b) <= angstrom_contact_threshold) {
+            group_connected = true;
+            sparse_contacts.emplace_back(group_a, group_b);
+            break;
+          }
+        }
+
+        if (group_connected)
+          break;
+      }
+    }
+  }
+  return sparse_contacts;
+}
+
+
+// Uniform grid over atom positions. Cell edge is never smaller than the contact threshold,
+// so all atoms closer than the threshold to a given atom are inside its 27 neighbouring cells.
+// Atoms are identified by their coordinate index, atoms inside every cell are kept in increasing index order,
+// which also means increasing residue order.
+struct AtomGrid {
+  float min_x, min_y, min_z;
+  float inverse_cell_size;
+  int size_x, size_y, size_z;
+  std::vector<int> cell_start;
+  std::vector<int> cell_atoms;
+
+  int CellCoordinate(float value, float min_value, int size) const {
+    int coordinate = (int) ((value - min_value) * inverse_cell_size);
+    return std::min(std::max(coordinate, 0), size - 1);
+  }
+
+  void Cell(float x_position, float y_position, float z_position, int& x, int& y, int& z) const {
+    x = CellCoordinate(x_position, min_x, size_x);
+    y = CellCoordinate(y_position, min_y, size_y);
+    z = CellCoordinate(z_position, min_z, size_z);
+  }
+
+  int CellIndex(int x, int y, int z) const {
+    return (z * size_y + y) * size_x + x;
+  }
+};
+
+
+// Coordinates of atoms as separate x, y, z arrays. Atoms of residue i are stored at
+// coordinate_indexes[i] ... coordinate_indexes[i] + group size - 1, slots between residues are padding.
+// Padding has to be NaN, so that kernels can run over the whole padded slot range of a residue.
+struct AtomsCoordinates {
+  int chain_length;
+  const int* group_indexes;
+  const int* coordinate_indexes;
+  const float* xs;
+  const float* ys;
+  const float* zs;
+
+  int GroupSize(int group) const {
+    return group_indexes[group + 1] - group_indexes[group];
+  }
+};
+
+
+static AtomGrid BuildAtomGrid(const AtomsCoordinates& atoms, const float angstrom_contact_threshold) {
+  AtomGrid grid{};
+  int atom_count = 0;
+
+  float max_x = 0, max_y = 0, max_z = 0;
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    for (int i = atoms.coordinate_indexes[group]; i < atoms.coordinate_indexes[group] + atoms.GroupSize(group); ++i) {
+      if (atom_count++ == 0) {
+        grid.min_x = max_x = atoms.xs[i];
+        grid.min_y = max_y = atoms.ys[i];
+        grid.min_z = max_z = atoms.zs[i];
+      }
+      grid.min_x = std::min(grid.min_x, atoms.xs[i]);
+      grid.min_y = std::min(grid.min_y, atoms.ys[i]);
+      grid.min_z = std::min(grid.min_z, atoms.zs[i]);
+      max_x = std::max(max_x, atoms.xs[i]);
+      max_y = std::max(max_y, atoms.ys[i]);
+      max_z = std::max(max_z, atoms.zs[i]);
+    }
+  }
+
+  // small margin over the threshold absorbs rounding of the cell coordinates,
+  // distances within the threshold can never be more than one cell apart
+  double cell_size = std::max(angstrom_contact_threshold, 0.0f) * 1.0001 + 0.001;
+  // extremely small thresholds or sparse structures would allocate more cells than atoms,
+  // bigger cells only add candidates, so the result stays the same
+  const double max_cells = std::max(8.0 * atom_count, 64.0);
+  double cells;
+  while (true) {
+    grid.size_x = (int) ((max_x - grid.min_x) / cell_size) + 1;
+    grid.size_y = (int) ((max_y - grid.min_y) / cell_size) + 1;
+    grid.size_z = (int) ((max_z - grid.min_z) / cell_size) + 1;
+    cells = (double) grid.size_x * grid.size_y * grid.size_z;
+    if (cells <= max_cells)
+      break;
+    cell_size *= 1.5;
+  }
+  grid.inverse_cell_size = (float) (1.0 / cell_size);
+
+  // counting sort of atoms by cell index
+  std::vector<int> atom_cells;
+  atom_cells.reserve(atom_count);
+  grid.cell_start.assign((size_t) cells + 1, 0);
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    for (int i = atoms.coordinate_indexes[group]; i < atoms.coordinate_indexes[group] + atoms.GroupSize(group); ++i) {
+      int x, y, z;
+      grid.Cell(atoms.xs[i], atoms.ys[i], atoms.zs[i], x, y, z);
+      atom_cells.push_back(grid.CellIndex(x, y, z));
+      ++grid.cell_start[atom_cells.back() + 1];
+    }
+  }
+  for (size_t cell = 1; cell < grid.cell_start.size(); ++cell) {
+    grid.cell_start[cell] += grid.cell_start[cell - 1];
+  }
+
+  grid.cell_atoms.resize(atom_count);
+  std::vector<int> cell_fill(grid.cell_start.begin(), grid.cell_start.end() - 1);
+  int atom = 0;
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    for (int i = atoms.coordinate_indexes[group]; i < atoms.coordinate_indexes[group] + atoms.GroupSize(group); ++i) {
+      grid.cell_atoms[cell_fill[atom_cells[atom++]]++] = i;
+    }
+  }
+  return grid;
+}
+
+
+// Bounding sphere of every residue, centre is the atom centroid and radius reaches its farthest atom.
+// Atoms of residues A and B can only be within the threshold if |centre A - centre B| <= radius A + radius B + threshold.
+struct ResidueSpheres {
+  std::vector<float> xs, ys, zs;
+  std::vector<float> radii;
+  // covers float rounding of atom distances, so the sphere test never rejects a pair the kernel would accept
+  float margin = 0;
+
+  // true if no atom of residue a can be within reach - margin of an atom of residue b
+  bool Apart(int a, int b, float reach) const {
+    const double dx = (double) xs[a] - xs[b];
+    const double dy = (double) ys[a] - ys[b];
+    const double dz = (double) zs[a] - zs[b];
+    const double limit = (double) radii[a] + radii[b] + reach + margin;
+    return dx * dx + dy * dy + dz * dz > limit * limit;
+  }
+};
+
+
+static ResidueSpheres BuildResidueSpheres(const AtomsCoordinates& atoms) {
+  ResidueSpheres spheres;
+  spheres.xs.resize(atoms.chain_length);
+  spheres.ys.resize(atoms.chain_length);
+  spheres.zs.resize(atoms.chain_length);
+  spheres.radii.resize(atoms.chain_length);
+  float max_coordinate = 0;
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    const int begin = atoms.coordinate_indexes[group];
+    const int end = begin + atoms.GroupSize(group);
+    double x = 0, y = 0, z = 0;
+    for (int i = begin; i < end; ++i) {
+      x += atoms.xs[i], y += atoms.ys[i], z += atoms.zs[i];
+      max_coordinate = std::max({max_coordinate, std::fabs(atoms.xs[i]), std::fabs(atoms.ys[i]), std::fabs(atoms.zs[i])});
+    }
+    const int count = std::max(end - begin, 1);
+    spheres.xs[group] = (float) (x / count);
+    spheres.ys[group] = (float) (y / count);
+    spheres.zs[group] = (float) (z / count);
+
+    // measured from the stored float centre, so the test does not depend on rounding of the centroid
+    double squared_radius = 0;
+    for (int i = begin; i < end; ++i) {
+      const double dx = (double) atoms.xs[i] - spheres.xs[group];
+      const double dy = (double) atoms.ys[i] - spheres.ys[group];
+      const double dz = (double) atoms.zs[i] - spheres.zs[group];
+      squared_radius = std::max(squared_radius, dx * dx + dy * dy + dz * dz);
+    }
+    spheres.radii[group] = (float) std::sqrt(squared_radius);
+  }
+  // float atom distances are off by a few ulps of the coordinates at most, radii are rounded to float as well
+  spheres.margin = 0.01f + 1e-5f * max_coordinate;
+  return spheres;
+}
+
+
+// Emits exactly the same residue pairs, in the same order, as BruteForceSparseContacts.
+// Grid cells around residue A give the later residues that can possibly be in contact with it,
+// residue pairs whose bounding spheres are farther apart than the threshold are dropped next,
+// only the remaining pairs are tested with the exact atom pair loop, so the cost grows linearly with chain length.
+// in_contact(a_begin, a_end, b_begin, b_count) is the atom pair loop over coordinate slots of residues A and B.
+template <typename ResiduesInContact>
+static std::vector<std::pair<int, int>> GridSparseContacts(const AtomsCoordinates& atoms, const float angstrom_contact_threshold,
+                                                           const ResiduesInContact& in_contact) {
+  std::vector<std::pair<int, int>> sparse_contacts;
+  if (atoms.chain_length <= 0 || atoms.group_indexes[atoms.chain_length] <= atoms.group_indexes[0])
+    return sparse_contacts;
+  sparse_contacts.reserve(atoms.chain_length * 10);
+
+  const AtomGrid grid = BuildAtomGrid(atoms, angstrom_contact_threshold);
+  const ResidueSpheres spheres = BuildResidueSpheres(atoms);
+
+  // residue of every coordinate slot
+  const int first_coordinate = atoms.coordinate_indexes[0];
+  std::vector<int> coordinate_groups(atoms.coordinate_indexes[atoms.chain_length] - first_coordinate);
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    std::fill(coordinate_groups.begin() + atoms.coordinate_indexes[group] - first_coordinate,
+              coordinate_groups.begin() + atoms.coordinate_indexes[group + 1] - first_coordinate, group);
+  }
+
+  // candidate_of[group_b] == group_a once group_b is listed as a candidate of group_a
+  std::vector<int> candidate_of(atoms.chain_length, -1);
+  std::vector<int> candidate_groups;
+  uint64_t pruned_pairs = 0;
+
+  for (int group_a = 0; group_a < atoms.chain_length; ++group_a) {
+    const int a_begin = atoms.coordinate_indexes[group_a];
+    const int a_end = a_begin + atoms.GroupSize(group_a);
+    if (a_begin == a_end)
+      continue;
+
+    // cells touched by residue A extended by one cell in every direction
+    int min_x, min_y, min_z, max_x, max_y, max_z;
+    grid.Cell(atoms.xs[a_begin], atoms.ys[a_begin], atoms.zs[a_begin], min_x, min_y, min_z);
+    max_x = min_x, max_y = min_y, max_z = min_z;
+    for (int atom_a = a_begin + 1; atom_a < a_end; ++atom_a) {
+      int x, y, z;
+      grid.Cell(atoms.xs[atom_a], atoms.ys[atom_a], atoms.zs[atom_a], x, y, z);
+      min_x = std::min(min_x, x), min_y = std::min(min_y, y), min_z = std::min(min_z, z);
+      max_x = std::max(max_x, x), max_y = std::max(max_y, y), max_z = std::max(max_z, z);
+    }
+
+    candidate_groups.clear();
+    for (int z = std::max(min_z - 1, 0); z <= std::min(max_z + 1, grid.size_z - 1); ++z) {
+      for (int y = std::max(min_y - 1, 0); y <= std::min(max_y + 1, grid.size_y - 1); ++y) {
+        for (int x = std::max(min_x - 1, 0); x <= std::min(max_x + 1, grid.size_x - 1); ++x) {
+          const int cell = grid.CellIndex(x, y, z);
+          const int* cell_end = grid.cell_atoms.data() + grid.cell_start[cell + 1];
+          // only atoms of later residues, same as group_b > group_a in the brute force loop
+          for (const int* atom_b = std::lower_bound(grid.cell_atoms.data() + grid.cell_start[cell], cell_end, a_end);
+               atom_b < cell_end; ++atom_b) {
+            const int group_b = coordinate_groups[*atom_b - first_coordinate];
+            if (candidate_of[group_b] != group_a) {
+              candidate_of[group_b] = group_a;
+              candidate_groups.push_back(group_b);
+            }
+          }
+        }
+      }
+    }
+    std::sort(candidate_groups.begin(), candidate_groups.end());
+
+    for (int group_b : candidate_groups) {
+      // neighbouring cells are up to three thresholds apart, most candidates fail the sphere test
+      if (spheres.Apart(group_a, group_b, angstrom_contact_threshold)) {
+        ++pruned_pairs;
+        continue;
+      }
+      // padding is NaN and never matches, so the whole slot range of residue B is streamed
+      const int b_begin = atoms.coordinate_indexes[group_b];
+      const int b_count = atoms.coordinate_indexes[group_b + 1] - b_begin;
+      if (in_contact(a_begin, a_end, b_begin, b_count))
+        sparse_contacts.emplace_back(group_a, group_b);
+    }
+  }
+  CountEngineEvent(EngineCounter::RESIDUE_PAIRS_PRUNED, pruned_pairs);
+  CountEngineEvent(EngineCounter::CONTACTS_EMITTED, sparse_contacts.size());
+  return sparse_contacts;
+}
+
+
+// Entry point for separate x, y, z arrays, used as they are.
+// Every atom of residue A runs the distance kernel against all atoms of residue B.
+static std::vector<std::pair<int, int>> ComputeSparseContacts(const AtomsCoordinates& atoms, const float angstrom_contact_threshold,
+                                                              const FindContactKernel find_contact) {
+  const float squared_threshold = SquaredThreshold(angstrom_contact_threshold);
+  uint64_t atom_pair_tests = 0;
+  std::vector<std::pair<int, int>> sparse_contacts = GridSparseContacts(atoms, angstrom_contact_threshold,
+                                                                        [&](const int a_begin, const int a_end, const int b_begin, const int b_count) {
+    for (int atom_a = a_begin; atom_a < a_end; ++atom_a) {
+      const float point[3] = {atoms.xs[atom_a], atoms.ys[atom_a], atoms.zs[atom_a]};
+      atom_pair_tests += b_count;
+      if (find_contact(point, atoms.xs + b_begin, atoms.ys + b_begin, atoms.zs + b_begin, b_count, squared_threshold) < b_count)
+        return true;
+    }
+    return false;
+  });
+  CountEngineEvent(EngineCounter::ATOM_PAIR_TESTS, atom_pair_tests);
+  return sparse_contacts;
+}
+
+
+static std::vector<std::pair<int, int>> ComputeSparseContacts(const AtomsCoordinates& atoms, const float angstrom_contact_threshold) {
+  return ComputeSparseContacts(atoms, angstrom_contact_threshold, FindContact());
+}
+
+
+// Entry point for interleaved positions, coordinates are copied into separate x, y, z arrays first.
+static std::vector<std::pair<int, int>> ComputeSparseContacts(const int chain_length, const int* group_indexes, const float* atoms_positions,
+                                                              const float angstrom_contact_threshold) {
+  if (chain_length <= 0)
+    return {};
+  const int atom_count = group_indexes[chain_length];
+  std::vector<float> xs(atom_count), ys(atom_count), zs(atom_count);
+  for (int atom = group_indexes[0]; atom < atom_count; ++atom) {
+    xs[atom] = atoms_positions[atom * 3];
+    ys[atom] = atoms_positions[atom * 3 + 1];
+    zs[atom] = atoms_positions[atom * 3 + 2];
+  }
+  const AtomsCoordinates atoms{chain_length, group_indexes, group_indexes, xs.data(), ys.data(), zs.data()};
+  return ComputeSparseContacts(atoms, angstrom_contact_threshold);
+}
+
+
+// Entry point for interleaved fixed point positions (see fixed_positions.h), origin does not change distances.
+// Grid and residue spheres run on the positions converted to float, atom pairs are tested on exact integer distances.
+static std::vector<std::pair<int, int>> ComputeSparseContacts(const int chain_length, const int* group_indexes, const int16_t* fixed_positions,
+                                                              const float angstrom_contact_threshold) {
+  if (chain_length <= 0)
+    return {};
+  const int atom_count = group_indexes[chain_length];
+  std::vector<float> xs(atom_count), ys(atom_count), zs(atom_count);
+  for (int atom = group_indexes[0]; atom < atom_count; ++atom) {
+    xs[atom] = FixedPositionToAngstrom(0, fixed_positions[atom * 3]);
+    ys[atom] = FixedPositionToAngstrom(0, fixed_positions[atom * 3 + 1]);
+    zs[atom] = FixedPositionToAngstrom(0, fixed_positions[atom * 3 + 2]);
+  }
+  const AtomsCoordinates atoms{chain_length, group_indexes, group_indexes, xs.data(), ys.data(), zs.data()};
+
+  // thresholds over 267 Å would overflow the int32 kernel, float distances are used instead
+  const int64_t squared_threshold = FixedSquaredThreshold(angstrom_contact_threshold);
+  const int64_t axis_limit = (int64_t) std::sqrt((double) std::max<int64_t>(squared_threshold, 0)) + 2;
+  if (3 * axis_limit * axis_limit > INT32_MAX)
+    return ComputeSparseContacts(atoms, angstrom_contact_threshold);
+
+  std::vector<int> units_x(atom_count), units_y(atom_count), units_z(atom_count);
+  for (int atom = group_indexes[0]; atom < atom_count; ++atom) {
+    units_x[atom] = fixed_positions[atom * 3];
+    units_y[atom] = fixed_positions[atom * 3 + 1];
+    units_z[atom] = fixed_positions[atom * 3 + 2];
+  }
+  const FindFixedContactKernel find_contact = FindFixedContact();
+  uint64_t atom_pair_tests = 0;
+  std::vector<std::pair<int, int>> sparse_contacts = GridSparseContacts(atoms, angstrom_contact_threshold,
+                                                                        [&](const int a_begin, const int a_end, const int b_begin, const int b_count) {
+    for (int atom_a = a_begin; atom_a < a_end; ++atom_a) {
+      const int point[3] = {units_x[atom_a], units_y[atom_a], units_z[atom_a]};
+      atom_pair_tests += b_count;
+      if (find_contact(point, units_x.data() + b_begin, units_y.data() + b_begin, units_z.data() + b_begin, b_count, (int) axis_limit,
+                       (int) squared_threshold) < b_count)
+        return true;
+    }
+    return false;
+  });
+  CountEngineEvent(EngineCounter::ATOM_PAIR_TESTS, atom_pair_tests);
+  return sparse_contacts;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef CONTACT_LISTS
+#define CONTACT_LISTS
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "contact_definition.h"
+#include "contact_map_cache.h"
+
+// Target contacts precomputed for a few thresholds are stored in the atoms database as compact residue pair lists.
+// Contact engine emits pairs sorted by first residue, then by second one, and first < second,
+// so every pair is stored as two small unsigned varints:
+//   first pair of a row:  first - previous first, second - first - 1
+//   next pairs in a row:  0,                      second - previous second - 1
+// A list starts with the varint number of pairs. Lists are always computed with the ALL_ATOMS contact definition.
+
+
+static void AppendVarint(std::string& output, uint32_t value) {
+  while (value >= 0x80) {
+    output.push_back((char) (value | 0x80));
+    value >>= 7;
+  }
+  output.push_back((char) value);
+}
+
+
+static uint32_t ReadVarint(const unsigned char*& data, const unsigned char* const end) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (data == end)
+      throw std::runtime_error("Contact list is truncated");
+    const unsigned char byte = *data++;
+    value |= (uint32_t) (byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return value;
+  }
+  throw std::runtime_error("Contact list has an invalid varint");
+}
+
+
+static void EncodeContactList(const SparseContacts& sparse_contacts, std::string& output) {
+  AppendVarint(output, (uint32_t) sparse_contacts.size());
+  int previous_first = 0;
+  int previous_second = 0;
+  bool row_started = false;
+  for (std::pair<int, int> contact : sparse_contacts) {
+    const bool new_row = !row_started || contact.first != previous_first;
+    if (contact.first < previous_first || contact.second <= contact.first || (!new_row && contact.second <= previous_second))
+      throw std::logic_error("Contacts must be sorted upper triangle pairs to be encoded");
+    AppendVarint(output, (uint32_t) (contact.first - previous_first));
+    AppendVarint(output, (uint32_t) (contact.second - (new_row ? contact.first : previous_second) - 1));
+    previous_first = contact.first;
+    previous_second = contact.second;
+    row_started = true;
+  }
+}
+
+
+// chain_length bounds every decoded residue, so a corrupted list can not produce pairs outside of the structure.
+// Replaces sparse_contacts with the decoded list, a reused vector keeps its memory.
+static void DecodeContactList(const std::string_view encoded, const int chain_length, SparseContacts& sparse_contacts) {
+  const unsigned char* data = reinterpret_cast<const unsigned char*>(encoded.data());
+  const unsigned char* const end = data + encoded.size();
+  const uint32_t count = ReadVarint(data, end);
+  // every pair takes at least two bytes
+  if (count > encoded.size() / 2)
+    throw std::runtime_error("Contact list is truncated");
+
+  sparse_contacts.resize(count);
+  int64_t first = 0;
+  int64_t second = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t first_delta = ReadVarint(data, end);
+    const uint32_t second_delta = ReadVarint(data, end);
+    if (i == 0 || first_delta != 0) {
+      first += first_delta;
+      second = first;
+    }
+    second += (int64_t) second_delta + 1;
+    if (second >= chain_length)
+      throw std::runtime_error("Contact list has a residue outside of the chain");
+    sparse_contacts[i] = std::make_pair((int) first, (int) second);
+  }
+}
+
+
+static SparseContacts DecodeContactList(const std::string_view encoded, const int chain_length) {
+  SparseContacts sparse_contacts;
+  DecodeContactList(encoded, chain_length, sparse_contacts);
+  return sparse_contacts;
+}
+
+
+// Stored after the ids table of the atoms database, 8 bytes aligned:
+//
+//   ContactListsHeader
+//   float32 thresholds[threshold_count], padded to 8 bytes
+//   encoded lists, data_size bytes, padded to 8 bytes
+//   uint64 list_offsets[entry_count * threshold_count + 1] relative to the first list
+//
+// List of index entry i for threshold t is k = i * threshold_count + t, it spans list_offsets[k] to list_offsets[k + 1].
+// Removed entries have empty lists.
+static const char CONTACT_LISTS_MAGIC[8] = {'D', 'F', 'R', 'I', 'C', 'T', 'L', 'S'};
+
+struct ContactListsHeader {
+  char magic[8];
+  uint32_t threshold_count;
+  uint32_t reserved;
+  uint64_t entry_count;
+  uint64_t data_size;
+};
+
+static_assert(sizeof(ContactListsHeader) == 32, "ContactListsHeader layout must not change");
+
+
+// encoded list of a protein for one threshold, points into a mapped database
+struct EncodedContactList {
+  float threshold;
+  std::string_view data;
+};
+
+typedef std::vector<EncodedContactList> EncodedContactLists;
+
+#endif
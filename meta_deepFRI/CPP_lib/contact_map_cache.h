@@ -0,0 +1,131 @@
+#ifndef CONTACT_MAP_CACHE
+#define CONTACT_MAP_CACHE
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "engine_stats.h"
+
+typedef std::vector<std::pair<int, int>> SparseContacts;
+typedef std::shared_ptr<const SparseContacts> SparseContactsPtr;
+
+struct ContactMapCacheStats {
+  size_t hits;
+  size_t misses;
+  size_t entries;
+  size_t size_bytes;
+  size_t budget_bytes;
+};
+
+// Process-wide least recently used cache of sparse target contacts and chain lengths of their targets.
+// Entries are shared pointers, so evicting an entry never invalidates contacts that are still in use.
+class ContactMapCache {
+ public:
+  explicit ContactMapCache(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+  // key is the source of the atoms (file path) combined with exact bits of the threshold and the contact definition
+  static std::string Key(const std::string& source, const float angstrom_contact_threshold, const int contact_definition) {
+    std::string key = source;
+    key.push_back('\0');
+    key.append(reinterpret_cast<const char*>(&angstrom_contact_threshold), sizeof(float));
+    key.push_back((char) contact_definition);
+    return key;
+  }
+
+  // chain_length, if given, is set when the entry is found
+  SparseContactsPtr Get(const std::string& key, int* chain_length = nullptr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = entries_.find(key);
+    if (entry == entries_.end()) {
+      ++misses_;
+      CountEngineEvent(EngineCounter::CACHE_MISSES, 1);
+      return nullptr;
+    }
+    ++hits_;
+    CountEngineEvent(EngineCounter::CACHE_HITS, 1);
+    recently_used_.splice(recently_used_.begin(), recently_used_, entry->second);
+    if (chain_length != nullptr)
+      *chain_length = entry->second->chain_length;
+    return entry->second->contacts;
+  }
+
+  void Put(const std::string& key, const SparseContactsPtr& contacts, const int chain_length) {
+    const size_t entry_bytes = EntryBytes(key, *contacts);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entry_bytes > budget_bytes_)
+      return;
+
+    auto entry = entries_.find(key);
+    if (entry != entries_.end()) {
+      size_bytes_ -= entry->second->size_bytes;
+      recently_used_.erase(entry->second);
+      entries_.erase(entry);
+    }
+    recently_used_.push_front(Entry{key, contacts, chain_length, entry_bytes});
+    entries_[key] = recently_used_.begin();
+    size_bytes_ += entry_bytes;
+    Evict();
+  }
+
+  void SetBudget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_bytes_ = budget_bytes;
+    Evict();
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    recently_used_.clear();
+    size_bytes_ = 0;
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+  ContactMapCacheStats Stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ContactMapCacheStats{hits_, misses_, entries_.size(), size_bytes_, budget_bytes_};
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    SparseContactsPtr contacts;
+    int chain_length;
+    size_t size_bytes;
+  };
+
+  static size_t EntryBytes(const std::string& key, const SparseContacts& contacts) {
+    // rough bookkeeping overhead of the list node, hash map node and shared pointer control block
+    return contacts.capacity() * sizeof(std::pair<int, int>) + 2 * key.size() + 128;
+  }
+
+  void Evict() {
+    while (size_bytes_ > budget_bytes_ && !recently_used_.empty()) {
+      size_bytes_ -= recently_used_.back().size_bytes;
+      entries_.erase(recently_used_.back().key);
+      recently_used_.pop_back();
+    }
+  }
+
+  std::mutex mutex_;
+  std::list<Entry> recently_used_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+  size_t budget_bytes_;
+  size_t size_bytes_ = 0;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+// 256 MB is enough to keep tens of thousands of typical targets
+inline ContactMapCache& GlobalContactMapCache() {
+  static ContactMapCache cache(256 * 1024 * 1024);
+  return cache;
+}
+
+#endif
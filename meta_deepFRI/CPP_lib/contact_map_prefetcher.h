@@ -0,0 +1,142 @@
+#ifndef CONTACT_MAP_PREFETCHER
+#define CONTACT_MAP_PREFETCHER
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "contact_maps.h"
+
+// Builds dense contact maps ahead of the consumer on background threads, so contact maps are ready while the consumer runs inference.
+// Maps are handed out in input order. Workers never get more than queue_size maps ahead of the consumer,
+// which bounds memory to queue_size dense maps. An exception of a map is rethrown when that map is taken.
+class ContactMapPrefetcher {
+ public:
+  // produce(index) gives a dense contact map allocated with new[] and its size
+  typedef std::function<std::pair<bool*, int>(size_t)> ProduceFunction;
+
+  ContactMapPrefetcher(ProduceFunction produce, const size_t size, int thread_count, const size_t queue_size)
+      : produce_(std::move(produce)), size_(size), slots_(std::max(queue_size, (size_t) 1)) {
+    if (thread_count <= 0)
+      thread_count = (int) std::max(std::thread::hardware_concurrency(), 1u);
+    thread_count = (int) std::min((size_t) thread_count, std::max(std::min(size_, slots_.size()), (size_t) 1));
+    for (int worker = 0; worker < thread_count; ++worker)
+      threads_.emplace_back(&ContactMapPrefetcher::WorkerLoop, this);
+  }
+
+  ~ContactMapPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    slot_freed_.notify_all();
+    for (auto& thread : threads_)
+      thread.join();
+    for (Slot& slot : slots_)
+      delete[] slot.contact_map.first;
+  }
+
+  ContactMapPrefetcher(const ContactMapPrefetcher&) = delete;
+  ContactMapPrefetcher& operator=(const ContactMapPrefetcher&) = delete;
+
+  size_t Size() const {
+    return size_;
+  }
+
+  // Waits for the next map, false once all maps were taken. The caller owns the returned map.
+  bool Next(std::pair<bool*, int>& contact_map) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (next_output_ == size_)
+      return false;
+    Slot& slot = slots_[next_output_ % slots_.size()];
+    slot_ready_.wait(lock, [&slot]() { return slot.ready; });
+    contact_map = slot.contact_map;
+    const std::exception_ptr error = slot.error;
+    slot = Slot();
+    ++next_output_;
+    lock.unlock();
+    slot_freed_.notify_all();
+    if (error)
+      std::rethrow_exception(error);
+    return true;
+  }
+
+ private:
+  struct Slot {
+    std::pair<bool*, int> contact_map{nullptr, 0};
+    std::exception_ptr error;
+    bool ready = false;
+  };
+
+  void WorkerLoop() {
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot_freed_.wait(lock, [this]() { return stopping_ || next_task_ == size_ || next_task_ < next_output_ + slots_.size(); });
+        if (stopping_ || next_task_ == size_)
+          return;
+        index = next_task_++;
+      }
+
+      Slot produced;
+      try {
+        produced.contact_map = produce_(index);
+      } catch (...) {
+        produced.error = std::current_exception();
+      }
+      produced.ready = true;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[index % slots_.size()] = produced;
+      }
+      slot_ready_.notify_all();
+    }
+  }
+
+  const ProduceFunction produce_;
+  const size_t size_;
+  std::vector<Slot> slots_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable slot_ready_;
+  std::condition_variable slot_freed_;
+  size_t next_task_ = 0;
+  size_t next_output_ = 0;
+  bool stopping_ = false;
+};
+
+
+static ContactMapPrefetcher::ProduceFunction AlignedContactMapsProducer(const SparseContactsLoader& load_target_contacts, std::vector<std::string> target_names,
+                                                                        AlignmentInputs alignments, const int generated_contacts) {
+  if (alignments.Size() != target_names.size())
+    throw std::invalid_argument("targets and alignments must have the same length");
+  auto inputs = std::make_shared<std::pair<std::vector<std::string>, AlignmentInputs>>(std::move(target_names), std::move(alignments));
+  return [load_target_contacts, inputs, generated_contacts](const size_t index) {
+    EngineTraceLabel trace_label(inputs->first[index]);
+    SparseContactsPtr sparse_target_contacts = load_target_contacts(inputs->first[index]);
+    ContactScratch& scratch = ThreadContactScratch();
+    const int query_length = inputs->second.Project(index, *sparse_target_contacts, generated_contacts, scratch);
+    return DenseFromAlignedContacts(scratch.query_contacts, query_length);
+  };
+}
+
+
+// dense maps of a contact map store in order, the prefetcher keeps the store alive
+static std::shared_ptr<ContactMapPrefetcher> PrefetchStoredContactMaps(const std::shared_ptr<AlignedContactMapStore>& store, const int thread_count,
+                                                                       const int queue_size) {
+  return std::make_shared<ContactMapPrefetcher>([store](const size_t index) {
+    SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+    const int query_length = store->Contacts(index, sparse_query_contacts);
+    return std::make_pair(SymmetricDenseContactMap(sparse_query_contacts, query_length), query_length);
+  }, store->Size(), thread_count, queue_size);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef CONTACT_MAP_PREFETCHER_PYTHON
+#define CONTACT_MAP_PREFETCHER_PYTHON
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "contact_map_prefetcher.h"
+#include "load_contact_maps.h"
+#include "python_utils.h"
+
+// Python layer of contact_map_prefetcher.h, prefetchers are python iterators of dense contact maps.
+
+static std::shared_ptr<ContactMapPrefetcher> PrefetchAlignedContactMaps(const py::list& file_paths, float angstrom_contact_threshold,
+                                                                        const py::list& query_alignments, const py::list& target_alignments,
+                                                                        const int generated_contacts, const int thread_count, const int queue_size) {
+  std::vector<std::string> target_names = ExtractStrings(file_paths);
+  const size_t size = target_names.size();
+  return std::make_shared<ContactMapPrefetcher>(AlignedContactMapsProducer([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, std::move(target_names), StringAlignmentInputs(query_alignments, target_alignments), generated_contacts), size, thread_count, queue_size);
+}
+
+
+static std::shared_ptr<ContactMapPrefetcher> PrefetchCigarAlignedContactMaps(const py::list& file_paths, float angstrom_contact_threshold, const py::list& cigars,
+                                                                             const int generated_contacts, const int thread_count, const int queue_size) {
+  std::vector<std::string> target_names = ExtractStrings(file_paths);
+  const size_t size = target_names.size();
+  return std::make_shared<ContactMapPrefetcher>(AlignedContactMapsProducer([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, std::move(target_names), CigarAlignmentInputs(cigars), generated_contacts), size, thread_count, queue_size);
+}
+
+
+// the database must outlive the prefetcher, bindings tie their lifetimes
+static std::shared_ptr<ContactMapPrefetcher> PrefetchAlignedContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids,
+                                                                                    float angstrom_contact_threshold, const py::list& query_alignments,
+                                                                                    const py::list& target_alignments, const int generated_contacts,
+                                                                                    const int thread_count, const int queue_size) {
+  std::vector<std::string> target_names = ExtractStrings(protein_ids);
+  const size_t size = target_names.size();
+  return std::make_shared<ContactMapPrefetcher>(AlignedContactMapsProducer([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, std::move(target_names), StringAlignmentInputs(query_alignments, target_alignments), generated_contacts), size, thread_count, queue_size);
+}
+
+
+static std::shared_ptr<ContactMapPrefetcher> PrefetchCigarAlignedContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids,
+                                                                                         float angstrom_contact_threshold, const py::list& cigars,
+                                                                                         const int generated_contacts, const int thread_count,
+                                                                                         const int queue_size) {
+  std::vector<std::string> target_names = ExtractStrings(protein_ids);
+  const size_t size = target_names.size();
+  return std::make_shared<ContactMapPrefetcher>(AlignedContactMapsProducer([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, std::move(target_names), CigarAlignmentInputs(cigars), generated_contacts), size, thread_count, queue_size);
+}
+
+
+static py::object PrefetcherIter(py::object prefetcher) {
+  return prefetcher;
+}
+
+
+static np::ndarray PrefetcherNext(ContactMapPrefetcher& prefetcher) {
+  std::pair<bool*, int> contact_map;
+  bool produced;
+  {
+    ReleaseGIL release_gil;
+    produced = prefetcher.Next(contact_map);
+  }
+  if (!produced) {
+    PyErr_SetString(PyExc_StopIteration, "");
+    py::throw_error_already_set();
+  }
+  return CreateNumpyArray(contact_map.first, contact_map.second);
+}
+
+#endif
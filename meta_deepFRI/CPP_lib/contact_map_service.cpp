@@ -0,0 +1,338 @@
+// Computes aligned contact maps of a job manifest into a packed contact map file (packed_contact_map_file.h), no python needed.
+//
+//   ContactMapService (--database DB | --atoms-dir DIR) [options] MANIFEST OUTPUT
+//   ContactMapService (--database DB | --atoms-dir DIR) [options] --serve SOCKET
+//
+// Manifest lines are tab separated, "query_id target cigar" or "query_id target query_alignment target_alignment",
+// empty lines and lines starting with # are skipped. Targets are protein ids of the database or atoms file names inside the atoms directory.
+// In service mode every line a client writes to the unix socket is "MANIFEST<tab>OUTPUT", the reply is "ok <map count>" or "error <message>".
+// Connections are served by their own threads and share the database and the contact map cache, so popular targets stay warm across jobs.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "contact_maps.h"
+#include "packed_contact_map_file.h"
+
+struct ServiceOptions {
+  std::string database_path;
+  std::string atoms_directory;
+  float angstrom_contact_threshold = 6;
+  int generated_contacts = 2;
+  int thread_count = 0;
+  std::string socket_path;
+  std::vector<std::string> positional;
+};
+
+
+struct Manifest {
+  std::vector<std::string> query_ids;
+  std::vector<std::string> targets;
+  AlignmentInputs alignments;
+};
+
+
+static std::vector<std::string> SplitTabs(const std::string& line) {
+  std::vector<std::string> fields;
+  size_t begin = 0;
+  while (true) {
+    const size_t end = line.find('\t', begin);
+    fields.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+    if (end == std::string::npos)
+      return fields;
+    begin = end + 1;
+  }
+}
+
+
+// all lines must use the same alignment form
+static Manifest ReadManifest(const std::string& manifest_path) {
+  std::ifstream reader(manifest_path);
+  if (!reader)
+    throw std::runtime_error("Unable to open manifest " + manifest_path);
+  Manifest manifest;
+  std::vector<std::string> cigars;
+  std::vector<std::string> query_alignments;
+  std::vector<std::string> target_alignments;
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(reader, line)) {
+    ++line_number;
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::vector<std::string> fields = SplitTabs(line);
+    if (fields.size() == 3 && query_alignments.empty()) {
+      cigars.push_back(std::move(fields[2]));
+    } else if (fields.size() == 4 && cigars.empty()) {
+      query_alignments.push_back(std::move(fields[2]));
+      target_alignments.push_back(std::move(fields[3]));
+    } else {
+      throw std::invalid_argument(manifest_path + ":" + std::to_string(line_number) +
+                                  " must have 3 fields (cigar) or 4 fields (aligned strings) like the lines before it");
+    }
+    manifest.query_ids.push_back(std::move(fields[0]));
+    manifest.targets.push_back(std::move(fields[1]));
+  }
+  manifest.alignments = cigars.empty() ? StringAlignmentInputs(std::move(query_alignments), std::move(target_alignments)) : CigarAlignmentInputs(cigars);
+  return manifest;
+}
+
+
+class ContactMapService {
+ public:
+  explicit ContactMapService(const ServiceOptions& options) : options_(options) {
+    if (!options_.database_path.empty()) {
+      database_ = std::make_unique<AtomsDatabase>(options_.database_path);
+      load_target_contacts_ = [this](const std::string& protein_id) {
+        return LoadSparseContactMap(*database_, protein_id, options_.angstrom_contact_threshold);
+      };
+    } else {
+      load_target_contacts_ = [this](const std::string& file_name) {
+        return LoadSparseContactMap(options_.atoms_directory + '/' + file_name, options_.angstrom_contact_threshold);
+      };
+    }
+  }
+
+  // returns number of maps written
+  size_t RunJob(const std::string& manifest_path, const std::string& output_path) const {
+    const Manifest manifest = ReadManifest(manifest_path);
+    const std::vector<PackedContactMap> contact_maps = ParallelBuildContactMaps<PackedContactMap>(
+        load_target_contacts_, manifest.targets, manifest.alignments, options_.generated_contacts, options_.thread_count,
+        PackedFromAlignedContacts, [](PackedContactMap&) {});
+    WritePackedContactMapFile(output_path, manifest.query_ids, contact_maps);
+    return contact_maps.size();
+  }
+
+  ~ContactMapService() {
+    StopClients();
+  }
+
+  // Serves until accept fails for a reason other than an interrupted call, an aborted connection or a temporary
+  // lack of resources. Clients are then stopped after their current request and the error is thrown.
+  void Serve() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (options_.socket_path.size() >= sizeof(address.sun_path))
+      throw std::invalid_argument("Socket path " + options_.socket_path + " is too long");
+    std::strcpy(address.sun_path, options_.socket_path.c_str());
+    const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0)
+      throw std::runtime_error(std::string("Unable to create socket: ") + std::strerror(errno));
+    // a socket file left by a previous run would make bind fail
+    unlink(options_.socket_path.c_str());
+    if (bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(server, 16) != 0) {
+      const std::string message = "Unable to listen on " + options_.socket_path + ": " + std::strerror(errno);
+      close(server);
+      throw std::runtime_error(message);
+    }
+    std::cerr << "Serving contact maps on " << options_.socket_path << std::endl;
+    while (true) {
+      const int client = accept(server, nullptr, nullptr);
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+          continue;
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+          // out of descriptors or memory for a moment, running jobs release them
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+          continue;
+        }
+        const std::string message = std::string("Unable to accept connection: ") + std::strerror(errno);
+        close(server);
+        StopClients();
+        throw std::runtime_error(message);
+      }
+      JoinFinishedClients();
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      clients_.emplace_back();
+      Client& connection = clients_.back();
+      connection.socket = client;
+      try {
+        connection.thread = std::thread(&ContactMapService::ServeClient, this, &connection);
+      } catch (const std::system_error&) {
+        // no thread for this connection now, the client sees it closed
+        close(client);
+        clients_.pop_back();
+      }
+    }
+  }
+
+ private:
+  // the client thread closes its socket under clients_mutex_, so StopClients never shuts down a reused descriptor
+  struct Client {
+    int socket = -1;
+    std::thread thread;
+    bool finished = false;
+  };
+
+  void ServeClient(Client* connection) const {
+    const int client = connection->socket;
+    std::string buffer;
+    char chunk[4096];
+    bool connected = true;
+    while (connected) {
+      const ssize_t received = read(client, chunk, sizeof(chunk));
+      if (received < 0 && errno == EINTR)
+        continue;
+      if (received <= 0)
+        break;
+      buffer.append(chunk, (size_t) received);
+      size_t line_end;
+      while (connected && (line_end = buffer.find('\n')) != std::string::npos) {
+        const std::string request = buffer.substr(0, line_end);
+        buffer.erase(0, line_end + 1);
+        connected = WriteAll(client, Answer(request) + '\n');
+      }
+    }
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    close(client);
+    connection->finished = true;
+  }
+
+  void JoinFinishedClients() {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+    for (auto connection = clients_.begin(); connection != clients_.end();) {
+      if (connection->finished) {
+        connection->thread.join();
+        connection = clients_.erase(connection);
+      } else {
+        ++connection;
+      }
+    }
+  }
+
+  // stops reading new requests, requests already read are answered before the threads are joined
+  void StopClients() {
+    {
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      for (Client& connection : clients_) {
+        if (!connection.finished)
+          shutdown(connection.socket, SHUT_RD);
+      }
+    }
+    // no client is added while Serve is not running, the list is only read here
+    for (Client& connection : clients_)
+      connection.thread.join();
+    clients_.clear();
+  }
+
+  std::string Answer(const std::string& request) const {
+    try {
+      const std::vector<std::string> fields = SplitTabs(request);
+      if (fields.size() != 2)
+        throw std::invalid_argument("Request must be MANIFEST<tab>OUTPUT");
+      return "ok " + std::to_string(RunJob(fields[0], fields[1]));
+    } catch (const std::exception& error) {
+      std::string message = error.what();
+      std::replace(message.begin(), message.end(), '\n', ' ');
+      return "error " + message;
+    }
+  }
+
+  static bool WriteAll(const int client, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+      // a client that hung up must not kill the service with SIGPIPE
+      const ssize_t count = send(client, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count <= 0)
+        return false;
+      written += (size_t) count;
+    }
+    return true;
+  }
+
+  const ServiceOptions options_;
+  std::unique_ptr<AtomsDatabase> database_;
+  SparseContactsLoader load_target_contacts_;
+  mutable std::mutex clients_mutex_;
+  std::list<Client> clients_;
+};
+
+
+static void PrintUsage() {
+  std::cerr << "usage: ContactMapService (--database DB | --atoms-dir DIR) [--threshold A] [--generated-contacts N] [--threads N]\n"
+               "                         [--cache-size BYTES] [--contact-definition ALL_ATOMS|CA|CB] (MANIFEST OUTPUT | --serve SOCKET)\n";
+}
+
+
+static ServiceOptions ParseOptions(const int argc, char** argv) {
+  ServiceOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const std::string argument = argv[i];
+    if (argument.rfind("--", 0) != 0) {
+      options.positional.push_back(argument);
+      continue;
+    }
+    if (i + 1 == argc)
+      throw std::invalid_argument(argument + " needs a value");
+    const std::string value = argv[++i];
+    if (argument == "--database")
+      options.database_path = value;
+    else if (argument == "--atoms-dir")
+      options.atoms_directory = value;
+    else if (argument == "--threshold")
+      options.angstrom_contact_threshold = std::stof(value);
+    else if (argument == "--generated-contacts")
+      options.generated_contacts = std::stoi(value);
+    else if (argument == "--threads")
+      options.thread_count = std::stoi(value);
+    else if (argument == "--cache-size")
+      SetContactMapCacheSize((size_t) std::stoull(value));
+    else if (argument == "--contact-definition")
+      SetContactDefinition(value);
+    else if (argument == "--serve")
+      options.socket_path = value;
+    else
+      throw std::invalid_argument("Unknown option " + argument);
+  }
+  if (options.database_path.empty() == options.atoms_directory.empty())
+    throw std::invalid_argument("Give exactly one of --database and --atoms-dir");
+  if (options.socket_path.empty() != (options.positional.size() == 2) || (!options.socket_path.empty() && !options.positional.empty()))
+    throw std::invalid_argument("Give MANIFEST and OUTPUT, or --serve SOCKET");
+  return options;
+}
+
+
+int main(int argc, char** argv) {
+  ServiceOptions options;
+  try {
+    options = ParseOptions(argc, argv);
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    PrintUsage();
+    return 2;
+  }
+  try {
+    ContactMapService service(options);
+    if (!options.socket_path.empty()) {
+      service.Serve();
+      return 0;
+    }
+    const size_t count = service.RunJob(options.positional[0], options.positional[1]);
+    std::cerr << "Wrote " << count << " contact maps to " << options.positional[1] << std::endl;
+    return 0;
+  } catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+}
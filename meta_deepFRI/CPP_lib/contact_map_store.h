@@ -0,0 +1,125 @@
+#ifndef CONTACT_MAP_STORE
+#define CONTACT_MAP_STORE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "contact_lists.h"
+#include "contact_map_cache.h"
+#include "contact_projection.h"
+#include "mapped_file.h"
+
+// Aligned contact maps do not depend on the DeepFRI mode, so a job computes them once and every mode reads them from the store.
+// A map is kept as its sorted unique upper triangle contacts encoded like contact lists (contact_lists.h), a few bytes per contact,
+// the diagonal is implied. Encoded maps are held in memory or spilled to a file and memory mapped.
+class AlignedContactMapStore {
+ public:
+  // encoded[i] spans offsets[i] to offsets[i + 1] of data
+  AlignedContactMapStore(std::vector<int> query_lengths, std::vector<uint64_t> offsets, std::string data, const std::string& spill_path)
+      : query_lengths_(std::move(query_lengths)), offsets_(std::move(offsets)), data_(std::move(data)) {
+    if (offsets_.size() != query_lengths_.size() + 1 || offsets_.back() != data_.size())
+      throw std::logic_error("Contact map store offsets do not match its data");
+    if (!spill_path.empty())
+      Spill(spill_path);
+  }
+
+  AlignedContactMapStore(const AlignedContactMapStore&) = delete;
+  AlignedContactMapStore& operator=(const AlignedContactMapStore&) = delete;
+
+  size_t Size() const {
+    return query_lengths_.size();
+  }
+
+  int QueryLength(const size_t index) const {
+    CheckIndex(index);
+    return query_lengths_[index];
+  }
+
+  const std::vector<int>& QueryLengths() const {
+    return query_lengths_;
+  }
+
+  // bytes of encoded contacts, held in memory unless spilled
+  size_t DataSize() const {
+    return offsets_.back();
+  }
+
+  bool Spilled() const {
+    return data_pointer_ != data_.data();
+  }
+
+  // Replaces sparse_contacts with upper triangle contacts of the map, returns query length.
+  int Contacts(const size_t index, SparseContacts& sparse_contacts) const {
+    CheckIndex(index);
+    const std::string_view encoded(data_pointer_ + offsets_[index], offsets_[index + 1] - offsets_[index]);
+    DecodeContactList(encoded, query_lengths_[index], sparse_contacts);
+    return query_lengths_[index];
+  }
+
+ private:
+  void CheckIndex(const size_t index) const {
+    if (index >= query_lengths_.size())
+      throw std::out_of_range("Contact map index " + std::to_string(index) + " is out of range of store of size " + std::to_string(query_lengths_.size()));
+  }
+
+  // The spill file is removed as soon as it is mapped, its pages stay valid until the store is destroyed.
+  void Spill(const std::string& spill_path) {
+    {
+      std::ofstream writer(spill_path, std::ios::out | std::ios::binary | std::ios::trunc);
+      writer.write(data_.data(), (std::streamsize) data_.size());
+      writer.close();
+      if (!writer)
+        throw std::runtime_error("Unable to write contact map store to " + spill_path);
+    }
+    spilled_ = MappedFile(spill_path);
+    std::remove(spill_path.c_str());
+    std::string().swap(data_);
+    data_pointer_ = spilled_.Data();
+  }
+
+  std::vector<int> query_lengths_;
+  std::vector<uint64_t> offsets_;
+  std::string data_;
+  MappedFile spilled_;
+  const char* data_pointer_ = data_.data();
+};
+
+
+// Groups maps of similar length for padded batches. Indexes are sorted by query length (ties keep store order) and cut into
+// batches of at most max_batch_size maps whose padded size, batch size * longest length^2, stays within max_batch_cells.
+// A map longer than max_batch_cells allows still gets a batch of its own.
+static std::vector<std::vector<int>> LengthBuckets(const std::vector<int>& query_lengths, const int max_batch_size, const size_t max_batch_cells) {
+  if (max_batch_size <= 0)
+    throw std::invalid_argument("max_batch_size must be positive");
+  std::vector<int> order(query_lengths.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = (int) i;
+  std::stable_sort(order.begin(), order.end(), [&query_lengths](const int a, const int b) { return query_lengths[a] < query_lengths[b]; });
+
+  std::vector<std::vector<int>> buckets;
+  for (const int index : order) {
+    // lengths only grow, the new map is the longest of its batch
+    const size_t length = (size_t) query_lengths[index];
+    if (buckets.empty() || (int) buckets.back().size() == max_batch_size || (buckets.back().size() + 1) * length * length > max_batch_cells)
+      buckets.emplace_back();
+    buckets.back().push_back(index);
+  }
+  return buckets;
+}
+
+// sorted unique upper triangle pairs of projected contacts appended as an encoded list
+static void EncodeAlignedContacts(SparseContacts& sparse_query_contacts, std::string& output) {
+  UpperTriangleContacts(sparse_query_contacts);
+  std::sort(sparse_query_contacts.begin(), sparse_query_contacts.end());
+  sparse_query_contacts.erase(std::unique(sparse_query_contacts.begin(), sparse_query_contacts.end()), sparse_query_contacts.end());
+  EncodeContactList(sparse_query_contacts, output);
+}
+
+#endif
@@ -0,0 +1,450 @@
+#ifndef CONTACT_MAPS
+#define CONTACT_MAPS
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "atoms_database.h"
+#include "atoms_file_io.h"
+#include "contact_definition.h"
+#include "contact_engine.h"
+#include "contact_lists.h"
+#include "contact_map_cache.h"
+#include "contact_map_store.h"
+#include "contact_projection.h"
+#include "contact_scratch.h"
+#include "engine_stats.h"
+#include "multiversion.h"
+#include "sequence_alignment.h"
+#include "thread_pool.h"
+
+// Contact maps of target structures and of queries aligned to them, the core shared by the python module,
+// the C API (contact_maps_c_api.h) and the contact map service. Nothing here depends on python.
+
+// Dense contact maps are materialised from upper triangle contacts only, first < second for every pair.
+// Contacts are bucketed by row for the upper triangle and by column for the mirrored lower triangle, then the matrix
+// is zeroed and filled one block of rows at a time. Every contact lands in a cache line that was just cleared,
+// instead of two scattered writes per contact, a row and a column one, into an already cold matrix.
+// Rows of output are row_stride bytes apart, only the first size bytes of the first size rows are written.
+MULTIVERSIONED static void FillSymmetricDenseContactMap(const SparseContacts& upper_contacts, const int size, bool* const output_data, const size_t row_stride) {
+  ContactScratch& scratch = ThreadContactScratch();
+  std::vector<int>& row_start = scratch.row_start;
+  std::vector<int>& column_start = scratch.column_start;
+  row_start.assign(size + 1, 0);
+  column_start.assign(size + 1, 0);
+  for (std::pair<int, int> contact : upper_contacts) {
+    ++row_start[contact.first + 1];
+    ++column_start[contact.second + 1];
+  }
+  for (int i = 0; i < size; ++i) {
+    row_start[i + 1] += row_start[i];
+    column_start[i + 1] += column_start[i];
+  }
+  // upper_contacts are usually sorted by row already, only the lower triangle needs the counting sort
+  std::vector<int>& lower_columns = scratch.columns;
+  std::vector<int>& column_fill = scratch.fill;
+  lower_columns.resize(upper_contacts.size());
+  column_fill.assign(column_start.begin(), column_start.end() - 1);
+  for (std::pair<int, int> contact : upper_contacts)
+    lower_columns[column_fill[contact.second]++] = contact.first;
+
+  const int block_rows = 16;
+  for (int block = 0; block < size; block += block_rows) {
+    const int block_end = std::min(block + block_rows, size);
+    if (row_stride == (size_t) size)
+      std::memset(output_data + (size_t) block * size, 0, (size_t) (block_end - block) * size);
+    else
+      for (int row = block; row < block_end; ++row)
+        std::memset(output_data + (size_t) row * row_stride, 0, size);
+    for (int row = block; row < block_end; ++row) {
+      output_data[(size_t) row * row_stride + row] = true;
+      for (int i = column_start[row]; i < column_start[row + 1]; ++i)
+        output_data[(size_t) row * row_stride + lower_columns[i]] = true;
+    }
+  }
+  // upper triangle in input order, rows written recently are still in cache when input is sorted
+  for (std::pair<int, int> contact : upper_contacts)
+    output_data[(size_t) contact.first * row_stride + contact.second] = true;
+}
+
+
+static bool* SymmetricDenseContactMap(const SparseContacts& upper_contacts, const int size) {
+  bool* const output_data = new bool[(size_t) size * size];
+  FillSymmetricDenseContactMap(upper_contacts, size, output_data, size);
+  return output_data;
+}
+
+
+static bool* DenseContactMap(const SparseContacts& sparse_contacts, const int chain_length) {
+  // target contacts always have first < second
+  return SymmetricDenseContactMap(sparse_contacts, chain_length);
+}
+
+
+static std::pair<bool*, int> LoadDenseContactMap(const std::string& file_path, const float angstrom_contact_threshold){
+  EngineTraceLabel trace_label(file_path);
+  const AtomsFile atoms_file = LoadAtomsFile(file_path);
+  const AtomsView& atoms = atoms_file.atoms;
+  std::vector<std::pair<int, int>> sparse_contacts = ComputeSparseContacts(atoms, angstrom_contact_threshold, GlobalContactDefinition().load());
+  return std::make_pair(DenseContactMap(sparse_contacts, atoms.chain_length), atoms.chain_length);
+}
+
+
+static const AtomsDatabaseEntry& FindDatabaseEntry(const AtomsDatabase& database, const std::string& protein_id) {
+  const AtomsDatabaseEntry* entry = database.FindLiveEntry(protein_id);
+  if (entry == nullptr)
+    throw std::out_of_range(protein_id + " not found in atoms database " + database.Path());
+  return *entry;
+}
+
+
+// precomputed contact list if the database has one for the threshold and contact definition, contact engine otherwise
+static SparseContacts DatabaseSparseContacts(const AtomsDatabase& database, const AtomsDatabaseEntry& entry, const std::string& protein_id,
+                                             const float angstrom_contact_threshold, const ContactDefinition definition) {
+  SparseContacts sparse_contacts;
+  if (definition != ContactDefinition::ALL_ATOMS || !database.LoadContactList(entry, angstrom_contact_threshold, sparse_contacts))
+    sparse_contacts = ComputeSparseContacts(database.View(entry, protein_id), angstrom_contact_threshold, definition);
+  return sparse_contacts;
+}
+
+
+static std::pair<bool*, int> LoadDenseContactMap(const AtomsDatabase& database, const std::string& protein_id, const float angstrom_contact_threshold){
+  EngineTraceLabel trace_label(protein_id);
+  const AtomsDatabaseEntry& entry = FindDatabaseEntry(database, protein_id);
+  std::vector<std::pair<int, int>> sparse_contacts = DatabaseSparseContacts(database, entry, protein_id, angstrom_contact_threshold,
+                                                                            GlobalContactDefinition().load());
+  return std::make_pair(DenseContactMap(sparse_contacts, (int) entry.chain_length), (int) entry.chain_length);
+}
+
+
+// chain_length, if given, is set to the chain length of the target, cached with its contacts
+static SparseContactsPtr LoadSparseContactMap(const std::string& file_path, const float angstrom_contact_threshold, int* chain_length = nullptr){
+  EngineTraceLabel trace_label(file_path);
+  // popular targets are aligned to many queries in every DeepFRI mode, their contacts are computed only once
+  const ContactDefinition definition = GlobalContactDefinition().load();
+  const std::string cache_key = ContactMapCache::Key(file_path, angstrom_contact_threshold, (int) definition);
+  SparseContactsPtr cached_contacts = GlobalContactMapCache().Get(cache_key, chain_length);
+  if (cached_contacts)
+    return cached_contacts;
+
+  const AtomsFile atoms_file = LoadAtomsFile(file_path);
+  const AtomsView& atoms = atoms_file.atoms;
+
+  // fill up vector with sparse atom contacts
+  auto sparse_contacts = std::make_shared<SparseContacts>(
+      ComputeSparseContacts(atoms, angstrom_contact_threshold, definition));
+  sparse_contacts->shrink_to_fit();
+
+  GlobalContactMapCache().Put(cache_key, sparse_contacts, atoms.chain_length);
+  if (chain_length != nullptr)
+    *chain_length = atoms.chain_length;
+  return sparse_contacts;
+}
+
+
+static SparseContactsPtr LoadSparseContactMap(const AtomsDatabase& database, const std::string& protein_id, const float angstrom_contact_threshold,
+                                              int* chain_length = nullptr){
+  EngineTraceLabel trace_label(protein_id);
+  const AtomsDatabaseEntry& entry = FindDatabaseEntry(database, protein_id);
+  if (chain_length != nullptr)
+    *chain_length = (int) entry.chain_length;
+  // content hash keeps cached contacts of unchanged proteins valid across database updates and compaction,
+  // version 1 databases have no hashes and use data offset instead
+  const uint64_t content_key = database.Header().version == 1 ? entry.data_offset : entry.content_hash;
+  const ContactDefinition definition = GlobalContactDefinition().load();
+  const std::string cache_key = ContactMapCache::Key(database.Path() + '/' + protein_id + '#' + std::to_string(content_key), angstrom_contact_threshold,
+                                                     (int) definition);
+  SparseContactsPtr cached_contacts = GlobalContactMapCache().Get(cache_key);
+  if (cached_contacts)
+    return cached_contacts;
+
+  // query time cost of databases built with contact lists is only decoding
+  auto sparse_contacts = std::make_shared<SparseContacts>(
+      DatabaseSparseContacts(database, entry, protein_id, angstrom_contact_threshold, definition));
+  sparse_contacts->shrink_to_fit();
+
+  GlobalContactMapCache().Put(cache_key, sparse_contacts, (int) entry.chain_length);
+  return sparse_contacts;
+}
+
+
+static void SetContactMapCacheSize(const size_t budget_bytes) {
+  GlobalContactMapCache().SetBudget(budget_bytes);
+}
+
+
+static void ClearContactMapCache() {
+  GlobalContactMapCache().Clear();
+}
+
+
+// Aligned contact map builders take projected query contacts and may reorder them.
+static std::pair<bool*, int> DenseFromAlignedContacts(SparseContacts& sparse_query_contacts, const int query_length) {
+  UpperTriangleContacts(sparse_query_contacts);
+  return std::make_pair(SymmetricDenseContactMap(sparse_query_contacts, query_length), query_length);
+}
+
+
+static std::pair<bool*, int> AlignContactMap(const SparseContactsPtr& sparse_target_contacts, const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  ContactScratch& scratch = ThreadContactScratch();
+  const int query_length = AlignSparseContacts(*sparse_target_contacts, query_alignment, target_alignment, generated_contacts, scratch);
+  return DenseFromAlignedContacts(scratch.query_contacts, query_length);
+}
+
+
+// Same entries as the dense contact map (symmetric, with the diagonal) in compressed sparse row form.
+// Column indexes of every row are sorted and unique.
+struct CsrContactMap {
+  int size = 0;
+  int nonzeros = 0;
+  std::unique_ptr<int[]> indptr;
+  std::unique_ptr<int[]> indices;
+};
+
+
+static CsrContactMap CsrFromSparseContacts(const SparseContacts& sparse_contacts, const int size) {
+  CsrContactMap contact_map;
+  contact_map.size = size;
+  contact_map.indptr.reset(new int[size + 1]);
+
+  // counting sort of both directions of every contact by row, the diagonal goes first
+  ContactScratch& scratch = ThreadContactScratch();
+  std::vector<int>& row_start = scratch.row_start;
+  row_start.assign(size + 1, 0);
+  for (int i = 0; i < size; ++i)
+    row_start[i + 1] = 1;
+  for (std::pair<int, int> pair : sparse_contacts) {
+    if (pair.first < 0 || pair.first >= size || pair.second < 0 || pair.second >= size || pair.first == pair.second)
+      continue;
+    ++row_start[pair.first + 1];
+    ++row_start[pair.second + 1];
+  }
+  for (int i = 0; i < size; ++i)
+    row_start[i + 1] += row_start[i];
+
+  std::vector<int>& columns = scratch.columns;
+  std::vector<int>& row_fill = scratch.fill;
+  columns.resize(row_start[size]);
+  row_fill.assign(row_start.begin(), row_start.end() - 1);
+  for (int i = 0; i < size; ++i)
+    columns[row_fill[i]++] = i;
+  for (std::pair<int, int> pair : sparse_contacts) {
+    if (pair.first < 0 || pair.first >= size || pair.second < 0 || pair.second >= size || pair.first == pair.second)
+      continue;
+    columns[row_fill[pair.first]++] = pair.second;
+    columns[row_fill[pair.second]++] = pair.first;
+  }
+
+  // generated and projected contacts may repeat, duplicates are dropped while compacting rows
+  int nonzeros = 0;
+  contact_map.indptr[0] = 0;
+  for (int i = 0; i < size; ++i) {
+    std::sort(columns.begin() + row_start[i], columns.begin() + row_start[i + 1]);
+    auto row_end = std::unique(columns.begin() + row_start[i], columns.begin() + row_start[i + 1]);
+    nonzeros = (int) (std::copy(columns.begin() + row_start[i], row_end, columns.begin() + nonzeros) - columns.begin());
+    contact_map.indptr[i + 1] = nonzeros;
+  }
+  contact_map.nonzeros = nonzeros;
+  contact_map.indices.reset(new int[nonzeros]);
+  std::copy(columns.begin(), columns.begin() + nonzeros, contact_map.indices.get());
+  return contact_map;
+}
+
+
+static CsrContactMap CsrFromAlignedContacts(SparseContacts& sparse_query_contacts, const int query_length) {
+  return CsrFromSparseContacts(sparse_query_contacts, query_length);
+}
+
+
+static CsrContactMap AlignCsrContactMap(const SparseContactsPtr& sparse_target_contacts, const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  ContactScratch& scratch = ThreadContactScratch();
+  const int query_length = AlignSparseContacts(*sparse_target_contacts, query_alignment, target_alignment, generated_contacts, scratch);
+  return CsrFromAlignedContacts(scratch.query_contacts, query_length);
+}
+
+
+// Contact map with one bit per entry, row r takes row_bytes bytes and column c is bit 7 - c % 8 of byte c / 8,
+// the order np.unpackbits uses by default. Padding bits at the end of every row stay zero.
+struct PackedContactMap {
+  int size = 0;
+  int row_bytes = 0;
+  std::unique_ptr<uint8_t[]> bits;
+
+  void Set(int row, int column) {
+    bits[(size_t) row * row_bytes + column / 8] |= (uint8_t) (0x80u >> (column % 8));
+  }
+};
+
+
+// Sets bits of the diagonal and of both directions of every contact, bits must be zeroed and rows row_bytes long.
+MULTIVERSIONED static void SetPackedContacts(const SparseContacts& sparse_contacts, const int size, uint8_t* const bits, const size_t row_bytes) {
+  const auto set = [bits, row_bytes](const int row, const int column) {
+    bits[(size_t) row * row_bytes + column / 8] |= (uint8_t) (0x80u >> (column % 8));
+  };
+  for (int i = 0; i < size; ++i)
+    set(i, i);
+  for (std::pair<int, int> pair : sparse_contacts) {
+    if (pair.first < 0 || pair.first >= size || pair.second < 0 || pair.second >= size)
+      continue;
+    set(pair.first, pair.second);
+    set(pair.second, pair.first);
+  }
+}
+
+
+static PackedContactMap PackedFromSparseContacts(const SparseContacts& sparse_contacts, const int size) {
+  PackedContactMap contact_map;
+  contact_map.size = size;
+  contact_map.row_bytes = (size + 7) / 8;
+  contact_map.bits.reset(new uint8_t[(size_t) size * contact_map.row_bytes]());
+  SetPackedContacts(sparse_contacts, size, contact_map.bits.get(), contact_map.row_bytes);
+  return contact_map;
+}
+
+
+static PackedContactMap PackedFromAlignedContacts(SparseContacts& sparse_query_contacts, const int query_length) {
+  return PackedFromSparseContacts(sparse_query_contacts, query_length);
+}
+
+
+static PackedContactMap AlignPackedContactMap(const SparseContactsPtr& sparse_target_contacts, const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  ContactScratch& scratch = ThreadContactScratch();
+  const int query_length = AlignSparseContacts(*sparse_target_contacts, query_alignment, target_alignment, generated_contacts, scratch);
+  return PackedFromAlignedContacts(scratch.query_contacts, query_length);
+}
+
+
+// Batch input, alignments are given either as pairs of aligned strings or as alignment runs of sequence_alignment.h.
+struct AlignmentInputs {
+  std::vector<std::string> query_alignments;
+  std::vector<std::string> target_alignments;
+  std::vector<AlignmentRuns> runs;
+  bool use_runs = false;
+
+  size_t Size() const {
+    return use_runs ? runs.size() : query_alignments.size();
+  }
+
+  // projects into scratch.query_contacts, returns query length
+  int Project(const size_t index, const SparseContacts& sparse_target_contacts, const int generated_contacts, ContactScratch& scratch) const {
+    if (use_runs)
+      return AlignSparseContacts(sparse_target_contacts, runs[index], generated_contacts, scratch);
+    return AlignSparseContacts(sparse_target_contacts, query_alignments[index], target_alignments[index], generated_contacts, scratch);
+  }
+};
+
+static AlignmentInputs StringAlignmentInputs(std::vector<std::string> query_alignments, std::vector<std::string> target_alignments) {
+  if (query_alignments.size() != target_alignments.size())
+    throw std::invalid_argument("query_alignments and target_alignments must have the same length");
+  AlignmentInputs alignments;
+  alignments.query_alignments = std::move(query_alignments);
+  alignments.target_alignments = std::move(target_alignments);
+  return alignments;
+}
+
+
+static AlignmentInputs CigarAlignmentInputs(const std::vector<std::string>& cigars) {
+  AlignmentInputs alignments;
+  alignments.use_runs = true;
+  alignments.runs.reserve(cigars.size());
+  for (const std::string& cigar : cigars)
+    alignments.runs.push_back(ParseCigar(cigar));
+  return alignments;
+}
+
+
+typedef std::function<SparseContactsPtr(const std::string&)> SparseContactsLoader;
+
+// Alignments sharing a target are grouped, so target contacts are computed once per batch. Projection of
+// the alignments is then split into smaller tasks that idle workers can steal. Python callers release the GIL around it.
+// Every worker projects into its own ContactScratch.
+// build(projected query contacts, query length) gives a ContactMap and release frees a ContactMap after an error.
+template <typename ContactMap, typename BuildFunction, typename ReleaseFunction>
+static std::vector<ContactMap> ParallelBuildContactMaps(const SparseContactsLoader& load_target_contacts, const std::vector<std::string>& target_names,
+                                                        const AlignmentInputs& alignments, const int generated_contacts, const int thread_count,
+                                                        const BuildFunction& build, const ReleaseFunction& release) {
+  const size_t batch_size = target_names.size();
+  if (alignments.Size() != batch_size)
+    throw std::invalid_argument("targets and alignments must have the same length");
+
+  // group alignments by target keeping order of first occurrence
+  std::unordered_map<std::string, size_t> target_groups_index;
+  std::vector<std::vector<size_t>> target_groups;
+  for (size_t i = 0; i < batch_size; ++i) {
+    auto inserted = target_groups_index.emplace(target_names[i], target_groups.size());
+    if (inserted.second)
+      target_groups.emplace_back();
+    target_groups[inserted.first->second].push_back(i);
+  }
+
+  const size_t alignments_per_task = 16;
+  std::vector<ContactMap> contact_maps(batch_size);
+  try {
+    WorkStealingPool pool(thread_count);
+    for (const std::vector<size_t>& group : target_groups) {
+      pool.Submit([&, group_ptr = &group]() {
+        SparseContactsPtr sparse_target_contacts = load_target_contacts(target_names[group_ptr->front()]);
+        for (size_t begin = 0; begin < group_ptr->size(); begin += alignments_per_task) {
+          pool.Submit([&, group_ptr, sparse_target_contacts, begin]() {
+            EngineTraceLabel trace_label(target_names[group_ptr->front()]);
+            const size_t end = std::min(begin + alignments_per_task, group_ptr->size());
+            ContactScratch& scratch = ThreadContactScratch();
+            for (size_t i = begin; i < end; ++i) {
+              const size_t index = group_ptr->operator[](i);
+              const int query_length = alignments.Project(index, *sparse_target_contacts, generated_contacts, scratch);
+              contact_maps[index] = build(scratch.query_contacts, query_length);
+            }
+          });
+        }
+      });
+    }
+    pool.Wait();
+  } catch (...) {
+    for (ContactMap& contact_map : contact_maps)
+      release(contact_map);
+    throw;
+  }
+  return contact_maps;
+}
+
+
+// Store of aligned contact maps computed once and shared by all DeepFRI modes, see contact_map_store.h.
+// Empty spill_path keeps encoded maps in memory, otherwise they are written there and memory mapped.
+static std::shared_ptr<AlignedContactMapStore> BuildContactMapStore(const SparseContactsLoader& load_target_contacts, const std::vector<std::string>& target_names,
+                                                                    const AlignmentInputs& alignments, const int generated_contacts, const int thread_count,
+                                                                    const std::string& spill_path) {
+  std::vector<std::pair<std::string, int>> encoded_maps = ParallelBuildContactMaps<std::pair<std::string, int>>(
+      load_target_contacts, target_names, alignments, generated_contacts, thread_count,
+      [](SparseContacts& sparse_query_contacts, const int query_length) {
+        std::string encoded;
+        EncodeAlignedContacts(sparse_query_contacts, encoded);
+        return std::make_pair(std::move(encoded), query_length);
+      },
+      [](std::pair<std::string, int>&) {});
+
+  std::vector<int> query_lengths;
+  std::vector<uint64_t> offsets(1, 0);
+  query_lengths.reserve(encoded_maps.size());
+  offsets.reserve(encoded_maps.size() + 1);
+  size_t data_size = 0;
+  for (const std::pair<std::string, int>& encoded_map : encoded_maps)
+    data_size += encoded_map.first.size();
+  std::string data;
+  data.reserve(data_size);
+  for (std::pair<std::string, int>& encoded_map : encoded_maps) {
+    data += encoded_map.first;
+    std::string().swap(encoded_map.first);
+    query_lengths.push_back(encoded_map.second);
+    offsets.push_back(data.size());
+  }
+  return std::make_shared<AlignedContactMapStore>(std::move(query_lengths), std::move(offsets), std::move(data), spill_path);
+}
+
+#endif
@@ -0,0 +1,155 @@
+#include "contact_maps_c_api.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "contact_maps.h"
+
+struct DeepFriAtomsDatabase {
+  explicit DeepFriAtomsDatabase(const std::string& database_path) : database(database_path) {}
+
+  AtomsDatabase database;
+};
+
+static std::string& LastError() {
+  thread_local std::string message;
+  return message;
+}
+
+// exceptions never cross the C boundary, they become return codes and the message of the thread
+template <typename Function>
+static int Guarded(const Function& function) {
+  try {
+    function();
+    LastError().clear();
+    return 0;
+  } catch (const std::exception& error) {
+    LastError() = error.what();
+  } catch (...) {
+    LastError() = "Unknown error";
+  }
+  return -1;
+}
+
+template <typename T>
+static T* CopyToMalloc(const T* data, const size_t count) {
+  T* const output = static_cast<T*>(std::malloc(std::max(count, (size_t) 1) * sizeof(T)));
+  if (output == nullptr)
+    throw std::bad_alloc();
+  if (count > 0)
+    std::memcpy(output, data, count * sizeof(T));
+  return output;
+}
+
+static void CheckArgument(const void* argument, const char* name) {
+  if (argument == nullptr)
+    throw std::invalid_argument(std::string(name) + " must not be NULL");
+}
+
+// chain_length, if given, is read from the database index or cached with the contacts of the atoms file, the file is loaded at most once
+static SparseContactsPtr TargetContacts(const DeepFriAtomsDatabase* database, const char* target, const float angstrom_contact_threshold,
+                                        int* chain_length = nullptr) {
+  CheckArgument(target, "target");
+  if (database != nullptr)
+    return LoadSparseContactMap(database->database, target, angstrom_contact_threshold, chain_length);
+  return LoadSparseContactMap(std::string(target), angstrom_contact_threshold, chain_length);
+}
+
+static void OutputPackedContactMap(SparseContacts& sparse_query_contacts, const int query_length, uint8_t** bits, int32_t* query_length_output) {
+  const PackedContactMap contact_map = PackedFromAlignedContacts(sparse_query_contacts, query_length);
+  *bits = CopyToMalloc(contact_map.bits.get(), (size_t) contact_map.size * contact_map.row_bytes);
+  *query_length_output = contact_map.size;
+}
+
+
+extern "C" {
+
+const char* deepfri_last_error(void) {
+  return LastError().c_str();
+}
+
+
+int deepfri_open_atoms_database(const char* database_path, DeepFriAtomsDatabase** database) {
+  return Guarded([&]() {
+    CheckArgument(database_path, "database_path");
+    CheckArgument(database, "database");
+    *database = new DeepFriAtomsDatabase(database_path);
+  });
+}
+
+
+void deepfri_close_atoms_database(DeepFriAtomsDatabase* database) {
+  delete database;
+}
+
+
+int deepfri_set_contact_definition(const char* definition) {
+  return Guarded([&]() {
+    CheckArgument(definition, "definition");
+    SetContactDefinition(definition);
+  });
+}
+
+
+void deepfri_set_contact_map_cache_size(const uint64_t budget_bytes) {
+  SetContactMapCacheSize((size_t) budget_bytes);
+}
+
+
+int deepfri_target_contacts(const DeepFriAtomsDatabase* database, const char* target, const float angstrom_contact_threshold, int32_t** contacts,
+                            int64_t* count, int32_t* chain_length) {
+  return Guarded([&]() {
+    CheckArgument(contacts, "contacts");
+    CheckArgument(count, "count");
+    CheckArgument(chain_length, "chain_length");
+    int length;
+    const SparseContactsPtr sparse_contacts = TargetContacts(database, target, angstrom_contact_threshold, &length);
+    static_assert(sizeof(std::pair<int, int>) == 2 * sizeof(int32_t), "contact pairs must be two packed int32");
+    *contacts = CopyToMalloc(reinterpret_cast<const int32_t*>(sparse_contacts->data()), sparse_contacts->size() * 2);
+    *count = (int64_t) sparse_contacts->size();
+    *chain_length = (int32_t) length;
+  });
+}
+
+
+int deepfri_aligned_packed_contact_map(const DeepFriAtomsDatabase* database, const char* target, const float angstrom_contact_threshold,
+                                       const char* query_alignment, const char* target_alignment, const int32_t generated_contacts, uint8_t** bits,
+                                       int32_t* query_length) {
+  return Guarded([&]() {
+    CheckArgument(query_alignment, "query_alignment");
+    CheckArgument(target_alignment, "target_alignment");
+    CheckArgument(bits, "bits");
+    CheckArgument(query_length, "query_length");
+    const SparseContactsPtr sparse_target_contacts = TargetContacts(database, target, angstrom_contact_threshold);
+    ContactScratch& scratch = ThreadContactScratch();
+    const int length = AlignSparseContacts(*sparse_target_contacts, query_alignment, target_alignment, generated_contacts, scratch);
+    OutputPackedContactMap(scratch.query_contacts, length, bits, query_length);
+  });
+}
+
+
+int deepfri_cigar_aligned_packed_contact_map(const DeepFriAtomsDatabase* database, const char* target, const float angstrom_contact_threshold,
+                                             const char* cigar, const int32_t generated_contacts, uint8_t** bits, int32_t* query_length) {
+  return Guarded([&]() {
+    CheckArgument(cigar, "cigar");
+    CheckArgument(bits, "bits");
+    CheckArgument(query_length, "query_length");
+    const SparseContactsPtr sparse_target_contacts = TargetContacts(database, target, angstrom_contact_threshold);
+    ContactScratch& scratch = ThreadContactScratch();
+    const int length = AlignSparseContacts(*sparse_target_contacts, ParseCigar(cigar), generated_contacts, scratch);
+    OutputPackedContactMap(scratch.query_contacts, length, bits, query_length);
+  });
+}
+
+
+void deepfri_free(void* data) {
+  std::free(data);
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef CONTACT_MAPS_C_API
+#define CONTACT_MAPS_C_API
+
+#include <stdint.h>
+
+/* C interface of the contact map core (contact_maps.h), for callers without python or C++.
+ * Functions return 0 on success and -1 on error, deepfri_last_error then gives the message of the calling thread.
+ * Arrays handed out are allocated by the library and released with deepfri_free.
+ * Packed maps have one bit per entry, row r takes (size + 7) / 8 bytes and column c is bit 7 - c % 8 of byte c / 8. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct DeepFriAtomsDatabase DeepFriAtomsDatabase;
+
+/* message of the last failed call of this thread, empty if there was none */
+const char* deepfri_last_error(void);
+
+int deepfri_open_atoms_database(const char* database_path, DeepFriAtomsDatabase** database);
+void deepfri_close_atoms_database(DeepFriAtomsDatabase* database);
+
+/* ALL_ATOMS, CA or CB */
+int deepfri_set_contact_definition(const char* definition);
+/* bytes of target contacts kept between calls, 0 disables the cache */
+void deepfri_set_contact_map_cache_size(uint64_t budget_bytes);
+
+/* Upper triangle residue contacts of a target, count (first, second) pairs in contacts.
+ * target is a protein id of database, or an atoms file path when database is NULL. */
+int deepfri_target_contacts(const DeepFriAtomsDatabase* database, const char* target, float angstrom_contact_threshold, int32_t** contacts,
+                            int64_t* count, int32_t* chain_length);
+
+/* packed contact map of a query aligned to a target, given as aligned strings */
+int deepfri_aligned_packed_contact_map(const DeepFriAtomsDatabase* database, const char* target, float angstrom_contact_threshold,
+                                       const char* query_alignment, const char* target_alignment, int32_t generated_contacts, uint8_t** bits,
+                                       int32_t* query_length);
+
+/* same for an alignment given as a CIGAR string of the query against the target */
+int deepfri_cigar_aligned_packed_contact_map(const DeepFriAtomsDatabase* database, const char* target, float angstrom_contact_threshold, const char* cigar,
+                                             int32_t generated_contacts, uint8_t** bits, int32_t* query_length);
+
+void deepfri_free(void* data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
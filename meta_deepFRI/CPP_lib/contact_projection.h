@@ -0,0 +1,210 @@
+#ifndef CONTACT_PROJECTION
+#define CONTACT_PROJECTION
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "contact_map_cache.h"
+#include "engine_stats.h"
+#include "multiversion.h"
+#include "sequence_alignment.h"
+
+// Projection of target contacts onto the query works in two stages:
+//   1. alignment is turned into ResidueMapping, a sized target to query index map and query residues aligned to gaps
+//   2. ProjectContacts emits generated and projected contacts using only that mapping
+// Every emitted pair is inside [0, query_length), consumers do not have to check bounds again.
+
+// What to do with a target contact whose residue is not covered by the alignment,
+// that happens when the structure has more residues than the target sequence that was aligned.
+enum class ContactBoundsPolicy { SKIP, RAISE };
+
+inline std::atomic<ContactBoundsPolicy>& GlobalContactBoundsPolicy() {
+  static std::atomic<ContactBoundsPolicy> policy(ContactBoundsPolicy::SKIP);
+  return policy;
+}
+
+
+struct ResidueMapping {
+  // query index of every target residue, -1 if target residue is aligned to a gap
+  std::vector<int> target_to_query;
+  // query residues aligned to gaps, they get generated contacts
+  std::vector<int> gapped_query_residues;
+  int query_length = 0;
+};
+
+
+// Out parameter versions clear and refill mapping, so vectors of a reused mapping keep their memory.
+static void MappingFromAlignment(const std::string& query_alignment, const std::string& target_alignment, ResidueMapping& mapping) {
+  if (query_alignment.size() != target_alignment.size())
+    throw std::invalid_argument("query_alignment and target_alignment must have the same length");
+
+  mapping.target_to_query.clear();
+  mapping.gapped_query_residues.clear();
+  mapping.target_to_query.reserve(target_alignment.size());
+  int query_index = 0;
+  for (size_t i = 0; i < query_alignment.size(); ++i) {
+    const bool query_residue = query_alignment[i] != '-';
+    const bool target_residue = target_alignment[i] != '-';
+    // columns with gaps on both sides do not move any index
+    if (target_residue)
+      mapping.target_to_query.push_back(query_residue ? query_index : -1);
+    else if (query_residue)
+      mapping.gapped_query_residues.push_back(query_index);
+    query_index += query_residue;
+  }
+  mapping.query_length = query_index;
+}
+
+
+static ResidueMapping MappingFromAlignment(const std::string& query_alignment, const std::string& target_alignment) {
+  ResidueMapping mapping;
+  MappingFromAlignment(query_alignment, target_alignment, mapping);
+  return mapping;
+}
+
+
+static void MappingFromRuns(const AlignmentRuns& runs, ResidueMapping& mapping) {
+  size_t target_length = 0;
+  size_t gapped_count = 0;
+  for (const AlignmentRun& run : runs) {
+    if (run.operation == 'I')
+      gapped_count += run.length;
+    else
+      target_length += run.length;
+  }
+
+  mapping.target_to_query.resize(target_length);
+  mapping.gapped_query_residues.resize(gapped_count);
+  int* target_to_query = mapping.target_to_query.data();
+  int* gapped = mapping.gapped_query_residues.data();
+  int query_index = 0;
+  for (const AlignmentRun& run : runs) {
+    if (run.operation == 'D') {
+      target_to_query = std::fill_n(target_to_query, run.length, -1);
+    } else if (run.operation == 'I') {
+      for (int k = 0; k < run.length; ++k)
+        *gapped++ = query_index++;
+    } else {
+      for (int k = 0; k < run.length; ++k)
+        *target_to_query++ = query_index++;
+    }
+  }
+  mapping.query_length = query_index;
+}
+
+
+static ResidueMapping MappingFromRuns(const AlignmentRuns& runs) {
+  ResidueMapping mapping;
+  MappingFromRuns(runs, mapping);
+  return mapping;
+}
+
+
+// Compile with VALIDATE_ALIGNED_CONTACTS (cmake -DDEEPFRI_VALIDATE_CONTACTS=ON) to check every emitted pair.
+static void ValidateProjectedContacts(const SparseContacts& sparse_query_contacts, const int query_length) {
+  for (std::pair<int, int> pair : sparse_query_contacts) {
+    if (pair.first < 0 || pair.first >= query_length || pair.second < 0 || pair.second >= query_length)
+      throw std::logic_error("Projected contact (" + std::to_string(pair.first) + ", " + std::to_string(pair.second) +
+                             ") is outside of query of length " + std::to_string(query_length));
+  }
+}
+
+
+// Replaces sparse_query_contacts with projected query contacts, returns query length.
+MULTIVERSIONED static int ProjectContacts(const ResidueMapping& mapping, const SparseContacts& sparse_target_contacts, const int generated_contacts,
+                           const ContactBoundsPolicy policy, SparseContacts& sparse_query_contacts) {
+  EngineStageTimer timer(EngineCounter::PROJECTION_NS);
+  const int query_length = mapping.query_length;
+  const int generated = std::max(generated_contacts, 0);
+  sparse_query_contacts.clear();
+  sparse_query_contacts.reserve(sparse_target_contacts.size() + 2 * (size_t) generated * mapping.gapped_query_residues.size());
+
+  // neighbours past either end of the query are clipped, not emitted
+  for (const int query_index : mapping.gapped_query_residues) {
+    const int begin = std::max(query_index - generated, 0);
+    const int end = std::min(query_index + generated, query_length - 1);
+    for (int j = begin; j < query_index; ++j)
+      sparse_query_contacts.emplace_back(j, query_index);
+    for (int j = query_index + 1; j <= end; ++j)
+      sparse_query_contacts.emplace_back(j, query_index);
+  }
+
+  const int* const target_to_query = mapping.target_to_query.data();
+  const unsigned target_length = (unsigned) mapping.target_to_query.size();
+  for (std::pair<int, int> contact : sparse_target_contacts) {
+    // negative indexes wrap around and fail the same comparison
+    if ((unsigned) contact.first >= target_length || (unsigned) contact.second >= target_length) {
+      if (policy == ContactBoundsPolicy::RAISE)
+        throw std::out_of_range("Target contact (" + std::to_string(contact.first) + ", " + std::to_string(contact.second) +
+                                ") is outside of aligned target of length " + std::to_string(target_length));
+      continue;
+    }
+    const int contact_x = target_to_query[contact.first];
+    const int contact_y = target_to_query[contact.second];
+    if ((contact_x | contact_y) < 0)
+      continue;
+    sparse_query_contacts.emplace_back(contact_x, contact_y);
+  }
+
+#ifdef VALIDATE_ALIGNED_CONTACTS
+  ValidateProjectedContacts(sparse_query_contacts, query_length);
+#endif
+  return query_length;
+}
+
+
+// Returns projected query contacts and query length.
+static std::pair<SparseContacts, int> ProjectContacts(const ResidueMapping& mapping, const SparseContacts& sparse_target_contacts,
+                                                      const int generated_contacts, const ContactBoundsPolicy policy) {
+  SparseContacts sparse_query_contacts;
+  const int query_length = ProjectContacts(mapping, sparse_target_contacts, generated_contacts, policy, sparse_query_contacts);
+  return std::make_pair(std::move(sparse_query_contacts), query_length);
+}
+
+
+// projected contacts are inside the query, they are only normalised to upper triangle pairs in place
+static void UpperTriangleContacts(SparseContacts& sparse_query_contacts) {
+  size_t upper_count = 0;
+  for (std::pair<int, int> pair : sparse_query_contacts) {
+    if (pair.first != pair.second)
+      sparse_query_contacts[upper_count++] = std::make_pair(std::min(pair.first, pair.second), std::max(pair.first, pair.second));
+  }
+  sparse_query_contacts.resize(upper_count);
+}
+
+
+// Projects target contacts onto the query, query residues aligned to gaps get generated_contacts neighbours.
+static std::pair<SparseContacts, int> AlignSparseContacts(const SparseContactsPtr& sparse_target_contacts, const std::string& query_alignment,
+                                                          const std::string& target_alignment, const int generated_contacts) {
+  return ProjectContacts(MappingFromAlignment(query_alignment, target_alignment), *sparse_target_contacts, generated_contacts,
+                         GlobalContactBoundsPolicy().load());
+}
+
+
+static std::pair<SparseContacts, int> AlignSparseContacts(const SparseContactsPtr& sparse_target_contacts, const AlignmentRuns& runs, const int generated_contacts) {
+  return ProjectContacts(MappingFromRuns(runs), *sparse_target_contacts, generated_contacts, GlobalContactBoundsPolicy().load());
+}
+
+
+// python interface
+
+// "skip" drops target contacts outside of the alignment, "raise" raises IndexError
+static void SetContactBoundsPolicy(const std::string& policy) {
+  if (policy == "skip")
+    GlobalContactBoundsPolicy().store(ContactBoundsPolicy::SKIP);
+  else if (policy == "raise")
+    GlobalContactBoundsPolicy().store(ContactBoundsPolicy::RAISE);
+  else
+    throw std::invalid_argument("Unknown contact bounds policy " + policy + ", use skip or raise");
+}
+
+
+static std::string GetContactBoundsPolicy() {
+  return GlobalContactBoundsPolicy().load() == ContactBoundsPolicy::RAISE ? "raise" : "skip";
+}
+
+#endif
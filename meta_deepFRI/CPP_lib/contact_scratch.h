@@ -0,0 +1,44 @@
+#ifndef CONTACT_SCRATCH
+#define CONTACT_SCRATCH
+
+#include <string>
+#include <vector>
+
+#include "contact_map_cache.h"
+#include "contact_projection.h"
+#include "sequence_alignment.h"
+
+// Scratch structures of aligned contact maps, every thread keeps its own and reuses them for every contact map it builds.
+// Vectors are cleared, never freed, so after the longest query has been seen building a contact map allocates nothing but its output.
+// Workers of batch functions live for one batch, the calling thread keeps its scratch for the lifetime of the process.
+struct ContactScratch {
+  ResidueMapping mapping;
+  // projected query contacts
+  SparseContacts query_contacts;
+  // counting sorts of the dense and sparse contact map builders
+  std::vector<int> row_start;
+  std::vector<int> column_start;
+  std::vector<int> fill;
+  std::vector<int> columns;
+};
+
+static ContactScratch& ThreadContactScratch() {
+  thread_local ContactScratch scratch;
+  return scratch;
+}
+
+
+// Projects target contacts into scratch.query_contacts, returns query length.
+static int AlignSparseContacts(const SparseContacts& sparse_target_contacts, const std::string& query_alignment, const std::string& target_alignment,
+                               const int generated_contacts, ContactScratch& scratch) {
+  MappingFromAlignment(query_alignment, target_alignment, scratch.mapping);
+  return ProjectContacts(scratch.mapping, sparse_target_contacts, generated_contacts, GlobalContactBoundsPolicy().load(), scratch.query_contacts);
+}
+
+
+static int AlignSparseContacts(const SparseContacts& sparse_target_contacts, const AlignmentRuns& runs, const int generated_contacts, ContactScratch& scratch) {
+  MappingFromRuns(runs, scratch.mapping);
+  return ProjectContacts(scratch.mapping, sparse_target_contacts, generated_contacts, GlobalContactBoundsPolicy().load(), scratch.query_contacts);
+}
+
+#endif
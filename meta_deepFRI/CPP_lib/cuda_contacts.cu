@@ -0,0 +1,320 @@
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cuda_contacts.h"
+
+// Kernels of the CUDA backend, see cuda_contacts.h.
+// Target contacts are a symmetric bit matrix per target, row r of target t takes (length + 31) / 32 words at target_bits_offsets[t].
+
+static void CheckCuda(const cudaError_t status, const char* what) {
+  if (status != cudaSuccess)
+    throw std::runtime_error(std::string("CUDA ") + what + " failed: " + cudaGetErrorString(status));
+}
+
+
+// device copy of a host vector, freed with the owner
+template <typename T>
+class DeviceVector {
+ public:
+  explicit DeviceVector(const size_t size) : size_(size) {
+    if (size_ > 0)
+      CheckCuda(cudaMalloc(reinterpret_cast<void**>(&data_), size_ * sizeof(T)), "allocation");
+  }
+
+  explicit DeviceVector(const std::vector<T>& host) : DeviceVector(host.size()) {
+    if (size_ > 0)
+      CheckCuda(cudaMemcpy(data_, host.data(), size_ * sizeof(T), cudaMemcpyHostToDevice), "upload");
+  }
+
+  ~DeviceVector() {
+    cudaFree(data_);
+  }
+
+  DeviceVector(const DeviceVector&) = delete;
+  DeviceVector& operator=(const DeviceVector&) = delete;
+
+  T* Data() const {
+    return data_;
+  }
+
+ private:
+  T* data_ = nullptr;
+  size_t size_;
+};
+
+
+constexpr int TILE_RESIDUES = 16;
+constexpr int TILE_ATOMS = 512;
+
+struct ResidueTile {
+  int target;
+  int row_tile;
+  int column_tile;
+};
+
+
+// Same rounding as the CPU kernels: differences, squares and (dx * dx + dy * dy) + dz * dz are never fused.
+__device__ __forceinline__ bool WithinThreshold(const float3 a, const float3 b, const float squared_threshold) {
+  const float dx = __fsub_rn(a.x, b.x);
+  const float dy = __fsub_rn(a.y, b.y);
+  const float dz = __fsub_rn(a.z, b.z);
+  return __fadd_rn(__fadd_rn(__fmul_rn(dx, dx), __fmul_rn(dy, dy)), __fmul_rn(dz, dz)) <= squared_threshold;
+}
+
+
+__device__ __forceinline__ void SetTargetContact(uint32_t* bits, const int words, const int row, const int column) {
+  atomicOr(bits + (size_t) row * words + column / 32, 1u << (column % 32));
+}
+
+
+// One block per upper triangle tile of TILE_RESIDUES x TILE_RESIDUES residue pairs, one thread per pair.
+// Atoms of both tile residue ranges are staged in shared memory TILE_ATOMS at a time, the block stops early once every pair is decided.
+__global__ void ResidueContactsKernel(const ResidueTile* tiles, const int* target_lengths, const int64_t* residue_offsets, const int64_t* target_bits_offsets,
+                                      const int* group_indexes, const float3* positions, const float squared_threshold, uint32_t* target_bits) {
+  __shared__ float3 row_atoms[TILE_ATOMS];
+  __shared__ float3 column_atoms[TILE_ATOMS];
+
+  const ResidueTile tile = tiles[blockIdx.x];
+  const int length = target_lengths[tile.target];
+  const int* groups = group_indexes + residue_offsets[tile.target];
+  const int row_begin = tile.row_tile * TILE_RESIDUES;
+  const int column_begin = tile.column_tile * TILE_RESIDUES;
+  const int row = row_begin + threadIdx.y;
+  const int column = column_begin + threadIdx.x;
+  const bool pair = row < length && column < length && row < column;
+
+  const int row_atoms_begin = groups[row_begin];
+  const int row_atoms_end = groups[min(row_begin + TILE_RESIDUES, length)];
+  const int column_atoms_begin = groups[column_begin];
+  const int column_atoms_end = groups[min(column_begin + TILE_RESIDUES, length)];
+  const int own_row_begin = pair ? groups[row] : 0;
+  const int own_row_end = pair ? groups[row + 1] : 0;
+  const int own_column_begin = pair ? groups[column] : 0;
+  const int own_column_end = pair ? groups[column + 1] : 0;
+  const int thread = threadIdx.y * blockDim.x + threadIdx.x;
+  const int thread_count = blockDim.x * blockDim.y;
+
+  bool found = false;
+  for (int row_chunk = row_atoms_begin; row_chunk < row_atoms_end; row_chunk += TILE_ATOMS) {
+    const int row_chunk_end = min(row_chunk + TILE_ATOMS, row_atoms_end);
+    __syncthreads();
+    for (int i = row_chunk + thread; i < row_chunk_end; i += thread_count)
+      row_atoms[i - row_chunk] = positions[i];
+
+    for (int column_chunk = column_atoms_begin; column_chunk < column_atoms_end; column_chunk += TILE_ATOMS) {
+      const int column_chunk_end = min(column_chunk + TILE_ATOMS, column_atoms_end);
+      if (__syncthreads_and(found || !pair))
+        break;
+      for (int i = column_chunk + thread; i < column_chunk_end; i += thread_count)
+        column_atoms[i - column_chunk] = positions[i];
+      __syncthreads();
+
+      if (!found && pair) {
+        const int a_begin = max(own_row_begin, row_chunk);
+        const int a_end = min(own_row_end, row_chunk_end);
+        const int b_begin = max(own_column_begin, column_chunk);
+        const int b_end = min(own_column_end, column_chunk_end);
+        for (int a = a_begin; a < a_end && !found; ++a) {
+          const float3 atom = row_atoms[a - row_chunk];
+          for (int b = b_begin; b < b_end; ++b) {
+            if (WithinThreshold(atom, column_atoms[b - column_chunk], squared_threshold)) {
+              found = true;
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (found) {
+    const int words = (length + 31) / 32;
+    uint32_t* bits = target_bits + target_bits_offsets[tile.target];
+    SetTargetContact(bits, words, row, column);
+    SetTargetContact(bits, words, column, row);
+  }
+}
+
+
+// contacts computed on the CPU, both directions
+__global__ void ScatterContactsKernel(const int* contacts, const int* contact_targets, const int64_t contact_count, const int* target_lengths,
+                                      const int64_t* target_bits_offsets, uint32_t* target_bits) {
+  const int64_t index = (int64_t) blockIdx.x * blockDim.x + threadIdx.x;
+  if (index >= contact_count)
+    return;
+  const int target = contact_targets[index];
+  const int length = target_lengths[target];
+  const int first = contacts[index * 2];
+  const int second = contacts[index * 2 + 1];
+  if ((unsigned) first >= (unsigned) length || (unsigned) second >= (unsigned) length)
+    return;
+  const int words = (length + 31) / 32;
+  uint32_t* bits = target_bits + target_bits_offsets[target];
+  SetTargetContact(bits, words, first, second);
+  SetTargetContact(bits, words, second, first);
+}
+
+
+// One thread per output byte of the batch, batch_offsets are prefix sums of the batch map sizes. Bit c of row r is set on the diagonal,
+// for generated contacts of gapped residues and for target contacts of the aligned target residues, like ProjectContacts followed by SetPackedContacts.
+__global__ void ProjectPackedKernel(const int query_count, const uint64_t* batch_offsets, const uint64_t* output_offsets, const int* query_targets,
+                                    const int* query_lengths, const int64_t* query_offsets, const int* query_to_target, const uint8_t* gapped,
+                                    const int generated_contacts, const int* target_lengths, const int64_t* target_bits_offsets, const uint32_t* target_bits,
+                                    uint8_t* output) {
+  const uint64_t byte = (uint64_t) blockIdx.x * blockDim.x + threadIdx.x;
+  if (byte >= batch_offsets[query_count])
+    return;
+  // last query starting at or before byte, empty queries share offsets with their successor
+  int low = 0;
+  int high = query_count - 1;
+  while (low < high) {
+    const int middle = (low + high + 1) / 2;
+    if (batch_offsets[middle] <= byte)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+  const int query = low;
+  const int query_length = query_lengths[query];
+  const int row_bytes = (query_length + 7) / 8;
+  const uint64_t position = byte - batch_offsets[query];
+  const int row = (int) (position / row_bytes);
+  const int column_begin = (int) (position % row_bytes) * 8;
+
+  const int* to_target = query_to_target + query_offsets[query];
+  const uint8_t* query_gapped = gapped + query_offsets[query];
+  const int target = query_targets[query];
+  const int words = (target_lengths[target] + 31) / 32;
+  const int target_row = to_target[row];
+  const uint32_t* row_bits = target_bits + target_bits_offsets[target] + (size_t) max(target_row, 0) * words;
+
+  uint8_t value = 0;
+  for (int k = 0; k < 8; ++k) {
+    const int column = column_begin + k;
+    if (column >= query_length)
+      break;
+    bool contact = column == row;
+    if (!contact && abs(column - row) <= generated_contacts)
+      contact = query_gapped[row] || query_gapped[column];
+    if (!contact && target_row >= 0) {
+      const int target_column = to_target[column];
+      contact = target_column >= 0 && ((row_bits[target_column / 32] >> (target_column % 32)) & 1u);
+    }
+    if (contact)
+      value |= (uint8_t) (0x80u >> k);
+  }
+  output[output_offsets[query] + position] = value;
+}
+
+
+static int BlockCount(const uint64_t items, const int block_size) {
+  return (int) ((items + block_size - 1) / block_size);
+}
+
+
+bool CudaContactsAvailable() {
+  static const bool available = []() {
+    int device_count = 0;
+    return cudaGetDeviceCount(&device_count) == cudaSuccess && device_count > 0;
+  }();
+  return available;
+}
+
+
+void* CudaAllocate(const size_t bytes) {
+  void* device_data = nullptr;
+  CheckCuda(cudaMalloc(&device_data, bytes), "allocation");
+  return device_data;
+}
+
+
+void CudaRelease(void* device_data) {
+  cudaFree(device_data);
+}
+
+
+void CudaCopyToHost(void* host_data, const void* device_data, const size_t bytes) {
+  CheckCuda(cudaMemcpy(host_data, device_data, bytes, cudaMemcpyDeviceToHost), "download");
+}
+
+
+void CudaAlignedPackedContactMaps(const CudaContactBatch& batch, uint8_t* device_output) {
+  const int target_count = (int) batch.target_lengths.size();
+  const int query_count = (int) batch.query_targets.size();
+  if (target_count == 0 || query_count == 0)
+    return;
+
+  std::vector<int64_t> target_bits_offsets(target_count + 1, 0);
+  std::vector<ResidueTile> tiles;
+  for (int target = 0; target < target_count; ++target) {
+    const int length = batch.target_lengths[target];
+    target_bits_offsets[target + 1] = target_bits_offsets[target] + (int64_t) length * ((length + 31) / 32);
+    const int tile_count = (length + TILE_RESIDUES - 1) / TILE_RESIDUES;
+    const int* groups = batch.group_indexes.data() + batch.residue_offsets[target];
+    if (groups[length] == groups[0])
+      continue;
+    for (int row_tile = 0; row_tile < tile_count; ++row_tile) {
+      for (int column_tile = row_tile; column_tile < tile_count; ++column_tile)
+        tiles.push_back(ResidueTile{target, row_tile, column_tile});
+    }
+  }
+
+  const DeviceVector<int> target_lengths(batch.target_lengths);
+  const DeviceVector<int64_t> residue_offsets(batch.residue_offsets);
+  const DeviceVector<int64_t> device_target_bits_offsets(target_bits_offsets);
+  const DeviceVector<int> group_indexes(batch.group_indexes);
+  const DeviceVector<float> positions(batch.positions);
+  const DeviceVector<uint32_t> target_bits((size_t) target_bits_offsets.back());
+  CheckCuda(cudaMemset(target_bits.Data(), 0, (size_t) target_bits_offsets.back() * sizeof(uint32_t)), "memset");
+
+  // blocks are launched in slices, grid x dimension is limited
+  const size_t max_blocks = 1 << 30;
+  if (!tiles.empty()) {
+    const DeviceVector<ResidueTile> device_tiles(tiles);
+    for (size_t first = 0; first < tiles.size(); first += max_blocks) {
+      const dim3 block(TILE_RESIDUES, TILE_RESIDUES);
+      ResidueContactsKernel<<<(unsigned) std::min(max_blocks, tiles.size() - first), block>>>(
+          device_tiles.Data() + first, target_lengths.Data(), residue_offsets.Data(), device_target_bits_offsets.Data(), group_indexes.Data(),
+          reinterpret_cast<const float3*>(positions.Data()), batch.squared_threshold, target_bits.Data());
+      CheckCuda(cudaGetLastError(), "contact kernel");
+    }
+  }
+
+  const int block_size = 256;
+  const int64_t contact_count = (int64_t) batch.contact_targets.size();
+  if (contact_count > 0) {
+    const DeviceVector<int> contacts(batch.contacts);
+    const DeviceVector<int> contact_targets(batch.contact_targets);
+    ScatterContactsKernel<<<BlockCount(contact_count, block_size), block_size>>>(contacts.Data(), contact_targets.Data(), contact_count, target_lengths.Data(),
+                                                                                  device_target_bits_offsets.Data(), target_bits.Data());
+    CheckCuda(cudaGetLastError(), "scatter kernel");
+    CheckCuda(cudaDeviceSynchronize(), "scatter kernel");
+  }
+
+  // maps of a batch part are not contiguous in the output, threads run over the batch bytes and write at the output offsets
+  std::vector<uint64_t> batch_offsets(query_count + 1, 0);
+  for (int query = 0; query < query_count; ++query) {
+    const int query_length = batch.query_lengths[query];
+    batch_offsets[query + 1] = batch_offsets[query] + (uint64_t) query_length * ((query_length + 7) / 8);
+  }
+  if (batch_offsets.back() == 0)
+    return;
+  const DeviceVector<uint64_t> device_batch_offsets(batch_offsets);
+  const DeviceVector<uint64_t> output_offsets(batch.output_offsets);
+  const DeviceVector<int> query_targets(batch.query_targets);
+  const DeviceVector<int> query_lengths(batch.query_lengths);
+  const DeviceVector<int64_t> query_offsets(batch.query_offsets);
+  const DeviceVector<int> query_to_target(batch.query_to_target);
+  const DeviceVector<uint8_t> gapped(batch.gapped);
+  ProjectPackedKernel<<<BlockCount(batch_offsets.back(), block_size), block_size>>>(
+      query_count, device_batch_offsets.Data(), output_offsets.Data(), query_targets.Data(), query_lengths.Data(), query_offsets.Data(),
+      query_to_target.Data(), gapped.Data(), batch.generated_contacts, target_lengths.Data(), device_target_bits_offsets.Data(), target_bits.Data(),
+      device_output);
+  CheckCuda(cudaGetLastError(), "projection kernel");
+  CheckCuda(cudaDeviceSynchronize(), "projection kernel");
+}
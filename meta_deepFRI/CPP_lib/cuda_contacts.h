@@ -0,0 +1,360 @@
+#ifndef CUDA_CONTACTS
+#define CUDA_CONTACTS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "atoms_database.h"
+#include "atoms_file_io.h"
+#include "contact_definition.h"
+#include "contact_maps.h"
+#include "contact_projection.h"
+#include "distance_kernel.h"
+
+// Optional CUDA backend of aligned packed contact maps, built with -DDEEPFRI_CUDA=ON (cuda_contacts.cu).
+// A batch uploads atom positions and group indexes of its targets, residue contacts are found by a tiled shared memory kernel
+// into a bit matrix per target, then every query is projected on the device straight into packed rows (PackedContactMap layout).
+// Distances use the same rounding as the CPU kernels, so maps are bit identical to the CPU engine.
+// Targets with fixed positions or precomputed contact lists get their contacts on the CPU and only the projection runs on the device.
+
+// Host copy of a batch. Atoms of residue r of target t are group_indexes[residue_offsets[t] + r] up to the next group index,
+// positions are x, y, z of every atom. Contacts computed on the CPU are upper triangle pairs of contact_targets[i].
+// Query residue r of query i is aligned to target residue query_to_target[query_offsets[i] + r], -1 if none, and gets
+// generated contacts if gapped[query_offsets[i] + r]. Map of query i is written at output_offsets[i] of the output.
+struct CudaContactBatch {
+  float squared_threshold = 0;
+  int generated_contacts = 0;
+
+  std::vector<int> target_lengths;
+  std::vector<int64_t> residue_offsets;
+  std::vector<int> group_indexes;
+  std::vector<float> positions;
+  std::vector<int> contacts;
+  std::vector<int> contact_targets;
+
+  std::vector<int> query_targets;
+  std::vector<int> query_lengths;
+  std::vector<int64_t> query_offsets;
+  std::vector<int> query_to_target;
+  std::vector<uint8_t> gapped;
+  std::vector<uint64_t> output_offsets;
+
+  // device bytes of target data, used to split very large batches
+  size_t TargetBytes() const {
+    size_t bytes = (group_indexes.size() + contacts.size() + contact_targets.size()) * sizeof(int) + positions.size() * sizeof(float);
+    for (const int length : target_lengths)
+      bytes += (size_t) length * ((length + 31) / 32) * sizeof(uint32_t);
+    return bytes;
+  }
+};
+
+// targets of a batch are split so that their device data stays within this budget
+constexpr size_t CUDA_BATCH_TARGET_BYTES = (size_t) 512 * 1024 * 1024;
+
+#ifdef DEEPFRI_CUDA
+// cuda_contacts.cu, errors are thrown as std::runtime_error
+bool CudaContactsAvailable();
+void* CudaAllocate(size_t bytes);
+void CudaRelease(void* device_data);
+void CudaCopyToHost(void* host_data, const void* device_data, size_t bytes);
+// writes packed maps of all queries of batch into device_output
+void CudaAlignedPackedContactMaps(const CudaContactBatch& batch, uint8_t* device_output);
+#else
+inline bool CudaContactsAvailable() {
+  return false;
+}
+
+[[noreturn]] inline void ThrowCudaUnavailable() {
+  throw std::runtime_error("AtomDistanceIO was built without CUDA, configure it with -DDEEPFRI_CUDA=ON");
+}
+
+inline void* CudaAllocate(size_t) {
+  ThrowCudaUnavailable();
+}
+
+inline void CudaRelease(void*) {}
+
+inline void CudaCopyToHost(void*, const void*, size_t) {
+  ThrowCudaUnavailable();
+}
+
+inline void CudaAlignedPackedContactMaps(const CudaContactBatch&, uint8_t*) {
+  ThrowCudaUnavailable();
+}
+#endif
+
+
+// "cuda" runs packed batch loaders on the GPU whenever one is available, the CPU engine is used otherwise.
+enum class ContactBackend { CPU, CUDA };
+
+inline std::atomic<ContactBackend>& GlobalContactBackend() {
+  static std::atomic<ContactBackend> backend(ContactBackend::CPU);
+  return backend;
+}
+
+// The device only skips target contacts outside of the alignment, raise policy stays on the CPU.
+static bool UseCudaBackend() {
+  return GlobalContactBackend().load() == ContactBackend::CUDA && GlobalContactBoundsPolicy().load() == ContactBoundsPolicy::SKIP &&
+         CudaContactsAvailable();
+}
+
+
+// Packed contact maps of a batch kept in device memory, e.g. for a model running on the same GPU.
+// Map i has query_lengths[i] rows of (query_lengths[i] + 7) / 8 bytes starting at byte offsets[i] of the device buffer.
+class CudaPackedContactMaps {
+ public:
+  CudaPackedContactMaps(std::vector<int> query_lengths, std::vector<uint64_t> offsets)
+      : query_lengths_(std::move(query_lengths)), offsets_(std::move(offsets)),
+        data_(static_cast<uint8_t*>(CudaAllocate(std::max(offsets_.back(), (uint64_t) 1))), CudaRelease) {}
+
+  CudaPackedContactMaps(const CudaPackedContactMaps&) = delete;
+  CudaPackedContactMaps& operator=(const CudaPackedContactMaps&) = delete;
+
+  size_t Size() const {
+    return query_lengths_.size();
+  }
+
+  int QueryLength(const size_t index) const {
+    CheckIndex(index);
+    return query_lengths_[index];
+  }
+
+  uint64_t Offset(const size_t index) const {
+    CheckIndex(index);
+    return offsets_[index];
+  }
+
+  size_t DataSize() const {
+    return offsets_.back();
+  }
+
+  uint8_t* DeviceData() const {
+    return data_.get();
+  }
+
+  PackedContactMap CopyToHost(const size_t index) const {
+    CheckIndex(index);
+    PackedContactMap contact_map;
+    contact_map.size = query_lengths_[index];
+    contact_map.row_bytes = (contact_map.size + 7) / 8;
+    const size_t bytes = (size_t) contact_map.size * contact_map.row_bytes;
+    contact_map.bits.reset(new uint8_t[bytes]);
+    if (bytes > 0)
+      CudaCopyToHost(contact_map.bits.get(), data_.get() + offsets_[index], bytes);
+    return contact_map;
+  }
+
+ private:
+  void CheckIndex(const size_t index) const {
+    if (index >= query_lengths_.size())
+      throw std::out_of_range("Contact map index " + std::to_string(index) + " is out of range of batch of size " + std::to_string(query_lengths_.size()));
+  }
+
+  std::vector<int> query_lengths_;
+  std::vector<uint64_t> offsets_;
+  std::unique_ptr<uint8_t, void (*)(void*)> data_;
+};
+
+
+static void AddCudaTargetContacts(const SparseContacts& sparse_contacts, const int chain_length, CudaContactBatch& batch) {
+  const int target = (int) batch.target_lengths.size();
+  batch.target_lengths.push_back(chain_length);
+  batch.residue_offsets.push_back((int64_t) batch.group_indexes.size());
+  // no atoms, the contact kernel finds nothing and contacts are scattered instead
+  const int atom_end = (int) (batch.positions.size() / 3);
+  batch.group_indexes.insert(batch.group_indexes.end(), (size_t) chain_length + 1, atom_end);
+  for (std::pair<int, int> contact : sparse_contacts) {
+    batch.contacts.push_back(contact.first);
+    batch.contacts.push_back(contact.second);
+    batch.contact_targets.push_back(target);
+  }
+}
+
+
+// Atoms of the contact definition are gathered like ComputeSparseContacts does, fixed positions use the CPU engine.
+static void AddCudaTargetAtoms(const AtomsView& atoms, const float angstrom_contact_threshold, const ContactDefinition definition, CudaContactBatch& batch) {
+  if (atoms.fixed_positions != nullptr) {
+    AddCudaTargetContacts(ComputeSparseContacts(atoms, angstrom_contact_threshold, definition), atoms.chain_length, batch);
+    return;
+  }
+  if (definition != ContactDefinition::ALL_ATOMS && atoms.representative_atoms == nullptr)
+    throw std::runtime_error("Structure has no representative atoms for CA or CB contacts, process its structure file again");
+
+  batch.target_lengths.push_back(atoms.chain_length);
+  batch.residue_offsets.push_back((int64_t) batch.group_indexes.size());
+  const auto add_atom = [&atoms, &batch](const int group, const int atom) {
+    if (atoms.atoms_positions != nullptr) {
+      batch.positions.insert(batch.positions.end(), atoms.atoms_positions + (size_t) atom * 3, atoms.atoms_positions + (size_t) atom * 3 + 3);
+    } else {
+      const int coordinate = atoms.coordinate_indexes[group] + atom - atoms.group_indexes[group];
+      batch.positions.push_back(atoms.xs[coordinate]);
+      batch.positions.push_back(atoms.ys[coordinate]);
+      batch.positions.push_back(atoms.zs[coordinate]);
+    }
+  };
+  for (int group = 0; group < atoms.chain_length; ++group) {
+    batch.group_indexes.push_back((int) (batch.positions.size() / 3));
+    if (definition == ContactDefinition::ALL_ATOMS) {
+      for (int atom = atoms.group_indexes[group]; atom < atoms.group_indexes[group + 1]; ++atom)
+        add_atom(group, atom);
+    } else {
+      const int atom = RepresentativeAtom(atoms, group, definition);
+      if (atom >= 0)
+        add_atom(group, atom);
+    }
+  }
+  batch.group_indexes.push_back((int) (batch.positions.size() / 3));
+}
+
+
+// adds a target to the batch by name, see FileCudaTargetLoader and DatabaseCudaTargetLoader
+typedef std::function<void(const std::string&, CudaContactBatch&)> CudaTargetLoader;
+
+static CudaTargetLoader FileCudaTargetLoader(const float angstrom_contact_threshold) {
+  return [angstrom_contact_threshold](const std::string& file_path, CudaContactBatch& batch) {
+    const AtomsFile atoms_file = LoadAtomsFile(file_path);
+    AddCudaTargetAtoms(atoms_file.atoms, angstrom_contact_threshold, GlobalContactDefinition().load(), batch);
+  };
+}
+
+// precomputed contact lists are only decoded, like on the CPU path
+static CudaTargetLoader DatabaseCudaTargetLoader(const AtomsDatabase& database, const float angstrom_contact_threshold) {
+  return [&database, angstrom_contact_threshold](const std::string& protein_id, CudaContactBatch& batch) {
+    const AtomsDatabaseEntry& entry = FindDatabaseEntry(database, protein_id);
+    const ContactDefinition definition = GlobalContactDefinition().load();
+    SparseContacts sparse_contacts;
+    if (definition == ContactDefinition::ALL_ATOMS && database.LoadContactList(entry, angstrom_contact_threshold, sparse_contacts))
+      AddCudaTargetContacts(sparse_contacts, (int) entry.chain_length, batch);
+    else
+      AddCudaTargetAtoms(database.View(entry, protein_id), angstrom_contact_threshold, definition, batch);
+  };
+}
+
+
+// adds query index to batch, CPU skip policy drops target residues past the structure the same way
+static void AddCudaQuery(const AlignmentInputs& alignments, const size_t index, const int target, const uint64_t output_offset, ResidueMapping& mapping,
+                         CudaContactBatch& batch) {
+  if (alignments.use_runs)
+    MappingFromRuns(alignments.runs[index], mapping);
+  else
+    MappingFromAlignment(alignments.query_alignments[index], alignments.target_alignments[index], mapping);
+  const int query_length = mapping.query_length;
+  const int target_length = batch.target_lengths[target];
+  const size_t query_offset = batch.query_to_target.size();
+  batch.query_targets.push_back(target);
+  batch.query_lengths.push_back(query_length);
+  batch.query_offsets.push_back((int64_t) query_offset);
+  batch.output_offsets.push_back(output_offset);
+  batch.query_to_target.resize(query_offset + query_length, -1);
+  batch.gapped.resize(query_offset + query_length, 0);
+  for (int target_index = 0; target_index < (int) mapping.target_to_query.size() && target_index < target_length; ++target_index) {
+    const int query_index = mapping.target_to_query[target_index];
+    if (query_index >= 0)
+      batch.query_to_target[query_offset + query_index] = target_index;
+  }
+  for (const int query_index : mapping.gapped_query_residues)
+    batch.gapped[query_offset + query_index] = 1;
+}
+
+
+static int QueryLength(const AlignmentInputs& alignments, const size_t index, ResidueMapping& mapping) {
+  if (alignments.use_runs)
+    MappingFromRuns(alignments.runs[index], mapping);
+  else
+    MappingFromAlignment(alignments.query_alignments[index], alignments.target_alignments[index], mapping);
+  return mapping.query_length;
+}
+
+
+// Same maps as ParallelBuildContactMaps with PackedFromAlignedContacts, left in device memory.
+// Alignments sharing a target are grouped, so every target is uploaded once per batch part.
+static std::shared_ptr<CudaPackedContactMaps> CudaAlignPackedContactMaps(const CudaTargetLoader& load_target, const std::vector<std::string>& target_names,
+                                                                         const AlignmentInputs& alignments, const int generated_contacts,
+                                                                         const float angstrom_contact_threshold) {
+  const size_t batch_size = target_names.size();
+  if (alignments.Size() != batch_size)
+    throw std::invalid_argument("targets and alignments must have the same length");
+
+  std::unordered_map<std::string, size_t> target_groups_index;
+  std::vector<std::vector<size_t>> target_groups;
+  for (size_t i = 0; i < batch_size; ++i) {
+    auto inserted = target_groups_index.emplace(target_names[i], target_groups.size());
+    if (inserted.second)
+      target_groups.emplace_back();
+    target_groups[inserted.first->second].push_back(i);
+  }
+
+  ResidueMapping mapping;
+  std::vector<int> query_lengths(batch_size);
+  std::vector<uint64_t> offsets(batch_size + 1, 0);
+  for (size_t i = 0; i < batch_size; ++i) {
+    query_lengths[i] = QueryLength(alignments, i, mapping);
+    offsets[i + 1] = offsets[i] + (uint64_t) query_lengths[i] * ((query_lengths[i] + 7) / 8);
+  }
+  auto contact_maps = std::make_shared<CudaPackedContactMaps>(query_lengths, offsets);
+
+  CudaContactBatch batch;
+  const auto flush = [&]() {
+    if (!batch.query_targets.empty())
+      CudaAlignedPackedContactMaps(batch, contact_maps->DeviceData());
+    batch = CudaContactBatch();
+    batch.squared_threshold = SquaredThreshold(angstrom_contact_threshold);
+    batch.generated_contacts = std::max(generated_contacts, 0);
+  };
+  flush();
+  for (const std::vector<size_t>& group : target_groups) {
+    load_target(target_names[group.front()], batch);
+    const int target = (int) batch.target_lengths.size() - 1;
+    for (const size_t index : group)
+      AddCudaQuery(alignments, index, target, offsets[index], mapping, batch);
+    if (batch.TargetBytes() >= CUDA_BATCH_TARGET_BYTES)
+      flush();
+  }
+  flush();
+  return contact_maps;
+}
+
+
+// one copy of the whole device buffer, then split into maps
+static std::vector<PackedContactMap> CudaPackedContactMapsToHost(const CudaPackedContactMaps& contact_maps) {
+  std::vector<uint8_t> data(contact_maps.DataSize());
+  if (!data.empty())
+    CudaCopyToHost(data.data(), contact_maps.DeviceData(), data.size());
+  std::vector<PackedContactMap> output(contact_maps.Size());
+  for (size_t i = 0; i < contact_maps.Size(); ++i) {
+    PackedContactMap& contact_map = output[i];
+    contact_map.size = contact_maps.QueryLength(i);
+    contact_map.row_bytes = (contact_map.size + 7) / 8;
+    const size_t bytes = (size_t) contact_map.size * contact_map.row_bytes;
+    contact_map.bits.reset(new uint8_t[bytes]);
+    std::copy_n(data.data() + contact_maps.Offset(i), bytes, contact_map.bits.get());
+  }
+  return output;
+}
+
+
+// python interface
+
+static void SetContactBackend(const std::string& backend) {
+  if (backend == "cpu")
+    GlobalContactBackend().store(ContactBackend::CPU);
+  else if (backend == "cuda")
+    GlobalContactBackend().store(ContactBackend::CUDA);
+  else
+    throw std::invalid_argument("Unknown contact backend " + backend + ", use cpu or cuda");
+}
+
+
+static std::string GetContactBackend() {
+  return GlobalContactBackend().load() == ContactBackend::CUDA ? "cuda" : "cpu";
+}
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef DISTANCE_KERNEL
+#define DISTANCE_KERNEL
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DISTANCE_KERNEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define DISTANCE_KERNEL_NEON
+#endif
+
+// Kernels compare squared distances against a squared threshold instead of calling sqrtf for every atom pair.
+// SquaredThreshold returns the largest float s for which sqrtf(s) <= threshold. sqrtf is correctly rounded and monotonic,
+// so sum <= SquaredThreshold(threshold) gives exactly the same answer as sqrtf(sum) <= threshold.
+// Squares are summed as (dx * dx + dy * dy) + dz * dz in every kernel. The library is built with -ffp-contract=off,
+// so the compiler never fuses those into FMA and all kernels stay bit identical to the scalar Distance.
+static float SquaredThreshold(const float angstrom_contact_threshold) {
+  if (std::isnan(angstrom_contact_threshold))
+    return std::numeric_limits<float>::quiet_NaN();
+  if (angstrom_contact_threshold < 0)
+    return -1;
+
+  float squared_threshold = angstrom_contact_threshold * angstrom_contact_threshold;
+  while (sqrtf(squared_threshold) > angstrom_contact_threshold)
+    squared_threshold = std::nextafter(squared_threshold, -std::numeric_limits<float>::infinity());
+  while (squared_threshold < std::numeric_limits<float>::infinity()) {
+    float next = std::nextafter(squared_threshold, std::numeric_limits<float>::infinity());
+    if (sqrtf(next) > angstrom_contact_threshold)
+      break;
+    squared_threshold = next;
+  }
+  return squared_threshold;
+}
+
+// Returns index of the first atom among count atoms stored as xs[], ys[], zs[]
+// that is within the threshold from point, or count if there is none.
+typedef int (*FindContactKernel)(const float* point, const float* xs, const float* ys, const float* zs, int count, float squared_threshold);
+
+
+static int FindContactScalar(const float* point, const float* xs, const float* ys, const float* zs, const int count, const float squared_threshold) {
+  for (int i = 0; i < count; ++i) {
+    const float dx = point[0] - xs[i];
+    const float dy = point[1] - ys[i];
+    const float dz = point[2] - zs[i];
+    if (dx * dx + dy * dy + dz * dz <= squared_threshold)
+      return i;
+  }
+  return count;
+}
+
+
+#ifdef DISTANCE_KERNEL_X86
+__attribute__((target("avx2")))
+static int FindContactAVX2(const float* point, const float* xs, const float* ys, const float* zs, const int count, const float squared_threshold) {
+  const __m256 point_x = _mm256_set1_ps(point[0]);
+  const __m256 point_y = _mm256_set1_ps(point[1]);
+  const __m256 point_z = _mm256_set1_ps(point[2]);
+  const __m256 threshold = _mm256_set1_ps(squared_threshold);
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 dx = _mm256_sub_ps(point_x, _mm256_loadu_ps(xs + i));
+    const __m256 dy = _mm256_sub_ps(point_y, _mm256_loadu_ps(ys + i));
+    const __m256 dz = _mm256_sub_ps(point_z, _mm256_loadu_ps(zs + i));
+    const __m256 squared_distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    const int mask = _mm256_movemask_ps(_mm256_cmp_ps(squared_distance, threshold, _CMP_LE_OQ));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + FindContactScalar(point, xs + i, ys + i, zs + i, count - i, squared_threshold);
+}
+
+
+__attribute__((target("avx512f")))
+static int FindContactAVX512(const float* point, const float* xs, const float* ys, const float* zs, const int count, const float squared_threshold) {
+  const __m512 point_x = _mm512_set1_ps(point[0]);
+  const __m512 point_y = _mm512_set1_ps(point[1]);
+  const __m512 point_z = _mm512_set1_ps(point[2]);
+  const __m512 threshold = _mm512_set1_ps(squared_threshold);
+
+  for (int i = 0; i < count; i += 16) {
+    // masked loads handle the tail, lanes outside of count are excluded from the result by the same mask
+    const __mmask16 lanes = count - i >= 16 ? (__mmask16) 0xFFFF : (__mmask16) ((1u << (count - i)) - 1);
+    const __m512 dx = _mm512_sub_ps(point_x, _mm512_maskz_loadu_ps(lanes, xs + i));
+    const __m512 dy = _mm512_sub_ps(point_y, _mm512_maskz_loadu_ps(lanes, ys + i));
+    const __m512 dz = _mm512_sub_ps(point_z, _mm512_maskz_loadu_ps(lanes, zs + i));
+    const __m512 squared_distance = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz));
+    const __mmask16 mask = _mm512_mask_cmp_ps_mask(lanes, squared_distance, threshold, _CMP_LE_OQ);
+    if (mask != 0)
+      return i + __builtin_ctz((unsigned) mask);
+  }
+  return count;
+}
+#endif
+
+
+#ifdef DISTANCE_KERNEL_NEON
+static int FindContactNEON(const float* point, const float* xs, const float* ys, const float* zs, const int count, const float squared_threshold) {
+  const float32x4_t point_x = vdupq_n_f32(point[0]);
+  const float32x4_t point_y = vdupq_n_f32(point[1]);
+  const float32x4_t point_z = vdupq_n_f32(point[2]);
+  const float32x4_t threshold = vdupq_n_f32(squared_threshold);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const float32x4_t dx = vsubq_f32(point_x, vld1q_f32(xs + i));
+    const float32x4_t dy = vsubq_f32(point_y, vld1q_f32(ys + i));
+    const float32x4_t dz = vsubq_f32(point_z, vld1q_f32(zs + i));
+    const float32x4_t squared_distance = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz));
+    const uint32x4_t within = vcleq_f32(squared_distance, threshold);
+    if (vmaxvq_u32(within) != 0) {
+      for (int lane = 0; lane < 4; ++lane) {
+        if (FindContactScalar(point, xs + i + lane, ys + i + lane, zs + i + lane, 1, squared_threshold) == 0)
+          return i + lane;
+      }
+    }
+  }
+  return i + FindContactScalar(point, xs + i, ys + i, zs + i, count - i, squared_threshold);
+}
+#endif
+
+
+// Fixed point kernels (see fixed_positions.h) compare exact integer squared distances against an integer threshold.
+// Axis differences are clamped to axis_limit, which is over the threshold, so a clamped pair never matches
+// and the sum of three squares always fits int32.
+typedef int (*FindFixedContactKernel)(const int* point, const int* xs, const int* ys, const int* zs, int count, int axis_limit,
+                                      int squared_threshold);
+
+
+static int FindFixedContactScalar(const int* point, const int* xs, const int* ys, const int* zs, const int count, const int axis_limit,
+                                  const int squared_threshold) {
+  for (int i = 0; i < count; ++i) {
+    const int dx = std::min(std::abs(point[0] - xs[i]), axis_limit);
+    const int dy = std::min(std::abs(point[1] - ys[i]), axis_limit);
+    const int dz = std::min(std::abs(point[2] - zs[i]), axis_limit);
+    if (dx * dx + dy * dy + dz * dz <= squared_threshold)
+      return i;
+  }
+  return count;
+}
+
+
+#ifdef DISTANCE_KERNEL_X86
+__attribute__((target("avx2")))
+static int FindFixedContactAVX2(const int* point, const int* xs, const int* ys, const int* zs, const int count, const int axis_limit,
+                                const int squared_threshold) {
+  const __m256i point_x = _mm256_set1_epi32(point[0]);
+  const __m256i point_y = _mm256_set1_epi32(point[1]);
+  const __m256i point_z = _mm256_set1_epi32(point[2]);
+  const __m256i limit = _mm256_set1_epi32(axis_limit);
+  // squared_threshold < axis_limit^2, so adding one never overflows
+  const __m256i threshold = _mm256_set1_epi32(squared_threshold + 1);
+
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i dx = _mm256_min_epi32(_mm256_abs_epi32(_mm256_sub_epi32(point_x, _mm256_loadu_si256((const __m256i*) (xs + i)))), limit);
+    const __m256i dy = _mm256_min_epi32(_mm256_abs_epi32(_mm256_sub_epi32(point_y, _mm256_loadu_si256((const __m256i*) (ys + i)))), limit);
+    const __m256i dz = _mm256_min_epi32(_mm256_abs_epi32(_mm256_sub_epi32(point_z, _mm256_loadu_si256((const __m256i*) (zs + i)))), limit);
+    const __m256i squared_distance =
+        _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dx, dx), _mm256_mullo_epi32(dy, dy)), _mm256_mullo_epi32(dz, dz));
+    const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(threshold, squared_distance)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  // tail stays inside this function, calling the non VEX scalar kernel with dirty upper registers stalls on every call
+  for (; i < count; ++i) {
+    const int dx = std::min(std::abs(point[0] - xs[i]), axis_limit);
+    const int dy = std::min(std::abs(point[1] - ys[i]), axis_limit);
+    const int dz = std::min(std::abs(point[2] - zs[i]), axis_limit);
+    if (dx * dx + dy * dy + dz * dz <= squared_threshold)
+      return i;
+  }
+  return count;
+}
+#endif
+
+
+static FindFixedContactKernel SelectFindFixedContactKernel() {
+#if defined(DISTANCE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return FindFixedContactAVX2;
+#endif
+  return FindFixedContactScalar;
+}
+
+
+static FindFixedContactKernel FindFixedContact() {
+  static const FindFixedContactKernel kernel = SelectFindFixedContactKernel();
+  return kernel;
+}
+
+
+// chosen once per process by CPU features
+static FindContactKernel SelectFindContactKernel() {
+#if defined(DISTANCE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return FindContactAVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return FindContactAVX2;
+  return FindContactScalar;
+#elif defined(DISTANCE_KERNEL_NEON)
+  return FindContactNEON;
+#else
+  return FindContactScalar;
+#endif
+}
+
+
+static FindContactKernel FindContact() {
+  static const FindContactKernel kernel = SelectFindContactKernel();
+  return kernel;
+}
+
+
+// every kernel this CPU can run, for benchmarks and tests
+static std::vector<std::pair<const char*, FindContactKernel>> AvailableFindContactKernels() {
+  std::vector<std::pair<const char*, FindContactKernel>> kernels{{"scalar", FindContactScalar}};
+#if defined(DISTANCE_KERNEL_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    kernels.emplace_back("avx2", FindContactAVX2);
+  if (__builtin_cpu_supports("avx512f"))
+    kernels.emplace_back("avx512", FindContactAVX512);
+#elif defined(DISTANCE_KERNEL_NEON)
+  kernels.emplace_back("neon", FindContactNEON);
+#endif
+  return kernels;
+}
+
+
+static const char* FindContactKernelName() {
+  const FindContactKernel kernel = FindContact();
+#if defined(DISTANCE_KERNEL_X86)
+  if (kernel == FindContactAVX512)
+    return "avx512";
+  if (kernel == FindContactAVX2)
+    return "avx2";
+#elif defined(DISTANCE_KERNEL_NEON)
+  if (kernel == FindContactNEON)
+    return "neon";
+#endif
+  return "scalar";
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef ENGINE_STATS
+#define ENGINE_STATS
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Counters and stage timings of the contact map hot path. Every thread adds to its own block with plain relaxed stores,
+// no locks and no atomic read modify write. Reads sum blocks of live threads and totals of threads that exited.
+// Counting is per call, never per atom, so counters are always on.
+enum class EngineCounter {
+  BYTES_READ,            // atoms files mapped, database records and contact lists read
+  FILES_OPENED,          // atoms files and atoms databases opened
+  ATOM_PAIR_TESTS,       // atom pairs handed to the distance kernel, kernels stop at the first contact of an atom
+  RESIDUE_PAIRS_PRUNED,  // grid candidate residue pairs rejected by their bounding spheres
+  CONTACTS_EMITTED,      // residue contacts found by the contact engine
+  CACHE_HITS,            // target contacts found in the contact map cache
+  CACHE_MISSES,
+  LOAD_NS,               // mapping and validating atoms, decoding contact lists
+  CONTACT_NS,            // contact engine
+  PROJECTION_NS,         // projecting target contacts onto queries
+};
+
+constexpr int ENGINE_COUNTER_COUNT = 10;
+
+static const char* const ENGINE_COUNTER_NAMES[ENGINE_COUNTER_COUNT] = {
+    "bytes_read", "files_opened", "atom_pair_tests", "residue_pairs_pruned", "contacts_emitted",
+    "cache_hits", "cache_misses", "load_ns", "contact_ns", "projection_ns"};
+
+// one timed stage of a call, recorded only while tracing is enabled
+struct EngineTraceEvent {
+  EngineCounter stage;
+  // structure the thread was working on, see EngineTraceLabel
+  std::string label;
+  size_t thread;
+  // steady clock
+  int64_t start_ns;
+  int64_t duration_ns;
+};
+
+// events kept per thread until they are taken, later ones are dropped
+constexpr size_t ENGINE_TRACE_THREAD_LIMIT = 1 << 20;
+
+struct EngineCounterBlock {
+  EngineCounterBlock() {
+    for (std::atomic<uint64_t>& value : values)
+      value.store(0, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> values[ENGINE_COUNTER_COUNT];
+  std::mutex trace_mutex;
+  std::vector<EngineTraceEvent> trace;
+};
+
+class EngineStats {
+ public:
+  typedef std::vector<uint64_t> Counters;
+
+  void Register(EngineCounterBlock* block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    live_.push_back(block);
+  }
+
+  // totals of an exiting thread are kept, so counts of finished batch workers are not lost
+  void Retire(EngineCounterBlock* block) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < ENGINE_COUNTER_COUNT; ++i)
+      retired_[i] += block->values[i].load(std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> trace_lock(block->trace_mutex);
+      retired_trace_.insert(retired_trace_.end(), std::make_move_iterator(block->trace.begin()), std::make_move_iterator(block->trace.end()));
+    }
+    live_.erase(std::remove(live_.begin(), live_.end(), block), live_.end());
+  }
+
+  // counts since the last reset
+  Counters Read() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Counters counters = Totals();
+    for (int i = 0; i < ENGINE_COUNTER_COUNT; ++i)
+      counters[i] -= baseline_[i];
+    return counters;
+  }
+
+  // Blocks are only ever written by their threads, reset moves the baseline instead of clearing them.
+  void Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    baseline_ = Totals();
+    retired_trace_.clear();
+    for (EngineCounterBlock* block : live_) {
+      std::lock_guard<std::mutex> trace_lock(block->trace_mutex);
+      block->trace.clear();
+    }
+  }
+
+  // recorded events of all threads ordered by start, they are removed from the stats
+  std::vector<EngineTraceEvent> TakeTrace() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<EngineTraceEvent> trace = std::move(retired_trace_);
+    retired_trace_.clear();
+    for (EngineCounterBlock* block : live_) {
+      std::lock_guard<std::mutex> trace_lock(block->trace_mutex);
+      trace.insert(trace.end(), std::make_move_iterator(block->trace.begin()), std::make_move_iterator(block->trace.end()));
+      block->trace.clear();
+    }
+    std::stable_sort(trace.begin(), trace.end(), [](const EngineTraceEvent& a, const EngineTraceEvent& b) { return a.start_ns < b.start_ns; });
+    return trace;
+  }
+
+  std::atomic<bool>& Tracing() {
+    return tracing_;
+  }
+
+ private:
+  Counters Totals() const {
+    Counters totals = retired_;
+    for (const EngineCounterBlock* block : live_) {
+      for (int i = 0; i < ENGINE_COUNTER_COUNT; ++i)
+        totals[i] += block->values[i].load(std::memory_order_relaxed);
+    }
+    return totals;
+  }
+
+  std::mutex mutex_;
+  std::vector<EngineCounterBlock*> live_;
+  Counters retired_ = Counters(ENGINE_COUNTER_COUNT, 0);
+  Counters baseline_ = Counters(ENGINE_COUNTER_COUNT, 0);
+  std::vector<EngineTraceEvent> retired_trace_;
+  std::atomic<bool> tracing_{false};
+};
+
+inline EngineStats& GlobalEngineStats() {
+  static EngineStats stats;
+  return stats;
+}
+
+// block of the calling thread, registered on first use and retired when the thread exits
+inline EngineCounterBlock& ThreadEngineCounters() {
+  struct Registration {
+    Registration() {
+      GlobalEngineStats().Register(&block);
+    }
+    ~Registration() {
+      GlobalEngineStats().Retire(&block);
+    }
+    EngineCounterBlock block;
+  };
+  thread_local Registration registration;
+  return registration.block;
+}
+
+
+static void CountEngineEvent(const EngineCounter counter, const uint64_t value) {
+  // only this thread writes its block, readers just need untorn values
+  std::atomic<uint64_t>& slot = ThreadEngineCounters().values[(int) counter];
+  slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+
+// Names the structure the calling thread works on, trace events of its scope carry the label. Scopes nest.
+class EngineTraceLabel {
+ public:
+  explicit EngineTraceLabel(const std::string& label) : previous_(Current()) {
+    Current() = &label;
+  }
+
+  ~EngineTraceLabel() {
+    Current() = previous_;
+  }
+
+  EngineTraceLabel(const EngineTraceLabel&) = delete;
+  EngineTraceLabel& operator=(const EngineTraceLabel&) = delete;
+
+  static const std::string*& Current() {
+    thread_local const std::string* label = nullptr;
+    return label;
+  }
+
+ private:
+  const std::string* previous_;
+};
+
+
+// Adds nanoseconds of its scope to a stage counter, and records a trace event if tracing was enabled when the scope began.
+class EngineStageTimer {
+ public:
+  explicit EngineStageTimer(const EngineCounter stage)
+      : stage_(stage), tracing_(GlobalEngineStats().Tracing().load(std::memory_order_relaxed)), start_(std::chrono::steady_clock::now()) {}
+
+  ~EngineStageTimer() {
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    const int64_t duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_).count();
+    CountEngineEvent(stage_, (uint64_t) duration_ns);
+    if (!tracing_)
+      return;
+    EngineCounterBlock& block = ThreadEngineCounters();
+    const std::string* label = EngineTraceLabel::Current();
+    std::lock_guard<std::mutex> lock(block.trace_mutex);
+    if (block.trace.size() < ENGINE_TRACE_THREAD_LIMIT) {
+      block.trace.push_back(EngineTraceEvent{stage_, label != nullptr ? *label : std::string(), std::hash<std::thread::id>()(std::this_thread::get_id()),
+                                             std::chrono::duration_cast<std::chrono::nanoseconds>(start_.time_since_epoch()).count(), duration_ns});
+    }
+  }
+
+  EngineStageTimer(const EngineStageTimer&) = delete;
+  EngineStageTimer& operator=(const EngineStageTimer&) = delete;
+
+ private:
+  const EngineCounter stage_;
+  const bool tracing_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef FIXED_POSITIONS
+#define FIXED_POSITIONS
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Fixed point positions are integer multiples of 0.01 Å. A protein keeps int32 origin[3] and
+// int16 positions[atom_count * 3] relative to it, so atom coordinate is (origin + position) / 100 Å.
+// int16 covers 655 Å along every axis around the origin, more than any single chain spans.
+// Rounding moves an atom by at most 0.005 Å along every axis, so only atom pairs closer than 0.02 Å
+// to the threshold can change their contact state.
+static const int FIXED_POSITION_UNITS_PER_ANGSTROM = 100;
+
+
+// Quantises interleaved positions around the middle of their bounding box.
+// Returns false if a position is not finite or the protein does not fit int16 around the origin.
+static bool QuantizePositions(const float* positions, const int atom_count, int origin[3], std::vector<int16_t>& fixed_positions) {
+  const size_t count = (size_t) atom_count * 3;
+  std::vector<int64_t> units(count);
+  int64_t min_units[3] = {0, 0, 0};
+  int64_t max_units[3] = {0, 0, 0};
+  for (size_t i = 0; i < count; ++i) {
+    const double value = (double) positions[i] * FIXED_POSITION_UNITS_PER_ANGSTROM;
+    // also false for NaN
+    if (!(std::fabs(value) < 1e9))
+      return false;
+    units[i] = std::llround(value);
+    const size_t axis = i % 3;
+    if (i < 3 || units[i] < min_units[axis])
+      min_units[axis] = units[i];
+    if (i < 3 || units[i] > max_units[axis])
+      max_units[axis] = units[i];
+  }
+
+  for (int axis = 0; axis < 3; ++axis) {
+    const int64_t middle = min_units[axis] + (max_units[axis] - min_units[axis]) / 2;
+    if (max_units[axis] - middle > INT16_MAX || min_units[axis] - middle < INT16_MIN)
+      return false;
+    origin[axis] = (int) middle;
+  }
+  fixed_positions.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    fixed_positions[i] = (int16_t) (units[i] - origin[i % 3]);
+  return true;
+}
+
+
+static float FixedPositionToAngstrom(const int origin, const int16_t position) {
+  return (float) (origin + position) / FIXED_POSITION_UNITS_PER_ANGSTROM;
+}
+
+
+// largest integer squared distance in units that is within the threshold, -1 for negative and NaN thresholds
+static int64_t FixedSquaredThreshold(const float angstrom_contact_threshold) {
+  if (!(angstrom_contact_threshold >= 0))
+    return -1;
+  const long double units = (long double) angstrom_contact_threshold * FIXED_POSITION_UNITS_PER_ANGSTROM;
+  if (units > 1e9L)
+    return INT64_MAX;
+  return (int64_t) std::floor(units * units);
+}
+
+#endif
@@ -4,16 +4,204 @@
 
 #include <boost/python.hpp>
 
-#include "atoms_file_io.h"
+#include "alignment_store_python.h"
+#include "atoms_database_python.h"
+#include "atoms_file_io_python.h"
+#include "contact_map_prefetcher_python.h"
 #include "load_contact_maps.h"
 #include "python_utils.h"
+#include "sequence_alignment_python.h"
+#include "structure_ingest_python.h"
 
 namespace py = boost::python;
 namespace np = py::numpy;
 
 BOOST_PYTHON_MODULE (libAtomDistanceIO) {
   py::def("initialize", Initialize);
-  py::def("save_atoms", SaveAtomsFile);
+  py::def("save_atoms", SaveAtomsFile,
+          (py::arg("positions"), py::arg("groups"), py::arg("save_path"), py::arg("separate_coordinates") = false,
+              py::arg("residue_padding") = 0, py::arg("representative_atoms") = py::object(), py::arg("fixed_positions") = false));
   py::def("load_contact_map", LoadContactMap);
   py::def("load_aligned_contact_map", LoadAlignedContactMap);
+  py::def("load_aligned_contact_map", LoadStoredAlignedContactMap,
+          (py::arg("file_path"), py::arg("angstrom_contact_threshold"), py::arg("alignment"), py::arg("generated_contacts")));
+  py::def("load_aligned_contact_maps", LoadAlignedContactMaps);
+  py::def("fill_aligned_contact_map", FillAlignedContactMap,
+          (py::arg("buffer"), py::arg("file_path"), py::arg("angstrom_contact_threshold"), py::arg("query_alignment"), py::arg("target_alignment"),
+              py::arg("generated_contacts")));
+  py::def("load_packed_contact_map", LoadPackedContactMap);
+  py::def("load_aligned_packed_contact_map", LoadAlignedPackedContactMap);
+  py::def("load_aligned_packed_contact_maps", LoadAlignedPackedContactMaps);
+  py::def("load_packed_contact_map_file", LoadPackedContactMapFile);
+  py::def("load_aligned_packed_contact_maps_to_device", LoadAlignedPackedContactMapsToDevice);
+  py::def("load_aligned_sparse_contact_map", LoadAlignedSparseContactMap,
+          (py::arg("file_path"), py::arg("angstrom_contact_threshold"), py::arg("query_alignment"), py::arg("target_alignment"),
+              py::arg("generated_contacts"), py::arg("format") = "csr"));
+  py::def("load_aligned_sparse_contact_maps", LoadAlignedSparseContactMaps,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+              py::arg("generated_contacts"), py::arg("thread_count"), py::arg("format") = "csr"));
+  py::def("load_cigar_aligned_contact_maps", LoadCigarAlignedContactMaps);
+  py::def("prefetch_aligned_contact_maps", PrefetchAlignedContactMaps,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+              py::arg("generated_contacts"), py::arg("thread_count"), py::arg("queue_size") = 64));
+  py::def("prefetch_cigar_aligned_contact_maps", PrefetchCigarAlignedContactMaps,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("cigars"), py::arg("generated_contacts"), py::arg("thread_count"),
+              py::arg("queue_size") = 64));
+  py::def("build_aligned_contact_map_store", BuildAlignedContactMapStore,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+              py::arg("generated_contacts"), py::arg("thread_count"), py::arg("spill_path") = ""));
+  py::def("build_cigar_aligned_contact_map_store", BuildCigarAlignedContactMapStore,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("cigars"), py::arg("generated_contacts"), py::arg("thread_count"),
+              py::arg("spill_path") = ""));
+  py::def("build_stored_aligned_contact_map_store", BuildStoredAlignedContactMapStore,
+          (py::arg("file_paths"), py::arg("angstrom_contact_threshold"), py::arg("alignment_store"), py::arg("generated_contacts"), py::arg("thread_count"),
+              py::arg("spill_path") = ""));
+  py::def("align_and_load_contact_map", AlignAndLoadContactMap,
+          (py::arg("file_path"), py::arg("angstrom_contact_threshold"), py::arg("query_sequence"), py::arg("target_sequence"), py::arg("match"),
+              py::arg("mismatch"), py::arg("gap_open"), py::arg("gap_continuation"), py::arg("generated_contacts"), py::arg("format") = "dense"));
+
+  py::class_<AtomsDatabaseWriter, boost::noncopyable>("AtomsDatabaseWriter", py::init<std::string>())
+      .def("add", AddAtomsToDatabase<AtomsDatabaseWriter>,
+           (py::arg("self"), py::arg("protein_id"), py::arg("positions"), py::arg("groups"), py::arg("representative_atoms") = py::object()))
+      .def("add_atoms_file", AddAtomsFileToDatabase<AtomsDatabaseWriter>)
+      .def("add_from_database", AddDatabaseAtomsToDatabase<AtomsDatabaseWriter>)
+      .def("set_contact_thresholds", SetContactThresholdsPython<AtomsDatabaseWriter>,
+           (py::arg("self"), py::arg("angstrom_contact_thresholds"), py::arg("thread_count")))
+      .def("set_fixed_positions", &AtomsDatabaseWriter::SetFixedPositions, (py::arg("self"), py::arg("fixed_positions")))
+      .def("close", CloseDatabasePython<AtomsDatabaseWriter>)
+      .def("__len__", &AtomsDatabaseWriter::Size);
+
+  py::class_<AtomsDatabaseUpdater, boost::noncopyable>("AtomsDatabaseUpdater", py::init<std::string>())
+      .def("add", AddAtomsToDatabase<AtomsDatabaseUpdater>,
+           (py::arg("self"), py::arg("protein_id"), py::arg("positions"), py::arg("groups"), py::arg("representative_atoms") = py::object()))
+      .def("add_atoms_file", AddAtomsFileToDatabase<AtomsDatabaseUpdater>)
+      .def("add_from_database", AddDatabaseAtomsToDatabase<AtomsDatabaseUpdater>)
+      .def("remove", &AtomsDatabaseUpdater::Remove)
+      .def("set_contact_thresholds", SetContactThresholdsPython<AtomsDatabaseUpdater>,
+           (py::arg("self"), py::arg("angstrom_contact_thresholds"), py::arg("thread_count")))
+      .def("set_fixed_positions", &AtomsDatabaseUpdater::SetFixedPositions, (py::arg("self"), py::arg("fixed_positions")))
+      .def("close", CloseDatabasePython<AtomsDatabaseUpdater>)
+      .def("__contains__", &AtomsDatabaseUpdater::Contains)
+      .def("__len__", &AtomsDatabaseUpdater::Size)
+      .def("ids", AtomsDatabaseUpdaterIds);
+
+  py::class_<AtomsDatabase, boost::noncopyable>("AtomsDatabase", py::init<std::string>())
+      .def("__len__", &AtomsDatabase::Size)
+      .def("__contains__", &AtomsDatabase::Contains)
+      .def("ids", AtomsDatabaseIds)
+      .def("stats", AtomsDatabaseStats)
+      .def("contact_thresholds", AtomsDatabaseContactThresholds)
+      .def("load_contact_map", LoadContactMapFromDatabase)
+      .def("load_aligned_contact_map", LoadAlignedContactMapFromDatabase)
+      .def("load_aligned_contact_map", LoadStoredAlignedContactMapFromDatabase,
+           (py::arg("self"), py::arg("angstrom_contact_threshold"), py::arg("alignment"), py::arg("generated_contacts")))
+      .def("load_aligned_contact_maps", LoadAlignedContactMapsFromDatabase)
+      .def("fill_aligned_contact_map", FillAlignedContactMapFromDatabase,
+           (py::arg("self"), py::arg("buffer"), py::arg("protein_id"), py::arg("angstrom_contact_threshold"), py::arg("query_alignment"),
+               py::arg("target_alignment"), py::arg("generated_contacts")))
+      .def("load_packed_contact_map", LoadPackedContactMapFromDatabase)
+      .def("load_aligned_packed_contact_map", LoadAlignedPackedContactMapFromDatabase)
+      .def("load_aligned_packed_contact_maps", LoadAlignedPackedContactMapsFromDatabase)
+      .def("load_aligned_packed_contact_maps_to_device", LoadAlignedPackedContactMapsToDeviceFromDatabase)
+      .def("load_aligned_sparse_contact_map", LoadAlignedSparseContactMapFromDatabase,
+           (py::arg("self"), py::arg("protein_id"), py::arg("angstrom_contact_threshold"), py::arg("query_alignment"), py::arg("target_alignment"),
+               py::arg("generated_contacts"), py::arg("format") = "csr"))
+      .def("load_aligned_sparse_contact_maps", LoadAlignedSparseContactMapsFromDatabase,
+           (py::arg("self"), py::arg("protein_ids"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+               py::arg("generated_contacts"), py::arg("thread_count"), py::arg("format") = "csr"))
+      .def("load_cigar_aligned_contact_maps", LoadCigarAlignedContactMapsFromDatabase)
+      .def("prefetch_aligned_contact_maps", PrefetchAlignedContactMapsFromDatabase,
+           (py::arg("self"), py::arg("protein_ids"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+               py::arg("generated_contacts"), py::arg("thread_count"), py::arg("queue_size") = 64),
+           py::with_custodian_and_ward_postcall<0, 1>())
+      .def("prefetch_cigar_aligned_contact_maps", PrefetchCigarAlignedContactMapsFromDatabase,
+           (py::arg("self"), py::arg("protein_ids"), py::arg("angstrom_contact_threshold"), py::arg("cigars"), py::arg("generated_contacts"),
+               py::arg("thread_count"), py::arg("queue_size") = 64),
+           py::with_custodian_and_ward_postcall<0, 1>())
+      .def("build_aligned_contact_map_store", BuildAlignedContactMapStoreFromDatabase,
+           (py::arg("self"), py::arg("protein_ids"), py::arg("angstrom_contact_threshold"), py::arg("query_alignments"), py::arg("target_alignments"),
+               py::arg("generated_contacts"), py::arg("thread_count"), py::arg("spill_path") = ""))
+      .def("build_cigar_aligned_contact_map_store", BuildCigarAlignedContactMapStoreFromDatabase,
+           (py::arg("self"), py::arg("protein_ids"), py::arg("angstrom_contact_threshold"), py::arg("cigars"), py::arg("generated_contacts"),
+               py::arg("thread_count"), py::arg("spill_path") = ""))
+      .def("build_stored_aligned_contact_map_store", BuildStoredAlignedContactMapStoreFromDatabase,
+           (py::arg("self"), py::arg("angstrom_contact_threshold"), py::arg("alignment_store"), py::arg("generated_contacts"), py::arg("thread_count"),
+               py::arg("spill_path") = ""))
+      .def("align_and_load_contact_map", AlignAndLoadContactMapFromDatabase,
+           (py::arg("self"), py::arg("protein_id"), py::arg("angstrom_contact_threshold"), py::arg("query_sequence"), py::arg("target_sequence"),
+               py::arg("match"), py::arg("mismatch"), py::arg("gap_open"), py::arg("gap_continuation"), py::arg("generated_contacts"),
+               py::arg("format") = "dense"));
+
+  py::class_<AlignedContactMapStore, std::shared_ptr<AlignedContactMapStore>, boost::noncopyable>("AlignedContactMapStore", py::no_init)
+      .def("__len__", &AlignedContactMapStore::Size)
+      .def("query_length", &AlignedContactMapStore::QueryLength)
+      .def("data_size", &AlignedContactMapStore::DataSize)
+      .def("spilled", &AlignedContactMapStore::Spilled)
+      .def("load_contact_map", StoredContactMap)
+      .def("load_packed_contact_map", StoredPackedContactMap)
+      .def("load_sparse_contact_map", StoredSparseContactMap, (py::arg("self"), py::arg("index"), py::arg("format") = "csr"))
+      .def("fill_contact_map", FillStoredContactMap, (py::arg("self"), py::arg("index"), py::arg("buffer")))
+      .def("length_buckets", StoredLengthBuckets,
+           (py::arg("self"), py::arg("max_batch_size"), py::arg("max_batch_cells") = (size_t) 256 * 1024 * 1024))
+      .def("load_padded_contact_maps", StoredPaddedContactMaps,
+           (py::arg("self"), py::arg("indexes"), py::arg("format") = "dense", py::arg("thread_count") = 1))
+      .def("prefetch_contact_maps", PrefetchStoredContactMaps, (py::arg("self"), py::arg("thread_count"), py::arg("queue_size") = 64));
+
+  py::class_<CudaPackedContactMaps, std::shared_ptr<CudaPackedContactMaps>, boost::noncopyable>("DeviceContactMaps", py::no_init)
+      .def("__len__", &CudaPackedContactMaps::Size)
+      .def("query_length", &CudaPackedContactMaps::QueryLength)
+      .def("offset", &CudaPackedContactMaps::Offset)
+      .def("data_size", &CudaPackedContactMaps::DataSize)
+      .def("device_pointer", DevicePointer)
+      .def("load_packed_contact_map", DevicePackedContactMap);
+
+  py::class_<ContactMapPrefetcher, std::shared_ptr<ContactMapPrefetcher>, boost::noncopyable>("ContactMapPrefetcher", py::no_init)
+      .def("__len__", &ContactMapPrefetcher::Size)
+      .def("__iter__", PrefetcherIter)
+      .def("__next__", PrefetcherNext);
+
+  py::def("align_sequences", AlignSequencesPython);
+  py::def("align_best_hits", AlignBestHitsPython);
+  py::def("align_best_hits_to_alignment_shard", AlignBestHitsToShardPython);
+  py::def("save_alignment_shard", SaveAlignmentShard);
+
+  py::class_<StoredAlignment>("AlignmentRecord", py::no_init)
+      .add_property("query_id", py::make_getter(&StoredAlignment::query_id, py::return_value_policy<py::return_by_value>()))
+      .add_property("target_id", py::make_getter(&StoredAlignment::target_id, py::return_value_policy<py::return_by_value>()))
+      .def_readonly("score", &StoredAlignment::score)
+      .def_readonly("sequence_identity", &StoredAlignment::sequence_identity)
+      .add_property("query_length", StoredAlignmentQueryLength)
+      .add_property("cigar", StoredAlignmentCigar);
+
+  py::class_<AlignmentStore, std::shared_ptr<AlignmentStore>, boost::noncopyable>("AlignmentStore", py::init<std::string>())
+      .def("__len__", &AlignmentStore::Size)
+      .def("__contains__", AlignmentStoreContains)
+      .def("__getitem__", AlignmentStoreItem)
+      .def("alignment", &AlignmentStore::Alignment)
+      .def("query_ids", AlignmentStoreQueryIds)
+      .def("target_ids", AlignmentStoreTargetIds)
+      .def("shard_count", &AlignmentStore::ShardCount);
+
+  py::def("ingest_structure_files", IngestStructureFilesPython<AtomsDatabaseWriter>,
+          (py::arg("protein_ids"), py::arg("file_paths"), py::arg("database"), py::arg("fasta_path"), py::arg("max_target_chain_length"),
+              py::arg("thread_count"), py::arg("skip_unchanged") = false));
+  py::def("ingest_structure_files", IngestStructureFilesPython<AtomsDatabaseUpdater>,
+          (py::arg("protein_ids"), py::arg("file_paths"), py::arg("database"), py::arg("fasta_path"), py::arg("max_target_chain_length"),
+              py::arg("thread_count"), py::arg("skip_unchanged") = true));
+  py::def("compact_atoms_database", CompactAtomsDatabasePython);
+
+  py::def("set_contact_map_cache_size", SetContactMapCacheSize);
+  py::def("clear_contact_map_cache", ClearContactMapCache);
+  py::def("get_contact_map_cache_stats", GetContactMapCacheStats);
+  py::def("get_engine_stats", GetEngineStats);
+  py::def("reset_engine_stats", ResetEngineStats);
+  py::def("set_engine_tracing", SetEngineTracing);
+  py::def("take_engine_trace", TakeEngineTrace);
+  py::def("set_contact_bounds_policy", SetContactBoundsPolicy);
+  py::def("get_contact_bounds_policy", GetContactBoundsPolicy);
+  py::def("set_contact_definition", SetContactDefinition);
+  py::def("get_contact_definition", GetContactDefinition);
+  py::def("set_contact_backend", SetContactBackend);
+  py::def("get_contact_backend", GetContactBackend);
+  py::def("cuda_contacts_available", CudaContactsAvailable);
 }
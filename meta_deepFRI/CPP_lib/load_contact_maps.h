@@ -5,89 +5,64 @@
 #ifndef LOAD_CONTACT_MAPS
 #define LOAD_CONTACT_MAPS
 
-#include <cmath>
-#include <iostream>
-#include <queue>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
-#include "atoms_file_io.h"
+#include "contact_maps.h"
+#include "cuda_contacts.h"
+#include "packed_contact_map_file.h"
 #include "python_utils.h"
+#include "sequence_alignment_python.h"
 
-static float Distance(float* array, int i, int j) {
-  return sqrtf(powf(array[i * 3] - array[j * 3], 2) + powf(array[i * 3 + 1] - array[j * 3 + 1], 2) + powf(array[i * 3 + 2] - array[j * 3 + 2], 2));
+// Python layer of contact_maps.h, numpy arrays and lists in and out. GIL is released around the C++ core wherever it runs for long.
+
+static py::dict GetContactMapCacheStats() {
+  ContactMapCacheStats stats = GlobalContactMapCache().Stats();
+  py::dict output;
+  output["hits"] = stats.hits;
+  output["misses"] = stats.misses;
+  output["entries"] = stats.entries;
+  output["size_bytes"] = stats.size_bytes;
+  output["budget_bytes"] = stats.budget_bytes;
+  return output;
 }
 
 
-static std::pair<bool*, int> LoadDenseContactMap(const std::string& file_path, const float angstrom_contact_threshold){
-  int chain_length;
-  int* group_indexes;
-  float* atoms_positions;
-  std::tie(chain_length, group_indexes, atoms_positions) = LoadAtomsFile(file_path);
-
-  // allocate output array
-  bool* const output_data = new bool[(int) pow(chain_length, 2)];
-  std::memset(output_data, 0, (int) pow(chain_length, 2));
-
-  // fill up output array with atom contacts
-  for (int group_a = 0; group_a < chain_length; ++group_a) {
-    output_data[group_a * chain_length + group_a] = true;
-
-    for (int group_b = group_a + 1; group_b < chain_length; ++group_b) {
-      bool group_connected = false;
-
-      for (int atom_a = group_indexes[group_a]; atom_a < group_indexes[group_a + 1]; ++atom_a) {
-        for (int atom_b = group_indexes[group_b]; atom_b < group_indexes[group_b + 1]; ++atom_b) {
-          if (Distance(atoms_positions, atom_a, atom_b) <= angstrom_contact_threshold) {
-            group_connected = true;
-            output_data[group_a * chain_length + group_b] = true;
-            output_data[group_a + group_b * chain_length] = true;
-            break;
-          }
-        }
-
-        if (group_connected)
-          break;
-      }
-    }
-  }
+// counters since the last reset, times are in nanoseconds
+static py::dict GetEngineStats() {
+  const EngineStats::Counters counters = GlobalEngineStats().Read();
+  py::dict output;
+  for (int i = 0; i < ENGINE_COUNTER_COUNT; ++i)
+    output[ENGINE_COUNTER_NAMES[i]] = counters[i];
+  return output;
+}
+
 
-  delete[] group_indexes;
-  delete[] atoms_positions;
-  return std::make_pair(output_data, chain_length);
+static void ResetEngineStats() {
+  GlobalEngineStats().Reset();
 }
 
 
-static std::vector<std::pair<int, int>>* LoadSparseContactMap(const std::string& file_path, const float angstrom_contact_threshold){
-  int chain_length;
-  int* group_indexes;
-  float* atoms_positions;
-  std::tie(chain_length, group_indexes, atoms_positions) = LoadAtomsFile(file_path);
-
-  // fill up vector with sparse atom contacts
-  auto* sparse_contacts = new std::vector<std::pair<int, int>>();
-  sparse_contacts->reserve(chain_length * 10);
-
-  for (int group_a = 0; group_a < chain_length; ++group_a) {
-    for (int group_b = group_a + 1; group_b < chain_length; ++group_b) {
-      bool group_connected = false;
-
-      for (int atom_a = group_indexes[group_a]; atom_a < group_indexes[group_a + 1]; ++atom_a) {
-        for (int atom_b = group_indexes[group_b]; atom_b < group_indexes[group_b + 1]; ++atom_b) {
-          if (Distance(atoms_positions, atom_a, atom_b) <= angstrom_contact_threshold) {
-            group_connected = true;
-            sparse_contacts->emplace_back(group_a, group_b);
-            break;
-          }
-        }
-
-        if (group_connected)
-          break;
-      }
-    }
-  }
+static void SetEngineTracing(const bool enabled) {
+  GlobalEngineStats().Tracing().store(enabled);
+}
+
 
-  delete[] group_indexes;
-  delete[] atoms_positions;
-  return sparse_contacts;
+// recorded events as (stage, label, thread, start_ns, duration_ns) tuples, stage is load, contact or projection
+static py::list TakeEngineTrace() {
+  std::vector<EngineTraceEvent> trace = GlobalEngineStats().TakeTrace();
+  py::list output;
+  for (const EngineTraceEvent& event : trace) {
+    const std::string counter_name = ENGINE_COUNTER_NAMES[(int) event.stage];
+    output.append(py::make_tuple(counter_name.substr(0, counter_name.size() - 3), event.label, event.thread, event.start_ns, event.duration_ns));
+  }
+  return output;
 }
 
 
@@ -99,64 +74,605 @@ static np::ndarray LoadContactMap(const std::string& file_path, const float angs
 }
 
 
-static np::ndarray LoadAlignedContactMap(const std::string& file_path, float angstrom_contact_threshold, const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
-  std::vector<std::pair<int, int>>* sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
-  std::vector<std::pair<int, int>> sparse_query_contacts;
-  sparse_query_contacts.reserve(sparse_target_contacts->size());
-
-  int target_index = 0;
-  int query_index = 0;
-  std::vector<int> target_to_query_indexes;
-  target_to_query_indexes.reserve(query_alignment.size());
-
-  for (int i = 0; i < query_alignment.size(); ++i) {
-    if (query_alignment[i] == '-') {
-      target_to_query_indexes[target_index] = -1;
-      ++target_index;
-    } else if (target_alignment[i] == '-') {
-      for (int j = 1; j < generated_contacts + 1; ++j) {
-        sparse_query_contacts.emplace_back(query_index - j, query_index);
-        sparse_query_contacts.emplace_back(query_index + j, query_index);
-      }
-      ++query_index;
-    } else {
-      target_to_query_indexes[target_index] = query_index;
-      ++target_index;
-      ++query_index;
-    }
+// uint8 array of shape (size, ceil(size / 8)), np.unpackbits(array, axis=1)[:, :size] gives the dense map
+static np::ndarray PackedToPython(PackedContactMap& contact_map) {
+  const int row_bytes = contact_map.row_bytes;
+  return CreateNumpyArray(contact_map.bits.release(), py::make_tuple(contact_map.size, row_bytes), py::make_tuple(row_bytes, 1));
+}
+
+
+// "csr" gives tuple (indptr, indices), "coo" gives int32 array of shape (nonzeros, 2) with (row, column) pairs
+enum class SparseFormat { CSR, COO };
+
+static SparseFormat ParseSparseFormat(const std::string& format) {
+  if (format == "csr")
+    return SparseFormat::CSR;
+  if (format == "coo")
+    return SparseFormat::COO;
+  throw std::invalid_argument("Unknown sparse contact map format " + format + ", use csr or coo");
+}
+
+
+static py::object CsrToPython(CsrContactMap& contact_map, const SparseFormat format) {
+  if (format == SparseFormat::CSR) {
+    np::ndarray indptr = CreateNumpyVector(contact_map.indptr.release(), contact_map.size + 1);
+    np::ndarray indices = CreateNumpyVector(contact_map.indices.release(), contact_map.nonzeros);
+    return py::make_tuple(indptr, indices);
   }
 
-  for (int i = 0; i < sparse_target_contacts->size(); ++i) {
-    int contact_x = target_to_query_indexes[sparse_target_contacts->operator[](i).first];
-    if (contact_x < 0) {
-      continue;
+  int* const edges = new int[(size_t) contact_map.nonzeros * 2];
+  for (int row = 0; row < contact_map.size; ++row) {
+    for (int i = contact_map.indptr[row]; i < contact_map.indptr[row + 1]; ++i) {
+      edges[i * 2] = row;
+      edges[i * 2 + 1] = contact_map.indices[i];
     }
-    int contact_y = target_to_query_indexes[sparse_target_contacts->operator[](i).second];
-    if (contact_y < 0) {
-      continue;
-    }
-    sparse_query_contacts.emplace_back(contact_x, contact_y);
   }
+  return CreateNumpyArray(edges, py::make_tuple(contact_map.nonzeros, 2), py::make_tuple(2 * sizeof(int), sizeof(int)));
+}
+
+
+static np::ndarray LoadContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, const float angstrom_contact_threshold) {
+  bool* contact_map;
+  int chain_length;
+  std::tie(contact_map, chain_length) = LoadDenseContactMap(database, protein_id, angstrom_contact_threshold);
+  return CreateNumpyArray(contact_map, chain_length);
+}
+
+
+static np::ndarray LoadAlignedContactMap(const std::string& file_path, float angstrom_contact_threshold, const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  bool* contact_map;
+  int query_length;
+  std::tie(contact_map, query_length) = AlignContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return CreateNumpyArray(contact_map, query_length);
+}
+
+
+static np::ndarray LoadAlignedContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, float angstrom_contact_threshold,
+                                                     const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  bool* contact_map;
+  int query_length;
+  std::tie(contact_map, query_length) = AlignContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return CreateNumpyArray(contact_map, query_length);
+}
+
+
+// Writable bool matrix owned by python, e.g. a max query length buffer reused for every contact map.
+// Rows must be contiguous, row stride may be larger than the number of columns, so a view of a larger buffer works too.
+struct DenseContactMapBuffer {
+  bool* data;
+  size_t row_stride;
+  int rows;
+  int columns;
+};
+
+
+static DenseContactMapBuffer DenseBufferFromPython(const np::ndarray& buffer) {
+  if (!np::equivalent(buffer.get_dtype(), np::dtype::get_builtin<bool>()) || buffer.get_nd() != 2)
+    throw std::invalid_argument("Contact map buffer must be a 2D bool array");
+  if (!(buffer.get_flags() & np::ndarray::WRITEABLE))
+    throw std::invalid_argument("Contact map buffer must be writable");
+  const Py_intptr_t* shape = buffer.get_shape();
+  const Py_intptr_t* strides = buffer.get_strides();
+  if ((strides[1] != sizeof(bool) && shape[1] > 1) || strides[0] < shape[1])
+    throw std::invalid_argument("Rows of contact map buffer must be contiguous and must not overlap");
+  if (shape[0] > INT32_MAX || shape[1] > INT32_MAX)
+    throw std::invalid_argument("Contact map buffer is too large");
+  return DenseContactMapBuffer{reinterpret_cast<bool*>(buffer.get_data()), (size_t) strides[0], (int) shape[0], (int) shape[1]};
+}
+
+
+
+static void CheckDenseBufferSize(const DenseContactMapBuffer& buffer, const int query_length) {
+  if (query_length > buffer.rows || query_length > buffer.columns)
+    throw std::invalid_argument("Contact map buffer of shape (" + std::to_string(buffer.rows) + ", " + std::to_string(buffer.columns) +
+                                ") is too small for query of length " + std::to_string(query_length));
+}
+
+// Fills buffer[:query_length, :query_length] with the dense aligned contact map, the rest of the buffer is not touched.
+// Projection uses scratch of the calling thread, so nothing is allocated once the scratch has grown and target contacts are cached.
+// GIL is released while filling. Returns query length.
+static int FillDenseAlignedContactMap(const DenseContactMapBuffer& buffer, const SparseContactsPtr& sparse_target_contacts, const std::string& query_alignment,
+                                 const std::string& target_alignment, const int generated_contacts) {
+  ReleaseGIL release_gil;
+  ContactScratch& scratch = ThreadContactScratch();
+  const int query_length = AlignSparseContacts(*sparse_target_contacts, query_alignment, target_alignment, generated_contacts, scratch);
+  CheckDenseBufferSize(buffer, query_length);
+  UpperTriangleContacts(scratch.query_contacts);
+  FillSymmetricDenseContactMap(scratch.query_contacts, query_length, buffer.data, buffer.row_stride);
+  return query_length;
+}
+
+
+static int FillAlignedContactMap(np::ndarray& buffer, const std::string& file_path, float angstrom_contact_threshold, const std::string& query_alignment,
+                                 const std::string& target_alignment, const int generated_contacts) {
+  const DenseContactMapBuffer output = DenseBufferFromPython(buffer);
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  return FillDenseAlignedContactMap(output, sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+}
+
+
+static int FillAlignedContactMapFromDatabase(const AtomsDatabase& database, np::ndarray& buffer, const std::string& protein_id, float angstrom_contact_threshold,
+                                             const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  const DenseContactMapBuffer output = DenseBufferFromPython(buffer);
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  return FillDenseAlignedContactMap(output, sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+}
+
+// Bit packed alternatives of LoadContactMap and LoadAlignedContactMap.
+static np::ndarray LoadPackedContactMap(const std::string& file_path, const float angstrom_contact_threshold) {
+  const AtomsFile atoms_file = LoadAtomsFile(file_path);
+  PackedContactMap contact_map = PackedFromSparseContacts(ComputeSparseContacts(atoms_file.atoms, angstrom_contact_threshold, GlobalContactDefinition().load()),
+                                                          atoms_file.atoms.chain_length);
+  return PackedToPython(contact_map);
+}
+
+
+static np::ndarray LoadPackedContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, const float angstrom_contact_threshold) {
+  const AtomsDatabaseEntry& entry = FindDatabaseEntry(database, protein_id);
+  PackedContactMap contact_map = PackedFromSparseContacts(DatabaseSparseContacts(database, entry, protein_id, angstrom_contact_threshold,
+                                                                                 GlobalContactDefinition().load()),
+                                                          (int) entry.chain_length);
+  return PackedToPython(contact_map);
+}
+
+
+static np::ndarray LoadAlignedPackedContactMap(const std::string& file_path, float angstrom_contact_threshold, const std::string& query_alignment,
+                                               const std::string& target_alignment, const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  PackedContactMap contact_map = AlignPackedContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return PackedToPython(contact_map);
+}
+
+
+static np::ndarray LoadAlignedPackedContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, float angstrom_contact_threshold,
+                                                           const std::string& query_alignment, const std::string& target_alignment, const int generated_contacts) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  PackedContactMap contact_map = AlignPackedContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return PackedToPython(contact_map);
+}
+
+
+// Sparse alternatives of LoadAlignedContactMap, dense query_length^2 matrix is never allocated.
+static py::object LoadAlignedSparseContactMap(const std::string& file_path, float angstrom_contact_threshold, const std::string& query_alignment,
+                                              const std::string& target_alignment, const int generated_contacts, const std::string& format) {
+  const SparseFormat sparse_format = ParseSparseFormat(format);
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  CsrContactMap contact_map = AlignCsrContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return CsrToPython(contact_map, sparse_format);
+}
+
+
+static py::object LoadAlignedSparseContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, float angstrom_contact_threshold,
+                                                          const std::string& query_alignment, const std::string& target_alignment,
+                                                          const int generated_contacts, const std::string& format) {
+  const SparseFormat sparse_format = ParseSparseFormat(format);
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  CsrContactMap contact_map = AlignCsrContactMap(sparse_target_contacts, query_alignment, target_alignment, generated_contacts);
+  return CsrToPython(contact_map, sparse_format);
+}
+
+
+static AlignmentInputs StringAlignmentInputs(const py::list& query_alignments, const py::list& target_alignments) {
+  return StringAlignmentInputs(ExtractStrings(query_alignments), ExtractStrings(target_alignments));
+}
+
+
+static AlignmentInputs CigarAlignmentInputs(const py::list& cigars) {
+  return CigarAlignmentInputs(ExtractStrings(cigars));
+}
+
+
+// ParallelBuildContactMaps returning python list, to_python hands a ContactMap over to python.
+template <typename ContactMap, typename BuildFunction, typename ReleaseFunction, typename ToPythonFunction>
+static py::list ParallelAlignContactMaps(const SparseContactsLoader& load_target_contacts, const py::list& target_list, const AlignmentInputs& alignments,
+                                         const int generated_contacts, const int thread_count,
+                                         const BuildFunction& build, const ReleaseFunction& release, const ToPythonFunction& to_python) {
+  const std::vector<std::string> target_names = ExtractStrings(target_list);
+  std::vector<ContactMap> contact_maps;
+  {
+    ReleaseGIL release_gil;
+    contact_maps = ParallelBuildContactMaps<ContactMap>(load_target_contacts, target_names, alignments, generated_contacts, thread_count, build, release);
+  }
+  py::list output;
+  for (ContactMap& contact_map : contact_maps)
+    output.append(to_python(contact_map));
+  return output;
+}
+
+
+// dense contact maps, the default output of batch functions
+static py::list ParallelAlignContactMaps(const SparseContactsLoader& load_target_contacts, const py::list& target_list, const AlignmentInputs& alignments,
+                                         const int generated_contacts, const int thread_count) {
+  return ParallelAlignContactMaps<std::pair<bool*, int>>(
+      load_target_contacts, target_list, alignments, generated_contacts, thread_count, DenseFromAlignedContacts,
+      [](std::pair<bool*, int>& contact_map) { delete[] contact_map.first; },
+      [](std::pair<bool*, int>& contact_map) { return CreateNumpyArray(contact_map.first, contact_map.second); });
+}
+
+
+static py::list ParallelAlignPackedContactMaps(const SparseContactsLoader& load_target_contacts, const py::list& target_list, const AlignmentInputs& alignments,
+                                               const int generated_contacts, const int thread_count) {
+  return ParallelAlignContactMaps<PackedContactMap>(
+      load_target_contacts, target_list, alignments, generated_contacts, thread_count, PackedFromAlignedContacts,
+      [](PackedContactMap&) {},
+      [](PackedContactMap& contact_map) { return PackedToPython(contact_map); });
+}
+
+
+static py::list ParallelAlignSparseContactMaps(const SparseContactsLoader& load_target_contacts, const py::list& target_list, const AlignmentInputs& alignments,
+                                               const int generated_contacts, const int thread_count, const std::string& format) {
+  const SparseFormat sparse_format = ParseSparseFormat(format);
+  return ParallelAlignContactMaps<CsrContactMap>(
+      load_target_contacts, target_list, alignments, generated_contacts, thread_count, CsrFromAlignedContacts,
+      [](CsrContactMap&) {},
+      [sparse_format](CsrContactMap& contact_map) { return CsrToPython(contact_map, sparse_format); });
+}
+
+
+// Batch version of LoadAlignedContactMap, returns list of contact maps in the order of input lists.
+static py::list LoadAlignedContactMaps(const py::list& file_paths, float angstrom_contact_threshold, const py::list& query_alignments,
+                                       const py::list& target_alignments, const int generated_contacts, const int thread_count) {
+  return ParallelAlignContactMaps([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count);
+}
+
+
+static py::list LoadAlignedContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids, float angstrom_contact_threshold,
+                                                   const py::list& query_alignments, const py::list& target_alignments, const int generated_contacts,
+                                                   const int thread_count) {
+  return ParallelAlignContactMaps([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count);
+}
+
+// packed batch on the GPU (cuda_contacts.h), copied back to host maps
+static py::list CudaAlignPackedContactMapsToPython(const CudaTargetLoader& load_target, const py::list& target_list, const AlignmentInputs& alignments,
+                                                   const int generated_contacts, const float angstrom_contact_threshold) {
+  const std::vector<std::string> target_names = ExtractStrings(target_list);
+  std::vector<PackedContactMap> contact_maps;
+  {
+    ReleaseGIL release_gil;
+    contact_maps = CudaPackedContactMapsToHost(*CudaAlignPackedContactMaps(load_target, target_names, alignments, generated_contacts, angstrom_contact_threshold));
+  }
+  py::list output;
+  for (PackedContactMap& contact_map : contact_maps)
+    output.append(PackedToPython(contact_map));
+  return output;
+}
+
+
+static std::shared_ptr<CudaPackedContactMaps> CudaAlignPackedContactMaps(const CudaTargetLoader& load_target, const py::list& target_list,
+                                                                         const AlignmentInputs& alignments, const int generated_contacts,
+                                                                         const float angstrom_contact_threshold) {
+  const std::vector<std::string> target_names = ExtractStrings(target_list);
+  ReleaseGIL release_gil;
+  return CudaAlignPackedContactMaps(load_target, target_names, alignments, generated_contacts, angstrom_contact_threshold);
+}
+
+
+static py::list LoadAlignedPackedContactMaps(const py::list& file_paths, float angstrom_contact_threshold, const py::list& query_alignments,
+                                             const py::list& target_alignments, const int generated_contacts, const int thread_count) {
+  if (UseCudaBackend())
+    return CudaAlignPackedContactMapsToPython(FileCudaTargetLoader(angstrom_contact_threshold), file_paths,
+                                              StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, angstrom_contact_threshold);
+  return ParallelAlignPackedContactMaps([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count);
+}
+
+
+static py::list LoadAlignedPackedContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids, float angstrom_contact_threshold,
+                                                         const py::list& query_alignments, const py::list& target_alignments,
+                                                         const int generated_contacts, const int thread_count) {
+  if (UseCudaBackend())
+    return CudaAlignPackedContactMapsToPython(DatabaseCudaTargetLoader(database, angstrom_contact_threshold), protein_ids,
+                                              StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, angstrom_contact_threshold);
+  return ParallelAlignPackedContactMaps([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count);
+}
+
+
+// GPU backend is required here, maps stay in device memory
+static std::shared_ptr<CudaPackedContactMaps> LoadAlignedPackedContactMapsToDevice(const py::list& file_paths, float angstrom_contact_threshold,
+                                                                                   const py::list& query_alignments, const py::list& target_alignments,
+                                                                                   const int generated_contacts) {
+  return CudaAlignPackedContactMaps(FileCudaTargetLoader(angstrom_contact_threshold), file_paths, StringAlignmentInputs(query_alignments, target_alignments),
+                                    generated_contacts, angstrom_contact_threshold);
+}
+
+
+static std::shared_ptr<CudaPackedContactMaps> LoadAlignedPackedContactMapsToDeviceFromDatabase(const AtomsDatabase& database, const py::list& protein_ids,
+                                                                                               float angstrom_contact_threshold,
+                                                                                               const py::list& query_alignments,
+                                                                                               const py::list& target_alignments,
+                                                                                               const int generated_contacts) {
+  return CudaAlignPackedContactMaps(DatabaseCudaTargetLoader(database, angstrom_contact_threshold), protein_ids,
+                                    StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, angstrom_contact_threshold);
+}
+
 
-  bool* const output_data = new bool[(int) pow(query_index, 2)];
-  std::memset(output_data, 0, (int) pow(query_index, 2));
+static np::ndarray DevicePackedContactMap(const CudaPackedContactMaps& contact_maps, const size_t index) {
+  PackedContactMap contact_map = contact_maps.CopyToHost(index);
+  return PackedToPython(contact_map);
+}
 
-  for (int i = 0; i < query_index; ++i) {
-    output_data[i * query_index + i] = true;
+
+static uintptr_t DevicePointer(const CudaPackedContactMaps& contact_maps) {
+  return reinterpret_cast<uintptr_t>(contact_maps.DeviceData());
+}
+
+
+static py::list LoadAlignedSparseContactMaps(const py::list& file_paths, float angstrom_contact_threshold, const py::list& query_alignments,
+                                             const py::list& target_alignments, const int generated_contacts, const int thread_count,
+                                             const std::string& format) {
+  return ParallelAlignSparseContactMaps([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count, format);
+}
+
+
+static py::list LoadAlignedSparseContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids, float angstrom_contact_threshold,
+                                                         const py::list& query_alignments, const py::list& target_alignments,
+                                                         const int generated_contacts, const int thread_count, const std::string& format) {
+  return ParallelAlignSparseContactMaps([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count, format);
+}
+
+
+// Batch version of LoadAlignedContactMaps taking CIGAR strings returned by align_sequences and align_best_hits
+// instead of aligned strings, alignment runs map target residues to query residues without scanning alignments.
+static py::list LoadCigarAlignedContactMaps(const py::list& file_paths, float angstrom_contact_threshold, const py::list& cigars,
+                                            const int generated_contacts, const int thread_count) {
+  return ParallelAlignContactMaps([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, CigarAlignmentInputs(cigars), generated_contacts, thread_count);
+}
+
+
+static py::list LoadCigarAlignedContactMapsFromDatabase(const AtomsDatabase& database, const py::list& protein_ids, float angstrom_contact_threshold,
+                                                        const py::list& cigars, const int generated_contacts, const int thread_count) {
+  return ParallelAlignContactMaps([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, CigarAlignmentInputs(cigars), generated_contacts, thread_count);
+}
+
+
+// Empty spill_path keeps encoded maps in memory, otherwise they are written there and memory mapped.
+static std::shared_ptr<AlignedContactMapStore> BuildContactMapStore(const SparseContactsLoader& load_target_contacts, const py::list& target_list,
+                                                                    const AlignmentInputs& alignments, const int generated_contacts, const int thread_count,
+                                                                    const std::string& spill_path) {
+  const std::vector<std::string> target_names = ExtractStrings(target_list);
+  ReleaseGIL release_gil;
+  return BuildContactMapStore(load_target_contacts, target_names, alignments, generated_contacts, thread_count, spill_path);
+}
+
+
+static std::shared_ptr<AlignedContactMapStore> BuildAlignedContactMapStore(const py::list& file_paths, float angstrom_contact_threshold,
+                                                                           const py::list& query_alignments, const py::list& target_alignments,
+                                                                           const int generated_contacts, const int thread_count, const std::string& spill_path) {
+  return BuildContactMapStore([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count, spill_path);
+}
+
+
+static std::shared_ptr<AlignedContactMapStore> BuildAlignedContactMapStoreFromDatabase(const AtomsDatabase& database, const py::list& protein_ids,
+                                                                                       float angstrom_contact_threshold, const py::list& query_alignments,
+                                                                                       const py::list& target_alignments, const int generated_contacts,
+                                                                                       const int thread_count, const std::string& spill_path) {
+  return BuildContactMapStore([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, StringAlignmentInputs(query_alignments, target_alignments), generated_contacts, thread_count, spill_path);
+}
+
+
+static std::shared_ptr<AlignedContactMapStore> BuildCigarAlignedContactMapStore(const py::list& file_paths, float angstrom_contact_threshold, const py::list& cigars,
+                                                                                const int generated_contacts, const int thread_count, const std::string& spill_path) {
+  return BuildContactMapStore([angstrom_contact_threshold](const std::string& file_path) {
+    return LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  }, file_paths, CigarAlignmentInputs(cigars), generated_contacts, thread_count, spill_path);
+}
+
+
+static std::shared_ptr<AlignedContactMapStore> BuildCigarAlignedContactMapStoreFromDatabase(const AtomsDatabase& database, const py::list& protein_ids,
+                                                                                            float angstrom_contact_threshold, const py::list& cigars,
+                                                                                            const int generated_contacts, const int thread_count,
+                                                                                            const std::string& spill_path) {
+  return BuildContactMapStore([&database, angstrom_contact_threshold](const std::string& protein_id) {
+    return LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  }, protein_ids, CigarAlignmentInputs(cigars), generated_contacts, thread_count, spill_path);
+}
+
+
+// (id, packed map) tuples of a file written by the contact map service, maps are in the format of load_packed_contact_map
+static py::list LoadPackedContactMapFile(const std::string& file_path) {
+  const PackedContactMapFile file(file_path);
+  py::list output;
+  for (const PackedContactMapFile::Entry& entry : file.Entries()) {
+    PackedContactMap contact_map;
+    contact_map.size = entry.size;
+    contact_map.row_bytes = (entry.size + 7) / 8;
+    const size_t bytes = (size_t) entry.size * contact_map.row_bytes;
+    contact_map.bits.reset(new uint8_t[bytes]);
+    std::memcpy(contact_map.bits.get(), file.Bits(entry), bytes);
+    output.append(py::make_tuple(entry.id, PackedToPython(contact_map)));
+  }
+  return output;
+}
+
+
+// Stored maps in the same formats as the loaders, decoded into the scratch of the calling thread.
+// The store checks the upper bound of indexes.
+static size_t StoreIndex(const int index) {
+  if (index < 0)
+    throw std::out_of_range("Contact map index " + std::to_string(index) + " is negative");
+  return (size_t) index;
+}
+
+
+static np::ndarray StoredContactMap(const AlignedContactMapStore& store, const int index) {
+  SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+  const int query_length = store.Contacts(StoreIndex(index), sparse_query_contacts);
+  return CreateNumpyArray(SymmetricDenseContactMap(sparse_query_contacts, query_length), query_length);
+}
+
+
+static np::ndarray StoredPackedContactMap(const AlignedContactMapStore& store, const int index) {
+  SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+  const int query_length = store.Contacts(StoreIndex(index), sparse_query_contacts);
+  PackedContactMap contact_map = PackedFromSparseContacts(sparse_query_contacts, query_length);
+  return PackedToPython(contact_map);
+}
+
+
+static py::object StoredSparseContactMap(const AlignedContactMapStore& store, const int index, const std::string& format) {
+  const SparseFormat sparse_format = ParseSparseFormat(format);
+  SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+  const int query_length = store.Contacts(StoreIndex(index), sparse_query_contacts);
+  CsrContactMap contact_map = CsrFromSparseContacts(sparse_query_contacts, query_length);
+  return CsrToPython(contact_map, sparse_format);
+}
+
+
+// fill_aligned_contact_map for a stored map, returns query length
+static int FillStoredContactMap(const AlignedContactMapStore& store, const int index, np::ndarray& buffer) {
+  const DenseContactMapBuffer output = DenseBufferFromPython(buffer);
+  const size_t store_index = StoreIndex(index);
+  const int query_length = store.QueryLength(store_index);
+  CheckDenseBufferSize(output, query_length);
+  SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+  store.Contacts(store_index, sparse_query_contacts);
+  FillSymmetricDenseContactMap(sparse_query_contacts, query_length, output.data, output.row_stride);
+  return query_length;
+}
+
+
+// Length bucketed batches of a store, lists of indexes to pass to load_padded_contact_maps, see LengthBuckets.
+static py::list StoredLengthBuckets(const AlignedContactMapStore& store, const int max_batch_size, const size_t max_batch_cells) {
+  py::list output;
+  for (const std::vector<int>& bucket : LengthBuckets(store.QueryLengths(), max_batch_size, max_batch_cells)) {
+    py::list indexes;
+    for (const int index : bucket)
+      indexes.append(index);
+    output.append(indexes);
   }
-  for (std::pair<int, int> pair : sparse_query_contacts) {
-    if (pair.first < 0) {
-      continue;
+  return output;
+}
+
+
+// Writes stored maps straight into one padded tensor, no per map arrays are created. Returns tuple (contact maps, lengths):
+//   "dense"   bool array of shape (batch size, longest length, longest length)
+//   "packed"  uint8 array of shape (batch size, longest length, ceil(longest length / 8)), bits ordered like load_packed_contact_map
+// and int32 lengths of shape (batch size,). Padding is zero. Maps are decoded in parallel with GIL released.
+static py::tuple StoredPaddedContactMaps(const AlignedContactMapStore& store, const py::list& index_list, const std::string& format, const int thread_count) {
+  if (format != "dense" && format != "packed")
+    throw std::invalid_argument("Unknown padded contact map format " + format + ", use dense or packed");
+  const bool packed = format == "packed";
+  const size_t batch_size = py::len(index_list);
+  int* const lengths = new int[std::max(batch_size, (size_t) 1)];
+  std::vector<size_t> indexes(batch_size);
+  int max_length = 0;
+  try {
+    for (size_t i = 0; i < batch_size; ++i) {
+      indexes[i] = StoreIndex(py::extract<int>(index_list[i]));
+      lengths[i] = store.QueryLength(indexes[i]);
+      max_length = std::max(max_length, lengths[i]);
     }
-    if (pair.first >= query_index) {
-      continue;
+  } catch (...) {
+    delete[] lengths;
+    throw;
+  }
+
+  const size_t row_bytes = packed ? (size_t) (max_length + 7) / 8 : (size_t) max_length;
+  const size_t map_bytes = (size_t) max_length * row_bytes;
+  const size_t total_bytes = std::max(batch_size * map_bytes, (size_t) 1);
+  bool* const dense = packed ? nullptr : new bool[total_bytes]();
+  uint8_t* const bits = packed ? new uint8_t[total_bytes]() : nullptr;
+  try {
+    ReleaseGIL release_gil;
+    WorkStealingPool pool(std::min(thread_count, (int) std::max(batch_size, (size_t) 1)));
+    for (size_t i = 0; i < batch_size; ++i) {
+      pool.Submit([&, i]() {
+        SparseContacts& sparse_query_contacts = ThreadContactScratch().query_contacts;
+        store.Contacts(indexes[i], sparse_query_contacts);
+        if (packed)
+          SetPackedContacts(sparse_query_contacts, lengths[i], bits + i * map_bytes, row_bytes);
+        else
+          FillSymmetricDenseContactMap(sparse_query_contacts, lengths[i], dense + i * map_bytes, row_bytes);
+      });
     }
-    output_data[pair.first * query_index + pair.second] = true;
-    output_data[pair.second * query_index + pair.first] = true;
+    pool.Wait();
+  } catch (...) {
+    delete[] dense;
+    delete[] bits;
+    delete[] lengths;
+    throw;
   }
 
-  delete sparse_target_contacts;
-  return CreateNumpyArray(output_data, query_index);
+  np::ndarray lengths_array = CreateNumpyVector(lengths, (int) batch_size);
+  const py::tuple shape = py::make_tuple(batch_size, max_length, row_bytes);
+  const py::tuple strides = py::make_tuple(map_bytes, row_bytes, 1);
+  if (packed)
+    return py::make_tuple(CreateNumpyArray(bits, shape, strides), lengths_array);
+  return py::make_tuple(CreateNumpyArray(dense, shape, strides), lengths_array);
+}
+
+// Output of the single call align and load functions: "dense", "packed", "csr" or "coo", same arrays as the matching loaders.
+static py::object AlignedContactsToPython(SparseContacts& sparse_query_contacts, const int query_length, const std::string& format) {
+  if (format == "dense") {
+    bool* const contact_map = DenseFromAlignedContacts(sparse_query_contacts, query_length).first;
+    return CreateNumpyArray(contact_map, query_length);
+  }
+  if (format == "packed") {
+    PackedContactMap contact_map = PackedFromAlignedContacts(sparse_query_contacts, query_length);
+    return PackedToPython(contact_map);
+  }
+  if (format != "csr" && format != "coo")
+    throw std::invalid_argument("Unknown contact map format " + format + ", use dense, packed, csr or coo");
+  CsrContactMap contact_map = CsrFromAlignedContacts(sparse_query_contacts, query_length);
+  return CsrToPython(contact_map, ParseSparseFormat(format));
+}
+
+
+// Aligns query and target sequences and projects target contacts onto the query in one call.
+// Alignment runs are passed straight to the projection and aligned strings are never built.
+// Returns tuple (contact map, alignment score, sequence identity).
+static py::tuple AlignAndProjectContactMap(const SparseContactsPtr& sparse_target_contacts, const std::string& query_sequence, const std::string& target_sequence,
+                                           const AlignmentScoring& scoring, const int generated_contacts, const std::string& format) {
+  SequenceAlignment alignment;
+  ContactScratch& scratch = ThreadContactScratch();
+  int query_length;
+  {
+    ReleaseGIL release_gil;
+    alignment = AlignSequences(query_sequence, target_sequence, scoring, false);
+    query_length = AlignSparseContacts(*sparse_target_contacts, alignment.runs, generated_contacts, scratch);
+  }
+  py::object contact_map = AlignedContactsToPython(scratch.query_contacts, query_length, format);
+  return py::make_tuple(contact_map, alignment.score, alignment.identity);
+}
+
+
+static py::tuple AlignAndLoadContactMap(const std::string& file_path, float angstrom_contact_threshold, const std::string& query_sequence,
+                                        const std::string& target_sequence, const double match, const double mismatch, const double gap_open,
+                                        const double gap_continuation, const int generated_contacts, const std::string& format) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(file_path, angstrom_contact_threshold);
+  return AlignAndProjectContactMap(sparse_target_contacts, query_sequence, target_sequence, AlignmentScoring{match, mismatch, gap_open, gap_continuation},
+                                   generated_contacts, format);
+}
+
+
+static py::tuple AlignAndLoadContactMapFromDatabase(const AtomsDatabase& database, const std::string& protein_id, float angstrom_contact_threshold,
+                                                    const std::string& query_sequence, const std::string& target_sequence, const double match,
+                                                    const double mismatch, const double gap_open, const double gap_continuation,
+                                                    const int generated_contacts, const std::string& format) {
+  SparseContactsPtr sparse_target_contacts = LoadSparseContactMap(database, protein_id, angstrom_contact_threshold);
+  return AlignAndProjectContactMap(sparse_target_contacts, query_sequence, target_sequence, AlignmentScoring{match, mismatch, gap_open, gap_continuation},
+                                   generated_contacts, format);
 }
 
 #endif
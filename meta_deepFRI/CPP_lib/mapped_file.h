@@ -0,0 +1,89 @@
+#ifndef MAPPED_FILE
+#define MAPPED_FILE
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "engine_stats.h"
+
+// Read only memory map of a whole file, unmapped when the object is destroyed.
+class MappedFile {
+ public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string& file_path) {
+    int file_descriptor = open(file_path.c_str(), O_RDONLY);
+    if (file_descriptor < 0)
+      throw std::runtime_error("Unable to open " + file_path + ": " + std::strerror(errno));
+
+    struct stat file_stat{};
+    if (fstat(file_descriptor, &file_stat) != 0) {
+      close(file_descriptor);
+      throw std::runtime_error("Unable to stat " + file_path + ": " + std::strerror(errno));
+    }
+    size_ = (size_t) file_stat.st_size;
+    CountEngineEvent(EngineCounter::FILES_OPENED, 1);
+
+    // mmap does not accept empty mappings, empty files are left unmapped with size 0
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, file_descriptor, 0);
+      if (data == MAP_FAILED) {
+        close(file_descriptor);
+        throw std::runtime_error("Unable to mmap " + file_path + ": " + std::strerror(errno));
+      }
+      data_ = static_cast<const char*>(data);
+    }
+    close(file_descriptor);
+  }
+
+  ~MappedFile() {
+    Unmap();
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+
+  MappedFile& operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+      Unmap();
+      data_ = other.data_;
+      size_ = other.size_;
+      other.data_ = nullptr;
+      other.size_ = 0;
+    }
+    return *this;
+  }
+
+  const char* Data() const {
+    return data_;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+ private:
+  void Unmap() {
+    if (data_ != nullptr)
+      munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+#endif
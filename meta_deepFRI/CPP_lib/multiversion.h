@@ -0,0 +1,13 @@
+#ifndef MULTIVERSION
+#define MULTIVERSION
+
+// Portable builds (DEEPFRI_ARCH=multiversion) compile loops marked MULTIVERSIONED for baseline x86-64, AVX2 and AVX-512,
+// the dynamic loader picks the best clone for the CPU. Other builds compile them once for the target architecture.
+// Distance kernels are dispatched at runtime in every build, see distance_kernel.h.
+#if defined(DEEPFRI_MULTIVERSION) && defined(__x86_64__) && defined(__GNUC__) && defined(__ELF__)
+#define MULTIVERSIONED __attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define MULTIVERSIONED
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef PACKED_CONTACT_MAP_FILE
+#define PACKED_CONTACT_MAP_FILE
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "contact_maps.h"
+#include "mapped_file.h"
+
+// Packed contact maps (PackedContactMap) written by the contact map service, read back without recomputing anything.
+// Layout, native byte order:
+//   header   magic, version, reserved, map count
+//   map      uint32 id length, int32 size, id bytes, size rows of (size + 7) / 8 bytes
+static const char PACKED_CONTACT_MAP_FILE_MAGIC[8] = {'D', 'F', 'R', 'I', 'P', 'C', 'M', 'F'};
+static const uint32_t PACKED_CONTACT_MAP_FILE_VERSION = 1;
+
+struct PackedContactMapFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t map_count;
+};
+
+static_assert(sizeof(PackedContactMapFileHeader) == 24, "PackedContactMapFileHeader layout must not change");
+
+
+// Written to save_path.tmp and renamed, readers never see a partial file.
+static void WritePackedContactMapFile(const std::string& save_path, const std::vector<std::string>& ids, const std::vector<PackedContactMap>& contact_maps) {
+  if (ids.size() != contact_maps.size())
+    throw std::invalid_argument("ids and contact maps must have the same length");
+  const std::string temporary_path = save_path + ".tmp";
+  {
+    std::ofstream writer(temporary_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!writer)
+      throw std::runtime_error("Unable to create " + temporary_path);
+    PackedContactMapFileHeader header{};
+    std::memcpy(header.magic, PACKED_CONTACT_MAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = PACKED_CONTACT_MAP_FILE_VERSION;
+    header.map_count = ids.size();
+    writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t i = 0; i < ids.size(); ++i) {
+      const uint32_t id_length = (uint32_t) ids[i].size();
+      const int32_t size = contact_maps[i].size;
+      writer.write(reinterpret_cast<const char*>(&id_length), sizeof(id_length));
+      writer.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      writer.write(ids[i].data(), (std::streamsize) id_length);
+      writer.write(reinterpret_cast<const char*>(contact_maps[i].bits.get()), (std::streamsize) ((size_t) size * contact_maps[i].row_bytes));
+    }
+    writer.close();
+    if (!writer) {
+      std::remove(temporary_path.c_str());
+      throw std::runtime_error("Unable to write packed contact maps to " + temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), save_path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Unable to move packed contact maps to " + save_path);
+  }
+}
+
+
+// Memory mapped packed contact map file, every map is checked against file bounds when the file is opened.
+class PackedContactMapFile {
+ public:
+  struct Entry {
+    std::string id;
+    int size;
+    // offset of the first row inside the file
+    size_t offset;
+  };
+
+  explicit PackedContactMapFile(const std::string& file_path) : file_(file_path) {
+    PackedContactMapFileHeader header{};
+    if (file_.Size() < sizeof(header))
+      throw std::runtime_error(file_path + " is not a packed contact map file, file is too short");
+    std::memcpy(&header, file_.Data(), sizeof(header));
+    if (std::memcmp(header.magic, PACKED_CONTACT_MAP_FILE_MAGIC, sizeof(header.magic)) != 0)
+      throw std::runtime_error(file_path + " is not a packed contact map file");
+    if (header.version != PACKED_CONTACT_MAP_FILE_VERSION)
+      throw std::runtime_error(file_path + " has unsupported packed contact map file version " + std::to_string(header.version));
+
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.map_count; ++i) {
+      uint32_t id_length;
+      int32_t size;
+      if (file_.Size() - offset < sizeof(id_length) + sizeof(size))
+        throw std::runtime_error(file_path + " is corrupted, map " + std::to_string(i) + " is out of file bounds");
+      std::memcpy(&id_length, file_.Data() + offset, sizeof(id_length));
+      std::memcpy(&size, file_.Data() + offset + sizeof(id_length), sizeof(size));
+      offset += sizeof(id_length) + sizeof(size);
+      if (size < 0 || id_length > file_.Size() - offset ||
+          (size_t) size * ((size + 7) / 8) > file_.Size() - offset - id_length)
+        throw std::runtime_error(file_path + " is corrupted, map " + std::to_string(i) + " is out of file bounds");
+      entries_.push_back(Entry{std::string(file_.Data() + offset, id_length), size, offset + id_length});
+      offset += id_length + (size_t) size * ((size + 7) / 8);
+    }
+  }
+
+  const std::vector<Entry>& Entries() const {
+    return entries_;
+  }
+
+  // rows of entry, each (size + 7) / 8 bytes
+  const uint8_t* Bits(const Entry& entry) const {
+    return reinterpret_cast<const uint8_t*>(file_.Data() + entry.offset);
+  }
+
+ private:
+  MappedFile file_;
+  std::vector<Entry> entries_;
+};
+
+#endif
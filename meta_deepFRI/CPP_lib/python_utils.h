@@ -17,11 +17,44 @@ static void Initialize() {
   boost::python::numpy::initialize();
 }
 
+// Releases GIL for the lifetime of the object, python objects must not be touched meanwhile
+class ReleaseGIL {
+ public:
+  ReleaseGIL() : thread_state_(PyEval_SaveThread()) {}
+  ~ReleaseGIL() {
+    PyEval_RestoreThread(thread_state_);
+  }
+
+  ReleaseGIL(const ReleaseGIL&) = delete;
+  ReleaseGIL& operator=(const ReleaseGIL&) = delete;
+
+ private:
+  PyThreadState* thread_state_;
+};
+
 static void DestroyCapsule(PyObject* self) {
   auto* b = reinterpret_cast<bool*>(PyCapsule_GetPointer(self, nullptr));
   delete[] b;
 }
 
+template <typename T>
+static void DestroyArrayCapsule(PyObject* self) {
+  delete[] reinterpret_cast<T*>(PyCapsule_GetPointer(self, nullptr));
+}
+
+// C contiguous array of any shape taking ownership of memory allocated with new[]
+template <typename T>
+static np::ndarray CreateNumpyArray(T* array, const py::tuple& shape, const py::tuple& strides) {
+  PyObject* capsule = PyCapsule_New((void*) array, nullptr, (PyCapsule_Destructor) &DestroyArrayCapsule<T>);
+  py::handle<> capsule_handle{capsule};
+  py::object capsule_owner{capsule_handle};
+  return np::from_data(array, np::dtype::get_builtin<T>(), shape, strides, capsule_owner);
+}
+
+static np::ndarray CreateNumpyVector(int* array, int size) {
+  return CreateNumpyArray(array, py::make_tuple(size), py::make_tuple(sizeof(int)));
+}
+
 static np::ndarray CreateNumpyArray(bool* array, int size){
   // handling over memory management to python
   // https://stackoverflow.com/questions/57068443/setting-owner-in-boostpythonndarray-so-that-data-is-owned-and-managed-by-pyt
@@ -0,0 +1,304 @@
+#ifndef SEQUENCE_ALIGNMENT
+#define SEQUENCE_ALIGNMENT
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "alignment_kernel.h"
+#include "thread_pool.h"
+
+// Global alignment with affine gaps, same scoring as Bio.pairwise2.align.globalms:
+// every aligned pair scores match or mismatch, gap of length k scores gap_open + (k - 1) * gap_continuation,
+// gaps at both ends are penalized like any other gap.
+struct AlignmentScoring {
+  double match;
+  double mismatch;
+  double gap_open;
+  double gap_continuation;
+};
+
+// Run of alignment columns of the same kind, CIGAR like:
+// 'M' query residue aligned to target residue, 'I' query residue against a gap in target,
+// 'D' target residue against a gap in query.
+struct AlignmentRun {
+  char operation;
+  int length;
+};
+
+typedef std::vector<AlignmentRun> AlignmentRuns;
+
+struct SequenceAlignment {
+  // gapped strings are filled only when requested, runs are always filled
+  std::string query_alignment;
+  std::string target_alignment;
+  AlignmentRuns runs;
+  double score;
+  // identical aligned positions divided by alignment length, as alignment_sequences_identity used to compute
+  double identity;
+};
+
+
+// text form of runs, for example "12M1I30M2D5M"
+static std::string FormatCigar(const AlignmentRuns& runs) {
+  std::string cigar;
+  for (const AlignmentRun& run : runs) {
+    cigar += std::to_string(run.length);
+    cigar += run.operation;
+  }
+  return cigar;
+}
+
+
+static AlignmentRuns ParseCigar(const std::string& cigar) {
+  AlignmentRuns runs;
+  int64_t length = 0;
+  bool has_length = false;
+  for (char c : cigar) {
+    if (c >= '0' && c <= '9') {
+      length = length * 10 + (c - '0');
+      has_length = true;
+      if (length > std::numeric_limits<int>::max())
+        throw std::invalid_argument("Too long run in cigar " + cigar);
+    } else if ((c == 'M' || c == 'I' || c == 'D') && has_length && length > 0) {
+      if (!runs.empty() && runs.back().operation == c)
+        runs.back().length += (int) length;
+      else
+        runs.push_back(AlignmentRun{c, (int) length});
+      length = 0;
+      has_length = false;
+    } else {
+      throw std::invalid_argument("Invalid cigar " + cigar);
+    }
+  }
+  if (has_length)
+    throw std::invalid_argument("Invalid cigar " + cigar);
+  return runs;
+}
+
+
+// runs of gapped alignment strings, '-' in query is 'D', '-' in target is 'I'
+static AlignmentRuns AlignmentRunsFromStrings(const std::string& query_alignment, const std::string& target_alignment) {
+  if (query_alignment.size() != target_alignment.size())
+    throw std::invalid_argument("Query and target alignments must have the same length");
+  AlignmentRuns runs;
+  for (size_t i = 0; i < query_alignment.size(); ++i) {
+    const char operation = query_alignment[i] == '-' ? 'D' : (target_alignment[i] == '-' ? 'I' : 'M');
+    if (!runs.empty() && runs.back().operation == operation)
+      ++runs.back().length;
+    else
+      runs.push_back(AlignmentRun{operation, 1});
+  }
+  return runs;
+}
+
+// Scores are compared in thousandths, the precision pairwise2 uses to compare alignment scores,
+// so the DP runs on exact integers and the result does not depend on the order of float additions.
+static const int ALIGNMENT_SCORE_PRECISION = 1000;
+
+static int32_t AlignmentScoreUnits(const double value, const char* name) {
+  const double scaled = value * ALIGNMENT_SCORE_PRECISION;
+  if (!std::isfinite(scaled) || std::fabs(scaled - std::round(scaled)) > 1e-6 || std::fabs(scaled) > 1e6)
+    throw std::invalid_argument(std::string(name) + " has to be a multiple of 0.001 with absolute value up to 1000");
+  return (int32_t) std::round(scaled);
+}
+
+
+// Gotoh DP evaluated one anti-diagonal at a time. All cells of an anti-diagonal depend only on the two previous ones,
+// interior cells are filled by the SIMD kernel of alignment_kernel.h chosen for the CPU.
+// Cell (i, j) aligns query[0, i) with target[0, j), it lives on diagonal i + j at position i.
+// Ties prefer aligned pairs, then gaps in target, then gaps in query, and opening a gap over extending one.
+static SequenceAlignment AlignSequences(const std::string& query, const std::string& target, const AlignmentScoring& scoring,
+                                        const bool aligned_strings = true, const AlignAntiDiagonalKernel kernel = AlignAntiDiagonal()) {
+  const AlignmentPenalties penalties{AlignmentScoreUnits(scoring.match, "match"), AlignmentScoreUnits(scoring.mismatch, "mismatch"),
+                                     AlignmentScoreUnits(scoring.gap_open, "gap_open"), AlignmentScoreUnits(scoring.gap_continuation, "gap_continuation")};
+
+  const int n = (int) query.size();
+  const int m = (int) target.size();
+  if ((int64_t) (n + 1) * (m + 1) > std::numeric_limits<int32_t>::max())
+    throw std::invalid_argument("Sequences are too long to be aligned");
+  // far enough from overflow after adding any penalty many times
+  const int32_t minus_infinity = std::numeric_limits<int32_t>::min() / 4;
+
+  // target reversed, so that target[j - 1] for j = d - i is read with increasing i
+  const std::string reversed_target(target.rbegin(), target.rend());
+
+  // best scores H, scores ending with a gap in query E and ending with a gap in target F, indexed by i
+  std::vector<int32_t> h_previous2(n + 1, minus_infinity), h_previous(n + 1, minus_infinity), h_current(n + 1, minus_infinity);
+  std::vector<int32_t> e_previous(n + 1, minus_infinity), e_current(n + 1, minus_infinity);
+  std::vector<int32_t> f_previous(n + 1, minus_infinity), f_current(n + 1, minus_infinity);
+
+  // traceback stored diagonal by diagonal, diagonal d keeps cells i = first_row(d) ... last_row(d)
+  std::vector<int64_t> diagonal_start(n + m + 2, 0);
+  for (int d = 0; d <= n + m; ++d)
+    diagonal_start[d + 1] = diagonal_start[d] + std::min(n, d) - std::max(0, d - m) + 1;
+  std::vector<uint8_t> trace(diagonal_start[n + m + 1], 0);
+
+  for (int d = 0; d <= n + m; ++d) {
+    const int first_row = std::max(0, d - m);
+    const int last_row = std::min(n, d);
+    uint8_t* const diagonal_trace = trace.data() + diagonal_start[d] - first_row;
+
+    // interior cells, both i >= 1 and j >= 1
+    const int begin = std::max(1, d - m);
+    const int end = std::min(n, d - 1);
+    if (begin <= end) {
+      const AntiDiagonalCells cells{h_previous2.data(), h_previous.data(), e_previous.data(), f_previous.data(), h_current.data(), e_current.data(),
+                                    f_current.data(), diagonal_trace, query.data(), reversed_target.data() + m - d};
+      kernel(cells, penalties, begin, end);
+    }
+
+    // borders, leading gaps of length d
+    const int32_t border_gap = d == 0 ? 0 : penalties.gap_open + (d - 1) * penalties.gap_continuation;
+    if (first_row == 0) {
+      // cell (0, d), query starts with a gap
+      h_current[0] = border_gap;
+      e_current[0] = d == 0 ? minus_infinity : border_gap;
+      f_current[0] = minus_infinity;
+      diagonal_trace[0] = d <= 1 ? TRACE_QUERY_GAP : (uint8_t) (TRACE_QUERY_GAP | TRACE_QUERY_GAP_EXTENDED);
+    }
+    if (last_row == d && d > 0) {
+      // cell (d, 0), target starts with a gap
+      h_current[d] = border_gap;
+      e_current[d] = minus_infinity;
+      f_current[d] = border_gap;
+      diagonal_trace[d] = d == 1 ? TRACE_TARGET_GAP : (uint8_t) (TRACE_TARGET_GAP | TRACE_TARGET_GAP_EXTENDED);
+    }
+
+    std::swap(h_previous2, h_previous);
+    std::swap(h_previous, h_current);
+    std::swap(e_previous, e_current);
+    std::swap(f_previous, f_current);
+  }
+
+  SequenceAlignment alignment;
+  alignment.score = (double) h_previous[n] / ALIGNMENT_SCORE_PRECISION;
+
+  // traceback from (n, m), state says which matrix the path is currently in, runs are collected backwards
+  int i = n;
+  int j = m;
+  uint8_t state = TRACE_DIAGONAL;
+  int identical = 0;
+  int columns = 0;
+  AlignmentRuns& runs = alignment.runs;
+  while (i > 0 || j > 0) {
+    const uint8_t cell = trace[diagonal_start[i + j] + i - std::max(0, i + j - m)];
+    if (state == TRACE_DIAGONAL)
+      state = cell & TRACE_SOURCE_MASK;
+    char operation;
+    if (state == TRACE_DIAGONAL) {
+      identical += query[--i] == target[--j];
+      operation = 'M';
+    } else if (state == TRACE_QUERY_GAP) {
+      --j;
+      operation = 'D';
+      if (!(cell & TRACE_QUERY_GAP_EXTENDED))
+        state = TRACE_DIAGONAL;
+    } else {
+      --i;
+      operation = 'I';
+      if (!(cell & TRACE_TARGET_GAP_EXTENDED))
+        state = TRACE_DIAGONAL;
+    }
+    if (!runs.empty() && runs.back().operation == operation)
+      ++runs.back().length;
+    else
+      runs.push_back(AlignmentRun{operation, 1});
+    ++columns;
+  }
+  std::reverse(runs.begin(), runs.end());
+  alignment.identity = columns == 0 ? 0 : (double) identical / columns;
+
+  if (aligned_strings) {
+    alignment.query_alignment.reserve(columns);
+    alignment.target_alignment.reserve(columns);
+    int query_index = 0;
+    int target_index = 0;
+    for (const AlignmentRun& run : runs) {
+      for (int k = 0; k < run.length; ++k) {
+        alignment.query_alignment += run.operation == 'D' ? '-' : query[query_index++];
+        alignment.target_alignment += run.operation == 'I' ? '-' : target[target_index++];
+      }
+    }
+  }
+  return alignment;
+}
+
+
+// Best alignment of one query, hit is the index of the chosen pair in the batch.
+struct BestAlignment {
+  size_t hit;
+  SequenceAlignment alignment;
+};
+
+
+// Aligns all query target pairs and keeps for every query the highest scoring alignment with identity above
+// min_sequence_identity. Same reduction as the former python loop: pairs are considered in input order and a later
+// pair replaces the current best only with a strictly higher score. Results follow first occurrence of queries,
+// queries without any alignment passing the identity filter are left out.
+static std::vector<BestAlignment> AlignBestHits(const std::vector<std::string>& query_ids, const std::vector<std::string>& query_sequences,
+                                                const std::vector<std::string>& target_sequences, const AlignmentScoring& scoring,
+                                                const double min_sequence_identity, const int thread_count, const bool aligned_strings) {
+  const size_t batch_size = query_ids.size();
+  if (query_sequences.size() != batch_size || target_sequences.size() != batch_size)
+    throw std::invalid_argument("query ids, query sequences and target sequences must have the same length");
+
+  // group pairs by query keeping order of first occurrence
+  std::unordered_map<std::string, size_t> query_groups_index;
+  std::vector<std::vector<size_t>> query_groups;
+  for (size_t i = 0; i < batch_size; ++i) {
+    auto inserted = query_groups_index.emplace(query_ids[i], query_groups.size());
+    if (inserted.second)
+      query_groups.emplace_back();
+    query_groups[inserted.first->second].push_back(i);
+  }
+
+  // queries with many hits are split into chunks, every chunk keeps its own best and chunks are merged in order
+  const size_t alignments_per_task = 8;
+  std::vector<std::vector<BestAlignment>> chunk_best(query_groups.size());
+  for (size_t group = 0; group < query_groups.size(); ++group)
+    chunk_best[group].assign((query_groups[group].size() + alignments_per_task - 1) / alignments_per_task, BestAlignment{batch_size, {}});
+
+  const auto better = [](const BestAlignment& candidate, const BestAlignment& best, const size_t none) {
+    return candidate.hit != none && (best.hit == none || candidate.alignment.score > best.alignment.score);
+  };
+
+  WorkStealingPool pool(thread_count);
+  for (size_t group = 0; group < query_groups.size(); ++group) {
+    for (size_t chunk = 0; chunk < chunk_best[group].size(); ++chunk) {
+      pool.Submit([&, group, chunk]() {
+        const std::vector<size_t>& hits = query_groups[group];
+        BestAlignment& best = chunk_best[group][chunk];
+        const size_t end = std::min((chunk + 1) * alignments_per_task, hits.size());
+        for (size_t i = chunk * alignments_per_task; i < end; ++i) {
+          BestAlignment candidate{hits[i], AlignSequences(query_sequences[hits[i]], target_sequences[hits[i]], scoring, aligned_strings)};
+          if (candidate.alignment.identity <= min_sequence_identity)
+            continue;
+          if (better(candidate, best, batch_size))
+            best = std::move(candidate);
+        }
+      });
+    }
+  }
+  pool.Wait();
+
+  std::vector<BestAlignment> output;
+  for (std::vector<BestAlignment>& chunks : chunk_best) {
+    BestAlignment best{batch_size, {}};
+    for (BestAlignment& chunk : chunks) {
+      if (better(chunk, best, batch_size))
+        best = std::move(chunk);
+    }
+    if (best.hit != batch_size)
+      output.push_back(std::move(best));
+  }
+  return output;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SEQUENCE_ALIGNMENT_PYTHON
+#define SEQUENCE_ALIGNMENT_PYTHON
+
+#include <boost/python.hpp>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "python_utils.h"
+#include "sequence_alignment.h"
+
+// python layer of sequence_alignment.h
+
+// returns (query_alignment, target_alignment, score, identity, cigar)
+static py::tuple AlignSequencesPython(const std::string& query, const std::string& target, const double match, const double mismatch,
+                                      const double gap_open, const double gap_continuation) {
+  SequenceAlignment alignment;
+  {
+    ReleaseGIL release_gil;
+    alignment = AlignSequences(query, target, AlignmentScoring{match, mismatch, gap_open, gap_continuation});
+  }
+  return py::make_tuple(alignment.query_alignment, alignment.target_alignment, alignment.score, alignment.identity, FormatCigar(alignment.runs));
+}
+
+
+static std::vector<std::string> ExtractStrings(const py::list& list) {
+  std::vector<std::string> output(py::len(list));
+  for (size_t i = 0; i < output.size(); ++i)
+    output[i] = py::extract<std::string>(list[i]);
+  return output;
+}
+
+
+// Aligns all pairs of the filtered mmseqs table and returns
+// dict[query_id] = (target_id, query_alignment, target_alignment, score, identity, cigar) of the best alignment of every query.
+static py::dict AlignBestHitsPython(const py::list& query_id_list, const py::list& target_id_list, const py::list& query_sequence_list,
+                                    const py::list& target_sequence_list, const double match, const double mismatch, const double gap_open,
+                                    const double gap_continuation, const double min_sequence_identity, const int thread_count) {
+  const std::vector<std::string> query_ids = ExtractStrings(query_id_list);
+  const std::vector<std::string> target_ids = ExtractStrings(target_id_list);
+  const std::vector<std::string> query_sequences = ExtractStrings(query_sequence_list);
+  const std::vector<std::string> target_sequences = ExtractStrings(target_sequence_list);
+  if (target_ids.size() != query_ids.size())
+    throw std::invalid_argument("query ids and target ids must have the same length");
+
+  std::vector<BestAlignment> best_alignments;
+  {
+    ReleaseGIL release_gil;
+    best_alignments = AlignBestHits(query_ids, query_sequences, target_sequences, AlignmentScoring{match, mismatch, gap_open, gap_continuation},
+                                    min_sequence_identity, thread_count, true);
+  }
+
+  py::dict output;
+  for (const BestAlignment& best : best_alignments) {
+    const SequenceAlignment& alignment = best.alignment;
+    output[query_ids[best.hit]] = py::make_tuple(target_ids[best.hit], alignment.query_alignment, alignment.target_alignment,
+                                                 alignment.score, alignment.identity, FormatCigar(alignment.runs));
+  }
+  return output;
+}
+
+#endif
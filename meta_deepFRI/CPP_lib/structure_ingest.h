@@ -0,0 +1,503 @@
+#ifndef STRUCTURE_INGEST
+#define STRUCTURE_INGEST
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "atoms_database.h"
+#include "contact_definition.h"
+#include "thread_pool.h"
+
+// Native replacement of structure_files.process_structure_file writing into the packed atoms database.
+// Tokenizers follow structure_files/parse_pdb.py and parse_mmcif.py line by line, including their quirks,
+// and residues are grouped and truncated as in save_sequence_and_atoms, so both paths produce the same atoms and sequences.
+// Statuses are the strings process_structure_file returns.
+
+static const char* const INGEST_SUCCEED = "SUCCEED";
+static const char* const INGEST_TOO_SHORT = "sequences too short, probably DNA or corrupted";
+static const char* const INGEST_READING_EXCEPTION = "file reading exceptions";
+static const char* const INGEST_PROCESSING_EXCEPTION = "file processing exceptions";
+static const char* const INGEST_DUPLICATED_ID = "duplicated protein id";
+static const char* const INGEST_UNCHANGED = "UNCHANGED";
+
+// thrown by tokenizers where python parsers raise, reported as INGEST_READING_EXCEPTION
+class StructureReadingError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+
+static bool EndsWith(const std::string& text, const std::string& suffix) {
+  return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+
+static bool StartsWith(const std::string_view line, const std::string_view prefix) {
+  return line.substr(0, prefix.size()) == prefix;
+}
+
+
+// whole file as it is stored on disk
+static std::string ReadRawFile(const std::string& file_path) {
+  std::string content;
+  std::ifstream file(file_path, std::ios::in | std::ios::binary);
+  if (!file)
+    throw StructureReadingError("Unable to open " + file_path);
+  file.seekg(0, std::ios::end);
+  content.resize((size_t) file.tellg());
+  file.seekg(0, std::ios::beg);
+  file.read(&content[0], (std::streamsize) content.size());
+  if (!file)
+    throw StructureReadingError("Unable to read " + file_path);
+  CountEngineEvent(EngineCounter::FILES_OPENED, 1);
+  CountEngineEvent(EngineCounter::BYTES_READ, content.size());
+  return content;
+}
+
+
+// gzip.open(file).read(), concatenated members are joined and anything else than gzip data is an error
+static std::string Gunzip(const std::string& compressed, const std::string& file_path) {
+  std::string content;
+  if (compressed.empty())
+    return content;
+
+  z_stream stream{};
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+    throw StructureReadingError("Unable to decompress " + file_path);
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+  stream.avail_in = (uInt) compressed.size();
+  char buffer[1 << 16];
+  int result = Z_OK;
+  while (true) {
+    stream.next_out = reinterpret_cast<Bytef*>(buffer);
+    stream.avail_out = sizeof(buffer);
+    result = inflate(&stream, Z_NO_FLUSH);
+    content.append(buffer, sizeof(buffer) - stream.avail_out);
+    if (result == Z_STREAM_END) {
+      if (stream.avail_in == 0)
+        break;
+      inflateReset(&stream);
+    } else if (result != Z_OK) {
+      break;
+    }
+  }
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END)
+    throw StructureReadingError("Unable to decompress " + file_path);
+  return content;
+}
+
+
+// Identifies the structure file together with truncation, a file is parsed again only if either of them changes.
+// Bumping INGEST_FORMAT_VERSION parses every file again, version 2 added representative atoms.
+// Never 0, that means unknown source.
+static const uint64_t INGEST_FORMAT_VERSION = 2;
+
+static uint64_t StructureSourceHash(const std::string& raw_content, const int max_target_chain_length) {
+  const uint64_t seed = (INGEST_FORMAT_VERSION << 32) | (uint32_t) max_target_chain_length;
+  const uint64_t hash = HashBytes(raw_content.data(), raw_content.size(), seed);
+  return hash == 0 ? 1 : hash;
+}
+
+
+// Lines the way python text mode readline gives them: universal newlines, length includes the line break.
+class LineReader {
+ public:
+  explicit LineReader(const std::string& content) : content_(content) {}
+
+  // false at the end of file, line does not contain the line break
+  bool Next(std::string_view& line, size_t& python_length) {
+    if (position_ >= content_.size())
+      return false;
+    const size_t begin = position_;
+    size_t end = content_.find_first_of("\r\n", begin);
+    if (end == std::string::npos) {
+      position_ = content_.size();
+      line = std::string_view(content_).substr(begin);
+      python_length = line.size();
+      return true;
+    }
+    position_ = end + 1;
+    if (content_[end] == '\r' && position_ < content_.size() && content_[position_] == '\n')
+      ++position_;
+    line = std::string_view(content_).substr(begin, end - begin);
+    python_length = line.size() + 1;
+    return true;
+  }
+
+ private:
+  const std::string& content_;
+  size_t position_ = 0;
+};
+
+
+static bool IsPythonSpace(const char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r') || (c >= '\x1c' && c <= '\x1f');
+}
+
+
+// str.split() without arguments
+static void SplitWhitespace(const std::string_view line, std::vector<std::string_view>& tokens) {
+  tokens.clear();
+  size_t i = 0;
+  while (i < line.size()) {
+    while (i < line.size() && IsPythonSpace(line[i]))
+      ++i;
+    const size_t begin = i;
+    while (i < line.size() && !IsPythonSpace(line[i]))
+      ++i;
+    if (i > begin)
+      tokens.push_back(line.substr(begin, i - begin));
+  }
+}
+
+
+// float(text) converted to float32, the way numpy stores coordinate strings
+static float ParseCoordinate(const std::string_view text) {
+  size_t begin = 0;
+  size_t end = text.size();
+  while (begin < end && IsPythonSpace(text[begin]))
+    ++begin;
+  while (end > begin && IsPythonSpace(text[end - 1]))
+    --end;
+  const std::string value(text.substr(begin, end - begin));
+  if (value.empty() || value.find_first_of("xX") != std::string::npos)
+    throw StructureReadingError("could not convert string to float: '" + std::string(text) + "'");
+  char* parsed_end;
+  errno = 0;
+  const double number = std::strtod(value.c_str(), &parsed_end);
+  if (parsed_end != value.c_str() + value.size())
+    throw StructureReadingError("could not convert string to float: '" + std::string(text) + "'");
+  return (float) number;
+}
+
+
+// int(text), false where python raises ValueError
+static bool ParsePythonInt(const std::string_view text, long long& value) {
+  const std::string digits(text);
+  if (digits.empty() || digits.find_first_of(".eExXpP") != std::string::npos)
+    return false;
+  char* parsed_end;
+  errno = 0;
+  value = std::strtoll(digits.c_str(), &parsed_end, 10);
+  return parsed_end == digits.c_str() + digits.size() && errno == 0;
+}
+
+
+// Atoms grouped into residues on the fly. Residue of an atom is identified by its group string,
+// first atom of every distinct group starts a residue, same as np.unique(groups, return_index=True) sorted.
+struct ParsedStructure {
+  std::vector<float> positions;
+  // RepresentativeAtomSlot of every atom
+  std::vector<signed char> atom_slots;
+  std::vector<int> group_starts;
+  std::vector<std::string> group_residues;
+  std::unordered_set<std::string> groups;
+
+  int AtomCount() const {
+    return (int) (positions.size() / 3);
+  }
+
+  void AddAtom(const std::string_view residue, const std::string_view atom_name, std::string group, const float x, const float y, const float z) {
+    if (groups.insert(std::move(group)).second) {
+      group_starts.push_back(AtomCount());
+      group_residues.emplace_back(residue);
+    }
+    positions.push_back(x);
+    positions.push_back(y);
+    positions.push_back(z);
+    atom_slots.push_back((signed char) RepresentativeAtomSlot(atom_name));
+  }
+};
+
+
+static std::string_view StripSpaces(std::string_view text) {
+  while (!text.empty() && text.front() == ' ')
+    text.remove_prefix(1);
+  while (!text.empty() && text.back() == ' ')
+    text.remove_suffix(1);
+  return text;
+}
+
+
+// structure_files/parse_pdb.py
+static ParsedStructure ParsePdb(const std::string& content) {
+  ParsedStructure structure;
+  LineReader reader(content);
+  std::string_view line;
+  size_t python_length;
+  while (reader.Next(line, python_length)) {
+    if (StartsWith(line, "TER"))
+      break;
+    if (StartsWith(line, "ATOM") && python_length == 81 && line[76] != 'H' && line[17] != ' ') {
+      structure.AddAtom(line.substr(17, 3), StripSpaces(line.substr(12, 4)), std::string(line.substr(21, 5)),
+                        ParseCoordinate(line.substr(30, 8)), ParseCoordinate(line.substr(38, 8)), ParseCoordinate(line.substr(46, 8)));
+    }
+  }
+  return structure;
+}
+
+
+static const std::string_view& Token(const std::vector<std::string_view>& tokens, const int index) {
+  // unset label is a NameError and a short line is an IndexError in python
+  if (index < 0 || index >= (int) tokens.size())
+    throw StructureReadingError("ATOM record does not match _atom_site labels");
+  return tokens[index];
+}
+
+
+// structure_files/parse_mmcif.py
+static ParsedStructure ParseMmcif(const std::string& content) {
+  LineReader reader(content);
+  std::string_view line;
+  size_t python_length;
+  std::vector<std::string_view> tokens;
+
+  long long atom_limit = -1;
+  bool preallocated = false;
+  int label_counter = -1;
+  int atom_symbol = -1, atom_name = -1, assembly = -1, sequence_id = -1, residue = -1, x = -1, y = -1, z = -1;
+
+  bool has_line = reader.Next(line, python_length);
+  while (has_line) {
+    if (StartsWith(line, "_refine_hist.pdbx_number_atoms_protein")) {
+      SplitWhitespace(line, tokens);
+      const std::string_view n = tokens.back();
+      if (n != "?" && n != "0") {
+        long long value;
+        if (!ParsePythonInt(n, value)) {
+          has_line = reader.Next(line, python_length);
+          continue;
+        }
+        // np.empty of negative size
+        if (value < 0)
+          throw StructureReadingError("negative dimensions are not allowed");
+        atom_limit = value;
+        preallocated = true;
+      }
+    }
+
+    if (StartsWith(line, "_atom_site.")) {
+      ++label_counter;
+      if (StartsWith(line, "_atom_site.type_symbol "))
+        atom_symbol = label_counter;
+      if (StartsWith(line, "_atom_site.label_atom_id "))
+        atom_name = label_counter;
+      if (StartsWith(line, "_atom_site.label_asym_id "))
+        assembly = label_counter;
+      if (StartsWith(line, "_atom_site.label_seq_id "))
+        sequence_id = label_counter;
+      if (StartsWith(line, "_atom_site.label_comp_id "))
+        residue = label_counter;
+      if (StartsWith(line, "_atom_site.Cartn_x "))
+        x = label_counter;
+      if (StartsWith(line, "_atom_site.Cartn_y "))
+        y = label_counter;
+      if (StartsWith(line, "_atom_site.Cartn_z "))
+        z = label_counter;
+    }
+
+    has_line = reader.Next(line, python_length);
+    if (has_line && StartsWith(line, "ATOM") && label_counter > 0)
+      break;
+  }
+
+  ParsedStructure structure;
+  const bool limited = atom_limit > 0;
+  while (has_line) {
+    if (StartsWith(line, "loop_"))
+      break;
+    if (StartsWith(line, "ATOM")) {
+      SplitWhitespace(line, tokens);
+      if (Token(tokens, residue).size() == 3 && Token(tokens, atom_symbol) != "H") {
+        // pdbx_number_atoms_protein of 0 written as an other number leaves numpy arrays that have no append
+        if (preallocated && !limited)
+          throw StructureReadingError("'numpy.ndarray' object has no attribute 'append'");
+        std::string group = std::string(Token(tokens, assembly)) + std::string(Token(tokens, sequence_id));
+        // preallocated groups array is '<U10'
+        if (limited && group.size() > 10)
+          group.resize(10);
+        // atom names are optional, they only select representative atoms
+        structure.AddAtom(tokens[residue], atom_name >= 0 ? Token(tokens, atom_name) : std::string_view(), std::move(group),
+                          ParseCoordinate(Token(tokens, x)), ParseCoordinate(Token(tokens, y)), ParseCoordinate(Token(tokens, z)));
+        if (limited && structure.AtomCount() == atom_limit)
+          break;
+      }
+    }
+    has_line = reader.Next(line, python_length);
+  }
+  return structure;
+}
+
+
+// bio_utils.PROTEIN_LETTERS, upper case keys of Bio protein_letters_3to1_extended and UNK
+static const std::unordered_map<std::string, char>& ProteinLetters() {
+  static const std::unordered_map<std::string, char> letters = {
+      {"ALA", 'A'}, {"CYS", 'C'}, {"ASP", 'D'}, {"GLU", 'E'}, {"PHE", 'F'}, {"GLY", 'G'}, {"HIS", 'H'},
+      {"ILE", 'I'}, {"LYS", 'K'}, {"LEU", 'L'}, {"MET", 'M'}, {"ASN", 'N'}, {"PRO", 'P'}, {"GLN", 'Q'},
+      {"ARG", 'R'}, {"SER", 'S'}, {"THR", 'T'}, {"VAL", 'V'}, {"TRP", 'W'}, {"TYR", 'Y'}, {"ASX", 'B'},
+      {"XAA", 'X'}, {"GLX", 'Z'}, {"XLE", 'J'}, {"SEC", 'U'}, {"PYL", 'O'}, {"UNK", 'X'}};
+  return letters;
+}
+
+
+struct IngestedStructure {
+  std::string status;
+  std::string sequence;
+  std::vector<int> group_indexes;
+  std::vector<float> positions;
+  std::vector<int> representative_atoms;
+  uint64_t source_hash = 0;
+
+  bool Succeeded() const {
+    return status.compare(0, 7, INGEST_SUCCEED) == 0;
+  }
+};
+
+
+// read_structure_file followed by save_sequence_and_atoms, parser is chosen by the same suffixes as PARSERS.
+// Files with the same source hash as known_source_hash are not parsed and get INGEST_UNCHANGED.
+static IngestedStructure IngestStructureFile(const std::string& file_path, const int max_target_chain_length, const uint64_t known_source_hash = 0) {
+  IngestedStructure ingested;
+  ParsedStructure structure;
+  try {
+    const bool gzipped = EndsWith(file_path, ".gz");
+    const std::string name = gzipped ? file_path.substr(0, file_path.size() - 3) : file_path;
+    const bool pdb = EndsWith(name, ".pdb") || EndsWith(name, ".ent");
+    if (!pdb && !EndsWith(name, ".cif"))
+      throw StructureReadingError("Unknown structure file type " + file_path);
+
+    std::string content = ReadRawFile(file_path);
+    ingested.source_hash = StructureSourceHash(content, max_target_chain_length);
+    if (ingested.source_hash == known_source_hash) {
+      ingested.status = INGEST_UNCHANGED;
+      return ingested;
+    }
+    if (gzipped)
+      content = Gunzip(content, file_path);
+    structure = pdb ? ParsePdb(content) : ParseMmcif(content);
+  } catch (const std::exception&) {
+    ingested.status = INGEST_READING_EXCEPTION;
+    return ingested;
+  }
+
+  const int group_count = (int) structure.group_starts.size();
+  if (group_count < 9) {
+    ingested.status = INGEST_TOO_SHORT;
+    return ingested;
+  }
+
+  const bool truncated = group_count > max_target_chain_length;
+  const int chain_length = truncated ? std::max(max_target_chain_length, 0) : group_count;
+  ingested.group_indexes.assign(structure.group_starts.begin(), structure.group_starts.begin() + chain_length);
+  ingested.group_indexes.push_back(truncated ? structure.group_starts[chain_length] : structure.AtomCount());
+
+  const std::unordered_map<std::string, char>& letters = ProteinLetters();
+  ingested.sequence.resize(chain_length);
+  for (int i = 0; i < chain_length; ++i) {
+    auto letter = letters.find(structure.group_residues[i]);
+    if (letter == letters.end()) {
+      ingested.group_indexes.clear();
+      ingested.status = INGEST_PROCESSING_EXCEPTION;
+      return ingested;
+    }
+    ingested.sequence[i] = letter->second;
+  }
+
+  ingested.representative_atoms = RepresentativeAtoms(chain_length, ingested.group_indexes.data(), structure.atom_slots);
+  structure.positions.resize((size_t) ingested.group_indexes.back() * 3);
+  ingested.positions = std::move(structure.positions);
+  if (truncated)
+    ingested.status = "SUCCEED, but sequences and contact maps got truncated to " + std::to_string(max_target_chain_length);
+  else
+    ingested.status = INGEST_SUCCEED;
+  return ingested;
+}
+
+
+static uint64_t KnownSourceHash(const AtomsDatabaseWriter&, const std::string&) {
+  return 0;
+}
+
+
+static uint64_t KnownSourceHash(const AtomsDatabaseUpdater& updater, const std::string& protein_id) {
+  return updater.SourceHash(protein_id);
+}
+
+
+// Parses structure files on a thread pool and writes succeeded ones to the database writer and fasta file in input order.
+// Files are processed in windows, the next window is parsed while the previous one is written, so memory stays bounded.
+// DatabaseWriter is AtomsDatabaseWriter or AtomsDatabaseUpdater. With skip_unchanged files whose source hash
+// matches the one recorded by the updater are skipped, the writer has no recorded hashes.
+template <typename DatabaseWriter>
+static std::vector<std::string> IngestStructureFiles(const std::vector<std::string>& protein_ids, const std::vector<std::string>& file_paths,
+                                                     DatabaseWriter& writer, const std::string& fasta_path,
+                                                     const int max_target_chain_length, const int thread_count, const bool skip_unchanged) {
+  if (protein_ids.size() != file_paths.size())
+    throw std::invalid_argument("protein_ids and file_paths must have the same length");
+  std::ofstream fasta(fasta_path, std::ios::out | std::ios::binary | std::ios::app);
+  if (!fasta)
+    throw std::runtime_error("Unable to open " + fasta_path);
+
+  // looked up before workers start, the writer is only touched by this thread
+  std::vector<uint64_t> known_source_hashes(file_paths.size(), 0);
+  if (skip_unchanged) {
+    for (size_t i = 0; i < protein_ids.size(); ++i)
+      known_source_hashes[i] = KnownSourceHash(writer, protein_ids[i]);
+  }
+
+  const size_t file_count = file_paths.size();
+  std::vector<std::string> statuses(file_count);
+  std::vector<IngestedStructure> ingested(file_count);
+  std::unordered_set<std::string> written_ids;
+
+  WorkStealingPool pool(thread_count);
+  const size_t window = (size_t) pool.ThreadCount() * 64;
+  auto parse_window = [&](const size_t begin) {
+    for (size_t i = begin; i < std::min(begin + window, file_count); ++i)
+      pool.Submit([&, i]() { ingested[i] = IngestStructureFile(file_paths[i], max_target_chain_length, known_source_hashes[i]); });
+  };
+  auto write_window = [&](const size_t begin) {
+    for (size_t i = begin; i < std::min(begin + window, file_count); ++i) {
+      IngestedStructure structure = std::move(ingested[i]);
+      const bool succeeded = structure.Succeeded();
+      statuses[i] = std::move(structure.status);
+      if (succeeded) {
+        if (!written_ids.insert(protein_ids[i]).second) {
+          statuses[i] = INGEST_DUPLICATED_ID;
+          continue;
+        }
+        const AtomsView atoms{(int) structure.sequence.size(), structure.group_indexes.data(), structure.positions.data(),
+                              nullptr, nullptr, nullptr, nullptr, structure.representative_atoms.data(), nullptr, nullptr};
+        writer.Add(protein_ids[i], atoms, structure.source_hash);
+        fasta << '>' << protein_ids[i] << '\n' << structure.sequence << '\n';
+      }
+    }
+  };
+
+  parse_window(0);
+  pool.Wait();
+  for (size_t begin = 0; begin < file_count; begin += window) {
+    parse_window(begin + window);
+    write_window(begin);
+    pool.Wait();
+  }
+
+  fasta.close();
+  if (!fasta)
+    throw std::runtime_error("Unable to write " + fasta_path);
+  return statuses;
+}
+
+#endif
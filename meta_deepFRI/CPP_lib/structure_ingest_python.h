@@ -0,0 +1,35 @@
+#ifndef STRUCTURE_INGEST_PYTHON
+#define STRUCTURE_INGEST_PYTHON
+
+#include <boost/python.hpp>
+#include <string>
+#include <vector>
+
+#include "python_utils.h"
+#include "structure_ingest.h"
+
+// python layer of structure_ingest.h
+
+template <typename DatabaseWriter>
+static py::list IngestStructureFilesPython(const py::list& protein_id_list, const py::list& file_path_list, DatabaseWriter& writer,
+                                           const std::string& fasta_path, const int max_target_chain_length, const int thread_count,
+                                           const bool skip_unchanged) {
+  std::vector<std::string> protein_ids(py::len(protein_id_list));
+  std::vector<std::string> file_paths(py::len(file_path_list));
+  for (size_t i = 0; i < protein_ids.size(); ++i)
+    protein_ids[i] = py::extract<std::string>(protein_id_list[i]);
+  for (size_t i = 0; i < file_paths.size(); ++i)
+    file_paths[i] = py::extract<std::string>(file_path_list[i]);
+
+  std::vector<std::string> statuses;
+  {
+    ReleaseGIL release_gil;
+    statuses = IngestStructureFiles(protein_ids, file_paths, writer, fasta_path, max_target_chain_length, thread_count, skip_unchanged);
+  }
+  py::list output;
+  for (const std::string& status : statuses)
+    output.append(status);
+  return output;
+}
+
+#endif
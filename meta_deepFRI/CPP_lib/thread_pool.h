@@ -0,0 +1,161 @@
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Every worker owns a queue. Workers take tasks from the back of their own queue
+// and steal from the front of other queues once it is empty.
+// Tasks submitted from inside a worker go to that worker queue, so nested work stays local until it is stolen.
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(int thread_count) {
+    if (thread_count <= 0)
+      thread_count = (int) std::max(std::thread::hardware_concurrency(), 1u);
+    queues_.resize(thread_count);
+    for (auto& queue : queues_)
+      queue = std::make_unique<WorkerQueue>();
+    for (int worker = 0; worker < thread_count; ++worker)
+      threads_.emplace_back(&WorkStealingPool::WorkerLoop, this, worker);
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread : threads_)
+      thread.join();
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  int ThreadCount() const {
+    return (int) threads_.size();
+  }
+
+  void Submit(std::function<void()> task) {
+    int worker = CurrentWorker();
+    if (worker < 0)
+      worker = (int) (next_queue_++ % queues_.size());
+
+    ++pending_;
+    {
+      std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+      queues_[worker]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      ++queued_;
+    }
+    wake_.notify_one();
+  }
+
+  // blocks until every submitted task, including the nested ones, is finished
+  // rethrows the first exception thrown by any of the tasks
+  void Wait() {
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_.wait(lock, [this] { return pending_ == 0; });
+    if (exception_) {
+      std::exception_ptr exception = exception_;
+      exception_ = nullptr;
+      std::rethrow_exception(exception);
+    }
+  }
+
+ private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  int CurrentWorker() const {
+    return current_pool_ == this ? current_worker_ : -1;
+  }
+
+  bool TakeTask(int worker, std::function<void()>& task) {
+    {
+      WorkerQueue& own = *queues_[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --queued_;
+        return true;
+      }
+    }
+    for (size_t offset = 1; offset < queues_.size(); ++offset) {
+      WorkerQueue& victim = *queues_[(worker + offset) % queues_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void WorkerLoop(int worker) {
+    current_pool_ = this;
+    current_worker_ = worker;
+
+    std::function<void()> task;
+    while (true) {
+      if (TakeTask(worker, task)) {
+        try {
+          task();
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(done_mutex_);
+          if (!exception_)
+            exception_ = std::current_exception();
+        }
+        task = nullptr;
+        if (--pending_ == 0) {
+          std::lock_guard<std::mutex> lock(done_mutex_);
+          done_.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+      if (stopping_)
+        return;
+    }
+  }
+
+  static thread_local const WorkStealingPool* current_pool_;
+  static thread_local int current_worker_;
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_queue_{0};
+  std::atomic<size_t> pending_{0};
+  // may briefly drop below zero when a task is taken before Submit counted it
+  std::atomic<long> queued_{0};
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+
+  std::mutex done_mutex_;
+  std::condition_variable done_;
+  std::exception_ptr exception_;
+};
+
+inline thread_local const WorkStealingPool* WorkStealingPool::current_pool_ = nullptr;
+inline thread_local int WorkStealingPool::current_worker_ = -1;
+
+#endif
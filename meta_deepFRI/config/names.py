@@ -10,7 +10,12 @@ JOB_CONFIG = "job_config.json"
 TASK_CONFIG = "task_config.json"
 TARGET_DB_CONFIG = "target_db_config.json"
 
-ALIGNMENTS = "alignments.json"
+ATOMS_DATABASE = "atoms.db"
+# alignment store (CPP_lib.AlignmentStore), a directory of binary shards, one per task
+ALIGNMENTS = "alignments"
+ALIGNMENT_SHARD_SUFFIX = ".alns"
+# alignments of older jobs, converted to a shard when a task is resumed
+ALIGNMENTS_JSON = "alignments.json"
 MERGED_SEQUENCES = 'merged_sequences.faa'
 TASK_SEQUENCES = "task_sequences.faa"
 MMSEQS_SEARCH_RESULTS = 'mmseqs2_search_results.m8'
@@ -15,6 +15,17 @@ class RuntimeConfig:
     ANGSTROM_CONTACT_THRESHOLD: float = 6
     # GENERATE_CONTACTS are used to fill gaps in target sequence during contact map alignment
     GENERATE_CONTACTS: int = 2
+    # memory budget in bytes of CPP_lib cache holding target contact maps between queries and DeepFRI modes
+    CONTACT_MAP_CACHE_SIZE: int = 256 * 1024 * 1024
+    # residues are in contact if any of their atoms (ALL_ATOMS), alpha carbons (CA) or beta carbons (CB) are within threshold
+    # CA and CB need target atoms processed with atom names, ALL_ATOMS uses contact lists precomputed in the atoms database
+    CONTACT_DEFINITION: str = "ALL_ATOMS"
+    # aligned contact maps are computed once and shared by all DeepFRI modes, True keeps them in a memory mapped file
+    # inside the job directory instead of memory
+    SPILL_CONTACT_MAPS: bool = False
+    # CPP_lib counters of every DeepFRI mode are saved to metadata_engine_stats.json, True additionally records
+    # every load, contact and projection call of CPP_lib to metadata_engine_trace.csv
+    TRACE_CONTACT_MAPS: bool = False
 
     # parameters used to filter mmseqs2 search results before aligning
     MMSEQS_MIN_BIT_SCORE: float = -99999
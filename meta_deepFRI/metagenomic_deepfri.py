@@ -1,13 +1,15 @@
+import csv
 import json
 import os.path
 import pathlib
 
 from meta_deepFRI.config.folder_structure import FolderStructureConfig
-from meta_deepFRI.config.names import TASK_CONFIG, ATOMS
+from meta_deepFRI.config.names import TASK_CONFIG, ATOMS, ATOMS_DATABASE
 from meta_deepFRI.config.job_config import load_job_config, JobConfig
 from meta_deepFRI.DeepFRI.deepfrier import Predictor
 
 from meta_deepFRI import CPP_lib
+from meta_deepFRI.config import CPU_COUNT
 
 from meta_deepFRI.utils.elapsed_time_logger import ElapsedTimeLogger
 from meta_deepFRI.utils.fasta_file_io import load_fasta_file, SeqFileLoader
@@ -32,6 +34,15 @@ from meta_deepFRI.utils.search_alignments import search_alignments
 ###########################################################################
 from utils.mmseqs import run_mmseqs_search
 
+# spill file of aligned contact maps shared by DeepFRI modes, removed by CPP_lib as soon as it is mapped
+CONTACT_MAP_STORE_SPILL = "aligned_contact_maps.bin"
+
+
+def save_engine_trace(path: pathlib.Path, stage_name: str):
+    # rows: stage_name, CPP_lib stage, structure, thread, start_ns, duration_ns
+    with open(path, "a", newline="") as f:
+        csv.writer(f).writerows((stage_name, *event) for event in CPP_lib.take_engine_trace())
+
 
 def load_and_verify_job_data(fsc: FolderStructureConfig, runtime_config: JobConfig, job_path: pathlib.Path):
     # selects only one .faa file from task_path directory
@@ -94,9 +105,10 @@ def metagenomic_deepfri(fsc: FolderStructureConfig, job_path: pathlib.Path):
     mmseqs_search_output = run_mmseqs_search(query_file, target_db, job_path)
     timer.log("mmseqs2")
 
-    # format: alignments[query_id] = {target_id, identity, alignment[seqA = query_seq, seqB = target_seq, score, start, end]}
+    # alignments[query_id] = AlignmentRecord of the best alignment, see search_alignments
     alignments = search_alignments(query_seqs, mmseqs_search_output, target_seqs, job_path, job_config)
-    unaligned_queries = query_seqs.keys() - alignments.keys()
+    query_ids = alignments.query_ids()
+    unaligned_queries = query_seqs.keys() - set(query_ids)
     timer.log("alignments")
     if len(alignments) > 0:
         print(f"Using GCN for {len(alignments)} proteins")
@@ -106,9 +118,43 @@ def metagenomic_deepfri(fsc: FolderStructureConfig, job_path: pathlib.Path):
     json.dump(gcn_cnn_count, open(job_path / "metadata_cnn_gcn_counts.json", "w"), indent=4)
 
     CPP_lib.initialize()
+    CPP_lib.set_contact_map_cache_size(job_config.CONTACT_MAP_CACHE_SIZE)
+    CPP_lib.set_contact_definition(job_config.CONTACT_DEFINITION)
+    CPP_lib.reset_engine_stats()
+    CPP_lib.set_engine_tracing(job_config.TRACE_CONTACT_MAPS)
+    engine_stats = {}
     deepfri_models_config = load_deepfri_config(fsc)
     target_db_name = job_config.target_db_name
 
+    # packed atoms database is preferred over separate atom positions files
+    atoms_database_path = fsc.SEQ_ATOMS_DATASET_PATH / target_db_name / ATOMS_DATABASE
+    if atoms_database_path.exists():
+        atoms_database = CPP_lib.AtomsDatabase(str(atoms_database_path))
+        build_stored_aligned_contact_map_store = atoms_database.build_stored_aligned_contact_map_store
+    else:
+        atoms_path = fsc.SEQ_ATOMS_DATASET_PATH / target_db_name / ATOMS
+
+        def build_stored_aligned_contact_map_store(angstrom_contact_threshold, alignment_store, *args, **kwargs):
+            target_paths = [str(atoms_path / (target_id + ".bin")) for target_id in alignment_store.target_ids()]
+            return CPP_lib.build_stored_aligned_contact_map_store(target_paths, angstrom_contact_threshold,
+                                                                  alignment_store, *args, **kwargs)
+
+    # aligned contact maps do not depend on the mode, they are built once by the first mode that needs them
+    contact_map_store = None
+
+    def aligned_contact_map_store():
+        nonlocal contact_map_store
+        if contact_map_store is None:
+            spill_path = str(job_path / CONTACT_MAP_STORE_SPILL) if job_config.SPILL_CONTACT_MAPS else ""
+            # maps follow the order of alignments.query_ids()
+            contact_map_store = build_stored_aligned_contact_map_store(job_config.ANGSTROM_CONTACT_THRESHOLD,
+                                                                       alignments,
+                                                                       job_config.GENERATE_CONTACTS,
+                                                                       CPU_COUNT,
+                                                                       spill_path=spill_path)
+            print(f"Aligned contact maps: {len(contact_map_store)} maps, {contact_map_store.data_size()} bytes")
+        return contact_map_store
+
     # DEEPFRI_PROCESSING_MODES = ['mf', 'bp', 'cc', 'ec']
     # mf = molecular_function
     # bp = biological_process
@@ -125,25 +171,21 @@ def metagenomic_deepfri(fsc: FolderStructureConfig, job_path: pathlib.Path):
             else:
                 gcn_params = deepfri_models_config["gcn"]["models"][mode]
                 gcn = Predictor.Predictor(gcn_params, gcn=True)
-                for query_id in alignments.keys():
-                    alignment = alignments[query_id]
-                    query_seq = query_seqs[query_id]
-                    target_id = alignment["target_id"]
-
-                    generated_query_contact_map = CPP_lib.load_aligned_contact_map(
-                        str(fsc.SEQ_ATOMS_DATASET_PATH / target_db_name / ATOMS / (target_id + ".bin")),
-                        job_config.ANGSTROM_CONTACT_THRESHOLD,
-                        alignment["alignment"][0],    # query alignment
-                        alignment["alignment"][1],    # target alignment
-                        job_config.GENERATE_CONTACTS)
-
-                    gcn.predict_with_cmap(query_seq, generated_query_contact_map, query_id)
+                # dense maps are decoded on CPP_lib threads while the GCN runs
+                contact_maps = aligned_contact_map_store().prefetch_contact_maps(CPU_COUNT)
+                for query_id, generated_query_contact_map in zip(query_ids, contact_maps):
+                    gcn.predict_with_cmap(query_seqs[query_id], generated_query_contact_map, query_id)
 
                 gcn.export_csv(output_file_name.with_suffix('.csv'))
                 gcn.export_tsv(output_file_name.with_suffix('.tsv'))
                 gcn.export_json(output_file_name.with_suffix('.json'))
                 del gcn
                 timer.log(f"deepfri_gcn_{mode}")
+                print(f"Contact map cache: {CPP_lib.get_contact_map_cache_stats()}")
+                if job_config.TRACE_CONTACT_MAPS:
+                    save_engine_trace(job_path / "metadata_engine_trace.csv", f"deepfri_gcn_{mode}")
+                engine_stats[f"deepfri_gcn_{mode}"] = CPP_lib.get_engine_stats()
+                CPP_lib.reset_engine_stats()
 
         # CNN for queries without satisfying alignments
         if len(unaligned_queries) > 0:
@@ -162,4 +204,5 @@ def metagenomic_deepfri(fsc: FolderStructureConfig, job_path: pathlib.Path):
                 del cnn
                 timer.log(f"deepfri_cnn_{mode}")
 
+    json.dump(engine_stats, open(job_path / "metadata_engine_stats.json", "w"), indent=4)
     timer.log_total_time()
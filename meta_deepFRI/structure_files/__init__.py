@@ -1,4 +1,5 @@
 from .parse_pdb import parse_pdb
 from .parse_mmcif import parse_mmcif
 
-from .parse_structure_file import PARSERS, read_structure_file, save_sequence_and_atoms, search_structure_files
+from .parse_structure_file import PARSERS, read_structure_file, save_sequence_and_atoms, search_structure_files, \
+    structure_file_protein_id
@@ -6,8 +6,11 @@ def parse_mmcif(file):
     sequence = []
     positions = []
     groups = []
+    atom_names = []
 
     label_counter = -1
+    # atom names are optional, they only select representative atoms
+    atom_name = None
     line = file.readline()
     while line != "":
         if line.startswith('_refine_hist.pdbx_number_atoms_protein'):
@@ -21,11 +24,14 @@ def parse_mmcif(file):
                 sequence = np.empty(n_atoms, dtype=np.dtype('<U3'))
                 positions = np.empty((n_atoms, 3), dtype=np.float32)
                 groups = np.empty(n_atoms, dtype=np.dtype('<U10'))
+                atom_names = np.empty(n_atoms, dtype=np.dtype('<U4'))
 
         if line.startswith('_atom_site.'):
             label_counter += 1
             if line.startswith('_atom_site.type_symbol '):
                 atom_symbol = label_counter
+            if line.startswith('_atom_site.label_atom_id '):
+                atom_name = label_counter
             if line.startswith('_atom_site.label_asym_id '):
                 assembly = label_counter
             if line.startswith('_atom_site.label_seq_id '):
@@ -54,6 +60,7 @@ def parse_mmcif(file):
                 if len(atom[residue]) == 3 and atom[atom_symbol] != "H":
                     sequence[index] = atom[residue]
                     groups[index] = ''.join([atom[assembly], atom[sequence_id]])
+                    atom_names[index] = atom[atom_name] if atom_name is not None else ''
                     positions[index][0] = atom[x]
                     positions[index][1] = atom[y]
                     positions[index][2] = atom[z]
@@ -64,6 +71,7 @@ def parse_mmcif(file):
         sequence.resize(index)
         positions.resize((index, 3))
         groups.resize(index)
+        atom_names.resize(index)
     else:
         while line != '':
             if line.startswith('loop_'):
@@ -73,8 +81,9 @@ def parse_mmcif(file):
                 if len(atom[residue]) == 3 and atom[atom_symbol] != "H":
                     sequence.append(atom[residue])
                     groups.append(''.join([atom[assembly], atom[sequence_id]]))
+                    atom_names.append(atom[atom_name] if atom_name is not None else '')
                     positions.append([atom[x], atom[y], atom[z]])
             line = file.readline()
         positions = np.array(positions, dtype=np.float32)
 
-    return sequence, positions, groups
+    return sequence, positions, groups, atom_names
@@ -5,6 +5,7 @@ def parse_pdb(file):
     sequence = []
     positions = []
     groups = []
+    atom_names = []
     line = file.readline()
     while line != "":
         if line.startswith("TER"):
@@ -15,8 +16,9 @@ def parse_pdb(file):
                     sequence.append(line[17:20])
                     positions.append([line[30:38], line[38:46], line[46:54]])
                     groups.append(line[21:26])
+                    atom_names.append(line[12:16].strip())
         line = file.readline()
 
     positions = np.array(positions, dtype=np.float32)
     groups = np.array(groups)
-    return sequence, positions, groups
+    return sequence, positions, groups, atom_names
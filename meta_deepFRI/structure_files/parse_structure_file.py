@@ -29,6 +29,7 @@ class SeqAtoms:
     atom_amino_group: np.ndarray
     positions: np.ndarray
     groups: np.ndarray
+    atom_names: np.ndarray
 
 
 def search_structure_files(input_paths: list):
@@ -62,6 +63,17 @@ def search_structure_files(input_paths: list):
     return structure_files_paths
 
 
+def structure_file_protein_id(file_path: pathlib.Path) -> str:
+    """
+    Protein id used for the structure file, the same one read_structure_file gives
+    :param file_path:
+    :return:
+    """
+    for pattern in PARSERS.keys():
+        if file_path.name.endswith(pattern):
+            return file_path.name.replace(pattern, '')
+
+
 def read_structure_file(file_path: pathlib.Path) -> SeqAtoms:
     """
     Extract sequence and atom positions from structure file
@@ -74,11 +86,29 @@ def read_structure_file(file_path: pathlib.Path) -> SeqAtoms:
                 f = gzip.open(file_path, 'rt')
             else:
                 f = open(file_path, 'r')
-            atom_amino_group, positions, groups = PARSERS[pattern](f)
+            atom_amino_group, positions, groups, atom_names = PARSERS[pattern](f)
             f.close()
 
             protein_id = file_path.name.replace(pattern, '')
-            return SeqAtoms(protein_id, atom_amino_group, positions, groups)
+            return SeqAtoms(protein_id, atom_amino_group, positions, groups, np.array(atom_names))
+
+
+def representative_atom_indexes(atom_names: np.ndarray, group_indexes: np.ndarray) -> np.ndarray:
+    """
+    Alpha and beta carbon atom indexes of every residue used by CA and CB contact definitions,
+    -1 if the residue has no such atom, first matching atom of a residue wins
+    :param atom_names:
+    :param group_indexes:
+    :return: int32 array of shape (chain_length, 2)
+    """
+    chain_length = len(group_indexes) - 1
+    representative_atoms = np.full((chain_length, 2), -1, dtype=np.int32)
+    residues = np.repeat(np.arange(chain_length), np.diff(group_indexes))
+    for slot, name in enumerate(("CA", "CB")):
+        atoms = np.flatnonzero(atom_names[:group_indexes[-1]] == name)
+        _, first = np.unique(residues[atoms], return_index=True)
+        representative_atoms[residues[atoms[first]], slot] = atoms[first]
+    return representative_atoms
 
 
 def save_sequence_and_atoms(seq_atoms: SeqAtoms, sequence_path: pathlib.Path, atoms_path: pathlib.Path,
@@ -120,7 +150,10 @@ def save_sequence_and_atoms(seq_atoms: SeqAtoms, sequence_path: pathlib.Path, at
     sequence = ''.join([bio_utils.PROTEIN_LETTERS[seq_atoms.atom_amino_group[i]] for i in group_indexes[:-1]])
     with open(sequence_path, "w") as f:
         f.write(f">{seq_atoms.protein_id}\n{sequence}\n")
-    CPP_lib.save_atoms(seq_atoms.positions, group_indexes, str(atoms_path))
+    CPP_lib.save_atoms(seq_atoms.positions,
+                       group_indexes,
+                       str(atoms_path),
+                       representative_atoms=representative_atom_indexes(seq_atoms.atom_names, group_indexes))
 
     if truncated:
         return f"SUCCEED, but sequences and contact maps got truncated to {max_target_chain_length}"
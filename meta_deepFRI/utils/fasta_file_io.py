@@ -3,7 +3,7 @@ import pathlib
 
 from Bio import SeqIO
 
-from meta_deepFRI.config.names import SEQUENCES, ATOMS
+from meta_deepFRI.config.names import SEQUENCES, ATOMS, ATOMS_DATABASE, MERGED_SEQUENCES
 
 
 @dataclasses.dataclass
@@ -33,12 +33,22 @@ def write_fasta_file(seq_records, path):
 class SeqFileLoader:
     def __init__(self, path):
         self.path = pathlib.Path(path)
+        # native ingest keeps atoms only in ATOMS_DATABASE and sequences only in MERGED_SEQUENCES
+        self.packed = (self.path / ATOMS_DATABASE).exists()
+        self.merged_sequences = None
 
     def __getitem__(self, target_id):
+        if self.packed and not (self.path / SEQUENCES / (target_id + ".faa")).exists():
+            if self.merged_sequences is None:
+                self.merged_sequences = {record.id: record.seq for record in load_fasta_file(self.path / MERGED_SEQUENCES)}
+            assert target_id in self.merged_sequences, f"Target database {self.path.name} contains ID that is not in the {self.path / MERGED_SEQUENCES}. " \
+                                                       f"It should not happen. Please create new target database."
+            return self.merged_sequences[target_id]
+
         assert (self.path / SEQUENCES / (target_id + ".faa")).exists(), f"Target database {self.path.name} contains ID for SEQUENCE.faa that is not in the {self.path / SEQUENCES / (target_id + '.faa')}. " \
                                                                         f"It should not happen. Please create new target database."
-        assert (self.path / ATOMS / (target_id + ".bin")).exists(), f"Target database {self.path.name} contains ID to ATOM.bin that is not in the {self.path / ATOMS / (target_id + '.bin')}. " \
-                                                                    f"It should not happen. Please create new target database."
+        assert self.packed or (self.path / ATOMS / (target_id + ".bin")).exists(), f"Target database {self.path.name} contains ID to ATOM.bin that is not in the {self.path / ATOMS / (target_id + '.bin')}. " \
+                                                                                   f"It should not happen. Please create new target database."
 
         with open(self.path / SEQUENCES / (target_id + ".faa"), "r") as f:
             sequence = SeqIO.read(f, "fasta").seq
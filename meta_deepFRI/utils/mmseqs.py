@@ -32,17 +32,20 @@ def convertalis(query_db, target_db, result_db, output_file):
     run_command(f"mmseqs convertalis {query_db} {target_db} {result_db} {output_file}")
 
 
-def create_target_database(seq_atoms_path: pathlib.Path, new_db_path: pathlib.Path, freshly_added_ids: list) -> None:
+def create_target_database(seq_atoms_path: pathlib.Path, new_db_path: pathlib.Path, freshly_added_ids: list,
+                           merge_sequences: bool = True) -> None:
     """
 
     :param seq_atoms_path:
     :param new_db_path:
     :param freshly_added_ids:
+    :param merge_sequences: False if MERGED_SEQUENCES is already complete, as written by the native ingest
     :return:
     """
-    sequence_files = list((seq_atoms_path / SEQUENCES).glob("**/*.faa"))
-    print("\nMerging " + str(len(sequence_files)) + " sequence files for mmseqs2")
-    merge_files_binary(sequence_files, seq_atoms_path / MERGED_SEQUENCES)
+    if merge_sequences:
+        sequence_files = list((seq_atoms_path / SEQUENCES).glob("**/*.faa"))
+        print("\nMerging " + str(len(sequence_files)) + " sequence files for mmseqs2")
+        merge_files_binary(sequence_files, seq_atoms_path / MERGED_SEQUENCES)
 
     print("Creating new target mmseqs2 database " + str(new_db_path))
     createdb(seq_atoms_path / MERGED_SEQUENCES, new_db_path / TARGET_MMSEQS_DB_NAME)
@@ -1,35 +1,43 @@
 import json
 import pandas as pd
 import pathlib
-import pathos
 
-from Bio import pairwise2
-
-from meta_deepFRI.config.names import ALIGNMENTS
+from meta_deepFRI import CPP_lib
+from meta_deepFRI.config.names import ALIGNMENTS, ALIGNMENT_SHARD_SUFFIX, ALIGNMENTS_JSON
 from meta_deepFRI.config.job_config import JobConfig
 from meta_deepFRI.config import CPU_COUNT
 from meta_deepFRI.utils.fasta_file_io import SeqFileLoader
 
 
-# alignment sequence identity return value between 0 and 1
-def alignment_sequences_identity(alignment):
-    matches = [alignment.seqA[i] == alignment.seqB[i] for i in range(len(alignment.seqA))]
-    seq_id = sum(matches) / len(alignment.seqA)
-    return seq_id
-
-
-def align(query_seq, target_seq, match, missmatch, gap_open, gap_continuation):
-    return pairwise2.align.globalms(query_seq,
-                                    target_seq,
-                                    match,
-                                    missmatch,
-                                    gap_open,
-                                    gap_continuation,
-                                    one_alignment_only=True)[0]
+def _cigar_from_alignment(query_alignment: str, target_alignment: str) -> str:
+    operations = ["D" if q == "-" else ("I" if t == "-" else "M") for q, t in zip(query_alignment, target_alignment)]
+    cigar = ""
+    begin = 0
+    for i in range(1, len(operations) + 1):
+        if i == len(operations) or operations[i] != operations[begin]:
+            cigar += f"{i - begin}{operations[begin]}"
+            begin = i
+    return cigar
+
+
+def _convert_alignments_json(alignments_json_path: pathlib.Path, shard_path: pathlib.Path):
+    alignments = json.load(open(alignments_json_path, "r"))
+    query_ids = list(alignments.keys())
+    cigars = []
+    for query_id in query_ids:
+        alignment = alignments[query_id]
+        if "cigar" in alignment:
+            cigars.append(alignment["cigar"])
+        else:
+            cigars.append(_cigar_from_alignment(alignment["alignment"][0], alignment["alignment"][1]))
+    target_ids = [alignments[query_id]["target_id"] for query_id in query_ids]
+    scores = [float(alignments[query_id]["alignment"][2]) for query_id in query_ids]
+    sequence_identities = [float(alignments[query_id]["sequence_identity"]) for query_id in query_ids]
+    CPP_lib.save_alignment_shard(str(shard_path), query_ids, target_ids, scores, sequence_identities, cigars)
 
 
 def search_alignments(query_seqs: dict, mmseqs_search_output: pd.DataFrame, target_seqs: SeqFileLoader,
-                      task_path: pathlib.Path, job_config: JobConfig):
+                      task_path: pathlib.Path, job_config: JobConfig) -> CPP_lib.AlignmentStore:
     """
 
     :param query_seqs:
@@ -39,19 +47,21 @@ def search_alignments(query_seqs: dict, mmseqs_search_output: pd.DataFrame, targ
     :param job_config:
     :return:
     """
-    # format of output JSON file:
-    # alignments = dict[query_id]
-    #     "target_id": target_id,
-    #     "sequence_identity" : alignment_sequence_identity(alignment)
-    #     "alignment": alignment = biopython.alignment
-    #         0. seqA = query_sequence
-    #         1. seqB = target_sequence
-    #         2. score = biopython alignment score
-    #         3. start and end of alignment
-
-    alignment_output_json_path = task_path / ALIGNMENTS
-    if alignment_output_json_path.exists():
-        return json.load(open(alignment_output_json_path, "r"))
+    # alignments are kept in a CPP_lib.AlignmentStore, a directory of memory mapped shards.
+    # store[query_id] is the best alignment of the query, an AlignmentRecord with
+    #     target_id
+    #     score = pairwise2.align.globalms alignment score
+    #     sequence_identity = identical aligned positions divided by alignment length
+    #     cigar = alignment as runs of M (aligned pair), I (query residue against gap), D (target residue against gap)
+    #     query_length
+
+    alignment_store_path = task_path / ALIGNMENTS
+    shard_path = alignment_store_path / (task_path.name + ALIGNMENT_SHARD_SUFFIX)
+    alignment_store_path.mkdir(exist_ok=True)
+    if not shard_path.exists() and (task_path / ALIGNMENTS_JSON).exists():
+        _convert_alignments_json(task_path / ALIGNMENTS_JSON, shard_path)
+    if shard_path.exists():
+        return CPP_lib.AlignmentStore(str(alignment_store_path))
 
     print(f"MMseqs search output is {len(mmseqs_search_output)} long.")
     query_seqs_keys = list(query_seqs.keys())
@@ -62,41 +72,18 @@ def search_alignments(query_seqs: dict, mmseqs_search_output: pd.DataFrame, targ
     print(f"Filtered {len(mmseqs_search_output) - len(filtered)} mmseqs matches. "
           f"Total alignments to check {len(filtered)}")
 
-    queries = list(map(lambda x: query_seqs[x], filtered["query"]))
-    targets = list(map(lambda x: target_seqs[x], filtered["target"]))
-
-    # Couldn't find more elegant solution on how to use repeating values for pathos.multiprocessing
-    # Standard multiprocessing.Pool is out of reach due to problematic pairwise2.align.globalms behaviour.
-    # todo make some runtime tests, maybe chunkified sequences will perform better
-    match = [job_config.PAIRWISE_ALIGNMENT_MATCH] * len(queries)
-    missmatch = [job_config.PAIRWISE_ALIGNMENT_MISSMATCH] * len(queries)
-    gap_open = [job_config.PAIRWISE_ALIGNMENT_GAP_OPEN] * len(queries)
-    gap_continuation = [job_config.PAIRWISE_ALIGNMENT_GAP_CONTINUATION] * len(queries)
-
-    with pathos.multiprocessing.ProcessingPool(processes=CPU_COUNT) as p:
-        all_alignments = p.map(align, queries, targets, match, missmatch, gap_open, gap_continuation)
-
-    alignments_output = dict()
-    for i in range(len(all_alignments)):
-        alignment = all_alignments[i]
-        # filter out bad alignments based on alignment sequences identity
-        sequence_identity = alignment_sequences_identity(alignment)
-        if sequence_identity > job_config.ALIGNMENT_MIN_SEQUENCE_IDENTITY:
-            query_id = filtered["query"].iloc[i]
-            target_id = filtered["target"].iloc[i]
-            if query_id not in alignments_output.keys():
-                alignments_output[query_id] = {
-                    "target_id": target_id,
-                    "alignment": alignment,
-                    "sequence_identity": sequence_identity
-                }
-            # select best alignment based on pairwise2.align.globalms.score
-            elif alignment.score > alignments_output[query_id]["alignment"].score:
-                alignments_output[query_id] = {
-                    "target_id": target_id,
-                    "alignment": alignment,
-                    "sequence_identity": sequence_identity
-                }
-
-    json.dump(alignments_output, open(alignment_output_json_path, "w"), indent=4, sort_keys=True)
-    return alignments_output
+    query_ids = list(filtered["query"])
+    target_ids = list(filtered["target"])
+    queries = list(map(lambda x: query_seqs[x], query_ids))
+    targets = list(map(lambda x: target_seqs[x], target_ids))
+
+    # CPP_lib aligns all pairs on a thread pool with the same scoring as pairwise2.align.globalms,
+    # drops alignments with sequence identity not above ALIGNMENT_MIN_SEQUENCE_IDENTITY
+    # and writes the best scoring alignment of every query, the first one among equal scores, into the shard
+    CPP_lib.align_best_hits_to_alignment_shard(query_ids, target_ids, queries, targets,
+                                               job_config.PAIRWISE_ALIGNMENT_MATCH,
+                                               job_config.PAIRWISE_ALIGNMENT_MISSMATCH,
+                                               job_config.PAIRWISE_ALIGNMENT_GAP_OPEN,
+                                               job_config.PAIRWISE_ALIGNMENT_GAP_CONTINUATION,
+                                               job_config.ALIGNMENT_MIN_SEQUENCE_IDENTITY, CPU_COUNT, str(shard_path))
+    return CPP_lib.AlignmentStore(str(alignment_store_path))
@@ -12,7 +12,7 @@ from typing import List, Union
 from meta_deepFRI.config import CPU_COUNT
 from meta_deepFRI.config.folder_structure import FolderStructureConfig, load_folder_structure_config
 from meta_deepFRI.config.names import MERGED_SEQUENCES, PROJECT_CONFIG, JOB_CONFIG, TASK_CONFIG, ALIGNMENTS, \
-    MMSEQS_SEARCH_RESULTS, \
+    ALIGNMENT_SHARD_SUFFIX, MMSEQS_SEARCH_RESULTS, \
     DEFAULT_NAME, TASK_SEQUENCES
 from meta_deepFRI.config.runtime_config import load_runtime_config
 from meta_deepFRI.config.job_config import JobConfig, load_job_config
@@ -207,10 +207,10 @@ def merge_completed_task_results(fsc: FolderStructureConfig, job_work_path: path
 
     merge_files_binary(list(job_work_path.glob(f"*/{MMSEQS_SEARCH_RESULTS}")), finished_path / MMSEQS_SEARCH_RESULTS)
 
-    alignments = {}
-    for task_alignment_file in list(job_work_path.glob(f"*/{ALIGNMENTS}")):
-        alignments.update(json.load(open(task_alignment_file, "r")))
-    json.dump(alignments, open(finished_path / ALIGNMENTS, "w"), indent=4, sort_keys=True)
+    # every task wrote its own shard, together they are the alignment store of the job
+    (finished_path / ALIGNMENTS).mkdir()
+    for task_alignment_shard in list(job_work_path.glob(f"*/{ALIGNMENTS}/*{ALIGNMENT_SHARD_SUFFIX}")):
+        shutil.copy(task_alignment_shard, finished_path / ALIGNMENTS / task_alignment_shard.name)
 
     for pattern in ["csv", "tsv"]:
         for task_deepfri_result in list(job_work_path.glob(f"*/results*{pattern}")):
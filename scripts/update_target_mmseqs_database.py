@@ -2,18 +2,21 @@ import argparse
 import json
 import multiprocessing
 import pathlib
+import threading
 
 from itertools import repeat
 import numpy as np
 
 from meta_deepFRI.config.folder_structure import FolderStructureConfig, load_folder_structure_config
 from meta_deepFRI import CPP_lib
-from meta_deepFRI.config.names import DEFAULT_NAME, ATOMS, TARGET_DB_CONFIG
+from meta_deepFRI.config.names import DEFAULT_NAME, ATOMS, ATOMS_DATABASE, TARGET_DB_CONFIG, SEQUENCES, MERGED_SEQUENCES
 from meta_deepFRI.config import CPU_COUNT
 
-from meta_deepFRI.structure_files.parse_structure_file import process_structure_file, search_structure_files
+from meta_deepFRI.structure_files.parse_structure_file import process_structure_file, search_structure_files, \
+    structure_file_protein_id
 from meta_deepFRI.utils.mmseqs import create_target_database
 from meta_deepFRI.utils import create_unix_timestamp_folder, parse_input_paths
+from meta_deepFRI.utils.fasta_file_io import SeqRecord, load_fasta_file, write_fasta_file
 
 ###################################################################################################################
 # utils.mmseqs.update_target_mmseqs_database:
@@ -29,6 +32,21 @@ from meta_deepFRI.utils import create_unix_timestamp_folder, parse_input_paths
 #               SEQ_ATOMS_DATASET_PATH / project_name / ATOMS / (protein_id + ".bin")
 #               For more information on how those binary are saved check out source code at CPP_lib/atoms_file_io.h
 #
+# build_atoms_database:
+#   packs all atom positions binary files into a single SEQ_ATOMS_DATASET_PATH / project_name / ATOMS_DATABASE file.
+#   With --contact_thresholds target contacts for those thresholds are precomputed and stored in the same file.
+#   With --fixed_positions atom positions are stored as int16 at 0.01 A resolution, half the size of float32.
+#   Runs with --packed_atoms_database or when the packed database already exists, so it never gets out of date.
+#   For more information on the packed format check out source code at CPP_lib/atoms_database.h
+#
+# native_ingest (--native_ingest):
+#   replaces process_structure_file and build_atoms_database with CPP_lib.ingest_structure_files.
+#   Structure files are parsed in parallel by CPP_lib the same way structure_files parsers do and written straight into
+#   SEQ_ATOMS_DATASET_PATH / project_name / ATOMS_DATABASE and SEQ_ATOMS_DATASET_PATH / project_name / MERGED_SEQUENCES.
+#   The database is updated in place: only new and changed structure files are parsed and appended,
+#   --remove_missing marks proteins missing from --input as removed and compaction runs in the background.
+#   For more information check out source code at CPP_lib/structure_ingest.h
+#
 # create_target_database:
 #   1.  merges all sequences from SEQ_ATOMS_DATASET_PATH / project_name / SEQUENCES
 #   2.  creates and index a new mmseqs target database inside MMSEQS_DATABASES_PATH / project_name / timestamp
@@ -58,19 +76,145 @@ def parse_args():
     #                     help="If protein chain is longer than this value, it will be truncated")
     parser.add_argument("--overwrite", action="store_true",
                         help="Flag to override existing sequences and atom positions")
+    parser.add_argument("--packed_atoms_database", action="store_true",
+                        help="Flag to pack atom positions into a single memory mapped file used by metagenomic_deepfri")
+    parser.add_argument("--native_ingest", action="store_true",
+                        help="Flag to parse structure files in CPP_lib and write them straight into the packed atoms database")
+    parser.add_argument("--remove_missing", action="store_true",
+                        help="With --native_ingest, remove proteins whose structure files are not found in --input")
+    parser.add_argument("--contact_thresholds", nargs='*', type=float, default=None,
+                        help="ANGSTROM_CONTACT_THRESHOLD values to precompute target contacts for inside the packed atoms database. "
+                             "By default thresholds of the existing database are kept, pass no values to drop them")
+    parser.add_argument("--fixed_positions", action="store_true",
+                        help="Store atom positions of new proteins inside the packed atoms database as int16 at 0.01 A "
+                             "resolution, half the size of float32. Contacts change only for atoms within 0.02 A of the threshold")
     return parser.parse_args()
     # yapf: enable
 
 
-def update_target_mmseqs_database(fsc: FolderStructureConfig, input_paths, project_name, overwrite) -> None:
+def build_atoms_database(seq_atoms_path: pathlib.Path, contact_thresholds: list = None, fixed_positions: bool = False) -> None:
+    """
+    Packs every SEQ_ATOMS_DATASET_PATH / project_name / ATOMS / protein_id.bin file into
+    SEQ_ATOMS_DATASET_PATH / project_name / ATOMS_DATABASE
+    :param seq_atoms_path:
+    :param contact_thresholds: thresholds to precompute target contacts for, None keeps thresholds of the existing database
+    :param fixed_positions: store int16 fixed point positions instead of float32
+    :return:
+    """
+    database_path = seq_atoms_path / ATOMS_DATABASE
+    if contact_thresholds is None and database_path.exists():
+        contact_thresholds = CPP_lib.AtomsDatabase(str(database_path)).contact_thresholds()
+    atoms_files = sorted((seq_atoms_path / ATOMS).glob("*.bin"))
+    print(f"Packing {len(atoms_files)} atom positions files into {database_path}")
+    writer = CPP_lib.AtomsDatabaseWriter(str(database_path))
+    writer.set_fixed_positions(fixed_positions)
+    for atoms_file in atoms_files:
+        writer.add_atoms_file(atoms_file.stem, str(atoms_file))
+    if contact_thresholds:
+        print(f"Precomputing target contacts for thresholds {contact_thresholds}")
+        writer.set_contact_thresholds(contact_thresholds, CPU_COUNT)
+    writer.close()
+
+
+def native_ingest(seq_atoms_path: pathlib.Path, structure_files_paths: dict, max_target_chain_length: int, overwrite: bool,
+                  remove_missing: bool, contact_thresholds: list = None, fixed_positions: bool = False) -> tuple:
+    """
+    Updates SEQ_ATOMS_DATASET_PATH / project_name / ATOMS_DATABASE in place with CPP_lib.AtomsDatabaseUpdater and rewrites
+    SEQ_ATOMS_DATASET_PATH / project_name / MERGED_SEQUENCES. Structure files whose content hash matches the one stored in the
+    database are not parsed again, unless overwrite. Proteins stored in separate files are carried over.
+    Unchanged proteins keep their offsets, so contact map caches stay valid.
+    :param seq_atoms_path:
+    :param structure_files_paths:
+    :param max_target_chain_length:
+    :param overwrite: parse every structure file, even if it did not change
+    :param remove_missing: remove proteins whose structure files are not among structure_files_paths
+    :param contact_thresholds: thresholds to precompute target contacts for, None keeps thresholds of the existing database.
+        Contacts of unchanged proteins are not computed again
+    :param fixed_positions: store int16 fixed point positions of new and changed proteins instead of float32
+    :return: processing status of every structure file and number of removed proteins
+    """
+    database_path = seq_atoms_path / ATOMS_DATABASE
+    sequences_path = seq_atoms_path / MERGED_SEQUENCES
+    new_sequences_path = seq_atoms_path / (MERGED_SEQUENCES + ".new")
+    temporary_sequences_path = seq_atoms_path / (MERGED_SEQUENCES + ".tmp")
+    structure_paths = list(structure_files_paths.values())
+    protein_ids = [structure_file_protein_id(path) for path in structure_paths]
+    processed_ids = set(protein_ids)
+
+    # until close the database keeps its previous state, a failed update leaves it untouched
+    updater = CPP_lib.AtomsDatabaseUpdater(str(database_path))
+    updater.set_fixed_positions(fixed_positions)
+    sequences = {}
+    if sequences_path.exists():
+        sequences = {record.id: record.seq for record in load_fasta_file(sequences_path)}
+
+    removed_ids = 0
+    if remove_missing:
+        for protein_id in updater.ids():
+            if protein_id not in processed_ids:
+                updater.remove(protein_id)
+                removed_ids += 1
+        print(f"Removing {removed_ids} proteins missing from the input")
+
+    carried_ids = 0
+    for atoms_file in sorted((seq_atoms_path / ATOMS).glob("*.bin")):
+        sequence_file = seq_atoms_path / SEQUENCES / (atoms_file.stem + ".faa")
+        if atoms_file.stem not in processed_ids and atoms_file.stem not in updater and sequence_file.exists():
+            updater.add_atoms_file(atoms_file.stem, str(atoms_file))
+            sequences.update({record.id: record.seq for record in load_fasta_file(sequence_file)})
+            carried_ids += 1
+    print(f"Carrying over {carried_ids} proteins stored in separate files")
+
+    write_fasta_file([], new_sequences_path)
+    processing_status = CPP_lib.ingest_structure_files(protein_ids, [str(path) for path in structure_paths], updater,
+                                                       str(new_sequences_path), max_target_chain_length, CPU_COUNT,
+                                                       not overwrite)
+    sequences.update({record.id: record.seq for record in load_fasta_file(new_sequences_path)})
+    write_fasta_file([SeqRecord(protein_id, sequences[protein_id]) for protein_id in updater.ids()],
+                     temporary_sequences_path)
+    if contact_thresholds is not None:
+        updater.set_contact_thresholds(contact_thresholds, CPU_COUNT)
+    updater.close()
+    temporary_sequences_path.replace(sequences_path)
+    new_sequences_path.unlink()
+    return processing_status, removed_ids
+
+
+def compact_atoms_database(seq_atoms_path: pathlib.Path):
+    """
+    Starts compaction of SEQ_ATOMS_DATASET_PATH / project_name / ATOMS_DATABASE in a background thread
+    once removed and replaced proteins take more than a quarter of its live data.
+    :param seq_atoms_path:
+    :return: started thread or None
+    """
+    database_path = str(seq_atoms_path / ATOMS_DATABASE)
+    stats = CPP_lib.AtomsDatabase(database_path).stats()
+    if stats["dead_bytes"] * 4 <= stats["live_bytes"]:
+        return None
+    print(f"Compacting {database_path}, {stats['dead_bytes']} bytes are no longer used")
+    thread = threading.Thread(target=CPP_lib.compact_atoms_database, args=(database_path, ))
+    thread.start()
+    return thread
+
+
+def update_target_mmseqs_database(fsc: FolderStructureConfig, input_paths, project_name, overwrite,
+                                  packed_atoms_database=False, use_native_ingest=False, remove_missing=False,
+                                  contact_thresholds=None, fixed_positions=False) -> None:
     """
     1.  iterates over --input searching for file extensions that match the PARSERS keys.
-    2.  filter out protein_ids that already exists in SEQ_ATOMS_DATASET_PATH / project_name / ATOMS
-    3.  process_structure_file in parallel
+    2.  filter out protein_ids that already exists in SEQ_ATOMS_DATASET_PATH / project_name / ATOMS,
+        native_ingest skips unchanged structure files by itself
+    3.  process_structure_file in parallel or native_ingest
+    4.  build_atoms_database if requested or if it already exists
     :param fsc:
     :param input_paths:
     :param project_name:
     :param overwrite:
+    :param packed_atoms_database:
+    :param use_native_ingest:
+    :param remove_missing: with use_native_ingest, remove proteins whose structure files are not in input_paths
+    :param contact_thresholds: ANGSTROM_CONTACT_THRESHOLD values to precompute target contacts for inside ATOMS_DATABASE
+    :param fixed_positions: store int16 fixed point positions inside ATOMS_DATABASE
     :return:
     """
     seq_atoms_path = fsc.SEQ_ATOMS_DATASET_PATH / project_name
@@ -106,10 +250,15 @@ def update_target_mmseqs_database(fsc: FolderStructureConfig, input_paths, proje
     # actual processing of structure files takes place here
     print("\nProcessing", len(structure_files_paths), "files")
     CPP_lib.initialize()
-    with multiprocessing.Pool(processes=CPU_COUNT) as p:
-        processing_status = p.starmap(
-            process_structure_file,
-            zip(structure_files_paths.values(), repeat(seq_atoms_path.absolute()), repeat(max_target_chain_length)))
+    removed_ids = 0
+    if use_native_ingest:
+        processing_status, removed_ids = native_ingest(seq_atoms_path, structure_files_paths, max_target_chain_length,
+                                                       overwrite, remove_missing, contact_thresholds, fixed_positions)
+    else:
+        with multiprocessing.Pool(processes=CPU_COUNT) as p:
+            processing_status = p.starmap(
+                process_structure_file,
+                zip(structure_files_paths.values(), repeat(seq_atoms_path.absolute()), repeat(max_target_chain_length)))
 
     status, status_count = np.unique(processing_status, return_counts=True)
     for i in range(len(status)):
@@ -121,12 +270,20 @@ def update_target_mmseqs_database(fsc: FolderStructureConfig, input_paths, proje
         if processing_status[i].startswith("SUCCEED"):
             freshly_added_ids.append(structure_file_ids[i])
 
-    if len(freshly_added_ids) == 0:
+    if len(freshly_added_ids) == 0 and removed_ids == 0:
         print(f"\n No new protein structures added.\n No new target database will be created.")
         return
 
+    if not use_native_ingest and (packed_atoms_database or (seq_atoms_path / ATOMS_DATABASE).exists()):
+        build_atoms_database(seq_atoms_path, contact_thresholds, fixed_positions)
+
+    # compaction runs while mmseqs2 builds the new target database
+    compaction = compact_atoms_database(seq_atoms_path) if use_native_ingest else None
+
     new_mmseqs2_db_path = create_unix_timestamp_folder(fsc.MMSEQS_DATABASES_PATH / project_name)
-    create_target_database(seq_atoms_path, new_mmseqs2_db_path, freshly_added_ids)
+    create_target_database(seq_atoms_path, new_mmseqs2_db_path, freshly_added_ids, merge_sequences=not use_native_ingest)
+    if compaction is not None:
+        compaction.join()
 
 
 def main():
@@ -142,7 +299,8 @@ def main():
     overwrite = args.overwrite
     input_paths = parse_input_paths(args.input, project_name, fsc.STRUCTURE_FILES_PATH)
 
-    update_target_mmseqs_database(fsc, input_paths, project_name, overwrite)
+    update_target_mmseqs_database(fsc, input_paths, project_name, overwrite, args.packed_atoms_database, args.native_ingest,
+                                  args.remove_missing, args.contact_thresholds, args.fixed_positions)
 
 
 if __name__ == '__main__':